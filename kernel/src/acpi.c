@@ -0,0 +1,229 @@
+/*
+ * ojjyOS v3 Kernel - ACPI Tables Implementation
+ *
+ * Tables live in ACPI reclaim/NVS memory, which the identity map
+ * covers. Every table is checksummed before use; a bad MADT simply
+ * leaves the system on one CPU.
+ */
+
+#include "acpi.h"
+#include "paging.h"
+#include "serial.h"
+#include "string.h"
+
+/* Root System Description Pointer (ACPI 2.0+ layout) */
+typedef struct {
+    char     signature[8];      /* "RSD PTR " */
+    uint8_t  checksum;          /* First 20 bytes */
+    char     oem_id[6];
+    uint8_t  revision;          /* 0 = ACPI 1.0 (RSDT only) */
+    uint32_t rsdt_addr;
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t  ext_checksum;      /* Whole structure */
+    uint8_t  reserved[3];
+} PACKED AcpiRsdp;
+
+/* MADT entry types */
+#define MADT_LAPIC              0
+#define MADT_IOAPIC             1
+#define MADT_LAPIC_OVERRIDE     5
+#define MADT_X2APIC             9
+
+#define MADT_FLAG_PCAT_COMPAT   (1U << 0)
+#define MADT_CPU_ENABLED        (1U << 0)
+#define MADT_CPU_ONLINE_CAPABLE (1U << 1)
+
+typedef struct {
+    AcpiSdtHeader header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+    uint8_t  entries[];
+} PACKED AcpiMadtTable;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} PACKED MadtEntry;
+
+static const AcpiRsdp *rsdp = NULL;
+static const AcpiSdtHeader *root = NULL;   /* XSDT or RSDT */
+static bool root_is_xsdt = false;
+static AcpiMadt madt;
+static bool madt_valid = false;
+
+static bool checksum_ok(const void *data, size_t length)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += p[i];
+    }
+    return sum == 0;
+}
+
+static const AcpiRsdp *rsdp_check(uint64_t addr)
+{
+    const AcpiRsdp *r = (const AcpiRsdp *)addr;
+    if (memcmp(r->signature, "RSD PTR ", 8) != 0 || !checksum_ok(r, 20)) {
+        return NULL;
+    }
+    if (r->revision >= 2 && !checksum_ok(r, r->length)) {
+        return NULL;
+    }
+    return r;
+}
+
+/*
+ * Legacy search: first KB of the EBDA, then the BIOS ROM area
+ */
+static const AcpiRsdp *rsdp_scan(void)
+{
+    /* EBDA segment from the BIOS data area, read via the direct map */
+    uint64_t ebda = (uint64_t)(*(volatile uint16_t *)phys_to_virt(0x40E)) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        for (uint64_t addr = ebda; addr < ebda + 1024; addr += 16) {
+            const AcpiRsdp *r = rsdp_check(addr);
+            if (r) return r;
+        }
+    }
+
+    for (uint64_t addr = 0xE0000; addr < 0x100000; addr += 16) {
+        const AcpiRsdp *r = rsdp_check(addr);
+        if (r) return r;
+    }
+    return NULL;
+}
+
+/*
+ * Decode the MADT into madt
+ */
+static void madt_parse(const AcpiMadtTable *table)
+{
+    memset(&madt, 0, sizeof(madt));
+    madt.lapic_base = table->lapic_addr;
+    madt.legacy_pic = (table->flags & MADT_FLAG_PCAT_COMPAT) != 0;
+
+    const uint8_t *p = table->entries;
+    const uint8_t *end = (const uint8_t *)table + table->header.length;
+
+    while (p + sizeof(MadtEntry) <= end) {
+        const MadtEntry *e = (const MadtEntry *)p;
+        if (e->length < sizeof(MadtEntry) || p + e->length > end) {
+            break;
+        }
+
+        switch (e->type) {
+            case MADT_LAPIC: {
+                /* acpi_id, apic_id, flags */
+                uint8_t apic_id = p[3];
+                uint32_t flags;
+                memcpy(&flags, p + 4, 4);
+                if ((flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE)) &&
+                    madt.cpu_count < ACPI_MAX_CPUS) {
+                    madt.apic_ids[madt.cpu_count++] = apic_id;
+                }
+                break;
+            }
+            case MADT_X2APIC: {
+                /* reserved[2], x2apic_id, flags, uid */
+                uint32_t apic_id, flags;
+                memcpy(&apic_id, p + 4, 4);
+                memcpy(&flags, p + 8, 4);
+                if ((flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE)) &&
+                    madt.cpu_count < ACPI_MAX_CPUS) {
+                    madt.apic_ids[madt.cpu_count++] = apic_id;
+                }
+                break;
+            }
+            case MADT_IOAPIC: {
+                /* id, reserved, address, gsi_base */
+                if (madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                    uint32_t addr, gsi;
+                    memcpy(&addr, p + 4, 4);
+                    memcpy(&gsi, p + 8, 4);
+                    madt.ioapic_addr[madt.ioapic_count] = addr;
+                    madt.ioapic_gsi_base[madt.ioapic_count] = gsi;
+                    madt.ioapic_count++;
+                }
+                break;
+            }
+            case MADT_LAPIC_OVERRIDE: {
+                /* reserved[2], 64-bit address */
+                memcpy(&madt.lapic_base, p + 4, 8);
+                break;
+            }
+            default:
+                break;
+        }
+        p += e->length;
+    }
+
+    madt_valid = madt.lapic_base != 0 && madt.cpu_count > 0;
+}
+
+bool acpi_init(uint64_t rsdp_addr)
+{
+    rsdp = rsdp_addr ? rsdp_check(rsdp_addr) : NULL;
+    if (!rsdp) {
+        rsdp = rsdp_scan();
+    }
+    if (!rsdp) {
+        serial_printf("[ACPI] No RSDP found\n");
+        return false;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_addr) {
+        root = (const AcpiSdtHeader *)rsdp->xsdt_addr;
+        root_is_xsdt = true;
+    } else {
+        root = (const AcpiSdtHeader *)(uint64_t)rsdp->rsdt_addr;
+        root_is_xsdt = false;
+    }
+
+    if (!checksum_ok(root, root->length)) {
+        serial_printf("[ACPI] %s checksum mismatch\n", root_is_xsdt ? "XSDT" : "RSDT");
+        root = NULL;
+        return false;
+    }
+
+    serial_printf("[ACPI] RSDP rev %d at 0x%p, %s with %d tables\n",
+        (uint64_t)rsdp->revision, (uint64_t)rsdp, root_is_xsdt ? "XSDT" : "RSDT",
+        (uint64_t)((root->length - sizeof(AcpiSdtHeader)) / (root_is_xsdt ? 8 : 4)));
+
+    const AcpiMadtTable *table = (const AcpiMadtTable *)acpi_find_table("APIC");
+    if (table) {
+        madt_parse(table);
+        serial_printf("[ACPI] MADT: %d CPUs, %d I/O APICs, LAPIC at 0x%p%s\n",
+            (uint64_t)madt.cpu_count, (uint64_t)madt.ioapic_count, madt.lapic_base,
+            madt.legacy_pic ? ", 8259 PICs" : "");
+    } else {
+        serial_printf("[ACPI] No MADT\n");
+    }
+    return true;
+}
+
+const AcpiSdtHeader *acpi_find_table(const char *signature)
+{
+    if (!root) return NULL;
+
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(AcpiSdtHeader)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)root + sizeof(AcpiSdtHeader);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t addr = 0;
+        memcpy(&addr, entries + (uint64_t)i * entry_size, entry_size);
+
+        const AcpiSdtHeader *h = (const AcpiSdtHeader *)addr;
+        if (h && memcmp(h->signature, signature, 4) == 0 && checksum_ok(h, h->length)) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+const AcpiMadt *acpi_get_madt(void)
+{
+    return madt_valid ? &madt : NULL;
+}
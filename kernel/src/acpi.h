@@ -0,0 +1,54 @@
+/*
+ * ojjyOS v3 Kernel - ACPI Tables
+ *
+ * Minimal ACPI support: locate the RSDP, walk the XSDT (or RSDT) and
+ * decode the MADT, which lists the processors' local APICs and the
+ * I/O APICs. Tables are read in place through the identity map.
+ */
+
+#ifndef _OJJY_ACPI_H
+#define _OJJY_ACPI_H
+
+#include "types.h"
+
+/* Processors and I/O APICs recorded from the MADT */
+#define ACPI_MAX_CPUS       64
+#define ACPI_MAX_IOAPICS    4
+
+/* System description table header */
+typedef struct {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED AcpiSdtHeader;
+
+/* Decoded MADT */
+typedef struct {
+    uint64_t lapic_base;                    /* Local APIC MMIO (physical) */
+    bool     legacy_pic;                    /* PCAT_COMPAT: 8259s present */
+    uint32_t cpu_count;                     /* Enabled processors */
+    uint32_t apic_ids[ACPI_MAX_CPUS];       /* In MADT order; BSP usually first */
+    uint32_t ioapic_count;
+    uint64_t ioapic_addr[ACPI_MAX_IOAPICS];
+    uint32_t ioapic_gsi_base[ACPI_MAX_IOAPICS];
+} AcpiMadt;
+
+/*
+ * Find the tables. rsdp_addr comes from the bootloader; if it is 0 the
+ * BIOS areas are scanned. Returns false if no valid RSDP is found.
+ */
+bool acpi_init(uint64_t rsdp_addr);
+
+/* Find a table by signature ("APIC", "HPET", ...); NULL if absent */
+const AcpiSdtHeader *acpi_find_table(const char *signature);
+
+/* Decoded MADT, or NULL if there is none */
+const AcpiMadt *acpi_get_madt(void);
+
+#endif /* _OJJY_ACPI_H */
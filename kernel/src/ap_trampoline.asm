@@ -0,0 +1,110 @@
+; ojjyOS v3 Kernel - Application Processor Startup Trampoline
+;
+; smp_init() copies this code to AP_TRAMPOLINE_PHYS (below 1MB) and
+; fills in the parameter block at its end. A STARTUP IPI then starts
+; the AP here in real mode with CS = AP_TRAMPOLINE_PHYS >> 4. The code
+; switches to protected mode, enables PAE and long mode with the BSP's
+; page tables and calls the C entry with the per-CPU pointer in RDI.
+;
+; NASM syntax
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_params
+
+; Must match AP_TRAMPOLINE_PHYS in smp.h
+TRAMPOLINE_BASE equ 0x8000
+
+; Address of a trampoline label once copied to TRAMPOLINE_BASE
+%define TADDR(label) (TRAMPOLINE_BASE + ((label) - ap_trampoline_start))
+
+section .text
+
+[BITS 16]
+align 16
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; Flat 32-bit segments, then protected mode
+    lgdt [TADDR(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TADDR(ap_protected)
+
+[BITS 32]
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    ; PAE (and whatever else the BSP's CR4 needs) before paging
+    mov eax, [TADDR(tramp_cr4)]
+    mov cr4, eax
+
+    ; Kernel page tables (the PML4 is below 4GB)
+    mov eax, [TADDR(tramp_cr3)]
+    mov cr3, eax
+
+    ; EFER: long mode enable, NX and SYSCALL as on the BSP
+    mov ecx, 0xC0000080
+    rdmsr
+    or eax, [TADDR(tramp_efer)]
+    wrmsr
+
+    ; Paging on: long mode becomes active
+    mov eax, [TADDR(tramp_cr0)]
+    mov cr0, eax
+    jmp 0x18:TADDR(ap_long)
+
+[BITS 64]
+ap_long:
+    mov ax, 0x20
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+
+    mov rsp, [TADDR(tramp_stack)]
+    mov rdi, [TADDR(tramp_cpu)]
+    mov rax, [TADDR(tramp_entry)]
+    call rax
+
+    ; The entry never returns
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; Temporary GDT: null, 32-bit code/data, 64-bit code/data
+align 16
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF       ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF       ; 0x10: 32-bit data
+    dq 0x00AF9A000000FFFF       ; 0x18: 64-bit code
+    dq 0x00CF92000000FFFF       ; 0x20: 64-bit data
+tramp_gdt_end:
+
+tramp_gdt_ptr:
+    dw tramp_gdt_end - tramp_gdt - 1
+    dd TADDR(tramp_gdt)
+
+; Parameter block (ApTrampolineParams in smp.c)
+align 8
+ap_trampoline_params:
+tramp_cr3:      dq 0
+tramp_cr4:      dq 0
+tramp_cr0:      dq 0
+tramp_efer:     dq 0
+tramp_stack:    dq 0
+tramp_entry:    dq 0
+tramp_cpu:      dq 0
+
+ap_trampoline_end:
@@ -1,7 +1,16 @@
 /*
  * ojjyOS v3 Kernel - Text Console Implementation
  *
- * Text mode console over framebuffer with scrolling.
+ * The console is a grid of character cells. Lines live in a scrollback
+ * ring; the screen shows a window of it starting at view_top, so
+ * scrolling only advances a line counter. Output updates the grid, and
+ * console_refresh() compares each visible cell with a shadow copy of
+ * what is on screen and redraws only the cells that differ.
+ *
+ * Refreshes run at the end of each console_puts()/console_printf().
+ * With the timer running, refreshes closer together than
+ * CONSOLE_REFRESH_MS are deferred to console_flush() in the main loop,
+ * so a burst of output is drawn once instead of once per line.
  */
 
 #include "console.h"
@@ -9,6 +18,21 @@
 #include "font.h"
 #include "string.h"
 #include "serial.h"
+#include "timer.h"
+
+/* A cell is the character in the low byte and a color pair index above */
+typedef uint16_t ConsoleCell;
+
+#define CELL(ch, attr)      ((ConsoleCell)((uint8_t)(ch) | ((attr) << 8)))
+#define CELL_CHAR(cell)     ((char)((cell) & 0xFF))
+#define CELL_ATTR(cell)     ((cell) >> 8)
+#define CELL_UNKNOWN        0xFFFF      /* Shadow: screen content unknown */
+
+/* Color pairs in use (indexed by cell attribute) */
+#define CONSOLE_MAX_ATTRS   255
+
+/* Scrollback ring slot of an absolute line number */
+#define LINE_SLOT(line)     ((line) & (CONSOLE_SCROLLBACK_LINES - 1))
 
 /* Console state */
 static int con_col = 0;
@@ -17,20 +41,84 @@ static int con_cols = 0;
 static int con_rows = 0;
 static Color con_fg = COLOR_TEXT;
 static Color con_bg = COLOR_CREAM;
+static uint8_t con_attr = 0;
+static bool serial_mirror = true;
+
+/* Color pairs */
+static Color attr_fg[CONSOLE_MAX_ATTRS];
+static Color attr_bg[CONSOLE_MAX_ATTRS];
+static int attr_count = 0;
+
+/* Scrollback ring and the on-screen shadow */
+static ConsoleCell lines[CONSOLE_SCROLLBACK_LINES][CONSOLE_MAX_COLS];
+static ConsoleCell shown[CONSOLE_MAX_ROWS][CONSOLE_MAX_COLS];
+static uint64_t screen_top = 0;     /* Absolute line at the top of the live screen */
+static uint64_t view_top = 0;       /* First line displayed (< screen_top when scrolled back) */
+
+/* Refresh deferral */
+static bool refresh_pending = false;
+static uint64_t last_refresh_ms = 0;
+
+/* Statistics */
+static ConsoleStats stats;
+
+/*
+ * Index of a color pair, adding it if new (falls back to pair 0)
+ */
+static uint8_t attr_lookup(Color fg, Color bg)
+{
+    for (int i = 0; i < attr_count; i++) {
+        if (attr_fg[i] == fg && attr_bg[i] == bg) {
+            return (uint8_t)i;
+        }
+    }
+    if (attr_count >= CONSOLE_MAX_ATTRS) {
+        return 0;
+    }
+    attr_fg[attr_count] = fg;
+    attr_bg[attr_count] = bg;
+    return (uint8_t)attr_count++;
+}
+
+static inline ConsoleCell *line_cells(uint64_t line)
+{
+    return lines[LINE_SLOT(line)];
+}
+
+static void clear_line(uint64_t line)
+{
+    ConsoleCell *cells = line_cells(line);
+    ConsoleCell blank = CELL(' ', con_attr);
+    for (int c = 0; c < con_cols; c++) {
+        cells[c] = blank;
+    }
+}
 
 /*
  * Initialize console
  */
 void console_init(void)
 {
-    con_cols = fb_get_width() / FONT_WIDTH;
-    con_rows = fb_get_height() / FONT_HEIGHT;
+    con_cols = MIN((int)(fb_get_width() / FONT_WIDTH), CONSOLE_MAX_COLS);
+    con_rows = MIN((int)(fb_get_height() / FONT_HEIGHT), CONSOLE_MAX_ROWS);
     con_col = 0;
     con_row = 0;
 
     /* Default colors */
     con_fg = COLOR_TEXT;
     con_bg = COLOR_CREAM;
+    attr_count = 0;
+    con_attr = attr_lookup(con_fg, con_bg);
+
+    screen_top = 0;
+    view_top = 0;
+    for (int r = 0; r < con_rows; r++) {
+        clear_line((uint64_t)r);
+        for (int c = 0; c < con_cols; c++) {
+            shown[r][c] = CELL_UNKNOWN;
+        }
+    }
+    memset(&stats, 0, sizeof(stats));
 }
 
 /*
@@ -40,41 +128,127 @@ void console_set_colors(Color fg, Color bg)
 {
     con_fg = fg;
     con_bg = bg;
+    con_attr = attr_lookup(fg, bg);
 }
 
 /*
- * Clear console
+ * Mirror console output to serial (on by default)
+ */
+void console_set_serial_mirror(bool enabled)
+{
+    serial_mirror = enabled;
+}
+
+/*
+ * Clear console. The old screen stays in the scrollback.
  */
 void console_clear(void)
 {
+    screen_top += con_rows;
+    view_top = screen_top;
+    for (int r = 0; r < con_rows; r++) {
+        clear_line(screen_top + r);
+    }
+
+    /* Paint the whole screen at once and record it in the shadow */
     fb_clear(con_bg);
+    ConsoleCell blank = CELL(' ', con_attr);
+    for (int r = 0; r < con_rows; r++) {
+        for (int c = 0; c < con_cols; c++) {
+            shown[r][c] = blank;
+        }
+    }
+
     con_col = 0;
     con_row = 0;
+    refresh_pending = false;
 }
 
 /*
- * Scroll the console up by one line
+ * Scroll the console up by one line: advance the ring window
  */
 static void console_scroll(void)
 {
-    /* Copy all lines up */
-    fb_copy_rect(0, 0, 0, FONT_HEIGHT,
-                 fb_get_width(), fb_get_height() - FONT_HEIGHT);
+    screen_top++;
+    clear_line(screen_top + con_rows - 1);
+    con_row = con_rows - 1;
+    stats.scrolls++;
+}
+
+/*
+ * Redraw cells that differ from the shadow
+ */
+static void console_render(void)
+{
+    for (int r = 0; r < con_rows; r++) {
+        const ConsoleCell *cells = line_cells(view_top + r);
+        ConsoleCell *screen = shown[r];
 
-    /* Clear the last line */
-    fb_fill_rect(0, (con_rows - 1) * FONT_HEIGHT,
-                 fb_get_width(), FONT_HEIGHT, con_bg);
+        if (memcmp(cells, screen, (size_t)con_cols * sizeof(ConsoleCell)) == 0) {
+            continue;
+        }
 
-    con_row = con_rows - 1;
+        for (int c = 0; c < con_cols; c++) {
+            ConsoleCell cell = cells[c];
+            if (cell != screen[c]) {
+                uint8_t attr = CELL_ATTR(cell);
+                fb_draw_char(c * FONT_WIDTH, r * FONT_HEIGHT, CELL_CHAR(cell),
+                             attr_fg[attr], attr_bg[attr]);
+                screen[c] = cell;
+                stats.cells_drawn++;
+            }
+        }
+    }
+    stats.refreshes++;
 }
 
 /*
- * Print a character
+ * Bring the screen up to date. Unless forced, a refresh soon after the
+ * previous one is left to console_flush() (only while the timer runs;
+ * early boot output is always drawn immediately).
  */
-void console_putc(char c)
+void console_refresh(bool force)
+{
+    if (!force && interrupts_enabled()) {
+        uint64_t now = timer_get_ticks();
+        if (now - last_refresh_ms < CONSOLE_REFRESH_MS) {
+            refresh_pending = true;
+            return;
+        }
+        last_refresh_ms = now;
+    }
+
+    refresh_pending = false;
+    console_render();
+}
+
+/*
+ * Draw deferred output (called from the main loop)
+ */
+void console_flush(void)
+{
+    if (refresh_pending) {
+        last_refresh_ms = timer_get_ticks();
+        refresh_pending = false;
+        console_render();
+    }
+}
+
+/*
+ * Update the grid for one character (no drawing)
+ */
+static void con_emit(char c)
 {
     /* Also output to serial */
-    serial_putc(c);
+    if (serial_mirror) {
+        serial_putc(c);
+    }
+    stats.chars++;
+
+    /* New output returns the view to the live screen */
+    view_top = screen_top;
+
+    ConsoleCell *cells = line_cells(screen_top + con_row);
 
     if (c == '\n') {
         con_col = 0;
@@ -86,13 +260,10 @@ void console_putc(char c)
     } else if (c == '\b') {
         if (con_col > 0) {
             con_col--;
-            fb_draw_char(con_col * FONT_WIDTH, con_row * FONT_HEIGHT,
-                        ' ', con_fg, con_bg);
+            cells[con_col] = CELL(' ', con_attr);
         }
     } else {
-        /* Draw the character */
-        fb_draw_char(con_col * FONT_WIDTH, con_row * FONT_HEIGHT,
-                    c, con_fg, con_bg);
+        cells[con_col] = CELL(c, con_attr);
         con_col++;
     }
 
@@ -108,14 +279,83 @@ void console_putc(char c)
     }
 }
 
+static void con_emit_str(const char *s)
+{
+    while (*s) {
+        con_emit(*s++);
+    }
+}
+
+/*
+ * Print a character (drawn immediately: used for keyboard echo)
+ */
+void console_putc(char c)
+{
+    con_emit(c);
+    console_refresh(true);
+}
+
 /*
  * Print a string
  */
 void console_puts(const char *s)
 {
-    while (*s) {
-        console_putc(*s++);
+    con_emit_str(s);
+    console_refresh(false);
+}
+
+/*
+ * Mark the cells under a pixel rectangle as unknown so the next
+ * refresh repaints them
+ */
+void console_invalidate(int x, int y, int w, int h)
+{
+    int c1 = MAX(0, x / FONT_WIDTH);
+    int r1 = MAX(0, y / FONT_HEIGHT);
+    int c2 = MIN(con_cols, (x + w + FONT_WIDTH - 1) / FONT_WIDTH);
+    int r2 = MIN(con_rows, (y + h + FONT_HEIGHT - 1) / FONT_HEIGHT);
+
+    for (int r = r1; r < r2; r++) {
+        for (int c = c1; c < c2; c++) {
+            shown[r][c] = CELL_UNKNOWN;
+        }
+    }
+}
+
+/*
+ * Scroll the view through the scrollback (positive = older lines)
+ */
+void console_scroll_view(int lines_back)
+{
+    uint64_t oldest = 0;
+    if (screen_top + con_rows > CONSOLE_SCROLLBACK_LINES) {
+        oldest = screen_top + con_rows - CONSOLE_SCROLLBACK_LINES;
     }
+
+    int64_t target = (int64_t)view_top - lines_back;
+    if (target < (int64_t)oldest) target = (int64_t)oldest;
+    if (target > (int64_t)screen_top) target = (int64_t)screen_top;
+
+    if ((uint64_t)target != view_top) {
+        view_top = (uint64_t)target;
+        console_refresh(true);
+    }
+}
+
+/*
+ * Lines the view is scrolled back from the live screen
+ */
+int console_view_offset(void)
+{
+    return (int)(screen_top - view_top);
+}
+
+/*
+ * Usage counters
+ */
+void console_get_stats(ConsoleStats *out)
+{
+    if (out) *out = stats;
 }
 
 /*
@@ -128,7 +368,7 @@ void console_printf(const char *fmt, ...)
 
     while (*fmt) {
         if (*fmt != '%') {
-            console_putc(*fmt++);
+            con_emit(*fmt++);
             continue;
         }
 
@@ -164,10 +404,10 @@ void console_printf(const char *fmt, ...)
             if (!s) s = "(null)";
             int len = strlen(s);
             while (len < width) {
-                console_putc(' ');
+                con_emit(' ');
                 width--;
             }
-            console_puts(s);
+            con_emit_str(s);
             break;
         }
         case 'd': {
@@ -181,10 +421,10 @@ void console_printf(const char *fmt, ...)
             itoa(val, buf, 10);
             int len = strlen(buf);
             while (len < width) {
-                console_putc(pad_zero ? '0' : ' ');
+                con_emit(pad_zero ? '0' : ' ');
                 width--;
             }
-            console_puts(buf);
+            con_emit_str(buf);
             break;
         }
         case 'u': {
@@ -198,10 +438,10 @@ void console_printf(const char *fmt, ...)
             utoa(val, buf, 10);
             int len = strlen(buf);
             while (len < width) {
-                console_putc(pad_zero ? '0' : ' ');
+                con_emit(pad_zero ? '0' : ' ');
                 width--;
             }
-            console_puts(buf);
+            con_emit_str(buf);
             break;
         }
         case 'x': {
@@ -215,36 +455,36 @@ void console_printf(const char *fmt, ...)
             utoa(val, buf, 16);
             int len = strlen(buf);
             while (len < width) {
-                console_putc(pad_zero ? '0' : ' ');
+                con_emit(pad_zero ? '0' : ' ');
                 width--;
             }
-            console_puts(buf);
+            con_emit_str(buf);
             break;
         }
         case 'p': {
             uint64_t val = __builtin_va_arg(args, uint64_t);
-            console_puts("0x");
+            con_emit_str("0x");
             char buf[32];
             utoa(val, buf, 16);
             int len = strlen(buf);
             while (len < 16) {
-                console_putc('0');
+                con_emit('0');
                 len++;
             }
-            console_puts(buf);
+            con_emit_str(buf);
             break;
         }
         case 'c': {
             char c = (char)__builtin_va_arg(args, int);
-            console_putc(c);
+            con_emit(c);
             break;
         }
         case '%':
-            console_putc('%');
+            con_emit('%');
             break;
         default:
-            console_putc('%');
-            console_putc(*fmt);
+            con_emit('%');
+            con_emit(*fmt);
             break;
         }
 
@@ -252,6 +492,7 @@ void console_printf(const char *fmt, ...)
     }
 
     __builtin_va_end(args);
+    console_refresh(false);
 }
 
 /*
@@ -1,7 +1,9 @@
 /*
  * ojjyOS v3 Kernel - Text Console
  *
- * Provides printf-style output to framebuffer.
+ * Provides printf-style output to framebuffer. Text is kept in a
+ * character-cell grid with a scrollback ring; only changed cells are
+ * redrawn.
  */
 
 #ifndef _OJJY_CONSOLE_H
@@ -10,6 +12,24 @@
 #include "types.h"
 #include "framebuffer.h"
 
+/* Grid limits (2048x2048 pixels with the 8x16 font) */
+#define CONSOLE_MAX_COLS            256
+#define CONSOLE_MAX_ROWS            128
+
+/* Scrollback lines kept (power of two, includes the screen) */
+#define CONSOLE_SCROLLBACK_LINES    1024
+
+/* Minimum gap between deferred refreshes */
+#define CONSOLE_REFRESH_MS          16
+
+/* Usage counters */
+typedef struct {
+    uint64_t chars;             /* Characters written */
+    uint64_t cells_drawn;       /* Cells rendered to the framebuffer */
+    uint64_t refreshes;         /* Render passes */
+    uint64_t scrolls;           /* Lines scrolled */
+} ConsoleStats;
+
 /* Initialize console */
 void console_init(void);
 
@@ -28,6 +48,30 @@ void console_puts(const char *s);
 /* Formatted print */
 void console_printf(const char *fmt, ...);
 
+/*
+ * Draw pending output. Without force, refreshes closer than
+ * CONSOLE_REFRESH_MS apart are deferred to console_flush().
+ */
+void console_refresh(bool force);
+
+/* Draw deferred output (call from the main loop) */
+void console_flush(void);
+
+/* Forget what is on screen in a pixel rectangle (drawn over by others) */
+void console_invalidate(int x, int y, int w, int h);
+
+/* Scroll the view through the scrollback (positive = older) */
+void console_scroll_view(int lines_back);
+
+/* Lines the view is currently scrolled back */
+int console_view_offset(void);
+
+/* Mirror output to serial (default on) */
+void console_set_serial_mirror(bool enabled);
+
+/* Usage counters */
+void console_get_stats(ConsoleStats *stats);
+
 /* Move cursor */
 void console_set_cursor(int x, int y);
 void console_get_cursor(int *x, int *y);
@@ -0,0 +1,79 @@
+/*
+ * ojjyOS v3 Kernel - AHCI SATA Driver
+ *
+ * Drives SATA disks behind an AHCI host bus adapter (QEMU ich9-ahci,
+ * VirtualBox "SATA" controller). Uses native command queuing when both
+ * the HBA and the drive support it, keeping up to 32 commands in flight
+ * per port with interrupt completion.
+ */
+
+#ifndef _OJJY_AHCI_H
+#define _OJJY_AHCI_H
+
+#include "../types.h"
+#include "driver.h"
+
+/* Maximum number of AHCI disks tracked */
+#define AHCI_MAX_DEVICES    8
+
+/* Command slots per port (AHCI maximum) */
+#define AHCI_MAX_SLOTS      32
+
+/* Largest transfer one command may carry (128KB) */
+#define AHCI_MAX_SECTORS    256
+
+/* AHCI disk info */
+typedef struct {
+    bool     present;           /* Device exists */
+    uint8_t  port;              /* HBA port number */
+    uint64_t sectors;           /* Total sectors */
+    bool     supports_lba48;    /* Supports 48-bit LBA */
+    bool     ncq;               /* Native command queuing in use */
+    uint8_t  queue_depth;       /* Commands allowed in flight */
+    char     model[41];         /* Model string */
+    char     serial[21];        /* Serial number */
+} AhciDevice;
+
+/*
+ * Completion callback for queued commands. Runs from the IRQ handler
+ * or from ahci_poll(); status is 0 on success, negative on error.
+ */
+typedef void (*AhciCallback)(void *ctx, int status);
+
+/* Get the AHCI driver */
+Driver *ahci_get_driver(void);
+
+/* Initialize AHCI subsystem (registers driver) */
+void ahci_init(void);
+
+/* Get device info */
+AhciDevice *ahci_get_device(int index);
+
+/* Get number of detected devices */
+int ahci_get_device_count(void);
+
+/*
+ * Queue a transfer of up to AHCI_MAX_SECTORS without waiting.
+ * The buffer must be 2-byte aligned and DMA-addressable (see
+ * ahci_buffer_ok). Returns 0 if issued, -1 if every slot is busy
+ * or the request is invalid.
+ */
+int ahci_submit(AhciDevice *dev, uint64_t lba, uint32_t count, void *buffer,
+                bool write, AhciCallback callback, void *ctx);
+
+/* True if the HBA can DMA directly to/from this buffer */
+bool ahci_buffer_ok(const void *buffer, size_t bytes);
+
+/* Reap finished commands without waiting for an interrupt */
+void ahci_poll(AhciDevice *dev);
+
+/* Read sectors (blocking; large reads are split across queued commands) */
+int ahci_read_sectors(AhciDevice *dev, uint64_t lba, uint32_t count, void *buffer);
+
+/* Write sectors (blocking, then flushes the drive cache) */
+int ahci_write_sectors(AhciDevice *dev, uint64_t lba, uint32_t count, const void *buffer);
+
+/* Print device info */
+void ahci_print_devices(void);
+
+#endif /* _OJJY_AHCI_H */
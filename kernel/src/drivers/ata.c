@@ -1,8 +1,11 @@
 /*
  * ojjyOS v3 Kernel - ATA/IDE Disk Driver Implementation
  *
- * PIO mode ATA driver. Simple but functional for MVP.
- * VirtualBox uses PIIX4 which presents as standard IDE.
+ * PIO mode ATA driver with PIIX bus-master DMA when the IDE
+ * controller exposes it (BAR4). Commands complete by interrupt;
+ * the issuing context halts until its channel's IRQ arrives.
+ * VirtualBox and QEMU both emulate PIIX3/4, which presents as
+ * standard IDE.
  *
  * Channels:
  *   Primary:   I/O 0x1F0-0x1F7, Control 0x3F6, IRQ 14
@@ -14,6 +17,13 @@
 #include "../serial.h"
 #include "../string.h"
 #include "../console.h"
+#include "../memory.h"
+#include "../timer.h"
+#include "../smp.h"
+#include "../trace.h"
+#include "pci.h"
+
+extern void pic_enable_irq(uint8_t irq);
 
 /* ATA I/O ports (relative to base) */
 #define ATA_REG_DATA        0x00
@@ -36,6 +46,10 @@
 #define ATA_CMD_READ_PIO_EXT    0x24
 #define ATA_CMD_WRITE_PIO       0x30
 #define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_WRITE_DMA_EXT   0x35
 #define ATA_CMD_IDENTIFY        0xEC
 #define ATA_CMD_IDENTIFY_PACKET 0xA1
 #define ATA_CMD_FLUSH           0xE7
@@ -53,6 +67,49 @@
 /* Error register bits */
 #define ATA_ER_ABRT     0x04    /* Command aborted */
 
+/* Control register bits */
+#define ATA_CTRL_NIEN   0x02    /* Disable drive interrupts */
+#define ATA_CTRL_SRST   0x04    /* Software reset */
+
+/* Bus master IDE registers (relative to the channel's BMIDE base) */
+#define BM_REG_COMMAND  0x00
+#define BM_REG_STATUS   0x02
+#define BM_REG_PRDT     0x04
+
+#define BM_CMD_START    0x01
+#define BM_CMD_READ     0x08    /* Direction: device to memory */
+
+#define BM_SR_ACTIVE    0x01
+#define BM_SR_ERR       0x02    /* Write 1 to clear */
+#define BM_SR_IRQ       0x04    /* Write 1 to clear */
+#define BM_SR_DRV_DMA   0x60    /* Drive 0/1 DMA capable (preserve) */
+
+/*
+ * DMA transfers go through a per-channel bounce buffer below 4GB,
+ * so callers can pass any kernel buffer. 128KB = 256 sectors, the
+ * LBA28 maximum, described by two 64KB PRD entries.
+ */
+#define ATA_DMA_BUF_ORDER   5
+#define ATA_DMA_BUF_SIZE    (PAGE_SIZE << ATA_DMA_BUF_ORDER)
+#define ATA_DMA_MAX_SECTORS (ATA_DMA_BUF_SIZE / ATA_SECTOR_SIZE)
+#define ATA_PRD_MAX_BYTES   0x10000
+#define ATA_PRD_EOT         0x8000
+
+/* Physical Region Descriptor */
+typedef struct {
+    uint32_t phys;
+    uint16_t byte_count;        /* 0 means 64KB */
+    uint16_t flags;             /* ATA_PRD_EOT on the last entry */
+} PACKED PrdEntry;
+
+/*
+ * Timeouts. Once interrupts are on they are measured with the timer;
+ * before that, waits fall back to bounded polling.
+ */
+#define ATA_CMD_TIMEOUT_MS  5000        /* Per command (up to 256 sectors) */
+#define ATA_DRQ_TIMEOUT_MS  500
+#define ATA_POLL_SPINS      50000000
+
 /* Drive select bits */
 #define ATA_DRIVE_MASTER    0xA0
 #define ATA_DRIVE_SLAVE     0xB0
@@ -63,6 +120,18 @@ typedef struct {
     uint16_t io_base;
     uint16_t ctrl_base;
     uint8_t  irq;
+
+    /* Bus-master DMA (bm_base == 0 means PIO only) */
+    uint16_t bm_base;
+    PrdEntry *prdt;
+    uint8_t  *dma_buf;
+
+    /* Interrupt completion */
+    bool     irq_enabled;           /* IRQ registered and nIEN cleared */
+    volatile bool    dma_active;    /* A bus-master transfer is running */
+    volatile bool    irq_pending;   /* Set by ata_handle_irq */
+    volatile uint8_t irq_status;    /* Drive status latched at IRQ */
+    volatile uint8_t bm_status;     /* Bus master status latched at IRQ */
 } AtaChannel;
 
 static AtaChannel channels[2] = {
@@ -79,11 +148,18 @@ static bool ata_probe(Driver *drv);
 static int ata_init_driver(Driver *drv);
 static ssize_t ata_read(Driver *drv, void *buf, size_t count, uint64_t offset);
 static ssize_t ata_write(Driver *drv, const void *buf, size_t count, uint64_t offset);
+static bool ata_handle_irq(Driver *drv, uint8_t irq);
+static int ata_ioctl(Driver *drv, uint32_t cmd, void *arg);
+static int ata_submit(Driver *drv, uint64_t lba, uint32_t count, void *buf,
+                      bool write, DriverDoneFn done, void *ctx);
 
 /* Driver operations */
 static DriverOps ata_ops = {
     .probe = ata_probe,
     .init = ata_init_driver,
+    .handle_irq = ata_handle_irq,
+    .ioctl = ata_ioctl,
+    .submit = ata_submit,
     .read = ata_read,
     .write = ata_write,
 };
@@ -91,7 +167,7 @@ static DriverOps ata_ops = {
 /* Driver instance */
 static Driver ata_driver = {
     .name = "ata",
-    .description = "ATA/IDE PIO Mode Disk Driver",
+    .description = "ATA/IDE Disk Driver (PIO, bus-master DMA)",
     .version = DRIVER_VERSION(1, 0, 0),
     .type = DRIVER_TYPE_BLOCK,
     .ops = &ata_ops,
@@ -102,11 +178,17 @@ static Driver ata_driver = {
  */
 static bool ata_wait_busy(AtaChannel *ch, int timeout_ms)
 {
-    for (int i = 0; i < timeout_ms * 1000; i++) {
+    bool timed = interrupts_enabled();
+    uint64_t deadline = timer_get_ticks() + timeout_ms;
+
+    for (uint64_t i = 0; timed || i < (uint64_t)timeout_ms * 1000; i++) {
         uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
         if (!(status & ATA_SR_BSY)) {
             return true;
         }
+        if (timed && timer_get_ticks() >= deadline) {
+            break;
+        }
         /* Small delay */
         inb(ch->ctrl_base + ATA_REG_ALTSTATUS);
     }
@@ -118,7 +200,10 @@ static bool ata_wait_busy(AtaChannel *ch, int timeout_ms)
  */
 static int ata_wait_drq(AtaChannel *ch)
 {
-    for (int i = 0; i < 500000; i++) {
+    bool timed = interrupts_enabled();
+    uint64_t deadline = timer_get_ticks() + ATA_DRQ_TIMEOUT_MS;
+
+    for (uint32_t i = 0; timed || i < 500000; i++) {
         uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
 
         if (status & ATA_SR_ERR) {
@@ -130,10 +215,60 @@ static int ata_wait_drq(AtaChannel *ch)
         if (status & ATA_SR_DRQ) {
             return 0;   /* Ready */
         }
+        if (timed && timer_get_ticks() >= deadline) {
+            break;
+        }
     }
     return -3;  /* Timeout */
 }
 
+/*
+ * Expect a new interrupt: call before the action that triggers it
+ */
+static inline void ata_irq_arm(AtaChannel *ch)
+{
+    ch->irq_pending = false;
+}
+
+/*
+ * Wait for the channel interrupt and return the drive status it
+ * latched, or -1 on timeout. With interrupts on, the CPU halts between
+ * checks so input and compositing keep running, and the deadline comes
+ * from the timer. Before interrupts are enabled we poll instead.
+ */
+static int ata_wait_irq(AtaChannel *ch, uint64_t deadline)
+{
+    if (ch->irq_enabled && interrupts_enabled()) {
+        while (!ch->irq_pending) {
+            if (timer_get_ticks() >= deadline) {
+                return -1;
+            }
+            cpu_wait();
+        }
+        ch->irq_pending = false;
+        return ch->irq_status;
+    }
+
+    bool bm_done = !ch->dma_active;
+    for (uint32_t i = 0; i < ATA_POLL_SPINS; i++) {
+        if (!bm_done) {
+            uint8_t bm = inb(ch->bm_base + BM_REG_STATUS);
+            if (!(bm & (BM_SR_IRQ | BM_SR_ERR))) {
+                continue;
+            }
+            ch->bm_status = bm;
+            outb(ch->bm_base + BM_REG_STATUS, (bm & BM_SR_DRV_DMA) | BM_SR_IRQ);
+            bm_done = true;
+        }
+
+        uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+    }
+    return -1;
+}
+
 /*
  * Select drive
  */
@@ -154,7 +289,7 @@ static void ata_select_drive(AtaChannel *ch, int drive)
  */
 static void ata_soft_reset(AtaChannel *ch)
 {
-    outb(ch->ctrl_base + ATA_REG_CONTROL, 0x04);  /* Set SRST */
+    outb(ch->ctrl_base + ATA_REG_CONTROL, ATA_CTRL_SRST);
     inb(ch->ctrl_base + ATA_REG_ALTSTATUS);
     inb(ch->ctrl_base + ATA_REG_ALTSTATUS);
     inb(ch->ctrl_base + ATA_REG_ALTSTATUS);
@@ -238,6 +373,9 @@ static bool ata_identify(AtaChannel *ch, int drive, AtaDevice *dev)
     /* LBA28 sector count (words 60-61) */
     dev->sectors_28 = identify[60] | ((uint32_t)identify[61] << 16);
 
+    /* Multiword/Ultra DMA support (word 49 bit 8) */
+    dev->supports_dma = (identify[49] & (1 << 8)) != 0;
+
     /* LBA48 support and sector count (words 83, 100-103) */
     dev->supports_lba48 = (identify[83] & (1 << 10)) != 0;
     if (dev->supports_lba48) {
@@ -275,6 +413,265 @@ static bool ata_identify(AtaChannel *ch, int drive, AtaDevice *dev)
     return true;
 }
 
+/*
+ * Find the PIIX bus-master registers and set up per-channel DMA memory
+ */
+static bool ata_dma_init(Driver *drv)
+{
+    PciDevice pci;
+
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)) {
+        serial_printf("[ATA] No PCI IDE controller, DMA unavailable\n");
+        return false;
+    }
+
+    /* prog-if bit 7: bus mastering supported */
+    if (!(pci.prog_if & 0x80)) {
+        serial_printf("[ATA] IDE controller is not bus-master capable\n");
+        return false;
+    }
+
+    uint64_t bar4 = pci_read_bar(&pci, 4);
+    if (bar4 == 0 || bar4 > 0xFFFF) {
+        serial_printf("[ATA] BAR4 not an I/O range (0x%x), DMA unavailable\n", bar4);
+        return false;
+    }
+
+    pci_enable(&pci, PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+    bool any = false;
+    for (int i = 0; i < 2; i++) {
+        AtaChannel *ch = &channels[i];
+
+        /* PRD table must not cross a 64KB boundary; a page never does */
+        uint64_t prdt = pmm_alloc_pages(0, PMM_ZERO | PMM_DMA32);
+        uint64_t buf = pmm_alloc_pages(ATA_DMA_BUF_ORDER, PMM_DMA32);
+        if (!prdt || !buf) {
+            if (prdt) pmm_free_pages(prdt, 0);
+            if (buf) pmm_free_pages(buf, ATA_DMA_BUF_ORDER);
+            serial_printf("[ATA] No DMA memory for channel %d\n", (uint64_t)i);
+            continue;
+        }
+
+        /* The buffer is naturally aligned, so each 64KB entry stays in bounds */
+        ch->prdt = (PrdEntry *)prdt;
+        ch->dma_buf = (uint8_t *)buf;
+        ch->bm_base = (uint16_t)bar4 + i * 8;
+
+        outb(ch->bm_base + BM_REG_COMMAND, 0);
+        outb(ch->bm_base + BM_REG_STATUS,
+            (inb(ch->bm_base + BM_REG_STATUS) & BM_SR_DRV_DMA) | BM_SR_IRQ | BM_SR_ERR);
+
+        serial_printf("[ATA] %s channel: bus master at 0x%x\n",
+            i == 0 ? "Primary" : "Secondary", (uint64_t)ch->bm_base);
+        any = true;
+    }
+
+    if (any) {
+        drv->flags |= DRIVER_FLAG_DMA;
+    }
+    return any;
+}
+
+/*
+ * Drive interrupt: latch status for the waiter and acknowledge
+ */
+static bool ata_handle_irq(Driver *drv, uint8_t irq)
+{
+    (void)drv;
+
+    for (int i = 0; i < 2; i++) {
+        AtaChannel *ch = &channels[i];
+        if (ch->irq != irq) {
+            continue;
+        }
+
+        uint8_t bm = ch->bm_base ? inb(ch->bm_base + BM_REG_STATUS) : 0;
+
+        /* Reading the status register deasserts INTRQ */
+        uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
+
+        if (ch->dma_active) {
+            /* DMA is done only once the bus master says so */
+            if (bm & BM_SR_IRQ) {
+                ch->bm_status = bm;
+                outb(ch->bm_base + BM_REG_STATUS, (bm & BM_SR_DRV_DMA) | BM_SR_IRQ);
+                ch->irq_status = status;
+                ch->irq_pending = true;
+            }
+        } else if (!(status & ATA_SR_BSY)) {
+            ch->irq_status = status;
+            ch->irq_pending = true;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Load the taskfile for a DMA command (LBA48 only when needed)
+ */
+static void ata_dma_taskfile(AtaChannel *ch, AtaDevice *dev, uint64_t lba,
+                             uint32_t count, bool write)
+{
+    uint8_t drive_sel = (dev->drive == 0) ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
+    drive_sel |= ATA_DRIVE_LBA;
+
+    if (dev->supports_lba48 && lba + count > 0x0FFFFFFF) {
+        outb(ch->io_base + ATA_REG_DRIVE, drive_sel);
+        outb(ch->io_base + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_LO, (lba >> 24) & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_MID, (lba >> 32) & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_HI, (lba >> 40) & 0xFF);
+        outb(ch->io_base + ATA_REG_SECCOUNT, count & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_LO, lba & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+        outb(ch->io_base + ATA_REG_COMMAND,
+            write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        outb(ch->io_base + ATA_REG_DRIVE, drive_sel | ((lba >> 24) & 0x0F));
+        outb(ch->io_base + ATA_REG_SECCOUNT, count & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_LO, lba & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+        outb(ch->io_base + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+        outb(ch->io_base + ATA_REG_COMMAND,
+            write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+}
+
+/*
+ * One DMA command of up to ATA_DMA_MAX_SECTORS through the bounce buffer
+ */
+static int ata_dma_transfer(AtaDevice *dev, uint64_t lba, uint32_t count, bool write)
+{
+    AtaChannel *ch = &channels[dev->channel];
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+
+    if (!ata_wait_busy(ch, 500)) {
+        return -1;
+    }
+
+    /* Build the PRD table over the bounce buffer */
+    uint64_t phys = (uint64_t)ch->dma_buf;
+    int entries = 0;
+    for (uint32_t done = 0; done < bytes; done += ATA_PRD_MAX_BYTES) {
+        uint32_t len = bytes - done;
+        if (len > ATA_PRD_MAX_BYTES) len = ATA_PRD_MAX_BYTES;
+        ch->prdt[entries].phys = (uint32_t)(phys + done);
+        ch->prdt[entries].byte_count = (uint16_t)len;   /* 64KB wraps to 0 */
+        ch->prdt[entries].flags = 0;
+        entries++;
+    }
+    ch->prdt[entries - 1].flags = ATA_PRD_EOT;
+
+    uint8_t bm_cmd = write ? 0 : BM_CMD_READ;
+    outb(ch->bm_base + BM_REG_COMMAND, bm_cmd);
+    outl(ch->bm_base + BM_REG_PRDT, (uint32_t)(uint64_t)ch->prdt);
+    outb(ch->bm_base + BM_REG_STATUS,
+        (inb(ch->bm_base + BM_REG_STATUS) & BM_SR_DRV_DMA) | BM_SR_IRQ | BM_SR_ERR);
+    uint64_t deadline = timer_get_ticks() + ATA_CMD_TIMEOUT_MS;
+    ata_irq_arm(ch);
+    ch->bm_status = 0;
+    ch->dma_active = true;
+
+    ata_dma_taskfile(ch, dev, lba, count, write);
+    outb(ch->bm_base + BM_REG_COMMAND, bm_cmd | BM_CMD_START);
+
+    int status = ata_wait_irq(ch, deadline);
+
+    outb(ch->bm_base + BM_REG_COMMAND, bm_cmd);
+    ch->dma_active = false;
+
+    if (status < 0) {
+        driver_report_error(&ata_driver, "DMA timeout");
+        ata_soft_reset(ch);
+        return -1;
+    }
+    if ((ch->bm_status & BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        outb(ch->bm_base + BM_REG_STATUS,
+            (inb(ch->bm_base + BM_REG_STATUS) & BM_SR_DRV_DMA) | BM_SR_ERR);
+        driver_report_error(&ata_driver, "DMA transfer error");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * FLUSH CACHE after a write, so the data has reached the media when
+ * the write returns. Returns 0, or -1 on timeout or device error.
+ */
+static int ata_flush_cache(AtaChannel *ch)
+{
+    ata_irq_arm(ch);
+    outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_FLUSH);
+
+    int status = ata_wait_irq(ch, timer_get_ticks() + ATA_CMD_TIMEOUT_MS);
+    if (status < 0) {
+        driver_report_error(&ata_driver, "Cache flush timeout");
+        ata_soft_reset(ch);
+        return -1;
+    }
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        driver_report_error(&ata_driver, "Cache flush failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read via DMA, copying out of the bounce buffer
+ */
+static int ata_dma_read(AtaDevice *dev, uint64_t lba, uint32_t count, uint8_t *buf)
+{
+    AtaChannel *ch = &channels[dev->channel];
+
+    while (count > 0) {
+        uint32_t chunk = (count > ATA_DMA_MAX_SECTORS) ? ATA_DMA_MAX_SECTORS : count;
+
+        if (ata_dma_transfer(dev, lba, chunk, false) != 0) {
+            return -1;
+        }
+        memcpy(buf, ch->dma_buf, chunk * ATA_SECTOR_SIZE);
+
+        buf += chunk * ATA_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Write via DMA, staging through the bounce buffer
+ */
+static int ata_dma_write(AtaDevice *dev, uint64_t lba, uint32_t count, const uint8_t *buf)
+{
+    AtaChannel *ch = &channels[dev->channel];
+
+    while (count > 0) {
+        uint32_t chunk = (count > ATA_DMA_MAX_SECTORS) ? ATA_DMA_MAX_SECTORS : count;
+
+        memcpy(ch->dma_buf, buf, chunk * ATA_SECTOR_SIZE);
+        if (ata_dma_transfer(dev, lba, chunk, true) != 0) {
+            return -1;
+        }
+
+        /* Flush cache, as the PIO path does */
+        if (ata_flush_cache(ch) != 0) {
+            return -1;
+        }
+
+        buf += chunk * ATA_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
 /*
  * Probe for ATA devices
  */
@@ -317,15 +714,39 @@ static bool ata_probe(Driver *drv)
  */
 static int ata_init_driver(Driver *drv)
 {
-    (void)drv;
-
     serial_printf("[ATA] Initializing...\n");
 
-    /* Disable interrupts for PIO mode (we'll poll) */
-    outb(channels[0].ctrl_base + ATA_REG_CONTROL, 0x02);
-    outb(channels[1].ctrl_base + ATA_REG_CONTROL, 0x02);
+    /* Commands on channels with a device complete by interrupt */
+    for (int i = 0; i < 2; i++) {
+        AtaChannel *ch = &channels[i];
+        if (!devices[i * 2].present && !devices[i * 2 + 1].present) {
+            outb(ch->ctrl_base + ATA_REG_CONTROL, ATA_CTRL_NIEN);
+            continue;
+        }
+
+        driver_register_irq(drv, ch->irq);
+        pic_enable_irq(ch->irq);
+        outb(ch->ctrl_base + ATA_REG_CONTROL, 0x00);
+        ch->irq_enabled = true;
+    }
+
+    if (!ata_dma_init(drv)) {
+        serial_printf("[ATA] Initialized in PIO mode\n");
+        return 0;
+    }
 
-    serial_printf("[ATA] Initialized in PIO mode\n");
+    int dma_devices = 0;
+    for (int i = 0; i < ATA_MAX_DEVICES; i++) {
+        AtaDevice *dev = &devices[i];
+        if (dev->present && !dev->is_atapi && dev->supports_dma &&
+            channels[dev->channel].bm_base) {
+            dev->dma_enabled = true;
+            dma_devices++;
+        }
+    }
+
+    serial_printf("[ATA] Initialized with bus-master DMA (%d device(s))\n",
+        (uint64_t)dma_devices);
     return 0;
 }
 
@@ -346,7 +767,16 @@ int ata_read_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, void *buffer)
     AtaChannel *ch = &channels[dev->channel];
     uint8_t *buf = (uint8_t *)buffer;
 
-    serial_printf("[ATA] Reading %d sectors from LBA %d\n", count, (int)lba);
+    trace(TRACE_ATA_READ, lba, count, dev->dma_enabled);
+
+    if (dev->dma_enabled) {
+        if (ata_dma_read(dev, lba, count, buf) == 0) {
+            return 0;
+        }
+        trace(TRACE_ATA_DMA_FALLBACK, lba, count, 0);
+        serial_printf("[ATA] DMA read failed, falling back to PIO\n");
+        dev->dma_enabled = false;
+    }
 
     /* Select drive with LBA mode */
     uint8_t drive_sel = (dev->drive == 0) ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
@@ -361,6 +791,9 @@ int ata_read_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, void *buffer)
             return -1;
         }
 
+        uint64_t deadline = timer_get_ticks() + ATA_CMD_TIMEOUT_MS;
+        ata_irq_arm(ch);
+
         if (dev->supports_lba48 && (lba >= 0x10000000 || chunk > 256)) {
             /* LBA48 mode */
             outb(ch->io_base + ATA_REG_DRIVE, drive_sel);
@@ -389,12 +822,18 @@ int ata_read_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, void *buffer)
             outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
         }
 
-        /* Read each sector */
+        /* Read each sector; the drive interrupts as each one is ready */
         for (uint32_t i = 0; i < chunk; i++) {
-            if (ata_wait_drq(ch) != 0) {
-                driver_report_error(&ata_driver, "DRQ timeout during read");
+            int status = ata_wait_irq(ch, deadline);
+            if (status < 0) {
+                driver_report_error(&ata_driver, "Timeout during read");
                 return -1;
             }
+            if ((status & (ATA_SR_ERR | ATA_SR_DF)) || !(status & ATA_SR_DRQ)) {
+                driver_report_error(&ata_driver, "Error during read");
+                return -1;
+            }
+            ata_irq_arm(ch);
 
             /* Read 256 words (512 bytes) */
             for (int j = 0; j < 256; j++) {
@@ -430,7 +869,16 @@ int ata_write_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, const void *
     AtaChannel *ch = &channels[dev->channel];
     const uint8_t *buf = (const uint8_t *)buffer;
 
-    serial_printf("[ATA] Writing %d sectors to LBA %d\n", count, (int)lba);
+    trace(TRACE_ATA_WRITE, lba, count, dev->dma_enabled);
+
+    if (dev->dma_enabled) {
+        if (ata_dma_write(dev, lba, count, buf) == 0) {
+            return 0;
+        }
+        trace(TRACE_ATA_DMA_FALLBACK, lba, count, 1);
+        serial_printf("[ATA] DMA write failed, falling back to PIO\n");
+        dev->dma_enabled = false;
+    }
 
     uint8_t drive_sel = (dev->drive == 0) ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
     drive_sel |= ATA_DRIVE_LBA;
@@ -443,6 +891,9 @@ int ata_write_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, const void *
             return -1;
         }
 
+        uint64_t deadline = timer_get_ticks() + ATA_CMD_TIMEOUT_MS;
+        ata_irq_arm(ch);
+
         /* LBA28 mode for simplicity */
         outb(ch->io_base + ATA_REG_DRIVE, drive_sel | ((lba >> 24) & 0x0F));
         outb(ch->io_base + ATA_REG_SECCOUNT, chunk & 0xFF);
@@ -452,12 +903,24 @@ int ata_write_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, const void *
 
         outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
 
-        /* Write each sector */
+        /*
+         * Write each sector. The drive requests the first one without an
+         * interrupt, then interrupts after every sector it has taken.
+         */
         for (uint32_t i = 0; i < chunk; i++) {
-            if (ata_wait_drq(ch) != 0) {
-                driver_report_error(&ata_driver, "DRQ timeout during write");
-                return -1;
+            if (i == 0) {
+                if (ata_wait_drq(ch) != 0) {
+                    driver_report_error(&ata_driver, "DRQ timeout during write");
+                    return -1;
+                }
+            } else {
+                int status = ata_wait_irq(ch, deadline);
+                if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF)) || !(status & ATA_SR_DRQ)) {
+                    driver_report_error(&ata_driver, "Error during write");
+                    return -1;
+                }
             }
+            ata_irq_arm(ch);
 
             /* Write 256 words */
             for (int j = 0; j < 256; j++) {
@@ -468,9 +931,17 @@ int ata_write_sectors(AtaDevice *dev, uint64_t lba, uint32_t count, const void *
             buf += ATA_SECTOR_SIZE;
         }
 
+        /* Completion interrupt for the last sector */
+        int status = ata_wait_irq(ch, deadline);
+        if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+            driver_report_error(&ata_driver, "Error completing write");
+            return -1;
+        }
+
         /* Flush cache */
-        outb(ch->io_base + ATA_REG_COMMAND, ATA_CMD_FLUSH);
-        ata_wait_busy(ch, 500);
+        if (ata_flush_cache(ch) != 0) {
+            return -1;
+        }
 
         lba += chunk;
         count -= chunk;
@@ -534,6 +1005,67 @@ static ssize_t ata_write(Driver *drv, const void *buf, size_t count, uint64_t of
     return count;
 }
 
+/*
+ * First non-ATAPI device, used by the generic driver ops
+ */
+static AtaDevice *ata_first_disk(void)
+{
+    for (int i = 0; i < ATA_MAX_DEVICES; i++) {
+        if (devices[i].present && !devices[i].is_atapi) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Driver ioctl (block geometry and flush for the first disk)
+ */
+static int ata_ioctl(Driver *drv, uint32_t cmd, void *arg)
+{
+    (void)drv;
+
+    AtaDevice *dev = ata_first_disk();
+    if (!dev || (!arg && cmd != DRIVER_IOCTL_BLOCK_FLUSH)) {
+        return -1;
+    }
+
+    switch (cmd) {
+        case DRIVER_IOCTL_BLOCK_SECTORS:
+            *(uint64_t *)arg = dev->supports_lba48 ? dev->sectors : dev->sectors_28;
+            return 0;
+        case DRIVER_IOCTL_BLOCK_QUEUE_DEPTH:
+            *(uint32_t *)arg = 1;   /* One command per channel, no queuing */
+            return 0;
+        case DRIVER_IOCTL_BLOCK_FLUSH:
+            return 0;               /* Every write already ends with a flush */
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Block queue hook. The channel runs one command at a time, so the
+ * transfer is carried out here and completes before returning. The
+ * queue calls this without its lock, so the thread blocks in
+ * ata_wait_irq() and others run until the channel interrupt.
+ */
+static int ata_submit(Driver *drv, uint64_t lba, uint32_t count, void *buf,
+                      bool write, DriverDoneFn done, void *ctx)
+{
+    (void)drv;
+
+    AtaDevice *dev = ata_first_disk();
+    if (!dev) {
+        return -2;
+    }
+
+    int ret = write ? ata_write_sectors(dev, lba, count, buf)
+                    : ata_read_sectors(dev, lba, count, buf);
+    done(ctx, ret);
+    return 0;
+}
+
 /*
  * Get device info
  */
@@ -568,9 +1100,10 @@ void ata_print_devices(void)
         const char *drv_str = (dev->drive == 0) ? "Master" : "Slave";
 
         console_printf("[%d] %s %s: %s\n", i, ch_str, drv_str, dev->model);
-        console_printf("    Type: %s, LBA48: %s\n",
+        console_printf("    Type: %s, LBA48: %s, Transfer: %s\n",
             dev->is_atapi ? "ATAPI" : "ATA",
-            dev->supports_lba48 ? "Yes" : "No");
+            dev->supports_lba48 ? "Yes" : "No",
+            dev->dma_enabled ? "DMA" : "PIO");
 
         if (!dev->is_atapi) {
             uint64_t size_mb = (dev->sectors * ATA_SECTOR_SIZE) / (1024 * 1024);
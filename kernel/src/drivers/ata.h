@@ -1,7 +1,8 @@
 /*
  * ojjyOS v3 Kernel - ATA/IDE Disk Driver
  *
- * Simple PIO mode ATA driver for reading/writing disk sectors.
+ * ATA driver for reading/writing disk sectors. Uses PIIX bus-master
+ * DMA when available and falls back to PIO otherwise.
  * Works with VirtualBox's PIIX4 IDE controller.
  */
 
@@ -28,6 +29,8 @@ typedef struct {
     char     model[41];         /* Model string */
     char     serial[21];        /* Serial number */
     bool     supports_lba48;    /* Supports 48-bit LBA */
+    bool     supports_dma;      /* IDENTIFY reports DMA support */
+    bool     dma_enabled;       /* Transfers use bus-master DMA */
 } AtaDevice;
 
 /* Get the ATA driver */
@@ -1,74 +1,275 @@
 /*
  * ojjyOS v3 Kernel - Block Cache Implementation
  *
- * Simple LRU cache with write-through policy.
+ * Hash-indexed LRU cache. Capacity is sized from free memory at boot.
+ * Lookups go through a power-of-two bucket table; recency is an
+ * intrusive doubly linked list (head = most recent), so hits, inserts
+ * and evictions are O(1). Writes are write-back by default: dirty
+ * blocks are written on eviction, on block_cache_flush(), and by the
+ * periodic flusher driven from the main loop.
+ *
+ * The cache sits on whichever DRIVER_TYPE_BLOCK driver is ready (AHCI
+ * when present, else ATA) and issues I/O through that driver's block
+ * request queue, falling back to the plain DriverOps read/write.
+ *
+ * Misses are filled with multi-sector disk commands. Sequential streams
+ * get an adaptive read-ahead window that doubles while the stream holds;
+ * a trigger block halfway through each window submits the next one
+ * asynchronously, so the reader keeps consuming cached blocks while the
+ * disk works. Flushes queue every dirty block at once and let the
+ * elevator merge neighbours into large writes.
+ *
+ * All cache state is guarded by cache_lock, which stays held across
+ * the cache's own disk I/O. Nothing here runs as a queue callback:
+ * a finished read-ahead is noticed through ra_req.done and inserted
+ * by the next cache call (or the periodic tick) under the lock, so a
+ * completion reaped on another CPU never needs the lock.
  */
 
 #include "block_cache.h"
-#include "ata.h"
+#include "driver.h"
+#include "block_queue.h"
 #include "../serial.h"
 #include "../string.h"
 #include "../console.h"
 #include "../timer.h"
+#include "../memory.h"
+#include "../heap.h"
+#include "../trace.h"
+#include "../sched.h"
+
+/* Capacity bounds; the cache takes 1/64 of free memory in between */
+#define CACHE_MIN_ENTRIES       64
+#define CACHE_MAX_ENTRIES       32768       /* 16MB of data */
+#define CACHE_MEMORY_SHIFT      6
+
+/* Data is carved from the largest PMM blocks */
+#define CACHE_CHUNK_BLOCKS      ((PAGE_SIZE << PMM_MAX_ORDER) / BLOCK_SIZE)
 
-/* Number of cache entries */
-#define CACHE_SIZE 64
+/* Largest single disk transfer, and the staging buffer that holds it */
+#define CACHE_MAX_BATCH         256
+#define CACHE_STAGING_ORDER     5           /* 128KB = 256 sectors */
+
+/* Read-ahead window (sectors) */
+#define READAHEAD_MIN           8
+#define READAHEAD_MAX           128
 
 /* Cache entry */
-typedef struct {
-    uint64_t block_num;     /* Block number (0 = invalid) */
-    uint64_t last_access;   /* Tick count of last access */
-    bool     valid;         /* Entry is valid */
+typedef struct CacheEntry {
+    uint64_t block_num;
+    bool     valid;         /* Entry holds a block */
     bool     dirty;         /* Needs to be written back */
-    uint8_t  data[BLOCK_SIZE];
+    bool     readahead;     /* Brought in by read-ahead, not yet used */
+    bool     ra_trigger;    /* Hitting this block fetches the next window */
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev;
+    struct CacheEntry *lru_next;
+    uint8_t  *data;
 } CacheEntry;
 
-/* Cache */
-static CacheEntry cache[CACHE_SIZE];
+/* Held across disk I/O: a mutex, never taken with interrupts off */
+static Mutex cache_lock = MUTEX_INIT;
+
+/* Cache storage */
+static CacheEntry *entries = NULL;
+static uint32_t capacity = 0;
+
+/* Hash buckets */
+static CacheEntry **buckets = NULL;
+static uint32_t bucket_mask = 0;
+
+/* LRU list of valid entries (head = most recently used) */
+static CacheEntry *lru_head = NULL;
+static CacheEntry *lru_tail = NULL;
+
+/* Unused entries */
+static CacheEntry *free_list = NULL;
+
+/* Multi-sector staging buffer */
+static uint8_t *staging = NULL;
+
+/* Asynchronous read-ahead: one window in flight at a time */
+static uint8_t *ra_buffer = NULL;
+static BlockRequest ra_req;
+static bool ra_in_flight = false;
+static uint64_t ra_trigger_block = 0;
+
+/* Sequential stream detection */
+static uint64_t seq_next = ~0ULL;       /* Block expected next */
+static uint64_t ra_next = 0;            /* First block past the current window */
+static uint32_t ra_window = 0;
+
+/* Write policy */
+static bool write_back = true;
+static uint64_t last_flush_ms = 0;
+static uint32_t valid_count = 0;
+static uint32_t dirty_count = 0;
 
 /* Statistics */
 static uint64_t cache_hits = 0;
 static uint64_t cache_misses = 0;
 static uint64_t cache_writes = 0;
 static uint64_t cache_flushes = 0;
+static uint64_t cache_evictions = 0;
+static uint64_t cache_periodic_flushes = 0;
+static uint64_t disk_reads = 0;             /* Disk read commands issued */
+static uint64_t readahead_blocks = 0;       /* Blocks fetched ahead of use */
+static uint64_t readahead_hits = 0;         /* ...that were later read */
+static uint64_t readahead_wasted = 0;       /* ...evicted or dropped unused */
+
+/*
+ * The block device under the cache (most recently registered ready one)
+ */
+static Driver *cache_disk(void)
+{
+    return driver_find_ready_by_type(DRIVER_TYPE_BLOCK);
+}
+
+/*
+ * Sector-granular I/O through the request queue, or the driver's
+ * byte-offset read/write ops if it has no submit op
+ */
+static int disk_read(Driver *disk, uint64_t lba, uint32_t count, void *buffer)
+{
+    BlockQueue *q = block_queue_get(disk);
+    if (q) {
+        return block_queue_rw(q, lba, count, buffer, false);
+    }
+
+    size_t bytes = (size_t)count * BLOCK_SIZE;
+    return disk->ops->read(disk, buffer, bytes, lba * BLOCK_SIZE) == (ssize_t)bytes ? 0 : -1;
+}
+
+static int disk_write(Driver *disk, uint64_t lba, uint32_t count, const void *buffer)
+{
+    BlockQueue *q = block_queue_get(disk);
+    if (q) {
+        return block_queue_rw(q, lba, count, (void *)buffer, true);
+    }
+
+    size_t bytes = (size_t)count * BLOCK_SIZE;
+    return disk->ops->write(disk, buffer, bytes, lba * BLOCK_SIZE) == (ssize_t)bytes ? 0 : -1;
+}
+
+/*
+ * Write the device's cache to the media. Queued writes don't flush
+ * per command, so callers do this once a batch has completed.
+ */
+static int disk_flush(Driver *disk)
+{
+    if (!disk->ops->ioctl || disk->ops->ioctl(disk, DRIVER_IOCTL_BLOCK_FLUSH, NULL) != 0) {
+        serial_printf("[CACHE] Flushing %s failed\n", disk->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Buffers handed to the request queue: below 4GB so HBAs without 64-bit
+ * addressing DMA straight into them, anywhere if low memory is gone
+ */
+static uint8_t *alloc_io_pages(uint32_t order)
+{
+    uint64_t addr = pmm_alloc_pages(order, PMM_DMA32);
+    if (!addr) {
+        addr = pmm_alloc_pages(order, 0);
+    }
+    return (uint8_t *)addr;
+}
+
+/*
+ * Hash a block number into the bucket table
+ */
+static inline uint32_t cache_hash(uint64_t block_num)
+{
+    uint64_t h = block_num * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h >> 32) & bucket_mask;
+}
+
+/*
+ * LRU list helpers
+ */
+static void lru_unlink(CacheEntry *entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(CacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+    lru_head = entry;
+}
+
+static void lru_touch(CacheEntry *entry)
+{
+    if (lru_head != entry) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+    }
+}
 
 /*
  * Find cache entry by block number
  */
 static CacheEntry *cache_find(uint64_t block_num)
 {
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].valid && cache[i].block_num == block_num) {
-            return &cache[i];
+    if (!buckets) return NULL;
+
+    for (CacheEntry *e = buckets[cache_hash(block_num)]; e; e = e->hash_next) {
+        if (e->block_num == block_num) {
+            return e;
         }
     }
     return NULL;
 }
 
-/*
- * Find LRU entry for eviction
- */
-static CacheEntry *cache_find_lru(void)
+static void hash_insert(CacheEntry *entry)
 {
-    CacheEntry *lru = NULL;
-    uint64_t oldest = ~0ULL;
+    uint32_t idx = cache_hash(entry->block_num);
+    entry->hash_next = buckets[idx];
+    buckets[idx] = entry;
+}
 
-    /* First try to find an invalid entry */
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (!cache[i].valid) {
-            return &cache[i];
+static void hash_remove(CacheEntry *entry)
+{
+    CacheEntry **link = &buckets[cache_hash(entry->block_num)];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            entry->hash_next = NULL;
+            return;
         }
+        link = &(*link)->hash_next;
     }
+}
 
-    /* Find least recently used */
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].last_access < oldest) {
-            oldest = cache[i].last_access;
-            lru = &cache[i];
+static void cache_mark_dirty(CacheEntry *entry, bool dirty)
+{
+    if (entry->dirty != dirty) {
+        entry->dirty = dirty;
+        if (dirty) {
+            dirty_count++;
+        } else {
+            dirty_count--;
         }
     }
-
-    return lru;
 }
 
 /*
@@ -80,86 +281,409 @@ static int cache_writeback(CacheEntry *entry)
         return 0;
     }
 
-    AtaDevice *dev = ata_get_device(0);
-    if (!dev) {
+    Driver *disk = cache_disk();
+    if (!disk) {
         return -1;
     }
 
-    int ret = ata_write_sectors(dev, entry->block_num, 1, entry->data);
+    int ret = disk_write(disk, entry->block_num, 1, entry->data);
     if (ret == 0) {
-        entry->dirty = false;
+        cache_mark_dirty(entry, false);
         cache_flushes++;
     }
 
     return ret;
 }
 
+/*
+ * Drop an entry from the hash and LRU and return it to the free list
+ */
+static void cache_release(CacheEntry *entry)
+{
+    hash_remove(entry);
+    lru_unlink(entry);
+    cache_mark_dirty(entry, false);
+    if (entry->readahead) {
+        readahead_wasted++;
+    }
+    entry->valid = false;
+    entry->lru_next = free_list;
+    free_list = entry;
+    valid_count--;
+}
+
+/*
+ * Get an entry for a new block: a free one, or the LRU victim
+ * (written back first if dirty). Returns NULL if the victim can't be
+ * written back.
+ */
+static CacheEntry *cache_alloc_entry(uint64_t block_num)
+{
+    CacheEntry *entry = free_list;
+    if (entry) {
+        free_list = entry->lru_next;
+        entry->lru_next = NULL;
+    } else {
+        entry = lru_tail;
+        if (!entry) return NULL;
+        trace(TRACE_CACHE_EVICT, entry->block_num, entry->dirty, 0);
+        if (entry->dirty && cache_writeback(entry) != 0) {
+            serial_printf("[CACHE] ERROR: Writeback of block %d failed\n", entry->block_num);
+            return NULL;
+        }
+        hash_remove(entry);
+        lru_unlink(entry);
+        entry->valid = false;
+        valid_count--;
+        cache_evictions++;
+        if (entry->readahead) {
+            readahead_wasted++;
+        }
+    }
+
+    entry->block_num = block_num;
+    entry->readahead = false;
+    entry->ra_trigger = false;
+    return entry;
+}
+
+/*
+ * Make a freshly filled entry visible
+ */
+static void cache_insert(CacheEntry *entry)
+{
+    entry->valid = true;
+    hash_insert(entry);
+    lru_push_front(entry);
+    valid_count++;
+}
+
+/*
+ * Sectors on the cached device
+ */
+static uint64_t device_sectors(Driver *disk)
+{
+    uint64_t sectors = 0;
+    if (!disk->ops->ioctl ||
+        disk->ops->ioctl(disk, DRIVER_IOCTL_BLOCK_SECTORS, &sectors) != 0) {
+        return 0;
+    }
+    return sectors;
+}
+
+/*
+ * Length of the run of uncached blocks starting at 'start' (max 'limit')
+ */
+static uint32_t uncached_run(uint64_t start, uint32_t limit)
+{
+    uint32_t n = 0;
+    while (n < limit && !cache_find(start + n)) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Read [start, start + count) with one disk command and insert every
+ * block into the cache. Blocks must not be cached already. Blocks after
+ * the first 'demand' are tagged as read-ahead. Returns 0 on success.
+ */
+static int cache_fill_run(Driver *disk, uint64_t start, uint32_t count, uint32_t demand)
+{
+    count = MIN(count, (uint32_t)CACHE_MAX_BATCH);
+    count = MIN(count, capacity / 2);
+    if (count == 0 || !staging) {
+        return -1;
+    }
+
+    int ret = disk_read(disk, start, count, staging);
+    disk_reads++;
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        CacheEntry *entry = cache_alloc_entry(start + i);
+        if (!entry) {
+            return i >= demand ? 0 : -1;
+        }
+        memcpy(entry->data, staging + (uint64_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        if (i >= demand) {
+            entry->readahead = true;
+            readahead_blocks++;
+        }
+        cache_insert(entry);
+    }
+    return 0;
+}
+
+/*
+ * Insert a finished read-ahead window (whatever is still uncached)
+ */
+static void readahead_reap(void)
+{
+    if (!ra_in_flight || !ra_req.done) {
+        return;
+    }
+
+    ra_in_flight = false;
+    if (ra_req.status != 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ra_req.count; i++) {
+        if (cache_find(ra_req.lba + i)) {
+            continue;           /* Written or read meanwhile */
+        }
+        CacheEntry *entry = cache_alloc_entry(ra_req.lba + i);
+        if (!entry) {
+            break;
+        }
+        memcpy(entry->data, ra_buffer + (uint64_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        entry->readahead = true;
+        readahead_blocks++;
+        cache_insert(entry);
+    }
+
+    CacheEntry *trigger = cache_find(ra_trigger_block);
+    if (trigger) {
+        trigger->ra_trigger = true;
+    }
+}
+
+/*
+ * Wait for the in-flight read-ahead if it covers block_num
+ */
+static void readahead_wait_for(Driver *disk, uint64_t block_num)
+{
+    if (ra_in_flight && block_num >= ra_req.lba && block_num < ra_req.lba + ra_req.count) {
+        block_queue_wait(block_queue_get(disk), &ra_req);
+    }
+    readahead_reap();
+}
+
+/*
+ * Fetch the next read-ahead window and place its trigger block.
+ * With a request queue the window is read asynchronously.
+ */
+static void readahead_window(Driver *disk, uint64_t start)
+{
+    uint64_t limit = device_sectors(disk);
+    if (start >= limit || ra_in_flight) return;
+
+    uint32_t want = (uint32_t)MIN((uint64_t)ra_window, limit - start);
+    uint32_t run = uncached_run(start, want);
+    run = MIN(run, capacity / 2);
+    ra_next = start + want;
+    ra_trigger_block = start + want / 2;
+
+    BlockQueue *q = block_queue_get(disk);
+    if (run > 0 && q && ra_buffer) {
+        memset(&ra_req, 0, sizeof(ra_req));
+        ra_req.lba = start;
+        ra_req.count = run;
+        ra_req.buffer = ra_buffer;
+        if (block_queue_submit(q, &ra_req) == 0) {
+            trace(TRACE_CACHE_READAHEAD, start, run, 1);
+            ra_in_flight = true;
+            disk_reads++;
+            block_queue_run(q);
+            readahead_reap();   /* Synchronous drivers finish in submit */
+            return;
+        }
+    }
+
+    if (run > 0) {
+        trace(TRACE_CACHE_READAHEAD, start, run, 0);
+        cache_fill_run(disk, start, run, 0);
+    }
+
+    CacheEntry *trigger = cache_find(ra_trigger_block);
+    if (trigger) {
+        trigger->ra_trigger = true;
+    }
+}
+
+/*
+ * Track sequential access; returns true if this read continues a stream
+ */
+static bool readahead_observe(uint64_t block_num)
+{
+    bool sequential = (block_num == seq_next);
+    seq_next = block_num + 1;
+    if (!sequential) {
+        ra_window = 0;
+    }
+    return sequential;
+}
+
+/*
+ * Grow the read-ahead window for a confirmed stream
+ */
+static void readahead_grow(void)
+{
+    ra_window = ra_window ? MIN(ra_window * 2, (uint32_t)READAHEAD_MAX) : READAHEAD_MIN;
+}
+
 /*
  * Initialize block cache
  */
 void block_cache_init(void)
 {
-    serial_printf("[CACHE] Initializing block cache (%d entries)...\n", CACHE_SIZE);
+    uint64_t budget = pmm_get_free_memory() >> CACHE_MEMORY_SHIFT;
+    capacity = (uint32_t)MIN(MAX(budget / BLOCK_SIZE, CACHE_MIN_ENTRIES), CACHE_MAX_ENTRIES);
+
+    serial_printf("[CACHE] Initializing block cache (%d entries)...\n", (uint64_t)capacity);
+
+    uint32_t bucket_count = 1;
+    while (bucket_count < capacity) {
+        bucket_count <<= 1;
+    }
+    bucket_mask = bucket_count - 1;
+
+    entries = (CacheEntry *)kzalloc(sizeof(CacheEntry) * capacity);
+    buckets = (CacheEntry **)kzalloc(sizeof(CacheEntry *) * bucket_count);
+    if (!entries || !buckets) {
+        serial_printf("[CACHE] ERROR: Cannot allocate cache metadata\n");
+        kfree(entries);
+        kfree(buckets);
+        entries = NULL;
+        buckets = NULL;
+        capacity = 0;
+        return;
+    }
+
+    /* Carve data buffers out of PMM blocks */
+    uint32_t assigned = 0;
+    while (assigned < capacity) {
+        uint32_t want = MIN(capacity - assigned, (uint32_t)CACHE_CHUNK_BLOCKS);
+        uint32_t order = 0;
+        while (((uint64_t)PAGE_SIZE << order) < (uint64_t)want * BLOCK_SIZE) {
+            order++;
+        }
+
+        uint8_t *chunk = alloc_io_pages(order);
+        if (!chunk) break;
+        for (uint32_t i = 0; i < want; i++) {
+            entries[assigned + i].data = chunk + (uint64_t)i * BLOCK_SIZE;
+        }
+        assigned += want;
+    }
+    capacity = assigned;
+
+    if (!staging) {
+        staging = alloc_io_pages(CACHE_STAGING_ORDER);
+    }
+    if (!ra_buffer) {
+        ra_buffer = alloc_io_pages(CACHE_STAGING_ORDER);
+    }
 
-    memset(cache, 0, sizeof(cache));
+    free_list = NULL;
+    for (int i = (int)capacity - 1; i >= 0; i--) {
+        entries[i].lru_next = free_list;
+        free_list = &entries[i];
+    }
+
+    lru_head = NULL;
+    lru_tail = NULL;
+    valid_count = 0;
+    dirty_count = 0;
+    last_flush_ms = timer_get_ticks();
     cache_hits = 0;
     cache_misses = 0;
     cache_writes = 0;
     cache_flushes = 0;
-
-    serial_printf("[CACHE] Block cache ready\n");
+    cache_evictions = 0;
+    cache_periodic_flushes = 0;
+    disk_reads = 0;
+    readahead_blocks = 0;
+    readahead_hits = 0;
+    readahead_wasted = 0;
+    seq_next = ~0ULL;
+    ra_window = 0;
+    ra_in_flight = false;
+
+    serial_printf("[CACHE] Block cache ready: %d KB, %d buckets, %s\n",
+        ((uint64_t)capacity * BLOCK_SIZE) / 1024, (uint64_t)bucket_count,
+        write_back ? "write-back" : "write-through");
 }
 
 /*
  * Read a block
  */
-int block_cache_read(uint64_t block_num, void *buffer)
+static int cache_read(uint64_t block_num, void *buffer)
 {
-    if (!buffer) return -1;
+    readahead_reap();
+
+    bool sequential = readahead_observe(block_num);
 
     /* Check cache first */
     CacheEntry *entry = cache_find(block_num);
     if (entry) {
         /* Cache hit */
-        entry->last_access = timer_get_ticks();
+        lru_touch(entry);
         memcpy(buffer, entry->data, BLOCK_SIZE);
         cache_hits++;
+
+        if (entry->readahead) {
+            entry->readahead = false;
+            readahead_hits++;
+        }
+
+        /* Stream reached the middle of the window: fetch the next one */
+        if (entry->ra_trigger) {
+            entry->ra_trigger = false;
+            Driver *disk = cache_disk();
+            if (sequential && disk) {
+                readahead_grow();
+                readahead_window(disk, ra_next);
+            }
+        }
         return 0;
     }
 
     /* Cache miss - read from disk */
     cache_misses++;
 
-    AtaDevice *dev = ata_get_device(0);
-    if (!dev) {
+    Driver *disk = cache_disk();
+    if (!disk) {
         serial_printf("[CACHE] No disk device available\n");
         return -1;
     }
 
-    /* Find entry to use */
-    entry = cache_find_lru();
-    if (!entry) {
-        /* Should never happen */
-        serial_printf("[CACHE] ERROR: No cache entry available\n");
-        return -1;
+    /* The block may be on its way in already */
+    readahead_wait_for(disk, block_num);
+    entry = cache_find(block_num);
+    if (entry) {
+        lru_touch(entry);
+        memcpy(buffer, entry->data, BLOCK_SIZE);
+        entry->readahead = false;
+        readahead_hits++;
+        return 0;
     }
 
-    /* Write back if dirty */
-    if (entry->valid && entry->dirty) {
-        cache_writeback(entry);
+    /* Sequential misses pull in a window behind the requested block */
+    uint32_t count = 1;
+    if (sequential) {
+        readahead_grow();
+        uint64_t limit = device_sectors(disk);
+        uint64_t avail = (block_num < limit) ? limit - block_num : 1;
+        count = 1 + uncached_run(block_num + 1, (uint32_t)MIN((uint64_t)ra_window, avail - 1));
     }
+    trace(TRACE_CACHE_MISS, block_num, count, 0);
 
-    /* Read from disk */
-    int ret = ata_read_sectors(dev, block_num, 1, entry->data);
-    if (ret != 0) {
-        return ret;
+    if (cache_fill_run(disk, block_num, count, 1) != 0 || !(entry = cache_find(block_num))) {
+        /* Uncached read */
+        return disk_read(disk, block_num, 1, buffer);
     }
 
-    /* Update cache entry */
-    entry->block_num = block_num;
-    entry->last_access = timer_get_ticks();
-    entry->valid = true;
-    entry->dirty = false;
+    if (count > 1) {
+        ra_next = block_num + count;
+        CacheEntry *trigger = cache_find(block_num + 1 + (count - 1) / 2);
+        if (trigger) {
+            trigger->ra_trigger = true;
+        }
+    }
 
     /* Copy to output buffer */
     memcpy(buffer, entry->data, BLOCK_SIZE);
@@ -167,77 +691,268 @@ int block_cache_read(uint64_t block_num, void *buffer)
     return 0;
 }
 
+int block_cache_read(uint64_t block_num, void *buffer)
+{
+    if (!buffer) return -1;
+
+    mutex_lock(&cache_lock);
+    int ret = cache_read(block_num, buffer);
+    mutex_unlock(&cache_lock);
+    return ret;
+}
+
 /*
- * Write a block (write-through)
+ * Read a range of blocks, filling each uncached run with one command.
+ * buffer may be NULL to only populate the cache.
  */
-int block_cache_write(uint64_t block_num, const void *buffer)
+static int cache_read_range(uint64_t start, uint32_t count, void *buffer)
 {
-    if (!buffer) return -1;
+    Driver *disk = cache_disk();
+    if (!disk) {
+        serial_printf("[CACHE] No disk device available\n");
+        return -1;
+    }
+
+    uint8_t *out = (uint8_t *)buffer;
+    uint32_t done = 0;
+
+    while (done < count) {
+        uint64_t block = start + done;
+        readahead_wait_for(disk, block);
+        CacheEntry *entry = cache_find(block);
+
+        if (!entry) {
+            uint32_t run = uncached_run(block, MIN(count - done, (uint32_t)CACHE_MAX_BATCH));
+            cache_misses += run;
+            trace(TRACE_CACHE_MISS, block, run, 0);
+            if (cache_fill_run(disk, block, run, run) != 0) {
+                /* Cache can't hold the run: read straight through */
+                if (!out) return -1;
+                run = MIN(run, (uint32_t)CACHE_MAX_BATCH);
+                int ret = disk_read(disk, block, run, out + (uint64_t)done * BLOCK_SIZE);
+                disk_reads++;
+                if (ret != 0) return ret;
+                done += run;
+                continue;
+            }
+            entry = cache_find(block);
+            if (!entry) return -1;
+        } else {
+            cache_hits++;
+            if (entry->readahead) {
+                entry->readahead = false;
+                readahead_hits++;
+            }
+        }
 
+        lru_touch(entry);
+        if (out) {
+            memcpy(out + (uint64_t)done * BLOCK_SIZE, entry->data, BLOCK_SIZE);
+        }
+        done++;
+    }
+
+    seq_next = start + count;
+    return 0;
+}
+
+int block_cache_read_range(uint64_t start, uint32_t count, void *buffer)
+{
+    mutex_lock(&cache_lock);
+    int ret = cache_read_range(start, count, buffer);
+    mutex_unlock(&cache_lock);
+    return ret;
+}
+
+/*
+ * Write a block
+ */
+static int cache_write(uint64_t block_num, const void *buffer)
+{
     cache_writes++;
 
-    AtaDevice *dev = ata_get_device(0);
-    if (!dev) {
+    Driver *disk = cache_disk();
+    if (!disk) {
         serial_printf("[CACHE] No disk device available\n");
         return -1;
     }
 
-    /* Write to disk immediately (write-through) */
-    int ret = ata_write_sectors(dev, block_num, 1, buffer);
-    if (ret != 0) {
-        return ret;
+    /* Reap a read-ahead covering this block first, or it could re-insert the old data */
+    readahead_wait_for(disk, block_num);
+
+    /* Write-through: disk first */
+    if (!write_back) {
+        int ret = disk_write(disk, block_num, 1, buffer);
+        if (ret == 0) {
+            ret = disk_flush(disk);
+        }
+        if (ret != 0) {
+            return ret;
+        }
     }
 
-    /* Update cache if block is cached */
     CacheEntry *entry = cache_find(block_num);
     if (entry) {
-        memcpy(entry->data, buffer, BLOCK_SIZE);
-        entry->last_access = timer_get_ticks();
-        entry->dirty = false;
+        lru_touch(entry);
     } else {
-        /* Add to cache */
-        entry = cache_find_lru();
-        if (entry) {
-            if (entry->valid && entry->dirty) {
-                cache_writeback(entry);
-            }
-
-            entry->block_num = block_num;
-            entry->last_access = timer_get_ticks();
-            entry->valid = true;
-            entry->dirty = false;
-            memcpy(entry->data, buffer, BLOCK_SIZE);
+        entry = cache_alloc_entry(block_num);
+        if (!entry) {
+            /* No room: fall back to a direct write */
+            return write_back ? disk_write(disk, block_num, 1, buffer) : 0;
         }
+        cache_insert(entry);
     }
 
+    memcpy(entry->data, buffer, BLOCK_SIZE);
+    cache_mark_dirty(entry, write_back);
+
     return 0;
 }
 
+int block_cache_write(uint64_t block_num, const void *buffer)
+{
+    if (!buffer) return -1;
+
+    mutex_lock(&cache_lock);
+    int ret = cache_write(block_num, buffer);
+    mutex_unlock(&cache_lock);
+    return ret;
+}
+
 /*
  * Invalidate a cached block
  */
 void block_cache_invalidate(uint64_t block_num)
 {
+    mutex_lock(&cache_lock);
+    readahead_reap();
     CacheEntry *entry = cache_find(block_num);
     if (entry) {
         /* Don't write back dirty data when invalidating */
-        entry->valid = false;
-        entry->dirty = false;
+        cache_release(entry);
     }
+    mutex_unlock(&cache_lock);
 }
 
 /*
- * Flush all dirty blocks
+ * Flush all dirty blocks. With a request queue every dirty block is
+ * submitted up front so adjacent blocks merge into large writes.
  */
+static void cache_flush(void)
+{
+    if (dirty_count == 0) return;
+
+    trace(TRACE_CACHE_FLUSH, dirty_count, 0, 0);
+
+    Driver *disk = cache_disk();
+    BlockQueue *q = disk ? block_queue_get(disk) : NULL;
+    BlockRequest *reqs = q ? (BlockRequest *)kzalloc(sizeof(BlockRequest) * dirty_count) : NULL;
+
+    if (!reqs) {
+        for (uint32_t i = 0; i < capacity && dirty_count > 0; i++) {
+            if (entries[i].valid && entries[i].dirty) {
+                cache_writeback(&entries[i]);
+            }
+        }
+        if (disk) {
+            disk_flush(disk);
+        }
+        return;
+    }
+
+    /* Its insertion may evict entries we are about to queue */
+    if (ra_in_flight) {
+        block_queue_wait(q, &ra_req);
+        readahead_reap();
+    }
+
+    uint32_t n = 0;
+    uint32_t total = dirty_count;
+    for (uint32_t i = 0; i < capacity && n < total; i++) {
+        if (entries[i].valid && entries[i].dirty) {
+            BlockRequest *req = &reqs[n];
+            req->lba = entries[i].block_num;
+            req->count = 1;
+            req->write = true;
+            req->buffer = entries[i].data;
+            req->ctx = &entries[i];
+            if (block_queue_submit(q, req) == 0) {
+                n++;
+            }
+        }
+    }
+
+    /* The lock is held throughout, so the entries are still ours */
+    for (uint32_t i = 0; i < n; i++) {
+        if (block_queue_wait(q, &reqs[i]) == 0) {
+            cache_mark_dirty((CacheEntry *)reqs[i].ctx, false);
+            cache_flushes++;
+        }
+    }
+    kfree(reqs);
+    disk_flush(disk);
+}
+
 void block_cache_flush(void)
 {
-    serial_printf("[CACHE] Flushing dirty blocks...\n");
+    mutex_lock(&cache_lock);
+    cache_flush();
+    mutex_unlock(&cache_lock);
+}
+
+/*
+ * Periodic flusher, called from the flusher thread
+ */
+void block_cache_tick(uint64_t now_ms)
+{
+    /* Another CPU is using the cache; it will pick up the read-ahead */
+    if (!mutex_trylock(&cache_lock)) {
+        return;
+    }
+
+    readahead_reap();
 
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].valid && cache[i].dirty) {
-            cache_writeback(&cache[i]);
+    if (now_ms - last_flush_ms >= BLOCK_CACHE_FLUSH_INTERVAL_MS) {
+        last_flush_ms = now_ms;
+        if (dirty_count > 0) {
+            cache_periodic_flushes++;
+            cache_flush();
         }
     }
+
+    mutex_unlock(&cache_lock);
+}
+
+/*
+ * Flusher thread: completes queued I/O and writes back dirty blocks at
+ * low priority, away from the input and compositor threads
+ */
+static void flusher_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        block_queue_run_all();
+        block_cache_tick(timer_get_ticks());
+        thread_sleep(BLOCK_CACHE_FLUSHER_PERIOD_MS);
+    }
+}
+
+void block_cache_start_flusher(void)
+{
+    thread_create("flusher", flusher_main, NULL, PRIO_LOW);
+}
+
+/*
+ * Select write-back or write-through
+ */
+void block_cache_set_write_back(bool enabled)
+{
+    mutex_lock(&cache_lock);
+    if (!enabled) {
+        cache_flush();
+    }
+    write_back = enabled;
+    mutex_unlock(&cache_lock);
 }
 
 /*
@@ -246,23 +961,27 @@ void block_cache_flush(void)
 void block_cache_print_stats(void)
 {
     console_printf("\n=== Block Cache Stats ===\n");
-    console_printf("  Entries: %d\n", CACHE_SIZE);
+    console_printf("  Entries: %d (%d KB), %s\n", (int)capacity,
+        (int)(((uint64_t)capacity * BLOCK_SIZE) / 1024),
+        write_back ? "write-back" : "write-through");
     console_printf("  Hits:    %d\n", (int)cache_hits);
     console_printf("  Misses:  %d\n", (int)cache_misses);
     console_printf("  Writes:  %d\n", (int)cache_writes);
-    console_printf("  Flushes: %d\n", (int)cache_flushes);
+    console_printf("  Flushes: %d (%d periodic)\n", (int)cache_flushes, (int)cache_periodic_flushes);
+    console_printf("  Evictions: %d\n", (int)cache_evictions);
+    console_printf("  Disk reads: %d commands\n", (int)disk_reads);
+    console_printf("  Read-ahead: %d blocks, %d used, %d wasted (window %d)\n",
+        (int)readahead_blocks, (int)readahead_hits, (int)readahead_wasted, (int)ra_window);
+    if (readahead_blocks > 0) {
+        console_printf("  Read-ahead hit rate: %d%%\n",
+            (int)((readahead_hits * 100) / readahead_blocks));
+    }
 
     if (cache_hits + cache_misses > 0) {
         int hit_rate = (cache_hits * 100) / (cache_hits + cache_misses);
         console_printf("  Hit rate: %d%%\n", hit_rate);
     }
 
-    /* Count valid/dirty entries */
-    int valid = 0, dirty = 0;
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].valid) valid++;
-        if (cache[i].dirty) dirty++;
-    }
-    console_printf("  Valid: %d, Dirty: %d\n", valid, dirty);
+    console_printf("  Valid: %d, Dirty: %d\n", (int)valid_count, (int)dirty_count);
     console_printf("\n");
 }
@@ -1,7 +1,7 @@
 /*
  * ojjyOS v3 Kernel - Block Cache
  *
- * Simple LRU cache for disk blocks.
+ * Hash-indexed LRU cache for disk blocks with write-back.
  */
 
 #ifndef _OJJY_BLOCK_CACHE_H
@@ -12,13 +12,26 @@
 /* Block size (matches sector size) */
 #define BLOCK_SIZE 512
 
+/* Dirty blocks are written back at least this often */
+#define BLOCK_CACHE_FLUSH_INTERVAL_MS   1000
+
+/* Flusher thread wakeup period (read-ahead reaping, queue progress) */
+#define BLOCK_CACHE_FLUSHER_PERIOD_MS   10
+
 /* Initialize block cache */
 void block_cache_init(void);
 
 /* Read a block (uses cache if available) */
 int block_cache_read(uint64_t block_num, void *buffer);
 
-/* Write a block (write-through to disk) */
+/*
+ * Read 'count' consecutive blocks. Each run of uncached blocks is fetched
+ * with a single multi-sector command and inserted into the cache.
+ * buffer may be NULL to prefetch only.
+ */
+int block_cache_read_range(uint64_t start, uint32_t count, void *buffer);
+
+/* Write a block (cached dirty in write-back mode, else written through) */
 int block_cache_write(uint64_t block_num, const void *buffer);
 
 /* Invalidate a cached block */
@@ -27,6 +40,15 @@ void block_cache_invalidate(uint64_t block_num);
 /* Flush all dirty blocks to disk */
 void block_cache_flush(void);
 
+/* Periodic flusher; call regularly with the current tick count */
+void block_cache_tick(uint64_t now_ms);
+
+/* Run block_cache_tick() and the block queues from a low-priority thread */
+void block_cache_start_flusher(void);
+
+/* Switch between write-back (default) and write-through */
+void block_cache_set_write_back(bool enabled);
+
 /* Print cache statistics */
 void block_cache_print_stats(void);
 
@@ -0,0 +1,550 @@
+/*
+ * ojjyOS v3 Kernel - Block Request Queue Implementation
+ *
+ * Each queue keeps a singly linked list of pending requests sorted by
+ * LBA. Dispatch picks the first request at or past the head position
+ * (C-LOOK), then chains the following requests while they are
+ * contiguous on disk, in the same direction, and fit in one command.
+ * A chain whose buffers are not contiguous in memory goes through a
+ * merge buffer; if none is free the first request goes out alone.
+ *
+ * Driver completions may arrive in IRQ context, so they only mark the
+ * dispatch slot finished. Copy-out, statistics and user callbacks
+ * happen later in block_queue_run(). Callbacks may submit or wait on
+ * further requests; a slot is released before its callbacks run.
+ *
+ * Each queue has a lock covering the pending list, the slots and the
+ * driver's poll op; any CPU may run the queue. It is dropped while
+ * callbacks run, and a request's 'done' flag is set before its
+ * callback, so a waiter never depends on the CPU that reaps it. It is
+ * also dropped around the driver's submit op, which may carry out the
+ * whole transfer (ATA) and block the calling thread until the IRQ: the
+ * slot is already busy, so other CPUs leave it alone, and drivers that
+ * queue more than one command serialize their own submits.
+ */
+
+#include "block_queue.h"
+#include "../serial.h"
+#include "../string.h"
+#include "../console.h"
+#include "../timer.h"
+#include "../memory.h"
+#include "../heap.h"
+#include "../spinlock.h"
+#include "../smp.h"
+
+#define SECTOR_SIZE             512
+
+/* Merge buffers per queue, each holding one full command */
+#define BLOCK_QUEUE_MERGE_BUFFERS   4
+#define BLOCK_QUEUE_MERGE_ORDER     5       /* 128KB = 256 sectors */
+
+/* One device command: a chain of one or more merged requests */
+typedef struct {
+    bool     busy;
+    volatile bool complete;     /* Set by the driver's done callback */
+    volatile int status;
+    bool     write;
+    uint64_t lba;
+    uint32_t count;
+    int      merge_buf;         /* Merge buffer index, or -1 if direct */
+    BlockRequest *chain;        /* In LBA order, linked by next */
+} BlockDispatch;
+
+struct BlockQueue {
+    Spinlock lock;
+    Driver  *drv;
+    uint32_t depth;
+    uint32_t in_flight;
+    BlockRequest *pending;      /* Sorted by LBA */
+    uint32_t pending_count;
+    uint64_t head_lba;          /* Elevator position: end of last dispatch */
+    BlockDispatch slots[BLOCK_QUEUE_MAX_DEPTH];
+    uint8_t *merge[BLOCK_QUEUE_MERGE_BUFFERS];
+    bool     merge_busy[BLOCK_QUEUE_MERGE_BUFFERS];
+
+    /* Statistics */
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t commands;          /* Device commands issued */
+    uint64_t merged;            /* Requests that rode along in another's command */
+    uint64_t bounced;           /* Merged commands that needed a merge buffer */
+    uint64_t wraps;             /* Elevator sweeps restarted from the lowest LBA */
+    uint64_t busy_rejects;      /* Device refused a command (queue full) */
+    uint64_t errors;
+    uint32_t max_pending;
+    uint32_t max_in_flight;
+    uint64_t latency_total;     /* Cycles, submit to completion */
+    uint64_t hist[BLOCK_QUEUE_HIST_BUCKETS];
+};
+
+static BlockQueue *queues[BLOCK_QUEUE_MAX_QUEUES];
+static int queue_count = 0;
+static Spinlock queues_lock = SPINLOCK_INIT;   /* Queue table */
+
+/*
+ * Driver completion: may run in IRQ context, so only latch the result
+ */
+static void dispatch_done(void *ctx, int status)
+{
+    BlockDispatch *d = (BlockDispatch *)ctx;
+    d->status = status;
+    d->complete = true;
+}
+
+/*
+ * Histogram bucket for a latency in cycles
+ */
+static int latency_bucket(uint64_t cycles)
+{
+    if (cycles >> BLOCK_QUEUE_HIST_SHIFT == 0) {
+        return 0;
+    }
+    int bucket = 63 - __builtin_clzll(cycles) - BLOCK_QUEUE_HIST_SHIFT;
+    return MIN(bucket, BLOCK_QUEUE_HIST_BUCKETS - 1);
+}
+
+/*
+ * Insert into the pending list, keeping LBA order (FIFO among equals)
+ */
+static void pending_insert(BlockQueue *q, BlockRequest *req)
+{
+    BlockRequest **link = &q->pending;
+    while (*link && (*link)->lba <= req->lba) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+    q->pending_count++;
+}
+
+static int merge_buf_get(BlockQueue *q)
+{
+    for (int i = 0; i < BLOCK_QUEUE_MERGE_BUFFERS; i++) {
+        if (q->merge[i] && !q->merge_busy[i]) {
+            q->merge_busy[i] = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+BlockQueue *block_queue_get(Driver *drv)
+{
+    if (!drv || !drv->ops || !drv->ops->submit) {
+        return NULL;
+    }
+
+    spin_lock(&queues_lock);
+    for (int i = 0; i < queue_count; i++) {
+        if (queues[i]->drv == drv) {
+            spin_unlock(&queues_lock);
+            return queues[i];
+        }
+    }
+
+    if (queue_count >= BLOCK_QUEUE_MAX_QUEUES) {
+        spin_unlock(&queues_lock);
+        return NULL;
+    }
+
+    BlockQueue *q = (BlockQueue *)kzalloc(sizeof(BlockQueue));
+    if (!q) {
+        spin_unlock(&queues_lock);
+        return NULL;
+    }
+
+    uint32_t depth = 1;
+    if (drv->ops->ioctl) {
+        drv->ops->ioctl(drv, DRIVER_IOCTL_BLOCK_QUEUE_DEPTH, &depth);
+    }
+    q->drv = drv;
+    q->depth = MAX(1U, MIN(depth, (uint32_t)BLOCK_QUEUE_MAX_DEPTH));
+
+    /* Merged commands may go straight to DMA, so keep them below 4GB */
+    for (int i = 0; i < BLOCK_QUEUE_MERGE_BUFFERS; i++) {
+        q->merge[i] = (uint8_t *)pmm_alloc_pages(BLOCK_QUEUE_MERGE_ORDER, PMM_DMA32);
+    }
+
+    queues[queue_count++] = q;
+    spin_unlock(&queues_lock);
+
+    serial_printf("[BLKQ] Queue for %s: depth %d\n", drv->name, (uint64_t)q->depth);
+    return q;
+}
+
+int block_queue_submit(BlockQueue *q, BlockRequest *req)
+{
+    if (!q || !req || !req->buffer || req->count == 0 ||
+        req->count > BLOCK_QUEUE_MAX_SECTORS) {
+        return -1;
+    }
+
+    req->status = 0;
+    req->done = false;
+    req->submit_tsc = rdtsc();
+
+    spin_lock(&q->lock);
+    pending_insert(q, req);
+    q->submitted++;
+    q->max_pending = MAX(q->max_pending, q->pending_count);
+    spin_unlock(&q->lock);
+    return 0;
+}
+
+/*
+ * Take the next chain off the pending list into slot d (C-LOOK order)
+ */
+static void build_chain(BlockQueue *q, BlockDispatch *d)
+{
+    BlockRequest **link = &q->pending;
+    while (*link && (*link)->lba < q->head_lba) {
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        link = &q->pending;
+        q->wraps++;
+    }
+
+    BlockRequest *first = *link;
+    BlockRequest *last = first;
+    uint32_t count = first->count;
+    bool contiguous = true;
+
+    /* Extend while the next request continues on disk */
+    while (last->next) {
+        BlockRequest *next = last->next;
+        if (next->write != first->write ||
+            next->lba != last->lba + last->count ||
+            count + next->count > BLOCK_QUEUE_MAX_SECTORS) {
+            break;
+        }
+        if ((uint8_t *)next->buffer !=
+            (uint8_t *)last->buffer + (uint64_t)last->count * SECTOR_SIZE) {
+            contiguous = false;
+        }
+        count += next->count;
+        last = next;
+    }
+
+    d->merge_buf = -1;
+    if (last != first && !contiguous) {
+        d->merge_buf = merge_buf_get(q);
+        if (d->merge_buf < 0) {
+            last = first;
+            count = first->count;
+        }
+    }
+
+    /* Unlink first..last */
+    *link = last->next;
+    last->next = NULL;
+
+    d->chain = first;
+    d->lba = first->lba;
+    d->count = count;
+    d->write = first->write;
+
+    for (BlockRequest *r = first; r; r = r->next) {
+        q->pending_count--;
+        if (r != first) {
+            q->merged++;
+        }
+    }
+}
+
+/*
+ * Put a refused chain back on the pending list
+ */
+static void unbuild_chain(BlockQueue *q, BlockDispatch *d)
+{
+    BlockRequest *r = d->chain;
+    while (r) {
+        BlockRequest *next = r->next;
+        if (r != d->chain) {
+            q->merged--;
+        }
+        pending_insert(q, r);
+        r = next;
+    }
+    if (d->merge_buf >= 0) {
+        q->merge_busy[d->merge_buf] = false;
+    }
+    d->chain = NULL;
+}
+
+/*
+ * Issue pending requests until the device queue is full.
+ * Returns true if anything was dispatched.
+ */
+static bool dispatch_pending(BlockQueue *q)
+{
+    bool progress = false;
+
+    while (q->pending && q->in_flight < q->depth) {
+        BlockDispatch *d = NULL;
+        for (uint32_t i = 0; i < q->depth; i++) {
+            if (!q->slots[i].busy) {
+                d = &q->slots[i];
+                break;
+            }
+        }
+        if (!d) break;
+
+        build_chain(q, d);
+
+        void *buf = d->chain->buffer;
+        if (d->merge_buf >= 0) {
+            buf = q->merge[d->merge_buf];
+            if (d->write) {
+                uint8_t *dst = (uint8_t *)buf;
+                for (BlockRequest *r = d->chain; r; r = r->next) {
+                    memcpy(dst, r->buffer, (size_t)r->count * SECTOR_SIZE);
+                    dst += (size_t)r->count * SECTOR_SIZE;
+                }
+            }
+            q->bounced++;
+        }
+
+        d->busy = true;
+        d->complete = false;
+        d->status = 0;
+        q->in_flight++;
+        q->max_in_flight = MAX(q->max_in_flight, q->in_flight);
+
+        /* Another CPU may reap the slot as soon as it completes */
+        uint64_t lba = d->lba;
+        uint32_t count = d->count;
+
+        spin_unlock(&q->lock);
+        int ret = q->drv->ops->submit(q->drv, lba, count, buf, d->write,
+                                      dispatch_done, d);
+        spin_lock(&q->lock);
+
+        if (ret == DRIVER_SUBMIT_BUSY) {
+            /* Device is full after all; retry once something completes */
+            q->busy_rejects++;
+            q->in_flight--;
+            d->busy = false;
+            if (d->merge_buf >= 0) q->bounced--;
+            unbuild_chain(q, d);
+            break;
+        }
+
+        q->commands++;
+        q->head_lba = lba + count;
+        progress = true;
+
+        if (ret < 0) {
+            d->status = ret;
+            d->complete = true;
+        }
+    }
+
+    return progress;
+}
+
+/*
+ * Retire a finished command: copy out, free the slot, record status.
+ * Returns the chain, whose requests still need completing.
+ */
+static BlockRequest *finish_dispatch(BlockQueue *q, BlockDispatch *d)
+{
+    BlockRequest *chain = d->chain;
+    int status = d->status;
+    uint64_t now = rdtsc();
+
+    if (d->merge_buf >= 0) {
+        if (!d->write && status == 0) {
+            uint8_t *src = q->merge[d->merge_buf];
+            for (BlockRequest *r = chain; r; r = r->next) {
+                memcpy(r->buffer, src, (size_t)r->count * SECTOR_SIZE);
+                src += (size_t)r->count * SECTOR_SIZE;
+            }
+        }
+        q->merge_busy[d->merge_buf] = false;
+    }
+
+    d->chain = NULL;
+    d->busy = false;
+    q->in_flight--;
+
+    if (status != 0) {
+        q->errors++;
+        serial_printf("[BLKQ] %s: %s of %d sectors at LBA %d failed (%d)\n",
+            q->drv->name, d->write ? "write" : "read",
+            (uint64_t)d->count, d->lba, (uint64_t)(int64_t)status);
+    }
+
+    for (BlockRequest *r = chain; r; r = r->next) {
+        uint64_t cycles = now - r->submit_tsc;
+
+        q->completed++;
+        q->latency_total += cycles;
+        q->hist[latency_bucket(cycles)]++;
+        r->status = status;
+    }
+    return chain;
+}
+
+/*
+ * Mark a retired chain done and run its callbacks (queue lock not held)
+ */
+static void complete_chain(BlockRequest *r)
+{
+    while (r) {
+        BlockRequest *next = r->next;
+        BlockCallback callback = r->callback;
+
+        r->next = NULL;
+        __atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+        if (callback) {
+            callback(r);
+        }
+        r = next;
+    }
+}
+
+void block_queue_run(BlockQueue *q)
+{
+    if (!q) return;
+
+    spin_lock(&q->lock);
+
+    /* Let polled devices notice finished commands */
+    if (q->drv->ops->poll && q->in_flight > 0) {
+        q->drv->ops->poll(q->drv);
+    }
+
+    bool progress;
+    do {
+        progress = false;
+        for (uint32_t i = 0; i < q->depth; i++) {
+            BlockDispatch *d = &q->slots[i];
+            if (d->busy && d->complete) {
+                BlockRequest *chain = finish_dispatch(q, d);
+                spin_unlock(&q->lock);
+                complete_chain(chain);
+                spin_lock(&q->lock);
+                progress = true;
+            }
+        }
+        if (dispatch_pending(q)) {
+            progress = true;
+        }
+    } while (progress);
+
+    spin_unlock(&q->lock);
+}
+
+void block_queue_run_all(void)
+{
+    int count = __atomic_load_n(&queue_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        block_queue_run(queues[i]);
+    }
+}
+
+int block_queue_wait(BlockQueue *q, BlockRequest *req)
+{
+    while (!req->done) {
+        block_queue_run(q);
+        if (req->done) break;
+
+        /* Sleep until the completion IRQ; otherwise keep polling */
+        if (interrupts_enabled()) {
+            cpu_wait();
+        }
+    }
+    return req->status;
+}
+
+int block_queue_rw(BlockQueue *q, uint64_t lba, uint32_t count, void *buffer, bool write)
+{
+    BlockRequest reqs[8];
+    uint8_t *buf = (uint8_t *)buffer;
+    int ret = 0;
+
+    while (count > 0 && ret == 0) {
+        int n = 0;
+        while (count > 0 && n < 8) {
+            uint32_t chunk = MIN(count, (uint32_t)BLOCK_QUEUE_MAX_SECTORS);
+            memset(&reqs[n], 0, sizeof(BlockRequest));
+            reqs[n].lba = lba;
+            reqs[n].count = chunk;
+            reqs[n].write = write;
+            reqs[n].buffer = buf;
+            if (block_queue_submit(q, &reqs[n]) != 0) {
+                count = 0;
+                ret = -1;
+                break;
+            }
+            n++;
+            lba += chunk;
+            buf += (uint64_t)chunk * SECTOR_SIZE;
+            count -= chunk;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int status = block_queue_wait(q, &reqs[i]);
+            if (status != 0 && ret == 0) {
+                ret = status;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Print the latency histogram bucket bounds in microseconds when the
+ * TSC rate is known, else in cycles
+ */
+static void print_histogram(BlockQueue *q)
+{
+    bool calibrated = timer_tsc_hz() != 0;
+
+    if (q->completed > 0) {
+        uint64_t avg = q->latency_total / q->completed;
+        if (calibrated) {
+            console_printf("  Avg latency: %d us\n", (int)(timer_cycles_to_ns(avg) / NS_PER_US));
+        } else {
+            console_printf("  Avg latency: %d cycles\n", (int)avg);
+        }
+    }
+
+    for (int i = 0; i < BLOCK_QUEUE_HIST_BUCKETS; i++) {
+        if (q->hist[i] == 0) continue;
+        uint64_t upper = 1ULL << (i + BLOCK_QUEUE_HIST_SHIFT + 1);
+        if (calibrated) {
+            console_printf("    < %d us: %d\n", (int)(timer_cycles_to_ns(upper) / NS_PER_US),
+                (int)q->hist[i]);
+        } else {
+            console_printf("    < %d cycles: %d\n", (int)upper, (int)q->hist[i]);
+        }
+    }
+}
+
+void block_queue_print_stats(void)
+{
+    console_printf("\n=== Block Queues ===\n");
+    if (queue_count == 0) {
+        console_printf("  (none)\n");
+        return;
+    }
+
+    for (int i = 0; i < queue_count; i++) {
+        BlockQueue *q = queues[i];
+        console_printf("  %s: depth %d, %d in flight, %d pending\n", q->drv->name,
+            (int)q->depth, (int)q->in_flight, (int)q->pending_count);
+        console_printf("  Requests: %d submitted, %d completed, %d errors\n",
+            (int)q->submitted, (int)q->completed, (int)q->errors);
+        console_printf("  Commands: %d (%d requests merged, %d via merge buffer)\n",
+            (int)q->commands, (int)q->merged, (int)q->bounced);
+        console_printf("  Elevator wraps: %d, device busy: %d\n",
+            (int)q->wraps, (int)q->busy_rejects);
+        console_printf("  Peak: %d pending, %d in flight\n",
+            (int)q->max_pending, (int)q->max_in_flight);
+        print_histogram(q);
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * ojjyOS v3 Kernel - Block Request Queue
+ *
+ * Asynchronous request queue in front of a block driver. Pending
+ * requests are kept sorted by LBA and dispatched in C-LOOK order
+ * (ascending from the last position, then wrap to the lowest LBA).
+ * Adjacent requests in the same direction are merged into a single
+ * device command, and up to the device's queue depth run at once.
+ *
+ * Completion callbacks always run in process context, from
+ * block_queue_run() / block_queue_wait(), never from an IRQ handler.
+ */
+
+#ifndef _OJJY_BLOCK_QUEUE_H
+#define _OJJY_BLOCK_QUEUE_H
+
+#include "../types.h"
+#include "driver.h"
+
+/* Queues (one per block driver) */
+#define BLOCK_QUEUE_MAX_QUEUES      4
+
+/* Device commands in flight per queue */
+#define BLOCK_QUEUE_MAX_DEPTH       32
+
+/* Largest request and largest merged command (128KB) */
+#define BLOCK_QUEUE_MAX_SECTORS     256
+
+/* Latency histogram: bucket i counts requests taking ~2^(i+10) cycles */
+#define BLOCK_QUEUE_HIST_BUCKETS    24
+#define BLOCK_QUEUE_HIST_SHIFT      10
+
+typedef struct BlockRequest BlockRequest;
+
+/* Completion callback; req->status is 0 or a negative error */
+typedef void (*BlockCallback)(BlockRequest *req);
+
+/*
+ * A block request. The submitter owns the memory and must keep it
+ * alive until 'done' is set (or the callback has run).
+ */
+struct BlockRequest {
+    uint64_t lba;
+    uint32_t count;             /* Sectors, 1..BLOCK_QUEUE_MAX_SECTORS */
+    bool     write;
+    void    *buffer;
+    BlockCallback callback;     /* Optional */
+    void    *ctx;               /* For the callback */
+
+    /* Set by the queue */
+    int      status;
+    volatile bool done;
+    uint64_t submit_tsc;
+    BlockRequest *next;
+};
+
+/* Opaque per-driver queue */
+typedef struct BlockQueue BlockQueue;
+
+/*
+ * Queue for a block driver, created on first use. Returns NULL if the
+ * driver has no submit op or the queue table is full.
+ */
+BlockQueue *block_queue_get(Driver *drv);
+
+/* Add a request to the queue. Returns 0, or -1 if the request is invalid */
+int block_queue_submit(BlockQueue *q, BlockRequest *req);
+
+/* Reap finished commands, run callbacks, dispatch pending requests */
+void block_queue_run(BlockQueue *q);
+
+/* block_queue_run() on every queue (called from the main loop) */
+void block_queue_run_all(void);
+
+/* Run the queue until req completes; returns req->status */
+int block_queue_wait(BlockQueue *q, BlockRequest *req);
+
+/* Blocking transfer of any length, split into queued requests */
+int block_queue_rw(BlockQueue *q, uint64_t lba, uint32_t count, void *buffer, bool write);
+
+/* Print per-queue dispatch and latency statistics */
+void block_queue_print_stats(void);
+
+#endif /* _OJJY_BLOCK_QUEUE_H */
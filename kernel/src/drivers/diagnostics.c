@@ -8,13 +8,18 @@
 #include "driver.h"
 #include "input.h"
 #include "ata.h"
+#include "ahci.h"
 #include "rtc.h"
 #include "block_cache.h"
+#include "block_queue.h"
 #include "../console.h"
 #include "../framebuffer.h"
 #include "../timer.h"
 #include "../memory.h"
 #include "../serial.h"
+#include "../heap.h"
+#include "../smp.h"
+#include "../ui/compositor.h"
 
 /*
  * Show full diagnostics screen
@@ -29,10 +34,24 @@ void diagnostics_show(void)
     /* System info */
     console_printf("System:\n");
     console_printf("  Display: %dx%d\n", fb_get_width(), fb_get_height());
+    console_printf("  CPUs:    %d online\n", (int)smp_cpu_count());
     console_printf("  Memory:  %d MB total, %d MB free\n",
         (int)(pmm_get_total_memory() / (1024 * 1024)),
         (int)(pmm_get_free_memory() / (1024 * 1024)));
+    PmmZeroPoolStats zp;
+    pmm_get_zero_pool_stats(&zp);
+    console_printf("  Zero pool: %d/%d pages, %d hits, %d misses\n",
+        (int)zp.level, (int)zp.capacity, (int)zp.hits, (int)zp.misses);
     console_printf("  Uptime:  %d ms\n", (int)timer_get_ticks());
+    uint32_t tx_peak;
+    uint64_t tx_stalls;
+    serial_get_tx_stats(&tx_peak, &tx_stalls);
+    console_printf("  Serial TX: %d bytes queued, peak %d, %d full-ring stalls\n",
+        (int)serial_tx_pending(), (int)tx_peak, (int)tx_stalls);
+    uint64_t glyph_hits, glyph_misses;
+    fb_get_glyph_cache_stats(&glyph_hits, &glyph_misses);
+    console_printf("  Glyph cache: %ld hits, %ld misses\n",
+        (int64_t)glyph_hits, (int64_t)glyph_misses);
     console_printf("\n");
 
     /* RTC time */
@@ -43,11 +62,19 @@ void diagnostics_show(void)
     /* Driver status */
     driver_print_all();
 
-    /* ATA devices */
+    /* Disks */
     ata_print_devices();
+    ahci_print_devices();
 
     /* Block cache stats */
     block_cache_print_stats();
+    block_queue_print_stats();
+
+    /* Kernel heap / slab cache usage */
+    heap_print_stats();
+
+    /* Compositor damage stats */
+    compositor_print_stats();
 
     /* Input status */
     int32_t mx, my;
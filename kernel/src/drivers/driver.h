@@ -47,6 +47,9 @@ typedef enum {
 /* Forward declaration */
 struct Driver;
 
+/* Completion for DriverOps.submit: status is 0 or a negative error */
+typedef void (*DriverDoneFn)(void *ctx, int status);
+
 /*
  * Driver operations - all callbacks are optional (NULL = not supported)
  */
@@ -93,6 +96,17 @@ typedef struct {
      */
     ssize_t (*write)(struct Driver *drv, const void *buf, size_t count, uint64_t offset);
 
+    /*
+     * submit - Start an asynchronous block transfer (lba/count in sectors)
+     * done(ctx, status) runs on completion, possibly from IRQ context or
+     * before submit returns. May be called from several CPUs at once
+     * when the queue depth is above 1. Returns 0 if started,
+     * DRIVER_SUBMIT_BUSY if the device queue is full, other negative
+     * values for bad requests
+     */
+    int (*submit)(struct Driver *drv, uint64_t lba, uint32_t count, void *buf,
+                  bool write, DriverDoneFn done, void *ctx);
+
     /*
      * ioctl - Device-specific control operations
      * Returns 0 on success, negative error code on failure
@@ -115,6 +129,16 @@ typedef struct {
 #define DRIVER_FLAG_DMA         (1 << 2)    /* Uses DMA */
 #define DRIVER_FLAG_EXCLUSIVE   (1 << 3)    /* Exclusive hardware access */
 
+/*
+ * Block device ioctls (DRIVER_TYPE_BLOCK)
+ */
+#define DRIVER_IOCTL_BLOCK_SECTORS  0x0100      /* arg: uint64_t *, device size */
+#define DRIVER_IOCTL_BLOCK_QUEUE_DEPTH 0x0101   /* arg: uint32_t *, commands in flight */
+#define DRIVER_IOCTL_BLOCK_FLUSH    0x0102      /* arg: unused, write cache to media */
+
+/* DriverOps.submit result when the device can't take another command */
+#define DRIVER_SUBMIT_BUSY          (-1)
+
 /*
  * Error thresholds
  */
@@ -1,14 +1,19 @@
 /*
  * ojjyOS v3 Kernel - Input Subsystem Implementation
  *
- * Ring buffer for input events from all input devices.
- * Single-producer/single-consumer safe for IRQ handler use.
+ * Ring buffer for input events from all input devices. Producers are
+ * IRQ handlers; consumers may run on any CPU, so both ends take
+ * queue_lock with interrupts disabled.
  */
 
 #include "input.h"
 #include "../serial.h"
 #include "../timer.h"
 #include "../string.h"
+#include "../trace.h"
+#include "../spinlock.h"
+#include "../smp.h"
+#include "../sched.h"
 
 /* Queue mask for power-of-2 size */
 #define INPUT_QUEUE_MASK (INPUT_QUEUE_SIZE - 1)
@@ -17,6 +22,8 @@
 static InputEvent event_queue[INPUT_QUEUE_SIZE];
 static volatile uint32_t queue_head = 0;  /* Write position (producer) */
 static volatile uint32_t queue_tail = 0;  /* Read position (consumer) */
+static Spinlock queue_lock = SPINLOCK_INIT;
+static WaitQueue event_waiters = WAIT_QUEUE_INIT;  /* Threads in input_wait() */
 
 /* Current mouse state */
 static int32_t mouse_x = 0;
@@ -64,12 +71,15 @@ void input_post_event(const InputEvent *event)
 {
     if (!event) return;
 
+    uint64_t irq = spin_lock_irqsave(&queue_lock);
+
     /* Check for queue overflow */
     uint32_t next_head = (queue_head + 1) & INPUT_QUEUE_MASK;
     if (next_head == queue_tail) {
         /* Queue full - drop event */
         dropped_events++;
-        serial_printf("[INPUT] WARNING: Queue overflow, dropped event\n");
+        spin_unlock_irqrestore(&queue_lock, irq);
+        trace(TRACE_INPUT_DROP, event->type, 0, 0);
         return;
     }
 
@@ -78,6 +88,9 @@ void input_post_event(const InputEvent *event)
     event_queue[queue_head].timestamp = timer_get_ticks();
     queue_head = next_head;
     total_events++;
+
+    spin_unlock_irqrestore(&queue_lock, irq);
+    wait_queue_wake_all(&event_waiters);
 }
 
 /*
@@ -180,7 +193,9 @@ bool input_has_event(void)
  */
 bool input_poll_event(InputEvent *event)
 {
+    uint64_t irq = spin_lock_irqsave(&queue_lock);
     if (!input_has_event()) {
+        spin_unlock_irqrestore(&queue_lock, irq);
         return false;
     }
 
@@ -188,6 +203,7 @@ bool input_poll_event(InputEvent *event)
         *event = event_queue[queue_tail];
     }
     queue_tail = (queue_tail + 1) & INPUT_QUEUE_MASK;
+    spin_unlock_irqrestore(&queue_lock, irq);
     return true;
 }
 
@@ -198,24 +214,42 @@ bool input_poll_event(InputEvent *event)
 bool input_wait_event(InputEvent *event)
 {
     while (!input_has_event()) {
-        __asm__ volatile("hlt");
+        cpu_wait();
     }
 
     return input_poll_event(event);
 }
 
+/*
+ * Block until an event is queued or timeout_ms passes.
+ * Interrupts stay off from the check until the thread is queued, so an
+ * event posted in between still wakes it.
+ */
+bool input_wait(uint64_t timeout_ms)
+{
+    uint64_t irq = irq_save();
+    if (!input_has_event()) {
+        wait_queue_sleep(&event_waiters, timeout_ms);
+    }
+    irq_restore(irq);
+    return input_has_event();
+}
+
 /*
  * Peek at next event without removing
  */
 bool input_peek_event(InputEvent *event)
 {
+    uint64_t irq = spin_lock_irqsave(&queue_lock);
     if (!input_has_event()) {
+        spin_unlock_irqrestore(&queue_lock, irq);
         return false;
     }
 
     if (event) {
         *event = event_queue[queue_tail];
     }
+    spin_unlock_irqrestore(&queue_lock, irq);
     return true;
 }
 
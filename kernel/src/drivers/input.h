@@ -5,7 +5,7 @@
  * This queue feeds the compositor for UI event handling.
  *
  * Architecture:
- *   - Ring buffer for lock-free single-producer/single-consumer
+ *   - Ring buffer guarded by an IRQ-safe spinlock (any CPU may consume)
  *   - Events have timestamps for ordering
  *   - Mouse position tracked internally with bounds clamping
  *   - Modifier key state tracked globally
@@ -152,6 +152,7 @@ void input_post_mouse_scroll(int32_t dx, int32_t dy);
 bool input_has_event(void);
 bool input_poll_event(InputEvent *event);   /* Non-blocking */
 bool input_wait_event(InputEvent *event);   /* Blocking */
+bool input_wait(uint64_t timeout_ms);       /* Block until an event is queued */
 bool input_peek_event(InputEvent *event);   /* Look without removing */
 
 /*
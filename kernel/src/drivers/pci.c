@@ -0,0 +1,137 @@
+/*
+ * ojjyOS v3 Kernel - PCI Configuration Space Implementation
+ *
+ * Uses configuration mechanism #1, which every chipset we target
+ * (PIIX3/4, ICH9, QEMU q35) supports.
+ */
+
+#include "pci.h"
+#include "../serial.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/*
+ * Select a config dword
+ */
+static inline void pci_select(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    uint32_t address = (1U << 31) |
+                       ((uint32_t)bus << 16) |
+                       ((uint32_t)(slot & 0x1F) << 11) |
+                       ((uint32_t)(func & 0x07) << 8) |
+                       (offset & 0xFC);
+    outl(PCI_CONFIG_ADDRESS, address);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    pci_select(bus, slot, func, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    uint32_t value = pci_config_read32(bus, slot, func, offset);
+    return (uint16_t)(value >> ((offset & 2) * 8));
+}
+
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    uint32_t value = pci_config_read32(bus, slot, func, offset);
+    return (uint8_t)(value >> ((offset & 3) * 8));
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value)
+{
+    pci_select(bus, slot, func, offset);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value)
+{
+    /* Read-modify-write the containing dword */
+    uint32_t dword = pci_config_read32(bus, slot, func, offset);
+    uint32_t shift = (offset & 2) * 8;
+    dword = (dword & ~(0xFFFFU << shift)) | ((uint32_t)value << shift);
+    pci_config_write32(bus, slot, func, offset, dword);
+}
+
+/*
+ * Fill in a PciDevice from config space
+ */
+static void pci_read_device(uint8_t bus, uint8_t slot, uint8_t func, PciDevice *dev)
+{
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor_id = pci_config_read16(bus, slot, func, PCI_VENDOR_ID);
+    dev->device_id = pci_config_read16(bus, slot, func, PCI_DEVICE_ID);
+    dev->class_code = pci_config_read8(bus, slot, func, PCI_CLASS);
+    dev->subclass = pci_config_read8(bus, slot, func, PCI_SUBCLASS);
+    dev->prog_if = pci_config_read8(bus, slot, func, PCI_PROG_IF);
+    dev->irq_line = pci_config_read8(bus, slot, func, PCI_INTERRUPT_LINE);
+}
+
+/*
+ * Brute-force scan of every bus/slot/function
+ */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *out)
+{
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            if (pci_config_read16(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) {
+                continue;
+            }
+
+            /* Only multi-function devices have functions 1-7 */
+            uint8_t header = pci_config_read8(bus, slot, 0, PCI_HEADER_TYPE);
+            int funcs = (header & 0x80) ? 8 : 1;
+
+            for (int func = 0; func < funcs; func++) {
+                if (pci_config_read16(bus, slot, func, PCI_VENDOR_ID) == 0xFFFF) {
+                    continue;
+                }
+                if (pci_config_read8(bus, slot, func, PCI_CLASS) != class_code ||
+                    pci_config_read8(bus, slot, func, PCI_SUBCLASS) != subclass) {
+                    continue;
+                }
+
+                pci_read_device(bus, slot, func, out);
+                serial_printf("[PCI] %x:%x.%d %x:%x class %x/%x\n",
+                    (uint64_t)bus, (uint64_t)slot, (uint64_t)func,
+                    (uint64_t)out->vendor_id, (uint64_t)out->device_id,
+                    (uint64_t)class_code, (uint64_t)subclass);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Decode a BAR (64-bit memory BARs take the following slot too)
+ */
+uint64_t pci_read_bar(const PciDevice *dev, int bar)
+{
+    uint8_t offset = PCI_BAR0 + bar * 4;
+    uint32_t low = pci_config_read32(dev->bus, dev->slot, dev->func, offset);
+
+    if (low & 1) {
+        return low & ~0x3U;
+    }
+
+    uint64_t addr = low & ~0xFU;
+    if (((low >> 1) & 3) == 2 && bar < 5) {
+        uint32_t high = pci_config_read32(dev->bus, dev->slot, dev->func, offset + 4);
+        addr |= (uint64_t)high << 32;
+    }
+    return addr;
+}
+
+void pci_enable(const PciDevice *dev, uint16_t command_bits)
+{
+    uint16_t cmd = pci_config_read16(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    pci_config_write16(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd | command_bits);
+}
@@ -0,0 +1,68 @@
+/*
+ * ojjyOS v3 Kernel - PCI Configuration Space
+ *
+ * Legacy port-I/O (0xCF8/0xCFC) config access and a simple
+ * bus scan for finding controllers by class code.
+ */
+
+#ifndef _OJJY_PCI_H
+#define _OJJY_PCI_H
+
+#include "../types.h"
+
+/* Config space offsets */
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS           0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_INTERRUPT_LINE  0x3C
+
+/* Command register bits */
+#define PCI_CMD_IO          (1 << 0)
+#define PCI_CMD_MEMORY      (1 << 1)
+#define PCI_CMD_BUS_MASTER  (1 << 2)
+#define PCI_CMD_INTX_OFF    (1 << 10)
+
+/* Mass storage class and subclasses */
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_SUBCLASS_SATA   0x06
+
+/* A discovered PCI function */
+typedef struct {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t  class_code;
+    uint8_t  subclass;
+    uint8_t  prog_if;
+    uint8_t  irq_line;          /* Legacy PIC line (0xFF = none) */
+} PciDevice;
+
+/* Raw config space access (offset must be naturally aligned) */
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+uint8_t  pci_config_read8(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value);
+
+/* Find the first function with the given class/subclass (false if none) */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice *out);
+
+/*
+ * Base address of a BAR with the type bits masked off
+ * (I/O BARs yield a port number, memory BARs a physical address).
+ */
+uint64_t pci_read_bar(const PciDevice *dev, int bar);
+
+/* Set bits in the command register (e.g. PCI_CMD_BUS_MASTER) */
+void pci_enable(const PciDevice *dev, uint16_t command_bits);
+
+#endif /* _OJJY_PCI_H */
@@ -10,6 +10,7 @@
 #include "input.h"
 #include "../serial.h"
 #include "../idt.h"
+#include "../trace.h"
 #include "../types.h"
 
 /* PS/2 ports */
@@ -255,14 +256,8 @@ static bool ps2_kbd_handle_irq(Driver *drv, uint8_t irq)
     InputEventType type = released ? INPUT_EVENT_KEY_RELEASE : INPUT_EVENT_KEY_PRESS;
     input_post_key_event(type, scancode, keycode, ascii);
 
-    /* Debug output for key press */
     if (!released) {
-        if (ascii >= 32 && ascii < 127) {
-            serial_printf("[PS2_KBD] Key: '%c' (scan=0x%x, key=%d)\n",
-                         ascii, scancode, keycode);
-        } else {
-            serial_printf("[PS2_KBD] Key: scan=0x%x, key=%d\n", scancode, keycode);
-        }
+        trace(TRACE_INPUT_KEY, scancode, keycode, (uint8_t)ascii);
     }
 
     return true;
@@ -10,6 +10,7 @@
 #include "input.h"
 #include "../serial.h"
 #include "../idt.h"
+#include "../trace.h"
 #include "../types.h"
 
 /* PS/2 controller ports */
@@ -313,11 +314,11 @@ static void mouse_process_packet(void)
         if (is_pressed && !was_pressed) {
             /* Button pressed */
             input_post_mouse_button(INPUT_EVENT_MOUSE_BUTTON_DOWN, (MouseButton)i);
-            serial_printf("[PS2_MOUSE] Button %d down\n", i);
+            trace(TRACE_INPUT_BUTTON, i, 1, 0);
         } else if (!is_pressed && was_pressed) {
             /* Button released */
             input_post_mouse_button(INPUT_EVENT_MOUSE_BUTTON_UP, (MouseButton)i);
-            serial_printf("[PS2_MOUSE] Button %d up\n", i);
+            trace(TRACE_INPUT_BUTTON, i, 0, 0);
         }
     }
 
@@ -22,6 +22,7 @@ global isr_stub_32, isr_stub_33, isr_stub_34, isr_stub_35
 global isr_stub_36, isr_stub_37, isr_stub_38, isr_stub_39
 global isr_stub_40, isr_stub_41, isr_stub_42, isr_stub_43
 global isr_stub_44, isr_stub_45, isr_stub_46, isr_stub_47
+global isr_stub_240, isr_stub_241, isr_stub_255
 
 ; Import symbols
 extern kernel_main
@@ -139,6 +140,11 @@ ISR_NOERRCODE 45    ; FPU (IRQ 13)
 ISR_NOERRCODE 46    ; Primary ATA (IRQ 14)
 ISR_NOERRCODE 47    ; Secondary ATA (IRQ 15)
 
+; Local APIC vectors
+ISR_NOERRCODE 240   ; smp_call() wakeup IPI
+ISR_NOERRCODE 241   ; Local APIC timer
+ISR_NOERRCODE 255   ; APIC spurious
+
 
 ; ============================================================================
 ; Common ISR Handler
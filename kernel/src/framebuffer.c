@@ -7,6 +7,11 @@
 #include "framebuffer.h"
 #include "font.h"
 #include "string.h"
+#include "smp.h"
+#include "spinlock.h"
+
+/* Back buffer capacity (covers up to 1920x1200) */
+#define FB_BACK_MAX_PIXELS  (1920 * 1200)
 
 /* Framebuffer state */
 static uint32_t *fb_base = NULL;
@@ -14,6 +19,44 @@ static uint32_t fb_width = 0;
 static uint32_t fb_height = 0;
 static uint32_t fb_pitch = 0;   /* In pixels, not bytes */
 
+/* Drawing target: fb_base, or back_buffer when back buffering */
+static uint32_t *draw_base = NULL;
+static uint32_t draw_pitch = 0;
+static bool back_active = false;
+static uint32_t back_buffer[FB_BACK_MAX_PIXELS] __attribute__((aligned(64)));
+
+/*
+ * Pre-rendered glyphs keyed by (char, fg, bg). Several CPUs draw text
+ * at once during tiled compositing, so entries are seqlocked: writers
+ * (serialized by glyph_lock) make seq odd while they fill an entry, and
+ * a reader that sees seq change under it redraws from a private copy.
+ */
+typedef struct {
+    volatile uint32_t seq;
+    Color    fg;
+    Color    bg;
+    char     ch;
+    bool     valid;
+    uint32_t pixels[FONT_WIDTH * FONT_HEIGHT];
+} GlyphCacheEntry;
+
+static GlyphCacheEntry glyph_cache[GLYPH_CACHE_ENTRIES];
+static Spinlock glyph_lock = SPINLOCK_INIT;
+static uint64_t glyph_hits = 0;
+static uint64_t glyph_misses = 0;
+
+/* Clip rectangle per CPU (x2/y2 exclusive), so tiles can render in parallel */
+typedef struct {
+    int x1, y1, x2, y2;
+} ClipRect;
+
+static ClipRect clips[SMP_MAX_CPUS];
+
+static inline ClipRect *cur_clip(void)
+{
+    return &clips[smp_cpu_id()];
+}
+
 /*
  * Initialize framebuffer from boot info
  */
@@ -23,6 +66,131 @@ void fb_init(BootInfo *info)
     fb_width = info->fb_width;
     fb_height = info->fb_height;
     fb_pitch = info->fb_pitch / 4;  /* Convert bytes to pixels */
+    draw_base = fb_base;
+    draw_pitch = fb_pitch;
+    back_active = false;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        clips[i] = (ClipRect){ 0, 0, (int)fb_width, (int)fb_height };
+    }
+}
+
+/*
+ * Switch drawing between the GOP framebuffer and the RAM back buffer.
+ * Enabling seeds the back buffer with the current screen contents.
+ */
+bool fb_set_back_buffer(bool enabled)
+{
+    if (enabled == back_active) {
+        return true;
+    }
+
+    if (!enabled) {
+        draw_base = fb_base;
+        draw_pitch = fb_pitch;
+        back_active = false;
+        return true;
+    }
+
+    if ((uint64_t)fb_width * fb_height > FB_BACK_MAX_PIXELS) {
+        return false;
+    }
+
+    for (uint32_t y = 0; y < fb_height; y++) {
+        memcpy(back_buffer + y * fb_width, fb_base + y * fb_pitch, fb_width * sizeof(uint32_t));
+    }
+    draw_base = back_buffer;
+    draw_pitch = fb_width;
+    back_active = true;
+    return true;
+}
+
+bool fb_back_buffer_active(void)
+{
+    return back_active;
+}
+
+/*
+ * Copy one row to the framebuffer with non-temporal 8-byte stores
+ * (movnti works on general registers, so no FPU/SSE state is touched)
+ */
+static void fb_stream_row(uint32_t *dst, const uint32_t *src, int count)
+{
+    if (count > 0 && ((uintptr_t)dst & 7)) {
+        *dst++ = *src++;
+        count--;
+    }
+
+    uint64_t *d = (uint64_t *)dst;
+    for (; count >= 2; count -= 2) {
+        uint64_t v;
+        __builtin_memcpy(&v, src, sizeof(v));
+        __asm__ volatile("movnti %1, %0" : "=m"(*d) : "r"(v));
+        d++;
+        src += 2;
+    }
+
+    if (count) {
+        *(uint32_t *)d = *src;
+    }
+}
+
+/*
+ * Present a region of the back buffer to the screen
+ */
+void fb_present(int x, int y, int w, int h)
+{
+    if (!back_active) {
+        return;
+    }
+
+    int x1 = MAX(0, x);
+    int y1 = MAX(0, y);
+    int x2 = MIN((int)fb_width, x + w);
+    int y2 = MIN((int)fb_height, y + h);
+    if (x2 <= x1 || y2 <= y1) {
+        return;
+    }
+
+    for (int py = y1; py < y2; py++) {
+        fb_stream_row(fb_base + py * fb_pitch + x1, back_buffer + py * fb_width + x1, x2 - x1);
+    }
+
+    /* Order the weakly-ordered streaming stores before returning */
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+/*
+ * Restrict drawing to a rectangle (intersected with the screen)
+ */
+void fb_set_clip(int x, int y, int w, int h)
+{
+    ClipRect *clip = cur_clip();
+    clip->x1 = MAX(0, x);
+    clip->y1 = MAX(0, y);
+    clip->x2 = MIN((int)fb_width, x + w);
+    clip->y2 = MIN((int)fb_height, y + h);
+    if (clip->x2 < clip->x1) clip->x2 = clip->x1;
+    if (clip->y2 < clip->y1) clip->y2 = clip->y1;
+}
+
+/*
+ * Allow drawing to the whole screen
+ */
+void fb_reset_clip(void)
+{
+    *cur_clip() = (ClipRect){ 0, 0, (int)fb_width, (int)fb_height };
+}
+
+/*
+ * Get the calling CPU's clip rectangle (x2/y2 exclusive)
+ */
+void fb_get_clip(int *x1, int *y1, int *x2, int *y2)
+{
+    const ClipRect *clip = cur_clip();
+    if (x1) *x1 = clip->x1;
+    if (y1) *y1 = clip->y1;
+    if (x2) *x2 = clip->x2;
+    if (y2) *y2 = clip->y2;
 }
 
 /*
@@ -38,13 +206,41 @@ uint32_t fb_get_height(void)
     return fb_height;
 }
 
+/*
+ * Fill bandwidth microbenchmark (always targets the GOP framebuffer)
+ */
+uint64_t fb_benchmark_fill(Color color)
+{
+    const int passes = 4;
+    uint32_t y0 = fb_height - fb_height / 4;
+    uint64_t bytes = 0;
+
+    uint64_t start = rdtsc();
+    for (int pass = 0; pass < passes; pass++) {
+        for (uint32_t y = y0; y < fb_height; y++) {
+            volatile uint32_t *row = fb_base + y * fb_pitch;
+            for (uint32_t x = 0; x < fb_width; x++) {
+                row[x] = color;
+            }
+        }
+        bytes += (uint64_t)(fb_height - y0) * fb_width * sizeof(uint32_t);
+    }
+    __asm__ volatile("sfence" ::: "memory");
+    uint64_t cycles = rdtsc() - start;
+
+    if (cycles == 0) {
+        return 0;
+    }
+    return (bytes * 1000) / cycles;
+}
+
 /*
  * Clear entire framebuffer
  */
 void fb_clear(Color color)
 {
     for (uint32_t y = 0; y < fb_height; y++) {
-        uint32_t *row = fb_base + y * fb_pitch;
+        uint32_t *row = draw_base + y * draw_pitch;
         for (uint32_t x = 0; x < fb_width; x++) {
             row[x] = color;
         }
@@ -56,10 +252,11 @@ void fb_clear(Color color)
  */
 void fb_put_pixel(int x, int y, Color color)
 {
-    if (x < 0 || x >= (int)fb_width || y < 0 || y >= (int)fb_height) {
+    const ClipRect *clip = cur_clip();
+    if (x < clip->x1 || x >= clip->x2 || y < clip->y1 || y >= clip->y2) {
         return;
     }
-    fb_base[y * fb_pitch + x] = color;
+    draw_base[y * draw_pitch + x] = color;
 }
 
 /*
@@ -70,7 +267,7 @@ Color fb_get_pixel(int x, int y)
     if (x < 0 || x >= (int)fb_width || y < 0 || y >= (int)fb_height) {
         return 0;
     }
-    return fb_base[y * fb_pitch + x];
+    return draw_base[y * draw_pitch + x];
 }
 
 /*
@@ -78,14 +275,15 @@ Color fb_get_pixel(int x, int y)
  */
 void fb_fill_rect(int x, int y, int w, int h, Color color)
 {
-    /* Clip to screen bounds */
-    int x1 = MAX(0, x);
-    int y1 = MAX(0, y);
-    int x2 = MIN((int)fb_width, x + w);
-    int y2 = MIN((int)fb_height, y + h);
+    /* Clip to screen bounds and clip rectangle */
+    const ClipRect *clip = cur_clip();
+    int x1 = MAX(clip->x1, x);
+    int y1 = MAX(clip->y1, y);
+    int x2 = MIN(clip->x2, x + w);
+    int y2 = MIN(clip->y2, y + h);
 
     for (int py = y1; py < y2; py++) {
-        uint32_t *row = fb_base + py * fb_pitch;
+        uint32_t *row = draw_base + py * draw_pitch;
         for (int px = x1; px < x2; px++) {
             row[px] = color;
         }
@@ -108,36 +306,136 @@ void fb_draw_rect(int x, int y, int w, int h, Color color)
 }
 
 /*
- * Draw a character using bitmap font
+ * Glyph cache: (char, fg, bg) -> pre-expanded 8x16 pixels, so a cached
+ * glyph is drawn by copying whole rows. Direct-mapped by hash.
  */
-void fb_draw_char(int x, int y, char c, Color fg, Color bg)
+static uint32_t glyph_hash(char c, Color fg, Color bg)
 {
-    const uint8_t *glyph = font_get_glyph(c);
+    uint64_t h = ((uint64_t)fg << 32 | bg) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)((h >> 40) ^ (uint8_t)c) & (GLYPH_CACHE_ENTRIES - 1);
+}
 
+static void glyph_render(uint32_t *px, char c, Color fg, Color bg)
+{
+    const uint8_t *glyph = font_get_glyph(c);
     for (int row = 0; row < FONT_HEIGHT; row++) {
         uint8_t bits = glyph[row];
         for (int col = 0; col < FONT_WIDTH; col++) {
-            Color color = (bits & (0x80 >> col)) ? fg : bg;
-            fb_put_pixel(x + col, y + row, color);
+            *px++ = (bits & (0x80 >> col)) ? fg : bg;
+        }
+    }
+}
+
+/* Copy rows [r0, r1) x columns [c0, c1) of a pre-rendered glyph */
+static void glyph_copy(uint32_t *dst, const uint32_t *src, int r0, int r1, int c0, int c1)
+{
+    src += r0 * FONT_WIDTH;
+    if (c0 == 0 && c1 == FONT_WIDTH) {
+        for (int row = r0; row < r1; row++, dst += draw_pitch, src += FONT_WIDTH) {
+            __builtin_memcpy(dst, src, FONT_WIDTH * sizeof(uint32_t));
+        }
+    } else {
+        for (int row = r0; row < r1; row++, dst += draw_pitch, src += FONT_WIDTH) {
+            for (int col = c0; col < c1; col++) {
+                dst[col] = src[col];
+            }
+        }
+    }
+}
+
+/*
+ * Draw one glyph clipped to [x1, x2) x [y1, y2), which must overlap it
+ */
+static void blit_glyph(int x, int y, char c, Color fg, Color bg,
+                       int x1, int y1, int x2, int y2)
+{
+    int r0 = MAX(0, y1 - y);
+    int r1 = MIN(FONT_HEIGHT, y2 - y);
+    int c0 = MAX(0, x1 - x);
+    int c1 = MIN(FONT_WIDTH, x2 - x);
+    uint32_t *dst = draw_base + (uint64_t)(y + r0) * draw_pitch + x;
+
+    if (bg == COLOR_TRANSPARENT) {
+        /* Only the set bits are written */
+        const uint8_t *glyph = font_get_glyph(c);
+        for (int row = r0; row < r1; row++, dst += draw_pitch) {
+            uint8_t bits = glyph[row];
+            for (int col = c0; bits && col < c1; col++) {
+                if (bits & (0x80 >> col)) {
+                    dst[col] = fg;
+                }
+            }
         }
+        return;
+    }
+
+    /* Hit: copy optimistically, keep the result if no writer interfered */
+    GlyphCacheEntry *e = &glyph_cache[glyph_hash(c, fg, bg)];
+    uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (!(seq & 1) && e->valid && e->ch == c && e->fg == fg && e->bg == bg) {
+        glyph_copy(dst, e->pixels, r0, r1, c0, c1);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (e->seq == seq) {
+            __atomic_fetch_add(&glyph_hits, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    /* Miss: fill the entry, or render privately if another CPU is filling */
+    __atomic_fetch_add(&glyph_misses, 1, __ATOMIC_RELAXED);
+    if (spin_trylock(&glyph_lock)) {
+        __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        glyph_render(e->pixels, c, fg, bg);
+        e->ch = c;
+        e->fg = fg;
+        e->bg = bg;
+        e->valid = true;
+        __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+        glyph_copy(dst, e->pixels, r0, r1, c0, c1);
+        spin_unlock(&glyph_lock);
+        return;
+    }
+
+    uint32_t pixels[FONT_WIDTH * FONT_HEIGHT];
+    glyph_render(pixels, c, fg, bg);
+    glyph_copy(dst, pixels, r0, r1, c0, c1);
+}
+
+/*
+ * Draw a character using bitmap font
+ */
+void fb_draw_char(int x, int y, char c, Color fg, Color bg)
+{
+    const ClipRect *clip = cur_clip();
+    if (x >= clip->x2 || y >= clip->y2 || x + FONT_WIDTH <= clip->x1 || y + FONT_HEIGHT <= clip->y1) {
+        return;
     }
+
+    blit_glyph(x, y, c, fg, bg, clip->x1, clip->y1, clip->x2, clip->y2);
 }
 
 /*
- * Draw a string
+ * Draw a string. The vertical clip test is made once per text line;
+ * glyphs outside the clip horizontally are skipped without drawing.
  */
 void fb_draw_string(int x, int y, const char *s, Color fg, Color bg)
 {
+    const ClipRect clip = *cur_clip();
     int cur_x = x;
+    bool line_visible = (y < clip.y2 && y + FONT_HEIGHT > clip.y1);
 
     while (*s) {
         if (*s == '\n') {
             cur_x = x;
             y += FONT_HEIGHT;
+            line_visible = (y < clip.y2 && y + FONT_HEIGHT > clip.y1);
         } else if (*s == '\t') {
             cur_x += FONT_WIDTH * 4;  /* 4-space tabs */
         } else {
-            fb_draw_char(cur_x, y, *s, fg, bg);
+            if (line_visible && cur_x < clip.x2 && cur_x + FONT_WIDTH > clip.x1) {
+                blit_glyph(cur_x, y, *s, fg, bg, clip.x1, clip.y1, clip.x2, clip.y2);
+            }
             cur_x += FONT_WIDTH;
         }
         s++;
@@ -146,10 +444,25 @@ void fb_draw_string(int x, int y, const char *s, Color fg, Color bg)
         if (cur_x + FONT_WIDTH > (int)fb_width) {
             cur_x = x;
             y += FONT_HEIGHT;
+            line_visible = (y < clip.y2 && y + FONT_HEIGHT > clip.y1);
+        }
+
+        /* Lines only move down: nothing more can be visible */
+        if (y >= clip.y2) {
+            break;
         }
     }
 }
 
+/*
+ * Glyph cache counters
+ */
+void fb_get_glyph_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+    if (hits) *hits = glyph_hits;
+    if (misses) *misses = glyph_misses;
+}
+
 /*
  * Blend two colors with alpha
  */
@@ -179,8 +492,8 @@ void fb_copy_rect(int dst_x, int dst_y, int src_x, int src_y, int w, int h)
     if (dst_y < src_y || (dst_y == src_y && dst_x < src_x)) {
         /* Copy top-to-bottom, left-to-right */
         for (int row = 0; row < h; row++) {
-            uint32_t *dst_row = fb_base + (dst_y + row) * fb_pitch;
-            uint32_t *src_row = fb_base + (src_y + row) * fb_pitch;
+            uint32_t *dst_row = draw_base + (dst_y + row) * draw_pitch;
+            uint32_t *src_row = draw_base + (src_y + row) * draw_pitch;
             for (int col = 0; col < w; col++) {
                 dst_row[dst_x + col] = src_row[src_x + col];
             }
@@ -188,8 +501,8 @@ void fb_copy_rect(int dst_x, int dst_y, int src_x, int src_y, int w, int h)
     } else {
         /* Copy bottom-to-top, right-to-left */
         for (int row = h - 1; row >= 0; row--) {
-            uint32_t *dst_row = fb_base + (dst_y + row) * fb_pitch;
-            uint32_t *src_row = fb_base + (src_y + row) * fb_pitch;
+            uint32_t *dst_row = draw_base + (dst_y + row) * draw_pitch;
+            uint32_t *src_row = draw_base + (src_y + row) * draw_pitch;
             for (int col = w - 1; col >= 0; col--) {
                 dst_row[dst_x + col] = src_row[src_x + col];
             }
@@ -41,6 +41,12 @@ typedef uint32_t Color;
 #define COLOR_PANIC_BG      RGB(180, 40, 40)        /* Red for panic */
 #define COLOR_PANIC_TEXT    RGB(255, 255, 255)
 
+/* Text background that leaves the pixels under the glyph untouched */
+#define COLOR_TRANSPARENT   ((Color)0)
+
+/* Pre-rendered glyphs kept for text drawing (power of two) */
+#define GLYPH_CACHE_ENTRIES 512
+
 /* Initialize framebuffer from boot info */
 void fb_init(BootInfo *info);
 
@@ -55,9 +61,34 @@ Color fb_get_pixel(int x, int y);
 void fb_fill_rect(int x, int y, int w, int h, Color color);
 void fb_draw_rect(int x, int y, int w, int h, Color color);
 
-/* Text drawing */
+/* Clip rectangle: pixel, rect and text drawing is restricted to it */
+void fb_set_clip(int x, int y, int w, int h);
+void fb_reset_clip(void);
+void fb_get_clip(int *x1, int *y1, int *x2, int *y2);
+
+/*
+ * Back buffer: when enabled, all drawing goes to a RAM surface and
+ * fb_present() copies regions to the GOP framebuffer with streaming
+ * stores. Returns false if the screen is larger than the back buffer.
+ */
+bool fb_set_back_buffer(bool enabled);
+bool fb_back_buffer_active(void);
+void fb_present(int x, int y, int w, int h);
+
+/*
+ * Measure framebuffer fill bandwidth by filling the bottom quarter of
+ * the screen with a color. Returns bytes written per 1000 TSC cycles.
+ */
+uint64_t fb_benchmark_fill(Color color);
+
+/*
+ * Text drawing. Glyphs come from a cache of pre-rendered (char, fg, bg)
+ * cells and are written a row at a time; pass COLOR_TRANSPARENT as bg
+ * to draw only the glyph's foreground pixels.
+ */
 void fb_draw_char(int x, int y, char c, Color fg, Color bg);
 void fb_draw_string(int x, int y, const char *s, Color fg, Color bg);
+void fb_get_glyph_cache_stats(uint64_t *hits, uint64_t *misses);
 
 /* Alpha blending */
 Color fb_blend(Color bg, Color fg, uint8_t alpha);
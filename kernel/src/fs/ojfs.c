@@ -7,6 +7,7 @@
 #include "ojfs.h"
 #include "../serial.h"
 #include "../string.h"
+#include "../heap.h"
 #include "../console.h"
 
 /*
@@ -21,18 +22,10 @@ static int instance_count = 0;
 static OjfsInstance *current_instance = NULL;
 
 /*
- * File handle pool
+ * File and directory handle caches
  */
-#define MAX_OJFS_FILES  16
-static OjfsFile file_pool[MAX_OJFS_FILES];
-static bool file_used[MAX_OJFS_FILES];
-
-/*
- * Directory handle pool
- */
-#define MAX_OJFS_DIRS   8
-static OjfsDirHandle dir_pool[MAX_OJFS_DIRS];
-static bool dir_used[MAX_OJFS_DIRS];
+static KmemCache *file_cache = NULL;
+static KmemCache *dir_cache = NULL;
 
 /*
  * Get entry name from string table
@@ -108,14 +101,7 @@ static int find_entry(OjfsInstance *fs, const char *path)
  */
 static OjfsFile *alloc_ojfs_file(void)
 {
-    for (int i = 0; i < MAX_OJFS_FILES; i++) {
-        if (!file_used[i]) {
-            file_used[i] = true;
-            memset(&file_pool[i], 0, sizeof(OjfsFile));
-            return &file_pool[i];
-        }
-    }
-    return NULL;
+    return (OjfsFile *)kmem_cache_alloc(file_cache);
 }
 
 /*
@@ -123,12 +109,7 @@ static OjfsFile *alloc_ojfs_file(void)
  */
 static void free_ojfs_file(OjfsFile *file)
 {
-    for (int i = 0; i < MAX_OJFS_FILES; i++) {
-        if (&file_pool[i] == file) {
-            file_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(file_cache, file);
 }
 
 /*
@@ -136,14 +117,7 @@ static void free_ojfs_file(OjfsFile *file)
  */
 static OjfsDirHandle *alloc_ojfs_dir(void)
 {
-    for (int i = 0; i < MAX_OJFS_DIRS; i++) {
-        if (!dir_used[i]) {
-            dir_used[i] = true;
-            memset(&dir_pool[i], 0, sizeof(OjfsDirHandle));
-            return &dir_pool[i];
-        }
-    }
-    return NULL;
+    return (OjfsDirHandle *)kmem_cache_alloc(dir_cache);
 }
 
 /*
@@ -151,12 +125,7 @@ static OjfsDirHandle *alloc_ojfs_dir(void)
  */
 static void free_ojfs_dir(OjfsDirHandle *dir)
 {
-    for (int i = 0; i < MAX_OJFS_DIRS; i++) {
-        if (&dir_pool[i] == dir) {
-            dir_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(dir_cache, dir);
 }
 
 /*
@@ -510,6 +479,13 @@ VfsOps *ojfs_init(const void *image, size_t size, OjfsInstance **out_instance)
         return NULL;
     }
 
+    if (!file_cache) {
+        file_cache = kmem_cache_create("ojfs_file", sizeof(OjfsFile));
+    }
+    if (!dir_cache) {
+        dir_cache = kmem_cache_create("ojfs_dir", sizeof(OjfsDirHandle));
+    }
+
     OjfsInstance *fs = &instances[instance_count++];
     fs->base = (const uint8_t *)image;
     fs->header = (const OjfsHeader *)image;
@@ -5,11 +5,10 @@
 #include "ramfs.h"
 #include "../string.h"
 #include "../serial.h"
+#include "../heap.h"
 
 #define RAMFS_MAX_NODES    256
-#define RAMFS_MAX_FILES    64
-#define RAMFS_MAX_DIRS     32
-#define RAMFS_DATA_SIZE    (256 * 1024)
+#define RAMFS_MIN_CAPACITY 4096
 
 typedef struct {
     RamfsNode *node;
@@ -24,14 +23,8 @@ typedef struct {
 static RamfsNode nodes[RAMFS_MAX_NODES];
 static int node_count = 0;
 
-static uint8_t data_pool[RAMFS_DATA_SIZE];
-static uint64_t data_offset = 0;
-
-static RamfsFile file_pool[RAMFS_MAX_FILES];
-static bool file_used[RAMFS_MAX_FILES];
-
-static RamfsDir dir_pool[RAMFS_MAX_DIRS];
-static bool dir_used[RAMFS_MAX_DIRS];
+static KmemCache *file_cache = NULL;
+static KmemCache *dir_cache = NULL;
 
 static RamfsNode *alloc_node(void)
 {
@@ -45,46 +38,22 @@ static RamfsNode *alloc_node(void)
 
 static RamfsFile *alloc_file(void)
 {
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (!file_used[i]) {
-            file_used[i] = true;
-            memset(&file_pool[i], 0, sizeof(RamfsFile));
-            return &file_pool[i];
-        }
-    }
-    return NULL;
+    return (RamfsFile *)kmem_cache_alloc(file_cache);
 }
 
 static void free_file(RamfsFile *file)
 {
-    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
-        if (&file_pool[i] == file) {
-            file_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(file_cache, file);
 }
 
 static RamfsDir *alloc_dir(void)
 {
-    for (int i = 0; i < RAMFS_MAX_DIRS; i++) {
-        if (!dir_used[i]) {
-            dir_used[i] = true;
-            memset(&dir_pool[i], 0, sizeof(RamfsDir));
-            return &dir_pool[i];
-        }
-    }
-    return NULL;
+    return (RamfsDir *)kmem_cache_alloc(dir_cache);
 }
 
 static void free_dir(RamfsDir *dir)
 {
-    for (int i = 0; i < RAMFS_MAX_DIRS; i++) {
-        if (&dir_pool[i] == dir) {
-            dir_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(dir_cache, dir);
 }
 
 static int find_child(uint32_t parent, const char *name)
@@ -195,12 +164,19 @@ static int create_node(const char *path, VfsFileType type)
     return (int)(node - nodes);
 }
 
-static int64_t ramfs_alloc_data(uint64_t size)
+/* Grow a node's buffer to hold at least 'needed' bytes (doubling) */
+static int ramfs_reserve(RamfsNode *node, uint64_t needed)
 {
-    if (data_offset + size > RAMFS_DATA_SIZE) return -1;
-    uint64_t offset = data_offset;
-    data_offset += size;
-    return (int64_t)offset;
+    if (needed <= node->capacity) return 0;
+
+    uint64_t new_capacity = node->capacity ? node->capacity * 2 : RAMFS_MIN_CAPACITY;
+    if (new_capacity < needed) new_capacity = needed;
+
+    uint8_t *data = (uint8_t *)krealloc(node->data, new_capacity);
+    if (!data) return -1;
+    node->data = data;
+    node->capacity = new_capacity;
+    return 0;
 }
 
 static VfsFile *ramfs_open(const char *path, uint32_t mode)
@@ -221,12 +197,7 @@ static VfsFile *ramfs_open(const char *path, uint32_t mode)
         node->size = 0;
     }
 
-    if (node->capacity == 0) {
-        int64_t offset = ramfs_alloc_data(4096);
-        if (offset < 0) return NULL;
-        node->data_offset = (uint64_t)offset;
-        node->capacity = 4096;
-    }
+    if (ramfs_reserve(node, RAMFS_MIN_CAPACITY) != 0) return NULL;
 
     RamfsFile *file = alloc_file();
     if (!file) return NULL;
@@ -251,7 +222,7 @@ static ssize_t ramfs_read(VfsFile *vfile, void *buf, size_t count)
     uint64_t remaining = node->size - file->position;
     if (count > remaining) count = remaining;
 
-    memcpy(buf, data_pool + node->data_offset + file->position, count);
+    memcpy(buf, node->data + file->position, count);
     file->position += count;
     return count;
 }
@@ -264,20 +235,11 @@ static ssize_t ramfs_write(VfsFile *vfile, const void *buf, size_t count)
     RamfsNode *node = file->node;
     if (node->capacity == 0) return -1;
 
-    uint64_t needed = file->position + count;
-    if (needed > node->capacity) {
-        uint64_t new_capacity = node->capacity + 4096;
-        if (new_capacity < needed) new_capacity = needed;
-        int64_t new_offset = ramfs_alloc_data(new_capacity);
-        if (new_offset < 0) {
-            return -1;
-        }
-        memcpy(data_pool + (uint64_t)new_offset, data_pool + node->data_offset, node->size);
-        node->data_offset = (uint64_t)new_offset;
-        node->capacity = new_capacity;
+    if (ramfs_reserve(node, file->position + count) != 0) {
+        return -1;
     }
 
-    memcpy(data_pool + node->data_offset + file->position, buf, count);
+    memcpy(node->data + file->position, buf, count);
     file->position += count;
     if (file->position > node->size) node->size = file->position;
     return count;
@@ -411,9 +373,10 @@ static int ramfs_unlink(const char *path)
 
     node->type = VFS_TYPE_UNKNOWN;
     node->name[0] = '\0';
+    kfree(node->data);
+    node->data = NULL;
     node->size = 0;
     node->capacity = 0;
-    node->data_offset = 0;
     return 0;
 }
 
@@ -459,11 +422,18 @@ static VfsOps ramfs_ops = {
 
 VfsOps *ramfs_init(void)
 {
+    for (int i = 0; i < node_count; i++) {
+        kfree(nodes[i].data);
+    }
     node_count = 0;
-    data_offset = 0;
     memset(nodes, 0, sizeof(nodes));
-    memset(file_used, 0, sizeof(file_used));
-    memset(dir_used, 0, sizeof(dir_used));
+
+    if (!file_cache) {
+        file_cache = kmem_cache_create("ramfs_file", sizeof(RamfsFile));
+    }
+    if (!dir_cache) {
+        dir_cache = kmem_cache_create("ramfs_dir", sizeof(RamfsDir));
+    }
 
     RamfsNode *root = alloc_node();
     if (!root) return NULL;
@@ -16,7 +16,7 @@ typedef struct {
     uint32_t permissions;
     uint64_t size;
     uint64_t capacity;
-    uint64_t data_offset;
+    uint8_t *data;              /* kmalloc'd contents (capacity bytes) */
 } RamfsNode;
 
 typedef struct {
@@ -2,11 +2,19 @@
  * ojjyOS v3 Kernel - Virtual Filesystem Implementation
  *
  * Routes filesystem calls to the appropriate mounted filesystem.
+ *
+ * The filesystems keep shared state (node pools, open instances), so
+ * every call into a filesystem's ops is made under fs_lock; handles
+ * come from the (locked) slab caches. The mount table is only changed
+ * during boot and is read without the lock.
  */
 
 #include "vfs.h"
 #include "../serial.h"
 #include "../string.h"
+#include "../heap.h"
+#include "../trace.h"
+#include "../sched.h"
 
 /*
  * Maximum number of mount points
@@ -27,6 +35,7 @@ struct VfsFile {
     void        *fs_file;       /* Filesystem-specific file data */
     uint32_t    mode;           /* Open mode */
     int64_t     position;       /* Current position */
+    uint32_t    id;             /* Handle number, for tracing */
 };
 
 /*
@@ -38,30 +47,24 @@ struct VfsDir {
 };
 
 /*
- * Simple file/dir handle pools (no malloc yet)
+ * File/dir handles come from slab caches, so there is no fixed limit
  */
-#define MAX_OPEN_FILES  32
-#define MAX_OPEN_DIRS   16
-
-static VfsFile file_pool[MAX_OPEN_FILES];
-static bool file_used[MAX_OPEN_FILES];
+static KmemCache *file_cache = NULL;
+static KmemCache *dir_cache = NULL;
+static uint32_t next_file_id = 1;
 
-static VfsDir dir_pool[MAX_OPEN_DIRS];
-static bool dir_used[MAX_OPEN_DIRS];
+/*
+ * Serializes calls into filesystem ops. A mutex: filesystems wait for
+ * disk interrupts while it is held, and other threads keep running.
+ */
+static Mutex fs_lock = MUTEX_INIT;
 
 /*
  * Allocate a file handle
  */
 static VfsFile *alloc_file(void)
 {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (!file_used[i]) {
-            file_used[i] = true;
-            memset(&file_pool[i], 0, sizeof(VfsFile));
-            return &file_pool[i];
-        }
-    }
-    return NULL;
+    return (VfsFile *)kmem_cache_alloc(file_cache);
 }
 
 /*
@@ -69,12 +72,7 @@ static VfsFile *alloc_file(void)
  */
 static void free_file(VfsFile *file)
 {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (&file_pool[i] == file) {
-            file_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(file_cache, file);
 }
 
 /*
@@ -82,14 +80,7 @@ static void free_file(VfsFile *file)
  */
 static VfsDir *alloc_dir(void)
 {
-    for (int i = 0; i < MAX_OPEN_DIRS; i++) {
-        if (!dir_used[i]) {
-            dir_used[i] = true;
-            memset(&dir_pool[i], 0, sizeof(VfsDir));
-            return &dir_pool[i];
-        }
-    }
-    return NULL;
+    return (VfsDir *)kmem_cache_alloc(dir_cache);
 }
 
 /*
@@ -97,12 +88,7 @@ static VfsDir *alloc_dir(void)
  */
 static void free_dir(VfsDir *dir)
 {
-    for (int i = 0; i < MAX_OPEN_DIRS; i++) {
-        if (&dir_pool[i] == dir) {
-            dir_used[i] = false;
-            return;
-        }
-    }
+    kmem_cache_free(dir_cache, dir);
 }
 
 /*
@@ -161,11 +147,15 @@ void vfs_init(void)
 
     mount_count = 0;
     memset(mounts, 0, sizeof(mounts));
-    memset(file_used, 0, sizeof(file_used));
-    memset(dir_used, 0, sizeof(dir_used));
+    if (!file_cache) {
+        file_cache = kmem_cache_create("vfs_file", sizeof(VfsFile));
+    }
+    if (!dir_cache) {
+        dir_cache = kmem_cache_create("vfs_dir", sizeof(VfsDir));
+    }
 
-    serial_printf("[VFS] VFS initialized (max %d mounts, %d files, %d dirs)\n",
-        MAX_MOUNTS, MAX_OPEN_FILES, MAX_OPEN_DIRS);
+    serial_printf("[VFS] VFS initialized (max %d mounts, handles from slab caches)\n",
+        MAX_MOUNTS);
 }
 
 /*
@@ -224,6 +214,18 @@ int vfs_unmount(const char *path)
     return -1;
 }
 
+/*
+ * Record an open (result is the handle number, or -1)
+ */
+static void vfs_trace_open(const char *path, int result)
+{
+    if (trace_mask & (1U << TRACE_VFS)) {
+        uint64_t a0, a1;
+        trace_pack_name(path, &a0, &a1);
+        trace_record(TRACE_VFS_OPEN, a0, a1, (uint32_t)result);
+    }
+}
+
 /*
  * Open a file
  */
@@ -247,8 +249,11 @@ VfsFile *vfs_open(const char *path, uint32_t mode)
     }
 
     const char *rel_path = get_relative_path(mount, path);
+    mutex_lock(&fs_lock);
     VfsFile *file = mount->ops->open(rel_path, mode);
+    mutex_unlock(&fs_lock);
     if (!file) {
+        vfs_trace_open(path, -1);
         return NULL;
     }
 
@@ -256,9 +261,11 @@ VfsFile *vfs_open(const char *path, uint32_t mode)
     VfsFile *vfile = alloc_file();
     if (!vfile) {
         if (mount->ops->close) {
+            mutex_lock(&fs_lock);
             mount->ops->close(file);
+            mutex_unlock(&fs_lock);
         }
-        serial_printf("[VFS] ERROR: Too many open files\n");
+        serial_printf("[VFS] ERROR: Out of memory for file handle\n");
         return NULL;
     }
 
@@ -266,7 +273,9 @@ VfsFile *vfs_open(const char *path, uint32_t mode)
     vfile->fs_file = file;
     vfile->mode = mode;
     vfile->position = 0;
+    vfile->id = __atomic_fetch_add(&next_file_id, 1, __ATOMIC_RELAXED);
 
+    vfs_trace_open(path, (int)vfile->id);
     return vfile;
 }
 
@@ -277,8 +286,12 @@ void vfs_close(VfsFile *file)
 {
     if (!file) return;
 
+    trace(TRACE_VFS_CLOSE, file->id, 0, 0);
+
     if (file->mount && file->mount->ops->close && file->fs_file) {
+        mutex_lock(&fs_lock);
         file->mount->ops->close(file->fs_file);
+        mutex_unlock(&fs_lock);
     }
 
     free_file(file);
@@ -293,7 +306,11 @@ ssize_t vfs_read(VfsFile *file, void *buf, size_t count)
         return -1;
     }
 
-    return file->mount->ops->read(file->fs_file, buf, count);
+    mutex_lock(&fs_lock);
+    ssize_t ret = file->mount->ops->read(file->fs_file, buf, count);
+    mutex_unlock(&fs_lock);
+    trace(TRACE_VFS_READ, file->id, count, (uint32_t)ret);
+    return ret;
 }
 
 /*
@@ -309,7 +326,11 @@ ssize_t vfs_write(VfsFile *file, const void *buf, size_t count)
         return -1;
     }
 
-    return file->mount->ops->write(file->fs_file, buf, count);
+    mutex_lock(&fs_lock);
+    ssize_t ret = file->mount->ops->write(file->fs_file, buf, count);
+    mutex_unlock(&fs_lock);
+    trace(TRACE_VFS_WRITE, file->id, count, (uint32_t)ret);
+    return ret;
 }
 
 /*
@@ -321,7 +342,10 @@ int64_t vfs_seek(VfsFile *file, int64_t offset, int whence)
         return -1;
     }
 
-    return file->mount->ops->seek(file->fs_file, offset, whence);
+    mutex_lock(&fs_lock);
+    int64_t ret = file->mount->ops->seek(file->fs_file, offset, whence);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
@@ -333,7 +357,10 @@ int64_t vfs_tell(VfsFile *file)
         return -1;
     }
 
-    return file->mount->ops->tell(file->fs_file);
+    mutex_lock(&fs_lock);
+    int64_t ret = file->mount->ops->tell(file->fs_file);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
@@ -341,10 +368,35 @@ int64_t vfs_tell(VfsFile *file)
  */
 ssize_t vfs_read_file(const char *path, void **buffer)
 {
-    /* Not implemented yet - needs malloc */
-    (void)path;
-    (void)buffer;
-    return -1;
+    if (!buffer) return -1;
+    *buffer = NULL;
+
+    VfsStat st;
+    if (vfs_stat(path, &st) != 0 || st.type != VFS_TYPE_FILE) {
+        return -1;
+    }
+
+    VfsFile *file = vfs_open(path, VFS_O_READ);
+    if (!file) return -1;
+
+    /* One spare byte so text files can be used as C strings */
+    uint8_t *data = (uint8_t *)kmalloc(st.size + 1);
+    if (!data) {
+        vfs_close(file);
+        return -1;
+    }
+
+    size_t total = 0;
+    while (total < st.size) {
+        ssize_t n = vfs_read(file, data + total, st.size - total);
+        if (n <= 0) break;
+        total += (size_t)n;
+    }
+    vfs_close(file);
+
+    data[total] = '\0';
+    *buffer = data;
+    return (ssize_t)total;
 }
 
 /*
@@ -358,7 +410,10 @@ int vfs_stat(const char *path, VfsStat *stat)
     }
 
     const char *rel_path = get_relative_path(mount, path);
-    return mount->ops->stat(rel_path, stat);
+    mutex_lock(&fs_lock);
+    int ret = mount->ops->stat(rel_path, stat);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
@@ -371,7 +426,10 @@ int vfs_exists(const char *path)
 
     if (mount->ops->exists) {
         const char *rel_path = get_relative_path(mount, path);
-        return mount->ops->exists(rel_path);
+        mutex_lock(&fs_lock);
+        int ret = mount->ops->exists(rel_path);
+        mutex_unlock(&fs_lock);
+        return ret;
     }
 
     /* Fallback: try stat */
@@ -389,7 +447,10 @@ int vfs_isdir(const char *path)
 
     if (mount->ops->isdir) {
         const char *rel_path = get_relative_path(mount, path);
-        return mount->ops->isdir(rel_path);
+        mutex_lock(&fs_lock);
+        int ret = mount->ops->isdir(rel_path);
+        mutex_unlock(&fs_lock);
+        return ret;
     }
 
     VfsStat st;
@@ -407,7 +468,10 @@ int vfs_isfile(const char *path)
 
     if (mount->ops->isfile) {
         const char *rel_path = get_relative_path(mount, path);
-        return mount->ops->isfile(rel_path);
+        mutex_lock(&fs_lock);
+        int ret = mount->ops->isfile(rel_path);
+        mutex_unlock(&fs_lock);
+        return ret;
     }
 
     VfsStat st;
@@ -426,7 +490,9 @@ VfsDir *vfs_opendir(const char *path)
     }
 
     const char *rel_path = get_relative_path(mount, path);
+    mutex_lock(&fs_lock);
     void *fs_dir = mount->ops->opendir(rel_path);
+    mutex_unlock(&fs_lock);
     if (!fs_dir) {
         return NULL;
     }
@@ -434,7 +500,9 @@ VfsDir *vfs_opendir(const char *path)
     VfsDir *dir = alloc_dir();
     if (!dir) {
         if (mount->ops->closedir) {
+            mutex_lock(&fs_lock);
             mount->ops->closedir(fs_dir);
+            mutex_unlock(&fs_lock);
         }
         return NULL;
     }
@@ -452,7 +520,9 @@ void vfs_closedir(VfsDir *dir)
     if (!dir) return;
 
     if (dir->mount && dir->mount->ops->closedir && dir->fs_dir) {
+        mutex_lock(&fs_lock);
         dir->mount->ops->closedir(dir->fs_dir);
+        mutex_unlock(&fs_lock);
     }
 
     free_dir(dir);
@@ -467,7 +537,10 @@ int vfs_readdir(VfsDir *dir, VfsDirEntry *entry)
         return -1;
     }
 
-    return dir->mount->ops->readdir(dir->fs_dir, entry);
+    mutex_lock(&fs_lock);
+    int ret = dir->mount->ops->readdir(dir->fs_dir, entry);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
@@ -479,7 +552,10 @@ int vfs_rewinddir(VfsDir *dir)
         return -1;
     }
 
-    return dir->mount->ops->rewinddir(dir->fs_dir);
+    mutex_lock(&fs_lock);
+    int ret = dir->mount->ops->rewinddir(dir->fs_dir);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
@@ -497,7 +573,10 @@ int vfs_mkdir(const char *path)
     }
 
     const char *rel_path = get_relative_path(mount, path);
-    return mount->ops->mkdir(rel_path);
+    mutex_lock(&fs_lock);
+    int ret = mount->ops->mkdir(rel_path);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 int vfs_unlink(const char *path)
@@ -512,7 +591,10 @@ int vfs_unlink(const char *path)
     }
 
     const char *rel_path = get_relative_path(mount, path);
-    return mount->ops->unlink(rel_path);
+    mutex_lock(&fs_lock);
+    int ret = mount->ops->unlink(rel_path);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 int vfs_rename(const char *from, const char *to)
@@ -533,7 +615,10 @@ int vfs_rename(const char *from, const char *to)
 
     const char *rel_from = get_relative_path(mount, from);
     const char *rel_to = get_relative_path(mount, to);
-    return mount->ops->rename(rel_from, rel_to);
+    mutex_lock(&fs_lock);
+    int ret = mount->ops->rename(rel_from, rel_to);
+    mutex_unlock(&fs_lock);
+    return ret;
 }
 
 /*
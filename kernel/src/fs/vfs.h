@@ -153,7 +153,7 @@ int64_t vfs_tell(VfsFile *file);
 /*
  * Read entire file into buffer (allocates memory)
  * Returns size read, or -1 on error
- * Caller must free the buffer
+ * Caller must kfree() the buffer
  */
 ssize_t vfs_read_file(const char *path, void **buffer);
 
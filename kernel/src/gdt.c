@@ -8,6 +8,7 @@
  */
 
 #include "gdt.h"
+#include "smp.h"
 #include "string.h"
 
 /* GDT entry structure */
@@ -57,18 +58,29 @@ typedef struct {
     uint64_t base;
 } PACKED GdtPointer;
 
-/* Our GDT (6 entries: null, kernel code, kernel data, user data, user code, TSS) */
-static struct {
+/* GDT layout (6 entries: null, kernel code, kernel data, user data, user code, TSS) */
+typedef struct {
     GdtEntry null;
     GdtEntry kernel_code;
     GdtEntry kernel_data;
     GdtEntry user_data;
     GdtEntry user_code;
     TssEntry tss;
-} PACKED gdt;
+} PACKED Gdt;
+
+#define MSR_GS_BASE     0xC0000101
+
+/* Double-fault stack size (TSS IST1) */
+#define DF_STACK_SIZE   4096
 
-static Tss tss;
-static GdtPointer gdt_ptr;
+/*
+ * One GDT and TSS per CPU: a busy TSS descriptor cannot be loaded by
+ * a second CPU, and each CPU needs its own IST stacks.
+ */
+static Gdt gdts[SMP_MAX_CPUS];
+static Tss tss[SMP_MAX_CPUS];
+static GdtPointer gdt_ptrs[SMP_MAX_CPUS];
+static uint8_t df_stacks[SMP_MAX_CPUS][DF_STACK_SIZE] __attribute__((aligned(16)));
 
 /*
  * Load GDT
@@ -132,49 +144,63 @@ static void gdt_set_tss(TssEntry *entry, uint64_t base, uint32_t limit)
 }
 
 /*
- * Initialize GDT
+ * Initialize GDT (BSP)
  */
 void gdt_init(void)
 {
+    gdt_init_cpu(0);
+}
+
+/*
+ * Build and load the GDT and TSS of one CPU
+ */
+void gdt_init_cpu(uint32_t cpu)
+{
+    Gdt *g = &gdts[cpu];
+    Tss *t = &tss[cpu];
+
     /* Clear structures */
-    memset(&gdt, 0, sizeof(gdt));
-    memset(&tss, 0, sizeof(tss));
+    memset(g, 0, sizeof(*g));
+    memset(t, 0, sizeof(*t));
 
     /* Null descriptor */
-    gdt_set_entry(&gdt.null, 0, 0);
+    gdt_set_entry(&g->null, 0, 0);
 
     /* Kernel code (64-bit, ring 0) */
     /* Access: Present(1) DPL(00) Type(1) Code(1) Conform(0) Read(1) Accessed(0) */
     /* = 0b10011010 = 0x9A */
     /* Granularity: Long mode (L=1, D=0), granularity doesn't matter */
     /* = 0b00100000 = 0x20 */
-    gdt_set_entry(&gdt.kernel_code, 0x9A, 0x20);
+    gdt_set_entry(&g->kernel_code, 0x9A, 0x20);
 
     /* Kernel data (64-bit, ring 0) */
     /* Access: Present(1) DPL(00) Type(1) Data(0) Direction(0) Write(1) Accessed(0) */
     /* = 0b10010010 = 0x92 */
-    gdt_set_entry(&gdt.kernel_data, 0x92, 0x00);
+    gdt_set_entry(&g->kernel_data, 0x92, 0x00);
 
     /* User data (64-bit, ring 3) */
     /* Access: Present(1) DPL(11) Type(1) Data(0) Direction(0) Write(1) Accessed(0) */
     /* = 0b11110010 = 0xF2 */
-    gdt_set_entry(&gdt.user_data, 0xF2, 0x00);
+    gdt_set_entry(&g->user_data, 0xF2, 0x00);
 
     /* User code (64-bit, ring 3) */
     /* Access: Present(1) DPL(11) Type(1) Code(1) Conform(0) Read(1) Accessed(0) */
     /* = 0b11111010 = 0xFA */
-    gdt_set_entry(&gdt.user_code, 0xFA, 0x20);
+    gdt_set_entry(&g->user_code, 0xFA, 0x20);
 
     /* TSS */
-    tss.iopb_offset = sizeof(Tss);
-    gdt_set_tss(&gdt.tss, (uint64_t)&tss, sizeof(Tss) - 1);
+    t->iopb_offset = sizeof(Tss);
+    t->ist1 = (uint64_t)&df_stacks[cpu][DF_STACK_SIZE];
+    gdt_set_tss(&g->tss, (uint64_t)t, sizeof(Tss) - 1);
 
     /* Set up GDT pointer */
-    gdt_ptr.limit = sizeof(gdt) - 1;
-    gdt_ptr.base = (uint64_t)&gdt;
+    gdt_ptrs[cpu].limit = sizeof(Gdt) - 1;
+    gdt_ptrs[cpu].base = (uint64_t)g;
 
-    /* Load GDT */
-    gdt_load(&gdt_ptr);
+    /* Load GDT; reloading GS clears its base, which points at PerCpu */
+    uint64_t gs_base = rdmsr(MSR_GS_BASE);
+    gdt_load(&gdt_ptrs[cpu]);
+    wrmsr(MSR_GS_BASE, gs_base);
 
     /* Load TSS */
     tss_load(GDT_TSS);
@@ -185,5 +211,5 @@ void gdt_init(void)
  */
 void gdt_set_kernel_stack(uint64_t stack)
 {
-    tss.rsp0 = stack;
+    tss[smp_cpu_id()].rsp0 = stack;
 }
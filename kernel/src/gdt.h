@@ -16,9 +16,12 @@
 #define GDT_USER_CODE       0x20
 #define GDT_TSS             0x28
 
-/* Initialize GDT */
+/* Initialize GDT (BSP) */
 void gdt_init(void);
 
+/* Build and load the GDT and TSS of one CPU (0 = BSP) */
+void gdt_init_cpu(uint32_t cpu);
+
 /* Set TSS RSP0 (kernel stack for interrupts from usermode) */
 void gdt_set_kernel_stack(uint64_t stack);
 
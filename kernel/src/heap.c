@@ -0,0 +1,520 @@
+/*
+ * ojjyOS v3 Kernel - Kernel Heap Implementation
+ *
+ * Each cache carves naturally aligned PMM blocks (slabs) into equal
+ * objects. The slab header sits at the start of the block, so an object's
+ * slab is found by masking its address. Free objects are chained through
+ * their first word. kmalloc prefixes a small header recording the size
+ * class; requests larger than the biggest class go straight to the PMM.
+ */
+
+#include "heap.h"
+#include "memory.h"
+#include "serial.h"
+#include "string.h"
+#include "console.h"
+#include "spinlock.h"
+
+#define SLAB_MAGIC          0x51AB51ABU
+#define KMALLOC_MAGIC       0x6B6D616CU     /* "kmal" */
+#define KMALLOC_LARGE       0xFFFF
+
+/* Object alignment and slab header alignment */
+#define HEAP_ALIGN          16
+#define SLAB_HEADER_ALIGN   64
+
+/* Slab sizing: keep waste under 1/8 of the slab where possible */
+#define SLAB_MIN_OBJECTS    8
+#define SLAB_WASTE_SHIFT    3
+
+/* kmalloc size classes (object size includes the header) */
+#define KMALLOC_MIN_SHIFT   5       /* 32 bytes */
+#define KMALLOC_MAX_SHIFT   11      /* 2048 bytes */
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+typedef struct Slab {
+    uint32_t magic;
+    uint32_t in_use;
+    KmemCache *cache;
+    struct Slab *next;
+    struct Slab *prev;
+    void *free_list;
+} Slab;
+
+struct KmemCache {
+    TicketLock lock;            /* Slab lists and counters */
+    const char *name;
+    uint32_t object_size;
+    uint32_t slab_order;
+    uint32_t objects_per_slab;
+    uint32_t first_offset;      /* Offset of object 0 from slab start */
+    Slab *partial;              /* Slabs with at least one free object */
+    Slab *full;                 /* Slabs with no free objects */
+    uint32_t slabs;
+    uint32_t empty_slabs;       /* Completely free slabs kept on partial */
+    uint64_t active;
+    uint64_t peak;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+};
+
+/* Header in front of every kmalloc allocation */
+typedef struct {
+    uint32_t magic;
+    uint16_t size_class;        /* Index into kmalloc_caches, or KMALLOC_LARGE */
+    uint16_t order;             /* PMM order for large allocations */
+    uint64_t size;              /* Requested size */
+} KmallocHeader;
+
+static KmemCache cache_table[HEAP_MAX_CACHES];
+static int cache_count = 0;
+
+static KmemCache *kmalloc_caches[KMALLOC_CLASSES];
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+/* Large (direct PMM) allocation stats */
+static Spinlock large_lock = SPINLOCK_INIT;
+static uint64_t large_active = 0;
+static uint64_t large_bytes = 0;
+static uint64_t large_allocs = 0;
+
+static bool heap_ready = false;
+
+/*
+ * Slab list helpers
+ */
+static void slab_list_add(Slab **head, Slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(Slab **head, Slab *slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/*
+ * Pick the smallest slab order that wastes little space
+ */
+static void cache_choose_layout(KmemCache *cache)
+{
+    uint32_t best_order = PMM_MAX_ORDER;
+    uint32_t best_waste = 0xFFFFFFFF;
+
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint64_t slab_bytes = (uint64_t)PAGE_SIZE << order;
+        if (slab_bytes < cache->first_offset + cache->object_size) {
+            continue;
+        }
+
+        uint64_t count = (slab_bytes - cache->first_offset) / cache->object_size;
+        uint64_t waste = slab_bytes - cache->first_offset - count * cache->object_size;
+
+        if (count >= SLAB_MIN_OBJECTS || waste <= (slab_bytes >> SLAB_WASTE_SHIFT)) {
+            best_order = order;
+            break;
+        }
+        /* Track the least wasteful fallback relative to slab size */
+        uint32_t waste_pct = (uint32_t)((waste * 100) / slab_bytes);
+        if (waste_pct < best_waste) {
+            best_waste = waste_pct;
+            best_order = order;
+        }
+    }
+
+    cache->slab_order = best_order;
+    cache->objects_per_slab = (uint32_t)((((uint64_t)PAGE_SIZE << best_order) -
+        cache->first_offset) / cache->object_size);
+}
+
+/*
+ * Get a new slab from the PMM and thread its free list
+ */
+static Slab *cache_grow(KmemCache *cache)
+{
+    uint64_t addr = pmm_alloc_pages(cache->slab_order, 0);
+    if (!addr) {
+        return NULL;
+    }
+
+    Slab *slab = (Slab *)addr;
+    slab->magic = SLAB_MAGIC;
+    slab->in_use = 0;
+    slab->cache = cache;
+    slab->free_list = NULL;
+
+    /* Push objects in reverse so allocation walks forward through memory */
+    uint8_t *base = (uint8_t *)addr + cache->first_offset;
+    for (int i = (int)cache->objects_per_slab - 1; i >= 0; i--) {
+        void **obj = (void **)(base + (uint64_t)i * cache->object_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    slab_list_add(&cache->partial, slab);
+    cache->slabs++;
+    cache->empty_slabs++;
+    return slab;
+}
+
+/*
+ * Initialize the heap
+ */
+void heap_init(void)
+{
+    serial_printf("[HEAP] Initializing slab allocator...\n");
+
+    memset(cache_table, 0, sizeof(cache_table));
+    cache_count = 0;
+    large_active = 0;
+    large_bytes = 0;
+    large_allocs = 0;
+    heap_ready = true;
+
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i],
+            (size_t)1 << (KMALLOC_MIN_SHIFT + i));
+    }
+
+    serial_printf("[HEAP] %d kmalloc classes (%d-%d bytes), larger requests use PMM blocks\n",
+        KMALLOC_CLASSES, 1 << KMALLOC_MIN_SHIFT, 1 << KMALLOC_MAX_SHIFT);
+}
+
+/*
+ * Create a slab cache
+ */
+KmemCache *kmem_cache_create(const char *name, size_t object_size)
+{
+    if (!heap_ready || cache_count >= HEAP_MAX_CACHES || object_size == 0) {
+        serial_printf("[HEAP] ERROR: Cannot create cache '%s'\n", name ? name : "?");
+        return NULL;
+    }
+
+    KmemCache *cache = &cache_table[cache_count];
+    memset(cache, 0, sizeof(*cache));
+    ticket_init(&cache->lock);
+    cache->name = name ? name : "cache";
+    cache->object_size = (uint32_t)ALIGN_UP(MAX(object_size, sizeof(void *)), HEAP_ALIGN);
+    cache->first_offset = ALIGN_UP(sizeof(Slab), SLAB_HEADER_ALIGN);
+
+    if ((uint64_t)cache->first_offset + cache->object_size > ((uint64_t)PAGE_SIZE << PMM_MAX_ORDER)) {
+        serial_printf("[HEAP] ERROR: Object size %d too large for cache '%s'\n",
+            (uint64_t)object_size, cache->name);
+        return NULL;
+    }
+
+    cache_choose_layout(cache);
+    cache_count++;
+
+    serial_printf("[HEAP] Cache '%s': %d bytes, order %d slabs, %d objects/slab\n",
+        cache->name, (uint64_t)cache->object_size, (uint64_t)cache->slab_order,
+        (uint64_t)cache->objects_per_slab);
+    return cache;
+}
+
+/*
+ * Take an object from a cache, contents undefined
+ */
+static void *cache_take(KmemCache *cache)
+{
+    if (!cache) return NULL;
+
+    uint64_t irq = ticket_lock_irqsave(&cache->lock);
+    Slab *slab = cache->partial;
+    if (!slab) {
+        slab = cache_grow(cache);
+        if (!slab) {
+            cache->failures++;
+            ticket_unlock_irqrestore(&cache->lock, irq);
+            serial_printf("[HEAP] ERROR: Cache '%s' out of memory\n", cache->name);
+            return NULL;
+        }
+    }
+
+    void **obj = (void **)slab->free_list;
+    slab->free_list = *obj;
+
+    if (slab->in_use == 0) {
+        cache->empty_slabs--;
+    }
+    slab->in_use++;
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->active++;
+    cache->allocs++;
+    if (cache->active > cache->peak) {
+        cache->peak = cache->active;
+    }
+    ticket_unlock_irqrestore(&cache->lock, irq);
+    return obj;
+}
+
+/*
+ * Allocate a zeroed object from a cache
+ */
+void *kmem_cache_alloc(KmemCache *cache)
+{
+    void *obj = cache_take(cache);
+    if (obj) {
+        memset(obj, 0, cache->object_size);
+    }
+    return obj;
+}
+
+/*
+ * Return an object to its cache
+ */
+void kmem_cache_free(KmemCache *cache, void *obj)
+{
+    if (!cache || !obj) return;
+
+    uint64_t slab_bytes = (uint64_t)PAGE_SIZE << cache->slab_order;
+    Slab *slab = (Slab *)((uint64_t)obj & ~(slab_bytes - 1));
+
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        serial_printf("[HEAP] WARNING: Bad free of 0x%p to cache '%s'\n", obj, cache->name);
+        return;
+    }
+
+    uint64_t irq = ticket_lock_irqsave(&cache->lock);
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+
+    cache->active--;
+    cache->frees++;
+
+    /* Keep one empty slab around to absorb alloc/free churn */
+    bool release = false;
+    if (slab->in_use == 0) {
+        if (cache->empty_slabs > 0) {
+            slab_list_remove(&cache->partial, slab);
+            slab->magic = 0;
+            cache->slabs--;
+            release = true;
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+    ticket_unlock_irqrestore(&cache->lock, irq);
+
+    if (release) {
+        pmm_free_pages((uint64_t)slab, cache->slab_order);
+    }
+}
+
+/*
+ * Size class index for a total (header-inclusive) size, or -1 if too large
+ */
+static int kmalloc_class(size_t total)
+{
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        if (total <= ((size_t)1 << (KMALLOC_MIN_SHIFT + i))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * General purpose allocation
+ */
+void *kmalloc(size_t size)
+{
+    if (size == 0 || !heap_ready) return NULL;
+
+    size_t total = size + sizeof(KmallocHeader);
+    KmallocHeader *hdr;
+
+    int cls = kmalloc_class(total);
+    if (cls >= 0) {
+        hdr = (KmallocHeader *)cache_take(kmalloc_caches[cls]);
+        if (!hdr) return NULL;
+        hdr->size_class = (uint16_t)cls;
+        hdr->order = 0;
+    } else {
+        uint32_t order = 0;
+        while (order <= PMM_MAX_ORDER && ((uint64_t)PAGE_SIZE << order) < total) {
+            order++;
+        }
+        if (order > PMM_MAX_ORDER) {
+            serial_printf("[HEAP] ERROR: kmalloc(%d) exceeds largest block\n", (uint64_t)size);
+            return NULL;
+        }
+
+        hdr = (KmallocHeader *)pmm_alloc_pages(order, 0);
+        if (!hdr) return NULL;
+        hdr->size_class = KMALLOC_LARGE;
+        hdr->order = (uint16_t)order;
+
+        uint64_t irq = spin_lock_irqsave(&large_lock);
+        large_active++;
+        large_allocs++;
+        large_bytes += (uint64_t)PAGE_SIZE << order;
+        spin_unlock_irqrestore(&large_lock, irq);
+    }
+
+    hdr->magic = KMALLOC_MAGIC;
+    hdr->size = size;
+    return hdr + 1;
+}
+
+/*
+ * Zeroed allocation
+ */
+void *kzalloc(size_t size)
+{
+    void *ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/*
+ * Usable bytes behind a kmalloc header
+ */
+static size_t kmalloc_usable(KmallocHeader *hdr)
+{
+    if (hdr->size_class == KMALLOC_LARGE) {
+        return ((size_t)PAGE_SIZE << hdr->order) - sizeof(KmallocHeader);
+    }
+    return ((size_t)1 << (KMALLOC_MIN_SHIFT + hdr->size_class)) - sizeof(KmallocHeader);
+}
+
+/*
+ * Resize an allocation
+ */
+void *krealloc(void *ptr, size_t size)
+{
+    if (!ptr) return kmalloc(size);
+    if (size == 0) {
+        kfree(ptr);
+        return NULL;
+    }
+
+    KmallocHeader *hdr = (KmallocHeader *)ptr - 1;
+    if (hdr->magic != KMALLOC_MAGIC) {
+        serial_printf("[HEAP] WARNING: krealloc of invalid pointer 0x%p\n", ptr);
+        return NULL;
+    }
+
+    /* Still fits in the current block */
+    if (size <= kmalloc_usable(hdr)) {
+        hdr->size = size;
+        return ptr;
+    }
+
+    void *new_ptr = kmalloc(size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, hdr->size);
+    kfree(ptr);
+    return new_ptr;
+}
+
+/*
+ * Free a kmalloc allocation
+ */
+void kfree(void *ptr)
+{
+    if (!ptr) return;
+
+    KmallocHeader *hdr = (KmallocHeader *)ptr - 1;
+    if (hdr->magic != KMALLOC_MAGIC) {
+        serial_printf("[HEAP] WARNING: kfree of invalid pointer 0x%p\n", ptr);
+        return;
+    }
+    hdr->magic = 0;
+
+    if (hdr->size_class == KMALLOC_LARGE) {
+        uint64_t irq = spin_lock_irqsave(&large_lock);
+        large_active--;
+        large_bytes -= (uint64_t)PAGE_SIZE << hdr->order;
+        spin_unlock_irqrestore(&large_lock, irq);
+        pmm_free_pages((uint64_t)hdr, hdr->order);
+    } else if (hdr->size_class < KMALLOC_CLASSES) {
+        kmem_cache_free(kmalloc_caches[hdr->size_class], hdr);
+    }
+}
+
+/*
+ * Statistics
+ */
+int heap_get_cache_count(void)
+{
+    return cache_count;
+}
+
+bool heap_get_cache_stats(int index, KmemCacheStats *stats)
+{
+    if (index < 0 || index >= cache_count || !stats) return false;
+
+    KmemCache *cache = &cache_table[index];
+    stats->name = cache->name;
+    stats->object_size = cache->object_size;
+    stats->slab_order = cache->slab_order;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->slabs = cache->slabs;
+    stats->active = cache->active;
+    stats->peak = cache->peak;
+    stats->allocs = cache->allocs;
+    stats->frees = cache->frees;
+    stats->failures = cache->failures;
+    return true;
+}
+
+void heap_print_stats(void)
+{
+    console_printf("\n=== Kernel Heap ===\n");
+
+    uint64_t slab_bytes_total = 0;
+    for (int i = 0; i < cache_count; i++) {
+        KmemCache *cache = &cache_table[i];
+        uint64_t slab_bytes = (uint64_t)cache->slabs * ((uint64_t)PAGE_SIZE << cache->slab_order);
+        slab_bytes_total += slab_bytes;
+
+        /* Skip idle kmalloc classes to keep the listing short */
+        if (cache->allocs == 0) continue;
+
+        uint64_t capacity = (uint64_t)cache->slabs * cache->objects_per_slab;
+        console_printf("  %s (%d B): %d/%d used, peak %d, %d slabs (%d KB)\n",
+            cache->name, (int)cache->object_size, (int)cache->active, (int)capacity,
+            (int)cache->peak, (int)cache->slabs, (int)(slab_bytes / 1024));
+        if (cache->failures > 0) {
+            console_printf("    allocation failures: %d\n", (int)cache->failures);
+        }
+    }
+
+    console_printf("  Large blocks: %d live (%d KB), %d total\n",
+        (int)large_active, (int)(large_bytes / 1024), (int)large_allocs);
+    console_printf("  Slab memory:  %d KB in %d caches\n",
+        (int)(slab_bytes_total / 1024), cache_count);
+}
@@ -0,0 +1,62 @@
+/*
+ * ojjyOS v3 Kernel - Kernel Heap
+ *
+ * Slab caches for fixed-size objects and a general kmalloc/kfree
+ * built on power-of-two size classes, all backed by the PMM.
+ */
+
+#ifndef _OJJY_HEAP_H
+#define _OJJY_HEAP_H
+
+#include "types.h"
+
+/* Maximum number of slab caches (named caches + kmalloc size classes) */
+#define HEAP_MAX_CACHES     32
+
+/* Opaque slab cache */
+typedef struct KmemCache KmemCache;
+
+/* Per-cache usage statistics */
+typedef struct {
+    const char *name;
+    uint32_t object_size;       /* Bytes per object (after alignment) */
+    uint32_t slab_order;        /* PMM order of each slab */
+    uint32_t objects_per_slab;
+    uint32_t slabs;             /* Slabs currently held */
+    uint64_t active;            /* Objects handed out */
+    uint64_t peak;              /* High-water mark of active */
+    uint64_t allocs;            /* Total successful allocations */
+    uint64_t frees;             /* Total frees */
+    uint64_t failures;          /* Allocations that could not get a slab */
+} KmemCacheStats;
+
+/* Initialize the heap (call after pmm_init) */
+void heap_init(void);
+
+/* Create a cache for objects of a fixed size (NULL if the table is full) */
+KmemCache *kmem_cache_create(const char *name, size_t object_size);
+
+/* Allocate a zeroed object from a cache */
+void *kmem_cache_alloc(KmemCache *cache);
+
+/* Return an object to its cache */
+void kmem_cache_free(KmemCache *cache, void *obj);
+
+/* General purpose allocation (16-byte aligned, not zeroed) */
+void *kmalloc(size_t size);
+
+/* Zeroed allocation */
+void *kzalloc(size_t size);
+
+/* Resize an allocation, preserving contents (like realloc) */
+void *krealloc(void *ptr, size_t size);
+
+/* Free memory from kmalloc/kzalloc/krealloc (NULL is ignored) */
+void kfree(void *ptr);
+
+/* Statistics */
+int heap_get_cache_count(void);
+bool heap_get_cache_stats(int index, KmemCacheStats *stats);
+void heap_print_stats(void);
+
+#endif /* _OJJY_HEAP_H */
@@ -8,6 +8,9 @@
 #include "gdt.h"
 #include "serial.h"
 #include "panic.h"
+#include "lapic.h"
+#include "sched.h"
+#include "drivers/driver.h"
 
 /* IDT entry structure */
 typedef struct {
@@ -119,6 +122,11 @@ extern void isr_stub_45(void);
 extern void isr_stub_46(void);
 extern void isr_stub_47(void);
 
+/* Local APIC stubs */
+extern void isr_stub_240(void);
+extern void isr_stub_241(void);
+extern void isr_stub_255(void);
+
 /* Stub table */
 static void (*isr_stubs[48])(void) = {
     isr_stub_0,  isr_stub_1,  isr_stub_2,  isr_stub_3,
@@ -211,6 +219,9 @@ void pic_enable_irq(uint8_t irq)
     } else {
         port = PIC2_DATA;
         irq -= 8;
+
+        /* Slave lines only reach the CPU through the cascade (IRQ 2) */
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << 2));
     }
 
     value = inb(port) & ~(1 << irq);
@@ -249,6 +260,7 @@ void isr_handler(InterruptFrame *frame)
     } else if (int_num < 32) {
         /* Unhandled CPU exception - panic */
         const char *name = (int_num < 21) ? exception_names[int_num] : "Unknown";
+        serial_sync();
         serial_printf("[PANIC] Exception %d: %s\n", int_num, name);
         serial_printf("  Error code: 0x%x\n", frame->error_code);
         serial_printf("  RIP: 0x%p\n", frame->rip);
@@ -258,14 +270,26 @@ void isr_handler(InterruptFrame *frame)
         serial_printf("  SS:  0x%x\n", frame->ss);
 
         panic_with_frame(name, frame);
+    } else if (int_num >= IRQ_BASE && int_num < IRQ_BASE + 16) {
+        /* Hardware IRQ - route to registered drivers */
+        if (!driver_dispatch_irq(int_num - IRQ_BASE)) {
+            serial_printf("[WARN] Unhandled IRQ %d\n", int_num - IRQ_BASE);
+        }
     } else {
-        /* Unhandled IRQ */
-        serial_printf("[WARN] Unhandled IRQ %d\n", int_num - IRQ_BASE);
+        serial_printf("[WARN] Unhandled interrupt %d\n", int_num);
     }
 
-    /* Send EOI for hardware interrupts */
+    /* Send EOI for hardware interrupts (spurious APIC vectors take none) */
     if (int_num >= IRQ_BASE && int_num < IRQ_BASE + 16) {
         pic_eoi(int_num - IRQ_BASE);
+
+        /* Wake IRQ waiters; switch threads if a slice ran out or a wakeup preempts */
+        sched_irq_exit();
+    } else if (int_num >= INT_LAPIC_BASE && int_num != INT_LAPIC_SPURIOUS) {
+        lapic_eoi();
+
+        /* Timer events and wakeups from APs can make a thread runnable */
+        sched_irq_exit();
     }
 }
 
@@ -286,6 +310,12 @@ void idt_init(void)
         /* = 0b10001110 = 0x8E */
         idt_set_entry(i, (uint64_t)isr_stubs[i], 0x8E);
     }
+    idt_set_entry(INT_IPI_WAKE, (uint64_t)isr_stub_240, 0x8E);
+    idt_set_entry(INT_LAPIC_TIMER, (uint64_t)isr_stub_241, 0x8E);
+    idt_set_entry(INT_LAPIC_SPURIOUS, (uint64_t)isr_stub_255, 0x8E);
+
+    /* Double faults run on a known-good stack (TSS IST1, see gdt.c) */
+    idt[INT_DOUBLE_FAULT].ist = 1;
 
     /* Remap PIC */
     pic_remap();
@@ -298,12 +328,19 @@ void idt_init(void)
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base = (uint64_t)&idt;
 
-    /* Load IDT */
-    __asm__ volatile("lidt (%0)" : : "r"(&idt_ptr));
+    idt_load();
 
     serial_printf("[IDT] Initialized with %d entries\n", IDT_ENTRIES);
 }
 
+/*
+ * Load IDT (every CPU shares the same table)
+ */
+void idt_load(void)
+{
+    __asm__ volatile("lidt (%0)" : : "r"(&idt_ptr));
+}
+
 /*
  * Register an interrupt handler
  */
@@ -44,6 +44,12 @@
 #define IRQ_RTC             8
 #define IRQ_MOUSE           12  /* IRQ 12 -> INT 44 */
 
+/* Local APIC vectors (EOI goes to the local APIC, not the PIC) */
+#define INT_LAPIC_BASE      0xF0
+#define INT_IPI_WAKE        0xF0    /* smp_call() doorbell */
+#define INT_LAPIC_TIMER     0xF1    /* BSP timer events (timer.c) */
+#define INT_LAPIC_SPURIOUS  0xFF
+
 /* Interrupt frame passed to handlers */
 typedef struct {
     /* Pushed by our stub */
@@ -68,6 +74,9 @@ typedef void (*InterruptHandler)(InterruptFrame *frame);
 /* Initialize IDT */
 void idt_init(void);
 
+/* Load the shared IDT on an application processor */
+void idt_load(void);
+
 /* Register an interrupt handler */
 void idt_register_handler(uint8_t vector, InterruptHandler handler);
 
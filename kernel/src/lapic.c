@@ -0,0 +1,245 @@
+/*
+ * ojjyOS v3 Kernel - Local APIC Implementation
+ */
+
+#include "lapic.h"
+#include "idt.h"
+#include "paging.h"
+#include "serial.h"
+
+/* IA32_APIC_BASE */
+#define MSR_APIC_BASE           0x1B
+#define APIC_BASE_BSP           (1ULL << 8)
+#define APIC_BASE_X2APIC        (1ULL << 10)
+#define APIC_BASE_ENABLE        (1ULL << 11)
+
+/* x2APIC registers are MSRs at 0x800 + (xAPIC offset >> 4) */
+#define MSR_X2APIC_BASE         0x800
+
+/* Register offsets */
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ESR               0x280
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INITIAL     0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+/* IA32_TSC_DEADLINE */
+#define MSR_TSC_DEADLINE        0x6E0
+
+/* Spurious vector register */
+#define SVR_ENABLE              0x100
+
+/* LVT bits */
+#define LVT_MASKED              0x10000
+#define LVT_DELIVERY_NMI        0x400
+#define LVT_DELIVERY_EXTINT     0x700
+#define LVT_TIMER_TSC_DEADLINE  0x40000     /* Timer mode 2 (mode 0 = one-shot) */
+
+/* Timer divide configuration: divide by 16 */
+#define TIMER_DIVIDE_16         0x3
+
+/* ICR bits */
+#define ICR_FIXED               0x00000
+#define ICR_NMI                 0x00400
+#define ICR_INIT                0x00500
+#define ICR_STARTUP             0x00600
+#define ICR_PENDING             0x01000     /* Delivery status (xAPIC) */
+#define ICR_ASSERT              0x04000
+#define ICR_LEVEL               0x08000
+#define ICR_ALL_BUT_SELF        0xC0000
+
+/* Polls of the delivery status bit before giving up on an IPI */
+#define ICR_SPINS               1000000
+
+static volatile uint32_t *lapic_mmio = NULL;
+static bool x2apic = false;
+static bool present = false;
+
+static uint32_t lapic_read(uint32_t reg)
+{
+    if (x2apic) {
+        return (uint32_t)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return lapic_mmio[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    lapic_mmio[reg / 4] = value;
+}
+
+/*
+ * Send an IPI. In x2APIC mode the ICR is one 64-bit MSR with the
+ * destination in the high half; xAPIC needs the high word first.
+ */
+static void lapic_send(uint32_t apic_id, uint32_t icr)
+{
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (LAPIC_ICR_LOW >> 4), ((uint64_t)apic_id << 32) | icr);
+        return;
+    }
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    for (int i = 0; i < ICR_SPINS && (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING); i++) {
+        __asm__ volatile("pause");
+    }
+}
+
+/*
+ * Software-enable the calling CPU's APIC
+ */
+static void lapic_enable(bool bsp)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | INT_LAPIC_SPURIOUS);
+
+    /* The BSP keeps taking 8259 interrupts through LINT0 */
+    lapic_write(LAPIC_LVT_LINT0, bsp ? LVT_DELIVERY_EXTINT : LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LVT_DELIVERY_NMI);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+
+    /* Clear stale errors (write, then read) */
+    lapic_write(LAPIC_ESR, 0);
+    (void)lapic_read(LAPIC_ESR);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void spurious_handler(InterruptFrame *frame)
+{
+    (void)frame;
+}
+
+bool lapic_init(uint64_t base)
+{
+    uint32_t edx;
+    cpuid(1, 0, NULL, NULL, NULL, &edx);
+    if (!(edx & (1U << 9))) {
+        serial_printf("[LAPIC] Not present\n");
+        return false;
+    }
+
+    uint64_t msr = rdmsr(MSR_APIC_BASE);
+    x2apic = (msr & APIC_BASE_X2APIC) != 0;
+
+    if (!x2apic) {
+        if (!base) {
+            base = msr & ~0xFFFULL;
+        }
+        /* Registers must be uncached */
+        if (paging_set_cache_mode(base, PAGE_SIZE, PAGE_CACHE_UC) != 0) {
+            serial_printf("[LAPIC] Cannot map registers at 0x%p\n", base);
+            return false;
+        }
+        lapic_mmio = (volatile uint32_t *)base;
+    }
+
+    if (!(msr & APIC_BASE_ENABLE)) {
+        wrmsr(MSR_APIC_BASE, msr | APIC_BASE_ENABLE);
+    }
+
+    idt_register_handler(INT_LAPIC_SPURIOUS, spurious_handler);
+    lapic_enable(true);
+    present = true;
+
+    serial_printf("[LAPIC] BSP APIC ID %d, version 0x%x, %s mode\n",
+        (uint64_t)lapic_id(), (uint64_t)(lapic_read(LAPIC_VERSION) & 0xFF),
+        x2apic ? "x2APIC" : "xAPIC");
+    return true;
+}
+
+void lapic_init_ap(void)
+{
+    uint64_t msr = rdmsr(MSR_APIC_BASE);
+    if (!(msr & APIC_BASE_ENABLE)) {
+        wrmsr(MSR_APIC_BASE, msr | APIC_BASE_ENABLE);
+    }
+    lapic_enable(false);
+}
+
+bool lapic_present(void)
+{
+    return present;
+}
+
+uint32_t lapic_id(void)
+{
+    uint32_t id = lapic_read(LAPIC_ID);
+    return x2apic ? id : id >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    lapic_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_send_nmi_others(void)
+{
+    if (present) {
+        lapic_send(0, ICR_NMI | ICR_ASSERT | ICR_ALL_BUT_SELF);
+    }
+}
+
+bool lapic_timer_has_tsc_deadline(void)
+{
+    uint32_t ecx;
+    cpuid(1, 0, NULL, NULL, &ecx, NULL);
+    return (ecx & (1U << 24)) != 0;
+}
+
+void lapic_timer_setup(uint8_t vector, bool tsc_deadline)
+{
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, vector | (tsc_deadline ? LVT_TIMER_TSC_DEADLINE : 0));
+}
+
+void lapic_timer_oneshot(uint32_t count)
+{
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+uint32_t lapic_timer_count(void)
+{
+    return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+void lapic_timer_deadline(uint64_t tsc)
+{
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    lapic_send(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+
+    /* Level de-assert: needed by old CPUs, not accepted in x2APIC mode */
+    if (!x2apic) {
+        lapic_send(apic_id, ICR_INIT | ICR_LEVEL);
+    }
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page)
+{
+    lapic_send(apic_id, ICR_STARTUP | ICR_ASSERT | page);
+}
@@ -0,0 +1,59 @@
+/*
+ * ojjyOS v3 Kernel - Local APIC
+ *
+ * Per-CPU local APIC: identification, EOI, inter-processor interrupts
+ * and the timer. xAPIC registers are used through MMIO; if the firmware
+ * left the APIC in x2APIC mode the same registers are reached through
+ * MSRs. Device IRQs still arrive through the 8259 PICs on the BSP
+ * (LINT0 in virtual-wire mode).
+ */
+
+#ifndef _OJJY_LAPIC_H
+#define _OJJY_LAPIC_H
+
+#include "types.h"
+
+/* Enable the BSP's local APIC at the MADT's base address */
+bool lapic_init(uint64_t base);
+
+/* Enable the local APIC of the calling AP */
+void lapic_init_ap(void);
+
+/* True once lapic_init() succeeded */
+bool lapic_present(void);
+
+/* APIC ID of the calling CPU */
+uint32_t lapic_id(void);
+
+/* Signal end of interrupt for a local APIC vector */
+void lapic_eoi(void);
+
+/* Fixed-vector IPI to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/* NMI to every CPU except the caller */
+void lapic_send_nmi_others(void);
+
+/* True if the CPU supports the TSC-deadline timer mode */
+bool lapic_timer_has_tsc_deadline(void);
+
+/*
+ * Point the calling CPU's timer at a vector, in TSC-deadline mode or
+ * else one-shot (counting at the bus clock / 16). The timer is stopped.
+ */
+void lapic_timer_setup(uint8_t vector, bool tsc_deadline);
+
+/* One-shot mode: start counting down from count (0 stops the timer) */
+void lapic_timer_oneshot(uint32_t count);
+
+/* One-shot mode: counts left */
+uint32_t lapic_timer_count(void);
+
+/* TSC-deadline mode: interrupt once the TSC reaches tsc (0 disarms) */
+void lapic_timer_deadline(uint64_t tsc);
+
+/* AP startup: INIT (assert + deassert), then STARTUP at page * 4KB */
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+#endif /* _OJJY_LAPIC_H */
@@ -13,10 +13,15 @@
 #include "gdt.h"
 #include "idt.h"
 #include "memory.h"
+#include "heap.h"
 #include "paging.h"
 #include "timer.h"
 #include "panic.h"
 #include "font.h"
+#include "trace.h"
+#include "smp.h"
+#include "sched.h"
+#include "task.h"
 
 /* Driver subsystem */
 #include "drivers/driver.h"
@@ -24,8 +29,10 @@
 #include "drivers/ps2_keyboard.h"
 #include "drivers/ps2_mouse.h"
 #include "drivers/ata.h"
+#include "drivers/ahci.h"
 #include "drivers/rtc.h"
 #include "drivers/block_cache.h"
+#include "drivers/block_queue.h"
 #include "drivers/diagnostics.h"
 
 /* Filesystem */
@@ -36,6 +43,7 @@
 
 /* UI compositor */
 #include "ui/compositor.h"
+#include "ui/services.h"
 
 /* Embedded filesystem (generated by mkfs.sh) */
 #include "fs/system_fs.h"
@@ -47,6 +55,12 @@ BootInfo *g_boot_info = NULL;
 #define OJJYOS_VERSION  "3.0.0-M2"
 #define OJJYOS_AUTHOR   "Jonas Lee"
 
+/* Longest the main thread sleeps without input (deferred console output) */
+#define MAIN_WAIT_MS            16
+
+/* Compositor thread wakeup period while the UI is off */
+#define COMPOSITOR_PERIOD_MS    8
+
 /* OJFS instance */
 static OjfsInstance *root_fs = NULL;
 
@@ -63,8 +77,12 @@ static size_t str_append(char *dest, size_t size, const char *src)
     return len + i;
 }
 
-/* UI state */
-static bool ui_mode = false;
+/*
+ * UI state. Compositor state belongs to whoever holds ui_lock: the main
+ * thread while it dispatches input, the compositor thread while it draws.
+ */
+static Mutex ui_lock = MUTEX_INIT;
+static volatile bool ui_mode = false;
 static bool ui_initialized = false;
 static bool ui_demo_created = false;
 
@@ -217,9 +235,137 @@ static void cmd_apps(void)
     console_printf("\n%d app(s) found\n\n", count);
 }
 
+/*
+ * Print a bytes-per-cycle figure given in hundredths
+ */
+static void print_bytes_per_cycle(const char *label, uint64_t centi)
+{
+    console_printf("  %s %d.%d%d B/cycle\n", label,
+        (int)(centi / 100), (int)((centi / 10) % 10), (int)(centi % 10));
+}
+
+/*
+ * Benchmark memcpy/memset at small, page and large sizes
+ */
+static void cmd_membench(void)
+{
+    static const uint64_t sizes[] = { 64, 4096, 4 * 1024 * 1024 };
+    static const char *labels[] = { "64 B", "4 KB", "4 MB" };
+
+    uint64_t src = pmm_alloc_pages(PMM_MAX_ORDER, 0);
+    uint64_t dst = pmm_alloc_pages(PMM_MAX_ORDER, 0);
+    if (!src || !dst) {
+        console_printf("membench: cannot allocate buffers\n");
+        if (src) pmm_free_pages(src, PMM_MAX_ORDER);
+        if (dst) pmm_free_pages(dst, PMM_MAX_ORDER);
+        return;
+    }
+
+    console_printf("\nMemory routines: %s\n",
+        string_uses_erms() ? "rep movsb/stosb (ERMS)" : "8-byte word loops");
+
+    for (int i = 0; i < 3; i++) {
+        uint64_t size = sizes[i];
+        /* Roughly 64 MB of traffic per measurement, at least 4 passes */
+        uint64_t iters = MAX((64ULL * 1024 * 1024) / size, 4);
+
+        memcpy((void *)dst, (const void *)src, size);   /* Warm up */
+        uint64_t start = rdtsc();
+        for (uint64_t n = 0; n < iters; n++) {
+            memcpy((void *)dst, (const void *)src, size);
+        }
+        uint64_t copy_cycles = rdtsc() - start;
+
+        start = rdtsc();
+        for (uint64_t n = 0; n < iters; n++) {
+            memset((void *)dst, (int)n, size);
+        }
+        uint64_t set_cycles = rdtsc() - start;
+
+        uint64_t bytes = size * iters;
+        console_printf("%s:\n", labels[i]);
+        print_bytes_per_cycle("memcpy:", copy_cycles ? (bytes * 100) / copy_cycles : 0);
+        print_bytes_per_cycle("memset:", set_cycles ? (bytes * 100) / set_cycles : 0);
+    }
+    console_printf("\n");
+
+    pmm_free_pages(src, PMM_MAX_ORDER);
+    pmm_free_pages(dst, PMM_MAX_ORDER);
+}
+
 /*
  * Show help
  */
+static void cmd_conbench(void)
+{
+    const int lines = 2000;
+    static const char text[] =
+        "The quick brown fox jumps over the lazy dog 0123456789 ABCDEFGHIJKLMNOP";
+
+    ConsoleStats before, after;
+    console_get_stats(&before);
+
+    /* Measure the console alone, not the serial line */
+    console_set_serial_mirror(false);
+    uint64_t start_ms = timer_get_ticks();
+    for (int i = 0; i < lines; i++) {
+        console_printf("%4d %s\n", i, text);
+    }
+    console_refresh(true);
+    uint64_t elapsed_ms = timer_get_ticks() - start_ms;
+    console_set_serial_mirror(true);
+
+    console_get_stats(&after);
+    uint64_t chars = after.chars - before.chars;
+    uint64_t cells = after.cells_drawn - before.cells_drawn;
+
+    console_printf("\nConsole: %d chars in %d ms", (int)chars, (int)elapsed_ms);
+    if (elapsed_ms > 0) {
+        console_printf(" (%d chars/s)", (int)((chars * 1000) / elapsed_ms));
+    }
+    console_printf("\n  %d cells drawn, %d refreshes, %d lines scrolled\n\n",
+        (int)cells, (int)(after.refreshes - before.refreshes),
+        (int)(after.scrolls - before.scrolls));
+}
+
+static void cmd_trace(char *arg)
+{
+    if (!arg || *arg == '\0') {
+        trace_dump();
+        return;
+    }
+
+    char *sub = NULL;
+    for (char *p = arg; *p; p++) {
+        if (*p == ' ') {
+            *p = '\0';
+            sub = p + 1;
+            while (*sub == ' ') sub++;
+            break;
+        }
+    }
+
+    if (strcmp(arg, "clear") == 0) {
+        trace_clear();
+        return;
+    }
+
+    if (strcmp(arg, "on") != 0 && strcmp(arg, "off") != 0) {
+        console_printf("Usage: trace [on|off [ata|cache|input|vfs] | clear]\n");
+        return;
+    }
+
+    int subsys = TRACE_SUBSYS_COUNT;
+    if (sub && *sub) {
+        subsys = trace_subsys_by_name(sub);
+        if (subsys < 0) {
+            console_printf("trace: unknown subsystem '%s'\n", sub);
+            return;
+        }
+    }
+    trace_enable((TraceSubsys)subsys, strcmp(arg, "on") == 0);
+}
+
 static void cmd_help(void)
 {
     console_printf("\nCommands:\n");
@@ -230,9 +376,16 @@ static void cmd_help(void)
     console_printf("  ui [dark]      - Start Tahoe UI demo\n");
     console_printf("  about          - Show About ojjyOS\n");
     console_printf("  diag           - Show diagnostics\n");
-    console_printf("  time           - Show current time\n");
+    console_printf("  membench       - Benchmark memcpy/memset\n");
+    console_printf("  cpus           - Show processors\n");
+    console_printf("  threads        - Show kernel threads\n");
+    console_printf("  tasks          - Show task pool statistics\n");
+    console_printf("  trace [cmd]    - Dump trace; on|off [subsys], clear\n");
+    console_printf("  conbench       - Benchmark console output\n");
+    console_printf("  time           - Show current time and clock source\n");
     console_printf("  tree           - Show filesystem tree\n");
     console_printf("  help           - Show this help\n");
+    console_printf("  (PgUp/PgDn scroll back through output)\n");
     console_printf("\n");
 }
 
@@ -241,6 +394,11 @@ static void cmd_help(void)
  */
 static void cmd_ui(const char *arg)
 {
+    /* Compose into RAM and present finished frames */
+    if (!fb_set_back_buffer(true)) {
+        serial_printf("[UI] Back buffer unavailable, drawing directly\n");
+    }
+
     if (!ui_initialized) {
         compositor_init(fb_get_width(), fb_get_height());
         ui_initialized = true;
@@ -262,10 +420,33 @@ static void cmd_ui(const char *arg)
     compositor_set_active_app("Finder");
     compositor_open_default_apps();
 
+    mutex_lock(&ui_lock);
     ui_mode = true;
+    mutex_unlock(&ui_lock);
     console_clear();
 }
 
+/*
+ * Compositor thread: draws frames while UI mode is on, sleeping until
+ * the exact time the next one is due
+ */
+static void compositor_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        uint64_t wake_ns = timer_get_ns() + COMPOSITOR_PERIOD_MS * NS_PER_MS;
+        if (ui_mode) {
+            mutex_lock(&ui_lock);
+            if (ui_mode) {
+                compositor_tick(timer_get_ticks());
+                wake_ns = compositor_next_frame_ns();
+            }
+            mutex_unlock(&ui_lock);
+        }
+        thread_sleep_until(wake_ns);
+    }
+}
+
 /*
  * Simple command parser
  */
@@ -313,10 +494,24 @@ static void process_command(void)
         about_app_handler(NULL);
     } else if (strcmp(cmd, "diag") == 0) {
         diagnostics_show();
+    } else if (strcmp(cmd, "membench") == 0) {
+        cmd_membench();
+    } else if (strcmp(cmd, "cpus") == 0) {
+        smp_print_info();
+    } else if (strcmp(cmd, "threads") == 0) {
+        sched_print_info();
+    } else if (strcmp(cmd, "tasks") == 0) {
+        task_print_stats();
+    } else if (strcmp(cmd, "conbench") == 0) {
+        cmd_conbench();
+    } else if (strcmp(cmd, "trace") == 0) {
+        cmd_trace(arg);
     } else if (strcmp(cmd, "time") == 0) {
         console_printf("\nTime: ");
         rtc_print_time();
         console_printf("\n");
+        timer_print_info();
+        console_printf("\n");
     } else if (strcmp(cmd, "tree") == 0) {
         if (root_fs) {
             ojfs_print_tree(root_fs);
@@ -406,6 +601,9 @@ void kernel_main(BootInfo *boot_info)
 {
     g_boot_info = boot_info;
 
+    /* Per-CPU data first: drawing code reads the CPU id through GS */
+    smp_init_bsp();
+
     /* Initialize serial first for debugging */
     serial_init(COM1_PORT);
     serial_printf("\n\n");
@@ -415,6 +613,10 @@ void kernel_main(BootInfo *boot_info)
     serial_printf("  Author:  %s\n", OJJYOS_AUTHOR);
     serial_printf("========================================\n\n");
 
+    string_init();
+    serial_printf("[BOOT] Memory routines: %s\n",
+        string_uses_erms() ? "rep movsb/stosb (ERMS)" : "8-byte word loops");
+
     serial_printf("[BOOT] Framebuffer: %dx%d @ 0x%p\n",
         boot_info->fb_width, boot_info->fb_height, boot_info->fb_addr);
 
@@ -445,11 +647,31 @@ void kernel_main(BootInfo *boot_info)
         (int)(pmm_get_total_memory() / (1024 * 1024)),
         (int)(pmm_get_free_memory() / (1024 * 1024)));
 
+    console_printf("Initializing kernel heap...\n");
+    heap_init();
+
     console_printf("Initializing paging...\n");
     paging_init();
 
+    /* The framebuffer BAR may sit above RAM on large-memory machines */
+    paging_identity_map(boot_info->fb_addr,
+                        (uint64_t)boot_info->fb_pitch * boot_info->fb_height);
+
+    /* Map the framebuffer write-combining and report the gain */
+    uint64_t fb_bw_before = fb_benchmark_fill(COLOR_CREAM);
+    if (paging_set_cache_mode(boot_info->fb_addr,
+                              (uint64_t)boot_info->fb_pitch * boot_info->fb_height,
+                              PAGE_CACHE_WC) == 0) {
+        uint64_t fb_bw_after = fb_benchmark_fill(COLOR_CREAM);
+        console_printf("  Framebuffer WC: %d -> %d bytes/kcycle\n",
+            (int)fb_bw_before, (int)fb_bw_after);
+        serial_printf("[BOOT] Framebuffer fill: %d -> %d bytes/kcycle\n",
+            (int)fb_bw_before, (int)fb_bw_after);
+    }
+
     console_printf("Initializing timer...\n");
     timer_init();
+    trace_init();
 
     /* Driver subsystem */
     console_printf("Initializing driver subsystem...\n");
@@ -460,9 +682,11 @@ void kernel_main(BootInfo *boot_info)
     input_set_mouse_bounds(fb_get_width(), fb_get_height());
 
     console_printf("Registering drivers...\n");
+    serial_driver_init();
     ps2_keyboard_init();
     ps2_mouse_init();
     ata_init();
+    ahci_init();    /* After ATA: the block cache uses the last ready disk */
     rtc_init();
 
     console_printf("Probing drivers...\n");
@@ -564,6 +788,22 @@ void kernel_main(BootInfo *boot_info)
     console_printf("Enabling interrupts...\n");
     interrupts_enable();
 
+    /* Start the other CPUs (the INIT/SIPI delays need the timer) */
+    console_printf("Starting application processors...\n");
+    smp_init();
+    console_printf("  %d CPU(s) online\n", (int)smp_cpu_count());
+
+    /* From here kernel_main is the high-priority "main" thread: input and shell */
+    console_printf("Starting threads...\n");
+    sched_init();
+    thread_create("compositor", compositor_main, NULL, PRIO_NORMAL);
+    block_cache_start_flusher();
+
+    /* The scheduler now arms the timer for its own deadlines */
+    if (timer_enable_tickless()) {
+        console_printf("  Tickless timer (local APIC)\n");
+    }
+
     /* Initialization complete */
     console_printf("\n========================================\n");
     console_printf("Kernel initialization complete!\n");
@@ -594,10 +834,12 @@ void kernel_main(BootInfo *boot_info)
             input_poll_event(&event);
 
             if (ui_mode) {
+                mutex_lock(&ui_lock);
                 switch (event.type) {
                     case INPUT_EVENT_KEY_PRESS:
                         if (event.key.keycode == KEY_ESCAPE && !compositor_overlay_active()) {
                             ui_mode = false;
+                            fb_set_back_buffer(false);
                             console_clear();
                             console_printf("Type 'help' for available commands.\n\n> ");
                             break;
@@ -616,10 +858,15 @@ void kernel_main(BootInfo *boot_info)
                     default:
                         break;
                 }
+                mutex_unlock(&ui_lock);
             } else {
                 switch (event.type) {
                     case INPUT_EVENT_KEY_PRESS:
-                        if (event.key.ascii) {
+                        if (event.key.keycode == KEY_PAGEUP || event.key.keycode == KEY_PAGEDOWN) {
+                            /* Scrollback, a screen at a time */
+                            int page = (int)(fb_get_height() / FONT_HEIGHT) - 1;
+                            console_scroll_view(event.key.keycode == KEY_PAGEUP ? page : -page);
+                        } else if (event.key.ascii) {
                             if (event.key.ascii == '\n') {
                                 console_putc('\n');
                                 process_command();
@@ -646,16 +893,19 @@ void kernel_main(BootInfo *boot_info)
             }
         }
 
-        if (ui_mode) {
-            compositor_tick(timer_get_ticks());
-        } else {
+        if (!ui_mode) {
             /* Update mouse cursor */
             int32_t mx, my;
             input_get_mouse_position(&mx, &my);
 
+            /* Deferred console output */
+            console_flush();
+
             if (mx != last_mx || my != last_my) {
                 if (last_mx >= 0 && last_my >= 0) {
-                    fb_fill_rect(last_mx, last_my, 12, 12, COLOR_CREAM);
+                    /* Repaint the text the cursor covered */
+                    console_invalidate(last_mx, last_my, 12, 12);
+                    console_refresh(true);
                 }
                 draw_cursor(mx, my);
                 last_mx = mx;
@@ -663,6 +913,7 @@ void kernel_main(BootInfo *boot_info)
             }
         }
 
-        __asm__ volatile("hlt");
+        /* Sleep until input arrives; the other threads run meanwhile */
+        input_wait(MAIN_WAIT_MS);
     }
 }
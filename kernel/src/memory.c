@@ -1,49 +1,168 @@
 /*
  * ojjyOS v3 Kernel - Physical Memory Manager Implementation
  *
- * Uses a bitmap to track free/used 4KB pages.
+ * Binary buddy allocator over 4KB pages, built from the UEFI memory map.
+ * Free blocks are kept on per-order lists whose links live inside the
+ * free blocks themselves; a byte per page records block heads. Memory
+ * below 4GB (DMA32) has its own set of lists: 4GB is a multiple of the
+ * largest block, so no block or buddy pair straddles the boundary.
  */
 
 #include "memory.h"
 #include "serial.h"
 #include "string.h"
+#include "spinlock.h"
 
-/* Bitmap for tracking physical pages */
-#define MAX_MEMORY_GB       4ULL
-#define MAX_MEMORY_BYTES    (MAX_MEMORY_GB * 1024ULL * 1024ULL * 1024ULL)
-#define MAX_PAGES           (MAX_MEMORY_BYTES / PAGE_SIZE)
-#define BITMAP_SIZE         (MAX_PAGES / 8)
+/* Low memory kept out of the allocator (legacy area + minimum kernel area) */
+#define RESERVED_LOW_BYTES  (4ULL * 1024 * 1024)
 
-/* Static bitmap (4GB max = 128KB bitmap) */
-static uint8_t page_bitmap[BITMAP_SIZE];
+/* Per-page state: block heads carry their order plus a free/allocated flag */
+#define PAGE_STATE_FREE     0x80
+#define PAGE_STATE_ALLOC    0x40
+#define PAGE_STATE_ORDER    0x3F
+
+/* Free block header, stored in the first bytes of the free block itself */
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+    struct FreeBlock *prev;
+} FreeBlock;
+
+/* End of kernel image including BSS (from linker.ld) */
+extern char _kernel_end[];
+
+/*
+ * Page state, one byte per 4KB page below max_pfn. Sized from the memory
+ * map at boot and placed in the first usable region large enough for it.
+ */
+static uint8_t *page_state = NULL;
+static uint64_t max_pfn = 0;
+static uint64_t meta_start_pfn = 0;
+static uint64_t meta_end_pfn = 0;
+static uint64_t reserved_end_pfn = 0;
+
+/* Memory map, kept for pmm_release_boot_services() */
+static BootInfo *boot_map = NULL;
+static bool boot_services_released = false;
+
+/* Zones: DMA32 allocations only search their own lists */
+#define ZONE_DMA32          0
+#define ZONE_NORMAL         1
+#define ZONE_COUNT          2
+#define DMA32_LIMIT_PFN     (PMM_DMA32_LIMIT / PAGE_SIZE)
+
+/* Buddy free lists, one per zone and order */
+static FreeBlock *free_lists[ZONE_COUNT][PMM_MAX_ORDER + 1];
+static uint64_t free_counts[ZONE_COUNT][PMM_MAX_ORDER + 1];
+
+/* Free lists, page state, zero pool and counters (IRQ-safe) */
+static TicketLock pmm_lock = TICKET_LOCK_INIT;
 
 /* Memory statistics */
 static uint64_t total_memory = 0;
 static uint64_t free_memory = 0;
-static uint64_t bitmap_pages = 0;
+static uint64_t managed_pages = 0;
+static uint64_t max_phys = 0;
 
 /*
- * Mark a page as used
+ * Pool of pre-zeroed single pages, refilled from the main loop's idle
+ * gaps so zeroed allocations don't pay for memset inline. Pool pages are
+ * taken from the buddy lists but still reported as free memory.
  */
-static void pmm_set_page_used(uint64_t page_index)
+#define ZERO_POOL_SIZE      512     /* 2MB */
+
+static uint64_t zero_pool[ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+static uint64_t zero_pool_hits = 0;
+static uint64_t zero_pool_misses = 0;
+static uint64_t zero_pool_filled = 0;
+
+static inline FreeBlock *pfn_to_block(uint64_t pfn)
 {
-    page_bitmap[page_index / 8] |= (1 << (page_index % 8));
+    return (FreeBlock *)(pfn * PAGE_SIZE);
+}
+
+static inline uint64_t block_to_pfn(FreeBlock *block)
+{
+    return (uint64_t)block / PAGE_SIZE;
+}
+
+static inline uint32_t pfn_zone(uint64_t pfn)
+{
+    return pfn < DMA32_LIMIT_PFN ? ZONE_DMA32 : ZONE_NORMAL;
 }
 
 /*
- * Mark a page as free
+ * Push a block onto its order's free list
  */
-static void pmm_set_page_free(uint64_t page_index)
+static void buddy_list_add(uint64_t pfn, uint32_t order)
 {
-    page_bitmap[page_index / 8] &= ~(1 << (page_index % 8));
+    uint32_t zone = pfn_zone(pfn);
+    FreeBlock *block = pfn_to_block(pfn);
+    block->prev = NULL;
+    block->next = free_lists[zone][order];
+    if (free_lists[zone][order]) {
+        free_lists[zone][order]->prev = block;
+    }
+    free_lists[zone][order] = block;
+    free_counts[zone][order]++;
+    page_state[pfn] = PAGE_STATE_FREE | order;
 }
 
 /*
- * Check if a page is used
+ * Unlink a block from its order's free list
  */
-static bool pmm_is_page_used(uint64_t page_index)
+static void buddy_list_remove(uint64_t pfn, uint32_t order)
 {
-    return (page_bitmap[page_index / 8] & (1 << (page_index % 8))) != 0;
+    uint32_t zone = pfn_zone(pfn);
+    FreeBlock *block = pfn_to_block(pfn);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[zone][order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    free_counts[zone][order]--;
+    page_state[pfn] = 0;
+}
+
+/*
+ * Return a block to the allocator, coalescing with free buddies
+ */
+static void buddy_free_block(uint64_t pfn, uint32_t order)
+{
+    free_memory += (PAGE_SIZE << order);
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (buddy >= max_pfn || page_state[buddy] != (PAGE_STATE_FREE | order)) {
+            break;
+        }
+        buddy_list_remove(buddy, order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+
+    buddy_list_add(pfn, order);
+}
+
+/*
+ * Hand a range of free pages [start, end) to the buddy allocator
+ */
+static void buddy_add_range(uint64_t start, uint64_t end)
+{
+    while (start < end) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (start & ((1ULL << (order + 1)) - 1)) == 0 &&
+               start + (1ULL << (order + 1)) <= end) {
+            order++;
+        }
+        buddy_free_block(start, order);
+        managed_pages += (1ULL << order);
+        start += (1ULL << order);
+    }
 }
 
 /*
@@ -98,15 +217,58 @@ void pmm_print_map(BootInfo *info)
     }
 }
 
+/*
+ * Memory types the allocator may hand out (boot services memory only
+ * once the firmware's page tables are no longer in use)
+ */
+static bool is_usable_type(uint32_t type)
+{
+    return type == EFI_CONVENTIONAL_MEMORY ||
+           type == EFI_BOOT_SERVICES_CODE ||
+           type == EFI_BOOT_SERVICES_DATA;
+}
+
+/*
+ * Add a usable range, skipping the page state array
+ */
+static void add_usable_range(uint64_t start, uint64_t end)
+{
+    if (start < meta_start_pfn) {
+        buddy_add_range(start, MIN(end, meta_start_pfn));
+    }
+    if (end > meta_end_pfn) {
+        buddy_add_range(MAX(start, meta_end_pfn), end);
+    }
+}
+
+/*
+ * Add the [start, end) pages of every map entry of one memory type
+ */
+static void add_type_ranges(uint32_t type)
+{
+    uint64_t entries = boot_map->mmap_size / boot_map->mmap_desc_size;
+    for (uint64_t i = 0; i < entries; i++) {
+        EfiMemoryDescriptor *desc = (EfiMemoryDescriptor *)(boot_map->mmap_addr +
+            i * boot_map->mmap_desc_size);
+        if (desc->type != type) continue;
+
+        uint64_t start_page = MAX(desc->phys_addr / PAGE_SIZE, reserved_end_pfn);
+        uint64_t end_page = desc->phys_addr / PAGE_SIZE + desc->num_pages;
+        if (start_page < end_page) {
+            add_usable_range(start_page, end_page);
+        }
+    }
+}
+
 /*
  * Initialize physical memory manager
  */
 void pmm_init(BootInfo *info)
 {
-    serial_printf("[PMM] Initializing physical memory manager...\n");
+    serial_printf("[PMM] Initializing buddy allocator...\n");
 
-    /* Clear bitmap (mark all pages as used initially) */
-    memset(page_bitmap, 0xFF, sizeof(page_bitmap));
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(free_counts, 0, sizeof(free_counts));
 
     uint64_t mmap_addr = info->mmap_addr;
     uint64_t mmap_size = info->mmap_size;
@@ -114,105 +276,260 @@ void pmm_init(BootInfo *info)
 
     uint64_t entries = mmap_size / desc_size;
 
-    /* First pass: calculate total memory and find usable regions */
+    /* Keep legacy low memory and the whole kernel image (including BSS) */
+    uint64_t reserved_end = ALIGN_UP((uint64_t)_kernel_end, PAGE_SIZE);
+    if (reserved_end < RESERVED_LOW_BYTES) {
+        reserved_end = RESERVED_LOW_BYTES;
+    }
+    reserved_end_pfn = reserved_end / PAGE_SIZE;
+    boot_map = info;
+
+    /* Pass 1: totals and the highest usable page */
     for (uint64_t i = 0; i < entries; i++) {
         EfiMemoryDescriptor *desc = (EfiMemoryDescriptor *)(mmap_addr + i * desc_size);
+        uint64_t end = desc->phys_addr + desc->num_pages * PAGE_SIZE;
 
-        uint64_t size = desc->num_pages * PAGE_SIZE;
-        total_memory += size;
-
-        /* Mark conventional memory (and boot services memory) as free */
-        if (desc->type == EFI_CONVENTIONAL_MEMORY ||
-            desc->type == EFI_BOOT_SERVICES_CODE ||
-            desc->type == EFI_BOOT_SERVICES_DATA) {
-
-            /* Mark each page as free */
-            uint64_t start_page = desc->phys_addr / PAGE_SIZE;
-            uint64_t end_page = start_page + desc->num_pages;
-
-            for (uint64_t page = start_page; page < end_page; page++) {
-                if (page < sizeof(page_bitmap) * 8) {
-                    pmm_set_page_free(page);
-                    free_memory += PAGE_SIZE;
-                }
-            }
+        total_memory += desc->num_pages * PAGE_SIZE;
+        max_phys = MAX(max_phys, end);
+        if (is_usable_type(desc->type)) {
+            max_pfn = MAX(max_pfn, end / PAGE_SIZE);
         }
     }
 
-    /* Reserve first 1MB (legacy area, BIOS, etc.) */
-    for (uint64_t page = 0; page < 256; page++) {
-        if (!pmm_is_page_used(page)) {
-            pmm_set_page_used(page);
-            free_memory -= PAGE_SIZE;
+    /* Pass 2: find a home for the page state array */
+    uint64_t meta_pages = ALIGN_UP(max_pfn, PAGE_SIZE) / PAGE_SIZE;
+    for (uint64_t i = 0; i < entries && !page_state; i++) {
+        EfiMemoryDescriptor *desc = (EfiMemoryDescriptor *)(mmap_addr + i * desc_size);
+        if (desc->type != EFI_CONVENTIONAL_MEMORY) continue;
+
+        uint64_t start = MAX(desc->phys_addr / PAGE_SIZE, reserved_end_pfn);
+        uint64_t end = desc->phys_addr / PAGE_SIZE + desc->num_pages;
+        if (start + meta_pages <= end) {
+            meta_start_pfn = start;
+            meta_end_pfn = start + meta_pages;
+            page_state = (uint8_t *)(meta_start_pfn * PAGE_SIZE);
         }
     }
 
-    /* Reserve kernel area (1MB - 4MB to be safe) */
-    for (uint64_t page = 256; page < 1024; page++) {
-        if (!pmm_is_page_used(page)) {
-            pmm_set_page_used(page);
-            free_memory -= PAGE_SIZE;
-        }
+    if (!page_state) {
+        serial_printf("[PMM] ERROR: No room for page state (%d pages)\n", meta_pages);
+        return;
     }
+    memset(page_state, 0, max_pfn);
 
-    bitmap_pages = sizeof(page_bitmap) * 8;
+    /*
+     * Pass 3: hand conventional memory to the buddy allocator. Boot
+     * services memory still holds the firmware's page tables, which
+     * stay live until paging_init() loads ours.
+     */
+    add_type_ranges(EFI_CONVENTIONAL_MEMORY);
 
     serial_printf("[PMM] Total memory: %d MB\n", total_memory / (1024 * 1024));
     serial_printf("[PMM] Free memory:  %d MB\n", free_memory / (1024 * 1024));
-    serial_printf("[PMM] Page bitmap covers %d pages\n", bitmap_pages);
+    serial_printf("[PMM] Reserved below 0x%p, managing %d pages up to 0x%p\n",
+        reserved_end, managed_pages, max_pfn * PAGE_SIZE);
+    serial_printf("[PMM] Page state: %d KB at 0x%p\n",
+        (meta_pages * PAGE_SIZE) / 1024, meta_start_pfn * PAGE_SIZE);
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        if (pmm_get_free_blocks(order)) {
+            serial_printf("[PMM]   order %d: %d free blocks (%d DMA32)\n", (uint64_t)order,
+                pmm_get_free_blocks(order), free_counts[ZONE_DMA32][order]);
+        }
+    }
 }
 
 /*
- * Allocate a physical page
+ * Add boot services code and data to the allocator
  */
-uint64_t pmm_alloc_page(void)
+void pmm_release_boot_services(void)
 {
-    /* Simple linear search for a free page */
-    for (uint64_t i = 0; i < sizeof(page_bitmap); i++) {
-        if (page_bitmap[i] != 0xFF) {
-            /* Found a byte with at least one free page */
-            for (int bit = 0; bit < 8; bit++) {
-                if (!(page_bitmap[i] & (1 << bit))) {
-                    /* Found a free page */
-                    uint64_t page_index = i * 8 + bit;
-                    pmm_set_page_used(page_index);
-                    free_memory -= PAGE_SIZE;
-
-                    uint64_t addr = page_index * PAGE_SIZE;
-
-                    /* Zero the page */
-                    memset((void *)addr, 0, PAGE_SIZE);
-
-                    return addr;
-                }
-            }
+    if (!page_state || boot_services_released) return;
+    boot_services_released = true;
+
+    uint64_t before = managed_pages;
+    uint64_t irq = ticket_lock_irqsave(&pmm_lock);
+    add_type_ranges(EFI_BOOT_SERVICES_CODE);
+    add_type_ranges(EFI_BOOT_SERVICES_DATA);
+    ticket_unlock_irqrestore(&pmm_lock, irq);
+
+    serial_printf("[PMM] Released %d KB of boot services memory\n",
+        ((managed_pages - before) * PAGE_SIZE) / 1024);
+}
+
+/*
+ * Take a block off the buddy lists (contents undefined). DMA32 requests
+ * use only the low zone; others prefer high memory to leave it for them.
+ */
+static uint64_t buddy_alloc(uint32_t order, bool dma32)
+{
+    /* Smallest non-empty list, at most PMM_MAX_ORDER + 1 per zone */
+    uint32_t current = order;
+    FreeBlock *block = NULL;
+    for (uint32_t zone = dma32 ? ZONE_DMA32 : ZONE_NORMAL; !block; zone--) {
+        for (current = order; current <= PMM_MAX_ORDER; current++) {
+            block = free_lists[zone][current];
+            if (block) break;
         }
+        if (zone == ZONE_DMA32) break;
     }
 
-    /* Out of memory */
-    serial_printf("[PMM] ERROR: Out of physical memory!\n");
-    return 0;
+    if (!block) {
+        return 0;
+    }
+
+    uint64_t pfn = block_to_pfn(block);
+    buddy_list_remove(pfn, current);
+
+    /* Split, returning upper halves to the smaller lists */
+    while (current > order) {
+        current--;
+        buddy_list_add(pfn + (1ULL << current), current);
+    }
+
+    page_state[pfn] = PAGE_STATE_ALLOC | order;
+    free_memory -= (PAGE_SIZE << order);
+
+    return pfn * PAGE_SIZE;
 }
 
 /*
- * Free a physical page
+ * Pop a page from the pre-zeroed pool (0 if empty)
  */
-void pmm_free_page(uint64_t addr)
+static uint64_t zero_pool_pop(void)
+{
+    if (zero_pool_count == 0) {
+        return 0;
+    }
+    free_memory -= PAGE_SIZE;
+    return zero_pool[--zero_pool_count];
+}
+
+/*
+ * Allocate 2^order physically contiguous pages
+ */
+uint64_t pmm_alloc_pages(uint32_t order, uint32_t flags)
+{
+    if (order > PMM_MAX_ORDER) {
+        serial_printf("[PMM] ERROR: Order %d exceeds maximum %d\n", (uint64_t)order, PMM_MAX_ORDER);
+        return 0;
+    }
+
+    /* DMA32 callers need a block the device can address */
+    bool dma32 = (flags & PMM_DMA32) != 0;
+    bool pool_ok = !dma32;
+
+    uint64_t irq = ticket_lock_irqsave(&pmm_lock);
+
+    /* Zeroed single pages come from the pool when it has any */
+    if (order == 0 && (flags & PMM_ZERO) && pool_ok) {
+        uint64_t addr = zero_pool_pop();
+        if (addr) {
+            zero_pool_hits++;
+            ticket_unlock_irqrestore(&pmm_lock, irq);
+            return addr;
+        }
+    }
+
+    uint64_t addr = buddy_alloc(order, dma32);
+
+    /* Last resort for single pages: the zero pool, even if unneeded */
+    if (!addr && order == 0 && pool_ok) {
+        addr = zero_pool_pop();
+        if (addr && (flags & PMM_ZERO)) {
+            zero_pool_hits++;
+            ticket_unlock_irqrestore(&pmm_lock, irq);
+            return addr;
+        }
+    }
+
+    if (addr && (flags & PMM_ZERO)) {
+        zero_pool_misses++;
+    }
+    ticket_unlock_irqrestore(&pmm_lock, irq);
+
+    if (!addr) {
+        serial_printf("[PMM] ERROR: Out of physical memory (order %d)!\n", (uint64_t)order);
+        return 0;
+    }
+
+    /* Zero outside the lock */
+    if (flags & PMM_ZERO) {
+        memset((void *)addr, 0, PAGE_SIZE << order);
+    }
+
+    return addr;
+}
+
+/*
+ * Zero free pages into the pool; called from idle time
+ */
+void pmm_zero_pool_refill(uint32_t max_pages)
+{
+    while (max_pages-- > 0 && zero_pool_count < ZERO_POOL_SIZE) {
+        uint64_t irq = ticket_lock_irqsave(&pmm_lock);
+        uint64_t addr = buddy_alloc(0, false);
+        ticket_unlock_irqrestore(&pmm_lock, irq);
+        if (!addr) {
+            return;
+        }
+
+        memset((void *)addr, 0, PAGE_SIZE);
+
+        irq = ticket_lock_irqsave(&pmm_lock);
+        if (zero_pool_count < ZERO_POOL_SIZE) {
+            /* Pool pages still count as free memory */
+            free_memory += PAGE_SIZE;
+            zero_pool[zero_pool_count++] = addr;
+            zero_pool_filled++;
+        } else {
+            /* Another CPU filled the pool meanwhile */
+            page_state[addr / PAGE_SIZE] = 0;
+            buddy_free_block(addr / PAGE_SIZE, 0);
+        }
+        ticket_unlock_irqrestore(&pmm_lock, irq);
+    }
+}
+
+/*
+ * Free 2^order pages previously returned by pmm_alloc_pages()
+ */
+void pmm_free_pages(uint64_t addr, uint32_t order)
 {
-    uint64_t page_index = addr / PAGE_SIZE;
+    uint64_t pfn = addr / PAGE_SIZE;
 
-    if (page_index >= sizeof(page_bitmap) * 8) {
-        serial_printf("[PMM] WARNING: Trying to free page outside bitmap range\n");
+    if (pfn >= max_pfn || (addr & PAGE_MASK)) {
+        serial_printf("[PMM] WARNING: Trying to free invalid page 0x%p\n", addr);
         return;
     }
 
-    if (!pmm_is_page_used(page_index)) {
-        serial_printf("[PMM] WARNING: Double-free of page 0x%x\n", addr);
+    uint64_t irq = ticket_lock_irqsave(&pmm_lock);
+    uint8_t state = page_state[pfn];
+    if (state != (PAGE_STATE_ALLOC | order)) {
+        ticket_unlock_irqrestore(&pmm_lock, irq);
+        serial_printf("[PMM] WARNING: Bad free of 0x%p (order %d, state 0x%x)\n",
+            addr, order, state);
         return;
     }
 
-    pmm_set_page_free(page_index);
-    free_memory += PAGE_SIZE;
+    page_state[pfn] = 0;
+    buddy_free_block(pfn, order);
+    ticket_unlock_irqrestore(&pmm_lock, irq);
+}
+
+/*
+ * Allocate a zeroed physical page
+ */
+uint64_t pmm_alloc_page(void)
+{
+    return pmm_alloc_pages(0, PMM_ZERO);
+}
+
+/*
+ * Free a physical page
+ */
+void pmm_free_page(uint64_t addr)
+{
+    pmm_free_pages(addr, 0);
 }
 
 /*
@@ -230,3 +547,33 @@ uint64_t pmm_get_free_memory(void)
 {
     return free_memory;
 }
+
+/*
+ * Get the highest physical address described by the memory map
+ */
+uint64_t pmm_get_max_phys(void)
+{
+    return max_phys;
+}
+
+/*
+ * Get zero pool statistics
+ */
+void pmm_get_zero_pool_stats(PmmZeroPoolStats *stats)
+{
+    if (!stats) return;
+    stats->level = zero_pool_count;
+    stats->capacity = ZERO_POOL_SIZE;
+    stats->hits = zero_pool_hits;
+    stats->misses = zero_pool_misses;
+    stats->filled = zero_pool_filled;
+}
+
+/*
+ * Get number of free blocks of a given order
+ */
+uint64_t pmm_get_free_blocks(uint32_t order)
+{
+    if (order > PMM_MAX_ORDER) return 0;
+    return free_counts[ZONE_DMA32][order] + free_counts[ZONE_NORMAL][order];
+}
@@ -1,7 +1,7 @@
 /*
  * ojjyOS v3 Kernel - Physical Memory Manager
  *
- * Simple bitmap-based physical page allocator.
+ * Buddy allocator for physical pages (orders 0 to PMM_MAX_ORDER).
  */
 
 #ifndef _OJJY_MEMORY_H
@@ -10,18 +10,63 @@
 #include "types.h"
 #include "boot_info.h"
 
-/* Initialize physical memory manager from UEFI memory map */
+/*
+ * Initialize physical memory manager from UEFI memory map. Only
+ * conventional memory is used until pmm_release_boot_services().
+ */
 void pmm_init(BootInfo *info);
 
-/* Allocate a physical page (returns physical address, or 0 on failure) */
+/*
+ * Hand boot services code/data to the allocator. Call once the
+ * kernel's page tables are loaded: the firmware's live in that memory.
+ */
+void pmm_release_boot_services(void);
+
+/* Largest block order: 2^10 pages = 4MB */
+#define PMM_MAX_ORDER   10
+
+/* Allocation flags */
+#define PMM_ZERO        (1U << 0)   /* Caller needs zeroed memory */
+#define PMM_DMA32       (1U << 1)   /* Block must lie below PMM_DMA32_LIMIT */
+
+/* Highest address (exclusive) reachable by 32-bit bus-master DMA */
+#define PMM_DMA32_LIMIT 0x100000000ULL
+
+/* Allocate a zeroed physical page (returns physical address, or 0 on failure) */
 uint64_t pmm_alloc_page(void);
 
 /* Free a physical page */
 void pmm_free_page(uint64_t addr);
 
+/*
+ * Allocate 2^order contiguous, naturally aligned pages (0 on failure).
+ * Single pages with PMM_ZERO come from the pre-zeroed pool when possible.
+ */
+uint64_t pmm_alloc_pages(uint32_t order, uint32_t flags);
+
+/* Free a block from pmm_alloc_pages() with the same order */
+void pmm_free_pages(uint64_t addr, uint32_t order);
+
 /* Get memory statistics */
 uint64_t pmm_get_total_memory(void);
 uint64_t pmm_get_free_memory(void);
+uint64_t pmm_get_free_blocks(uint32_t order);
+
+/* Pre-zeroed page pool */
+typedef struct {
+    uint32_t level;         /* Pages currently in the pool */
+    uint32_t capacity;
+    uint64_t hits;          /* Zeroed allocations served from the pool */
+    uint64_t misses;        /* Zeroed allocations that had to memset inline */
+    uint64_t filled;        /* Pages zeroed in idle time */
+} PmmZeroPoolStats;
+
+/* Zero up to max_pages free pages into the pool (call when idle) */
+void pmm_zero_pool_refill(uint32_t max_pages);
+void pmm_get_zero_pool_stats(PmmZeroPoolStats *stats);
+
+/* Highest physical address in the memory map, RAM or MMIO (for paging) */
+uint64_t pmm_get_max_phys(void);
 
 /* Print memory map (for debugging) */
 void pmm_print_map(BootInfo *info);
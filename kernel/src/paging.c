@@ -2,22 +2,58 @@
  * ojjyOS v3 Kernel - Paging Implementation
  *
  * Sets up 4-level paging for x86_64.
- * For MVP, we just identity-map the first 4GB using 2MB huge pages.
+ * Identity-maps all physical memory described by the UEFI memory map
+ * (at least 4GB) and mirrors it in a higher-half direct map at
+ * PHYS_MAP_BASE, using 1GB pages when the CPU supports them and 2MB
+ * pages otherwise. Tables beyond the PML4 come from the PMM; mappings of
+ * any page size can be added and removed until the APs start.
  */
 
 #include "paging.h"
 #include "memory.h"
 #include "serial.h"
 #include "string.h"
+#include "smp.h"
+#include "panic.h"
 
 /* Page table structure (512 entries * 8 bytes = 4KB) */
 typedef uint64_t PageTable[512] __attribute__((aligned(4096)));
 
-/* Static page tables for initial setup */
-/* We need: 1 PML4, 1 PDPT, 4 PDs (for 4GB with 2MB pages) */
+/* Top-level table; lower levels are allocated from the PMM */
 static PageTable pml4 __attribute__((aligned(4096)));
-static PageTable pdpt __attribute__((aligned(4096)));
-static PageTable pd[4] __attribute__((aligned(4096)));  /* 4 page directories for 4GB */
+
+/* Huge page sizes used by the identity map */
+#define HUGE_PAGE_SIZE      (2ULL * 1024 * 1024)
+#define GIANT_PAGE_SIZE     (1024ULL * 1024 * 1024)
+#define MIN_IDENTITY_MAP    (4ULL * 1024 * 1024 * 1024)
+
+/* Physical address bits of a table entry */
+#define PAGE_ADDR_MASK      0x000FFFFFFFFFF000ULL
+
+/* CPUID 0x80000001 EDX: 1GB pages */
+#define CPUID_EXT_EDX_PDPE1GB   (1U << 26)
+
+static bool giant_pages = false;
+static uint64_t identity_map_end = 0;
+
+/* Page Attribute Table */
+#define MSR_IA32_PAT        0x277
+#define PAT_UC              0x00ULL
+#define PAT_WC              0x01ULL
+#define PAT_WT              0x04ULL
+#define PAT_WP              0x05ULL
+#define PAT_WB              0x06ULL
+#define PAT_UC_MINUS        0x07ULL
+#define CPUID_1_EDX_PAT     (1U << 16)
+
+static bool pat_enabled = false;
+static uint64_t pat_value = 0;
+
+/*
+ * Table changes are only invalidated on the calling CPU and nothing
+ * serializes splits, so they must happen before any AP is online
+ */
+#define ASSERT_SINGLE_CPU()     ASSERT(smp_cpu_count() == 1)
 
 /*
  * Extract page table indices from virtual address
@@ -27,6 +63,183 @@ static PageTable pd[4] __attribute__((aligned(4096)));  /* 4 page directories fo
 #define PD_INDEX(addr)      (((addr) >> 21) & 0x1FF)
 #define PT_INDEX(addr)      (((addr) >> 12) & 0x1FF)
 
+/*
+ * Program the PAT so that PWT selects write-combining (entry 1).
+ * Entries 0, 2 and 3 keep their power-on meaning (WB, UC-, UC), so
+ * existing PCD/PWT users are unaffected.
+ */
+static void pat_init(void)
+{
+    uint32_t edx;
+    cpuid(1, 0, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_1_EDX_PAT)) {
+        serial_printf("[PAGING] PAT not supported, write-combining unavailable\n");
+        return;
+    }
+
+    pat_value = (PAT_WB << 0) | (PAT_WC << 8) | (PAT_UC_MINUS << 16) | (PAT_UC << 24) |
+                (PAT_WB << 32) | (PAT_WP << 40) | (PAT_UC_MINUS << 48) | (PAT_WT << 56);
+
+    wbinvd();
+    wrmsr(MSR_IA32_PAT, pat_value);
+    wbinvd();
+    pat_enabled = true;
+
+    serial_printf("[PAGING] PAT programmed (0x%x)\n", pat_value);
+}
+
+/*
+ * Check for 1GB page support
+ */
+static bool detect_giant_pages(void)
+{
+    uint32_t max_ext, edx;
+    cpuid(0x80000000, 0, &max_ext, NULL, NULL, NULL);
+    if (max_ext < 0x80000001) {
+        return false;
+    }
+    cpuid(0x80000001, 0, NULL, NULL, NULL, &edx);
+    return (edx & CPUID_EXT_EDX_PDPE1GB) != 0;
+}
+
+/*
+ * Physical address held by an entry mapping a page of the given size
+ */
+static inline uint64_t entry_addr(uint64_t entry, uint64_t page_size)
+{
+    return entry & PAGE_ADDR_MASK & ~(page_size - 1);
+}
+
+/*
+ * Return the table an entry points to, allocating it if the entry is
+ * empty. A huge page in the way is split into 512 pages of child_size
+ * with the same attributes.
+ */
+static uint64_t *next_table(uint64_t *entry, uint64_t child_size)
+{
+    if ((*entry & PAGE_PRESENT) && !(*entry & PAGE_HUGE)) {
+        return (uint64_t *)(*entry & PAGE_ADDR_MASK);
+    }
+
+    uint64_t table = pmm_alloc_page();
+    if (!table) return NULL;
+
+    if (*entry & PAGE_PRESENT) {
+        uint64_t *child = (uint64_t *)table;
+        uint64_t base = entry_addr(*entry, child_size * 512);
+        uint64_t flags = *entry & ~PAGE_ADDR_MASK;
+        if (child_size == PAGE_SIZE) {
+            flags &= ~PAGE_HUGE;    /* Bit 7 is PAT in a 4KB entry */
+        }
+        for (int i = 0; i < 512; i++) {
+            child[i] = (base + (uint64_t)i * child_size) | flags;
+        }
+        *entry = table | PAGE_PRESENT | PAGE_WRITABLE | (*entry & PAGE_USER);
+        paging_flush_tlb();
+    } else {
+        *entry = table | PAGE_PRESENT | PAGE_WRITABLE;
+    }
+    return (uint64_t *)table;
+}
+
+/*
+ * Get the entry that maps a page of page_size at virt, creating tables
+ * and splitting larger pages on the way down
+ */
+static uint64_t *get_entry(uint64_t virt, uint64_t page_size)
+{
+    uint64_t *pdpt = next_table(&pml4[PML4_INDEX(virt)], GIANT_PAGE_SIZE);
+    if (!pdpt) return NULL;
+    if (page_size == GIANT_PAGE_SIZE) return &pdpt[PDPT_INDEX(virt)];
+
+    uint64_t *pd = next_table(&pdpt[PDPT_INDEX(virt)], HUGE_PAGE_SIZE);
+    if (!pd) return NULL;
+    if (page_size == HUGE_PAGE_SIZE) return &pd[PD_INDEX(virt)];
+
+    uint64_t *pt = next_table(&pd[PD_INDEX(virt)], PAGE_SIZE);
+    if (!pt) return NULL;
+    return &pt[PT_INDEX(virt)];
+}
+
+/*
+ * Find the leaf entry mapping virt without modifying the tables
+ */
+static uint64_t *find_leaf(uint64_t virt, uint64_t *page_size)
+{
+    uint64_t entry = pml4[PML4_INDEX(virt)];
+    if (!(entry & PAGE_PRESENT)) return NULL;
+
+    uint64_t *pdpt = (uint64_t *)(entry & PAGE_ADDR_MASK);
+    uint64_t *e = &pdpt[PDPT_INDEX(virt)];
+    if (!(*e & PAGE_PRESENT)) return NULL;
+    if (*e & PAGE_HUGE) {
+        *page_size = GIANT_PAGE_SIZE;
+        return e;
+    }
+
+    uint64_t *pd = (uint64_t *)(*e & PAGE_ADDR_MASK);
+    e = &pd[PD_INDEX(virt)];
+    if (!(*e & PAGE_PRESENT)) return NULL;
+    if (*e & PAGE_HUGE) {
+        *page_size = HUGE_PAGE_SIZE;
+        return e;
+    }
+
+    uint64_t *pt = (uint64_t *)(*e & PAGE_ADDR_MASK);
+    e = &pt[PT_INDEX(virt)];
+    if (!(*e & PAGE_PRESENT)) return NULL;
+    *page_size = PAGE_SIZE;
+    return e;
+}
+
+/*
+ * Free a page table and every table below it
+ */
+static void free_table(uint64_t *table, uint64_t child_size)
+{
+    if (child_size > PAGE_SIZE) {
+        for (int i = 0; i < 512; i++) {
+            if ((table[i] & PAGE_PRESENT) && !(table[i] & PAGE_HUGE)) {
+                free_table((uint64_t *)(table[i] & PAGE_ADDR_MASK), child_size / 512);
+            }
+        }
+    }
+    pmm_free_page((uint64_t)table);
+}
+
+/*
+ * Largest page size usable for the next chunk of a mapping
+ */
+static uint64_t pick_page_size(uint64_t virt, uint64_t phys, uint64_t remaining)
+{
+    if (giant_pages && ((virt | phys) & (GIANT_PAGE_SIZE - 1)) == 0 &&
+        remaining >= GIANT_PAGE_SIZE) {
+        return GIANT_PAGE_SIZE;
+    }
+    if (((virt | phys) & (HUGE_PAGE_SIZE - 1)) == 0 && remaining >= HUGE_PAGE_SIZE) {
+        return HUGE_PAGE_SIZE;
+    }
+    return PAGE_SIZE;
+}
+
+/*
+ * Map a region of up to 1GB into the identity map and the direct map,
+ * unless it is already present
+ */
+static int map_physical_gigabyte(uint64_t addr)
+{
+    uint64_t size;
+    if (!find_leaf(addr, &size) &&
+        paging_map_range(addr, addr, GIANT_PAGE_SIZE, PAGE_WRITABLE) != 0) {
+        return -1;
+    }
+    if (!find_leaf(PHYS_MAP_BASE + addr, &size) &&
+        paging_map_range(PHYS_MAP_BASE + addr, addr, GIANT_PAGE_SIZE, PAGE_WRITABLE) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
 /*
  * Initialize paging with identity mapping
  */
@@ -34,58 +247,241 @@ void paging_init(void)
 {
     serial_printf("[PAGING] Setting up page tables...\n");
 
-    /* Clear all page tables */
     memset(pml4, 0, sizeof(pml4));
-    memset(pdpt, 0, sizeof(pdpt));
-    memset(pd, 0, sizeof(pd));
+    giant_pages = detect_giant_pages();
+    identity_map_end = 0;
 
-    /* Set up PML4 -> PDPT */
-    pml4[0] = ((uint64_t)pdpt) | PAGE_PRESENT | PAGE_WRITABLE;
-
-    /* Set up PDPT -> PDs (each PD covers 1GB) */
-    for (int i = 0; i < 4; i++) {
-        pdpt[i] = ((uint64_t)&pd[i]) | PAGE_PRESENT | PAGE_WRITABLE;
+    uint64_t map_end = ALIGN_UP(MAX(pmm_get_max_phys(), MIN_IDENTITY_MAP), GIANT_PAGE_SIZE);
+    if (paging_identity_map(0, map_end) != 0) {
+        serial_printf("[PAGING] ERROR: Out of memory for page tables\n");
     }
 
-    /* Set up PDs with 2MB huge pages (identity mapping) */
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 512; j++) {
-            uint64_t phys_addr = ((uint64_t)i * 512 + j) * (2 * 1024 * 1024);
-            pd[i][j] = phys_addr | PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE;
-        }
-    }
+    /* Program memory types before the new tables go live */
+    pat_init();
 
     /* Load new page tables */
     uint64_t pml4_addr = (uint64_t)pml4;
     write_cr3(pml4_addr);
 
+    /* The firmware's tables are dead now; their memory can be reused */
+    pmm_release_boot_services();
+
     serial_printf("[PAGING] Page tables loaded (CR3 = 0x%p)\n", pml4_addr);
-    serial_printf("[PAGING] Identity mapped first 4GB with 2MB pages\n");
+    serial_printf("[PAGING] Identity + direct map (0x%p) of %d GB with %s pages\n",
+        PHYS_MAP_BASE, identity_map_end / GIANT_PAGE_SIZE, giant_pages ? "1GB" : "2MB");
+}
+
+/*
+ * Per-AP setup: the page tables arrive through the trampoline's CR3,
+ * but the PAT is per-CPU and must match the BSP's, or a WC mapping
+ * would mean a different memory type on each CPU.
+ */
+void paging_init_ap(void)
+{
+    if (pat_enabled) {
+        wbinvd();
+        wrmsr(MSR_IA32_PAT, pat_value);
+        wbinvd();
+    }
+}
+
+/*
+ * Extend the identity map (and the direct map) to cover a physical range
+ */
+int paging_identity_map(uint64_t phys, uint64_t size)
+{
+    ASSERT_SINGLE_CPU();
+
+    uint64_t start = ALIGN_DOWN(phys, GIANT_PAGE_SIZE);
+    uint64_t end = ALIGN_UP(phys + size, GIANT_PAGE_SIZE);
+
+    for (uint64_t addr = start; addr < end; addr += GIANT_PAGE_SIZE) {
+        if (map_physical_gigabyte(addr) != 0) return -1;
+    }
+
+    if (end > identity_map_end) {
+        identity_map_end = end;
+    }
+    return 0;
+}
+
+/*
+ * Apply a memory type to the pages mapping [virt, virt + size)
+ */
+static int set_cache_range(uint64_t virt, uint64_t size, uint64_t cache)
+{
+    uint64_t addr = virt;
+    uint64_t end = virt + size;
+
+    while (addr < end) {
+        uint64_t page_size;
+        uint64_t *entry = find_leaf(addr, &page_size);
+        if (!entry) return -1;
+
+        /* Split pages that stick out of the range */
+        while ((addr & (page_size - 1)) || addr + page_size > end) {
+            page_size = (page_size == GIANT_PAGE_SIZE) ? HUGE_PAGE_SIZE : PAGE_SIZE;
+            entry = get_entry(addr, page_size);
+            if (!entry) return -1;
+            if (page_size == PAGE_SIZE) break;
+        }
+
+        *entry = (*entry & ~PAGE_CACHE_MASK) | cache;
+        paging_invalidate(addr);
+        addr += page_size;
+    }
+    return 0;
+}
+
+/*
+ * Change the memory type of a physical range in both the identity map
+ * and the direct map, so the two aliases never disagree.
+ */
+int paging_set_cache_mode(uint64_t phys, uint64_t size, uint64_t cache)
+{
+    ASSERT_SINGLE_CPU();
+
+    if (!pat_enabled && cache == PAGE_CACHE_WC) {
+        return -1;
+    }
+
+    uint64_t start = ALIGN_DOWN(phys, PAGE_SIZE);
+    uint64_t end = ALIGN_UP(phys + size, PAGE_SIZE);
+    if (size == 0 || paging_identity_map(phys, size) != 0) {
+        serial_printf("[PAGING] Cannot set cache mode for 0x%p (not mapped)\n", phys);
+        return -1;
+    }
+
+    if (set_cache_range(start, end - start, cache) != 0 ||
+        set_cache_range(PHYS_MAP_BASE + start, end - start, cache) != 0) {
+        serial_printf("[PAGING] Out of memory splitting pages for 0x%p\n", phys);
+        return -1;
+    }
+
+    /* Drop any lines cached under the old memory type */
+    wbinvd();
+
+    serial_printf("[PAGING] 0x%p - 0x%p cache mode 0x%x\n", start, end, cache);
+    return 0;
+}
+
+/*
+ * Map one page of 4KB, 2MB or 1GB
+ */
+int paging_map_page(uint64_t virt, uint64_t phys, uint64_t page_size, uint64_t flags)
+{
+    ASSERT_SINGLE_CPU();
+
+    if (page_size != PAGE_SIZE && page_size != HUGE_PAGE_SIZE && page_size != GIANT_PAGE_SIZE) {
+        return -1;
+    }
+    if (page_size == GIANT_PAGE_SIZE && !giant_pages) {
+        return -1;
+    }
+    if ((virt | phys) & (page_size - 1)) {
+        serial_printf("[PAGING] Misaligned map 0x%p -> 0x%p\n", virt, phys);
+        return -1;
+    }
+
+    uint64_t *entry = get_entry(virt, page_size);
+    if (!entry) {
+        serial_printf("[PAGING] Out of memory mapping 0x%p\n", virt);
+        return -1;
+    }
+
+    /* Replacing a table with a large page: release the old subtree */
+    if (page_size > PAGE_SIZE && (*entry & PAGE_PRESENT) && !(*entry & PAGE_HUGE)) {
+        free_table((uint64_t *)(*entry & PAGE_ADDR_MASK), page_size / 512);
+    }
+
+    *entry = phys | (flags & ~PAGE_ADDR_MASK) | PAGE_PRESENT |
+             (page_size > PAGE_SIZE ? PAGE_HUGE : 0);
+    paging_invalidate(virt);
+    return 0;
+}
+
+/*
+ * Map a range using the largest pages alignment allows
+ */
+int paging_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags)
+{
+    uint64_t end = virt + ALIGN_UP(size, PAGE_SIZE);
+
+    while (virt < end) {
+        uint64_t page_size = pick_page_size(virt, phys, end - virt);
+        if (paging_map_page(virt, phys, page_size, flags) != 0) {
+            return -1;
+        }
+        virt += page_size;
+        phys += page_size;
+    }
+    return 0;
+}
+
+/*
+ * Map a single 4KB page
+ */
+int paging_map(uint64_t virt, uint64_t phys, uint64_t flags)
+{
+    return paging_map_page(virt, phys, PAGE_SIZE, flags);
 }
 
 /*
- * Map a single 4KB page (for future use)
- * Note: Currently we use 2MB pages, so this is not fully implemented
+ * Unmap a range, splitting large pages that are only partly covered.
+ * Intermediate tables are kept for reuse.
  */
-void paging_map(uint64_t virt, uint64_t phys, uint64_t flags)
+void paging_unmap_range(uint64_t virt, uint64_t size)
 {
-    (void)virt;
-    (void)phys;
-    (void)flags;
+    ASSERT_SINGLE_CPU();
+
+    uint64_t addr = ALIGN_DOWN(virt, PAGE_SIZE);
+    uint64_t end = ALIGN_UP(virt + size, PAGE_SIZE);
+
+    while (addr < end) {
+        uint64_t page_size;
+        uint64_t *entry = find_leaf(addr, &page_size);
+        if (!entry) {
+            addr += PAGE_SIZE;
+            continue;
+        }
+
+        if ((addr & (page_size - 1)) || addr + page_size > end) {
+            /* Split one level and look again */
+            page_size = (page_size == GIANT_PAGE_SIZE) ? HUGE_PAGE_SIZE : PAGE_SIZE;
+            if (!get_entry(addr, page_size)) {
+                serial_printf("[PAGING] Out of memory unmapping 0x%p\n", addr);
+                return;
+            }
+            continue;
+        }
 
-    /* TODO: Implement 4KB page mapping when needed */
-    serial_printf("[PAGING] Warning: 4KB page mapping not implemented\n");
+        *entry = 0;
+        paging_invalidate(addr);
+        addr += page_size;
+    }
 }
 
 /*
- * Unmap a virtual address
+ * Unmap the 4KB page containing virt
  */
 void paging_unmap(uint64_t virt)
 {
-    (void)virt;
+    paging_unmap_range(virt, PAGE_SIZE);
+}
+
+/*
+ * Translate a virtual address through the current tables
+ */
+bool paging_translate(uint64_t virt, uint64_t *phys)
+{
+    uint64_t page_size;
+    uint64_t *entry = find_leaf(virt, &page_size);
+    if (!entry) return false;
 
-    /* TODO: Implement when needed */
-    serial_printf("[PAGING] Warning: Page unmapping not implemented\n");
+    if (phys) {
+        *phys = entry_addr(*entry, page_size) + (virt & (page_size - 1));
+    }
+    return true;
 }
 
 /*
@@ -1,7 +1,10 @@
 /*
  * ojjyOS v3 Kernel - Paging
  *
- * x86_64 4-level paging setup.
+ * x86_64 4-level paging setup. The tables are shared by every CPU, but
+ * there is no paging lock and no TLB shootdown: functions that change
+ * mappings or memory types may only be called before smp_init() starts
+ * the APs (or when none came up), and assert so.
  */
 
 #ifndef _OJJY_PAGING_H
@@ -21,15 +24,77 @@
 #define PAGE_GLOBAL         (1ULL << 8)
 #define PAGE_NO_EXECUTE     (1ULL << 63)
 
-/* Initialize paging (identity map first 4GB for now) */
+/*
+ * Memory types selected through the PAT (programmed by paging_init):
+ *   entry 0 = WB, 1 = WC, 2 = UC-, 3 = UC
+ */
+#define PAGE_CACHE_WB       0
+#define PAGE_CACHE_WC       PAGE_WRITE_THROUGH
+#define PAGE_CACHE_UC_MINUS PAGE_CACHE_DISABLE
+#define PAGE_CACHE_UC       (PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH)
+#define PAGE_CACHE_MASK     (PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH)
+
+/* Page sizes accepted by paging_map_page() */
+#define PAGE_SIZE_4K        PAGE_SIZE
+#define PAGE_SIZE_2M        (2ULL * 1024 * 1024)
+#define PAGE_SIZE_1G        (1024ULL * 1024 * 1024)
+
+/*
+ * Higher-half direct map: all physical memory is also mapped at
+ * PHYS_MAP_BASE + phys (PML4 slot 256)
+ */
+#define PHYS_MAP_BASE       0xFFFF800000000000ULL
+
+static inline void *phys_to_virt(uint64_t phys)
+{
+    return (void *)(phys + PHYS_MAP_BASE);
+}
+
+static inline uint64_t virt_to_phys(const void *virt)
+{
+    return (uint64_t)virt - PHYS_MAP_BASE;
+}
+
+/* Initialize paging (identity + direct map of all physical memory, at least 4GB) */
 void paging_init(void);
 
-/* Map a virtual address to a physical address */
-void paging_map(uint64_t virt, uint64_t phys, uint64_t flags);
+/* Match the BSP's per-CPU paging state (PAT) on an application processor */
+void paging_init_ap(void);
+
+/* Ensure a physical range is identity mapped (e.g. MMIO above RAM) */
+int paging_identity_map(uint64_t phys, uint64_t size);
 
-/* Unmap a virtual address */
+/*
+ * Change the memory type of an identity-mapped physical range.
+ * Works on whole 2MB pages (splitting 1GB pages as needed);
+ * returns 0 on success, -1 if unsupported.
+ */
+int paging_set_cache_mode(uint64_t phys, uint64_t size, uint64_t cache);
+
+/*
+ * Map one page of PAGE_SIZE_4K, _2M or _1G. flags may include
+ * PAGE_WRITABLE, PAGE_USER, PAGE_GLOBAL and a PAGE_CACHE_* type;
+ * PAGE_PRESENT (and PAGE_HUGE for large pages) are added.
+ * Intermediate tables are allocated from the PMM and larger pages in the
+ * way are split. Returns 0 on success, -1 on bad alignment or no memory.
+ */
+int paging_map_page(uint64_t virt, uint64_t phys, uint64_t page_size, uint64_t flags);
+
+/* Map a range with the largest pages alignment allows */
+int paging_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+
+/* Map a single 4KB page */
+int paging_map(uint64_t virt, uint64_t phys, uint64_t flags);
+
+/* Unmap the 4KB page containing virt (splitting a large page if needed) */
 void paging_unmap(uint64_t virt);
 
+/* Unmap a range, with selective TLB invalidation */
+void paging_unmap_range(uint64_t virt, uint64_t size);
+
+/* Look up the physical address behind virt; false if unmapped */
+bool paging_translate(uint64_t virt, uint64_t *phys);
+
 /* Flush TLB for a specific address */
 void paging_invalidate(uint64_t virt);
 
@@ -9,6 +9,7 @@
 #include "serial.h"
 #include "string.h"
 #include "console.h"
+#include "smp.h"
 
 /*
  * Draw panic screen
@@ -18,6 +19,9 @@ static void draw_panic_screen(const char *message, InterruptFrame *frame)
     uint32_t width = fb_get_width();
     uint32_t height = fb_get_height();
 
+    /* Panic may interrupt a clipped compositor pass */
+    fb_reset_clip();
+
     /* Fill background with panic color */
     fb_clear(COLOR_PANIC_BG);
 
@@ -111,8 +115,12 @@ static void draw_panic_screen(const char *message, InterruptFrame *frame)
  */
 void panic(const char *message)
 {
-    /* Disable interrupts */
+    /* Disable interrupts and stop the other CPUs */
     cli();
+    smp_stop_others();
+
+    /* Flush buffered output, then log synchronously */
+    serial_sync();
 
     /* Log to serial */
     serial_printf("\n\n");
@@ -136,8 +144,12 @@ void panic(const char *message)
  */
 void panic_with_frame(const char *message, InterruptFrame *frame)
 {
-    /* Disable interrupts */
+    /* Disable interrupts and stop the other CPUs */
     cli();
+    smp_stop_others();
+
+    /* Flush buffered output, then log synchronously */
+    serial_sync();
 
     /* Log to serial */
     serial_printf("\n\n");
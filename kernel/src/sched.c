@@ -0,0 +1,606 @@
+/*
+ * ojjyOS v3 Kernel - Kernel Threads and Scheduler Implementation
+ *
+ * All scheduler state (run queues, wait queues, thread states) is
+ * guarded by sched_lock. A thread that switches away holds it, and the
+ * thread switched to releases it: either where its own switch returns
+ * or, for a new thread, in thread_bootstrap().
+ */
+
+#include "sched.h"
+#include "smp.h"
+#include "task.h"
+#include "timer.h"
+#include "memory.h"
+#include "serial.h"
+#include "console.h"
+#include "string.h"
+
+/* Pages zeroed into the PMM pool per idle wakeup (32KB) */
+#define IDLE_ZERO_BATCH     8
+
+/* Timer event while a thread waits in cpu_wait(): its loop expects a tick */
+#define SCHED_POLL_NS       NS_PER_MS
+
+/* Longest stretch without a timer event, even with nothing scheduled */
+#define SCHED_MAX_EVENT_NS  (100 * NS_PER_MS)
+
+/* switch.asm */
+extern void context_switch(uint64_t *save_rsp, uint64_t new_rsp);
+extern void thread_start(void);
+
+static Thread threads[SCHED_MAX_THREADS];
+static Thread *current = NULL;
+static Thread *idle_thread = NULL;
+static Thread *run_head[PRIO_COUNT];
+static Thread *run_tail[PRIO_COUNT];
+static Spinlock sched_lock = SPINLOCK_INIT;
+static WaitQueue irq_waiters = WAIT_QUEUE_INIT;
+static volatile bool need_resched = false;
+static uint64_t slice_end_ns = 0;
+static uint64_t switched_in_ns = 0;         /* When current started running */
+static uint32_t next_id = 0;
+static bool running = false;
+
+/* TSC when the idle thread last halted, 0 while it is not halted */
+static uint64_t idle_since = 0;
+
+/* FPU state every new thread starts from */
+static uint8_t fpu_initial[512] __attribute__((aligned(16)));
+
+/* Statistics */
+static uint64_t context_switches = 0;
+static uint64_t preemptions = 0;
+
+static const char *state_names[] = { "free", "ready", "running", "blocked", "dead" };
+static const char *prio_names[] = { "high", "normal", "low", "idle" };
+
+static inline void fpu_save(uint8_t *area)
+{
+    __asm__ volatile("fxsave (%0)" : : "r"(area) : "memory");
+}
+
+static inline void fpu_restore(const uint8_t *area)
+{
+    __asm__ volatile("fxrstor (%0)" : : "r"(area) : "memory");
+}
+
+static void run_queue_push(Thread *t)
+{
+    t->next = NULL;
+    if (run_tail[t->priority]) {
+        run_tail[t->priority]->next = t;
+    } else {
+        run_head[t->priority] = t;
+    }
+    run_tail[t->priority] = t;
+}
+
+/* Highest-priority ready thread, or NULL */
+static Thread *run_queue_pop(void)
+{
+    for (int prio = 0; prio < PRIO_COUNT; prio++) {
+        Thread *t = run_head[prio];
+        if (t) {
+            run_head[prio] = t->next;
+            if (!run_head[prio]) {
+                run_tail[prio] = NULL;
+            }
+            t->next = NULL;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void wait_queue_push(WaitQueue *wq, Thread *t)
+{
+    t->next = NULL;
+    t->waiting_on = wq;
+    if (wq->tail) {
+        wq->tail->next = t;
+    } else {
+        wq->head = t;
+    }
+    wq->tail = t;
+}
+
+static void wait_queue_remove(WaitQueue *wq, Thread *t)
+{
+    Thread *prev = NULL;
+    for (Thread *it = wq->head; it; prev = it, it = it->next) {
+        if (it != t) continue;
+        if (prev) {
+            prev->next = t->next;
+        } else {
+            wq->head = t->next;
+        }
+        if (wq->tail == t) {
+            wq->tail = prev;
+        }
+        break;
+    }
+    t->next = NULL;
+    t->waiting_on = NULL;
+}
+
+/* Blocked -> ready; preempt the current thread if this one matters more */
+static void make_ready(Thread *t)
+{
+    if (t->waiting_on) {
+        wait_queue_remove(t->waiting_on, t);
+    }
+    t->wake_ns = 0;
+    t->state = THREAD_READY;
+    run_queue_push(t);
+    if (current && t->priority < current->priority) {
+        need_resched = true;
+    } else if (current && t->priority == current->priority && current != idle_thread) {
+        /* The running slice is contested now: make sure it ends on time */
+        timer_request_event(slice_end_ns);
+    }
+
+    /* From an AP: the BSP may be halted with no timer event due soon */
+    if (smp_cpu_id() != 0) {
+        smp_wake_cpu(0);
+    }
+}
+
+/*
+ * Arm the next timer event (sched_lock held): the earliest sleeper
+ * deadline, the end of the slice if another thread of the same
+ * priority waits for it, and a poll tick while threads wait for IRQs
+ * in cpu_wait() loops that also watch the clock.
+ */
+static void sched_arm_timer(uint64_t now)
+{
+    uint64_t next = now + SCHED_MAX_EVENT_NS;
+    if (current != idle_thread && run_head[current->priority]) {
+        next = MIN(next, slice_end_ns);
+    }
+    if (irq_waiters.head) {
+        next = MIN(next, now + SCHED_POLL_NS);
+    }
+    for (int i = 0; i < SCHED_MAX_THREADS; i++) {
+        Thread *t = &threads[i];
+        if (t->state == THREAD_BLOCKED && t->wake_ns) {
+            next = MIN(next, t->wake_ns);
+        }
+    }
+    timer_request_event(next);
+}
+
+/*
+ * Switch to the best ready thread. Called with sched_lock held and
+ * interrupts off; returns (in the same thread) with both unchanged.
+ * The caller sets current->state first: RUNNING to stay runnable,
+ * BLOCKED or DEAD to leave the run queues.
+ */
+static void schedule(void)
+{
+    Thread *prev = current;
+    if (prev->state == THREAD_RUNNING && prev != idle_thread) {
+        prev->state = THREAD_READY;
+        run_queue_push(prev);
+    }
+
+    Thread *next = run_queue_pop();
+    if (!next) {
+        next = idle_thread;
+    }
+    need_resched = false;
+
+    uint64_t now = timer_get_ns();
+    prev->run_ns += now - switched_in_ns;
+    switched_in_ns = now;
+    slice_end_ns = now + SCHED_SLICE_MS * NS_PER_MS;
+
+    next->state = THREAD_RUNNING;
+    if (next == prev) {
+        sched_arm_timer(now);
+        return;
+    }
+
+    next->switches++;
+    context_switches++;
+    current = next;
+    sched_arm_timer(now);
+
+    fpu_save(prev->fpu);
+    fpu_restore(next->fpu);
+    context_switch(&prev->rsp, next->rsp);
+}
+
+/*
+ * Whether the caller may block: a thread on the BSP, not the idle
+ * thread, holding no spinlock. Interrupts may be off (schedule() turns
+ * them back on for whoever runs next).
+ */
+static bool can_block(void)
+{
+    return running && smp_cpu_id() == 0 && current != idle_thread &&
+           this_cpu()->preempt_count == 0;
+}
+
+/* First code a new thread runs (from thread_start in switch.asm) */
+void thread_bootstrap(ThreadFn fn, void *arg)
+{
+    spin_unlock(&sched_lock);
+    sti();
+    fn(arg);
+    thread_exit();
+}
+
+static void idle_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        /* Run pool tasks, top up pre-zeroed pages, then halt until the next IRQ */
+        if (task_run_one()) continue;
+        pmm_zero_pool_refill(IDLE_ZERO_BATCH);
+
+        cli();
+        if (task_pending()) {
+            sti();
+            continue;
+        }
+        idle_since = rdtsc();
+        __asm__ volatile("sti; hlt" : : : "memory");
+    }
+}
+
+void sched_init(void)
+{
+    memset(threads, 0, sizeof(threads));
+
+    /* kernel_main carries on as "main" on the boot stack */
+    Thread *main_thread = &threads[0];
+    main_thread->id = next_id++;
+    main_thread->state = THREAD_RUNNING;
+    main_thread->priority = PRIO_HIGH;
+    strncpy(main_thread->name, "main", sizeof(main_thread->name) - 1);
+    current = main_thread;
+    switched_in_ns = timer_get_ns();
+    slice_end_ns = switched_in_ns + SCHED_SLICE_MS * NS_PER_MS;
+
+    __asm__ volatile("fninit");
+    fpu_save(fpu_initial);
+
+    int idle = thread_create("idle", idle_main, NULL, PRIO_IDLE);
+    if (idle < 0) {
+        serial_printf("[SCHED] Cannot create idle thread\n");
+        return;
+    }
+    for (int i = 0; i < SCHED_MAX_THREADS; i++) {
+        if (threads[i].state != THREAD_FREE && threads[i].id == (uint32_t)idle) {
+            idle_thread = &threads[i];
+        }
+    }
+
+    running = true;
+    serial_printf("[SCHED] Scheduler running (%d ms slices, %d threads max)\n",
+        (uint64_t)SCHED_SLICE_MS, (uint64_t)SCHED_MAX_THREADS);
+}
+
+bool sched_running(void)
+{
+    return running;
+}
+
+int thread_create(const char *name, ThreadFn fn, void *arg, ThreadPriority priority)
+{
+    /* Claim a slot; a dead thread's stack is freed once it is reused */
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    Thread *t = NULL;
+    for (int i = 0; i < SCHED_MAX_THREADS; i++) {
+        if (threads[i].state == THREAD_FREE ||
+            (threads[i].state == THREAD_DEAD && &threads[i] != current)) {
+            t = &threads[i];
+            break;
+        }
+    }
+    uint64_t old_stack = 0;
+    if (t) {
+        old_stack = t->stack;
+        t->stack = 0;
+        t->state = THREAD_BLOCKED;      /* Reserved: on no queue, no deadline */
+        t->wake_ns = 0;
+        t->waiting_on = NULL;
+        t->id = next_id++;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    if (!t) {
+        serial_printf("[SCHED] No free thread slot for %s\n", name);
+        return -1;
+    }
+    if (old_stack) {
+        pmm_free_pages(old_stack, THREAD_STACK_ORDER);
+    }
+
+    uint64_t stack = pmm_alloc_pages(THREAD_STACK_ORDER, 0);
+    if (!stack) {
+        serial_printf("[SCHED] No stack for %s\n", name);
+        t->state = THREAD_FREE;
+        return -1;
+    }
+
+    uint32_t id = t->id;
+    t->stack = stack;
+    t->priority = priority;
+    memset(t->name, 0, sizeof(t->name));
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    t->next = NULL;
+    t->timed_out = false;
+    t->switches = 0;
+    t->run_ns = 0;
+    memcpy(t->fpu, fpu_initial, sizeof(t->fpu));
+
+    /*
+     * Initial frame for context_switch(): six callee-saved registers
+     * (R12/R13 carry fn/arg) and a return into thread_start, placed so
+     * the stack is 16-byte aligned at thread_start's call
+     */
+    uint64_t *sp = (uint64_t *)(stack + (PAGE_SIZE << THREAD_STACK_ORDER) - 16);
+    *--sp = (uint64_t)thread_start;
+    *--sp = 0;                      /* RBP */
+    *--sp = 0;                      /* RBX */
+    *--sp = (uint64_t)fn;           /* R12 */
+    *--sp = (uint64_t)arg;          /* R13 */
+    *--sp = 0;                      /* R14 */
+    *--sp = 0;                      /* R15 */
+    t->rsp = (uint64_t)sp;
+
+    flags = spin_lock_irqsave(&sched_lock);
+    if (priority == PRIO_IDLE) {
+        t->state = THREAD_READY;    /* Runs whenever the queues are empty */
+    } else {
+        make_ready(t);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    serial_printf("[SCHED] Thread %d (%s) created, %s priority\n",
+        (uint64_t)id, name, prio_names[priority]);
+    return (int)id;
+}
+
+Thread *thread_current(void)
+{
+    return (running && smp_cpu_id() == 0) ? current : NULL;
+}
+
+void thread_yield(void)
+{
+    if (!can_block()) {
+        cpu_relax();
+        return;
+    }
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    schedule();
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void thread_sleep(uint64_t ms)
+{
+    thread_sleep_until(timer_get_ns() + (ms ? ms : 1) * NS_PER_MS);
+}
+
+void thread_sleep_until(uint64_t deadline_ns)
+{
+    if (!can_block() || !interrupts_enabled()) {
+        while (timer_get_ns() < deadline_ns) {
+            timer_request_event(deadline_ns);
+            cpu_wait();
+        }
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    if (timer_get_ns() < deadline_ns) {
+        current->wake_ns = deadline_ns;
+        current->state = THREAD_BLOCKED;
+        schedule();
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void thread_exit(void)
+{
+    spin_lock_irqsave(&sched_lock);
+    serial_printf("[SCHED] Thread %d (%s) exited\n", (uint64_t)current->id, current->name);
+    current->state = THREAD_DEAD;
+    schedule();
+
+    /* Dead threads are never switched back to */
+    for (;;) {
+        hlt();
+    }
+}
+
+bool wait_queue_sleep(WaitQueue *wq, uint64_t timeout_ms)
+{
+    if (!can_block()) {
+        /* Callers re-check their condition: report a spurious wakeup */
+        cpu_relax();
+        return true;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    wait_queue_push(wq, current);
+    current->wake_ns = timeout_ms ? timer_get_ns() + timeout_ms * NS_PER_MS : 0;
+    current->timed_out = false;
+    current->state = THREAD_BLOCKED;
+    schedule();
+    bool woken = !current->timed_out;
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return woken;
+}
+
+void wait_queue_wake_one(WaitQueue *wq)
+{
+    if (!running) return;
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    if (wq->head) {
+        make_ready(wq->head);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void wait_queue_wake_all(WaitQueue *wq)
+{
+    if (!running) return;
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    while (wq->head) {
+        make_ready(wq->head);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void mutex_init(Mutex *mutex)
+{
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    mutex->waiters.head = NULL;
+    mutex->waiters.tail = NULL;
+}
+
+bool mutex_trylock(Mutex *mutex)
+{
+    if (__atomic_exchange_n(&mutex->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+        return false;
+    }
+    mutex->owner = thread_current();
+    return true;
+}
+
+/*
+ * The retry under sched_lock pairs with mutex_unlock(), which releases
+ * under the same lock: an unlock either happens before the retry or
+ * finds this thread on the wait queue.
+ */
+void mutex_lock(Mutex *mutex)
+{
+    while (!mutex_trylock(mutex)) {
+        if (!can_block()) {
+            while (__atomic_load_n(&mutex->locked, __ATOMIC_RELAXED)) {
+                cpu_relax();
+            }
+            continue;
+        }
+
+        uint64_t flags = spin_lock_irqsave(&sched_lock);
+        if (__atomic_exchange_n(&mutex->locked, 1, __ATOMIC_ACQUIRE) == 0) {
+            mutex->owner = current;
+            spin_unlock_irqrestore(&sched_lock, flags);
+            return;
+        }
+        wait_queue_push(&mutex->waiters, current);
+        current->wake_ns = 0;
+        current->state = THREAD_BLOCKED;
+        schedule();
+        spin_unlock_irqrestore(&sched_lock, flags);
+    }
+}
+
+void mutex_unlock(Mutex *mutex)
+{
+    mutex->owner = NULL;
+    if (!running) {
+        __atomic_store_n(&mutex->locked, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    __atomic_store_n(&mutex->locked, 0, __ATOMIC_RELEASE);
+    if (mutex->waiters.head) {
+        make_ready(mutex->waiters.head);
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void sched_tick(void)
+{
+    if (!running) return;
+
+    spin_lock(&sched_lock);
+    uint64_t now = timer_get_ns();
+    if (current != idle_thread && now >= slice_end_ns) {
+        need_resched = true;
+    }
+
+    for (int i = 0; i < SCHED_MAX_THREADS; i++) {
+        Thread *t = &threads[i];
+        if (t->state == THREAD_BLOCKED && t->wake_ns && now >= t->wake_ns) {
+            t->timed_out = t->waiting_on != NULL;
+            make_ready(t);
+        }
+    }
+    sched_arm_timer(now);
+    spin_unlock(&sched_lock);
+}
+
+/*
+ * Runs at the end of every device IRQ, timer event and wakeup IPI on
+ * the BSP (interrupts off, EOI sent). A thread holding a spinlock is left alone; it is switched
+ * away from at a later IRQ.
+ */
+void sched_irq_exit(void)
+{
+    if (!running || smp_cpu_id() != 0) return;
+
+    /* The idle thread halted until this IRQ */
+    if (idle_since) {
+        this_cpu()->idle_cycles += rdtsc() - idle_since;
+        idle_since = 0;
+    }
+
+    spin_lock(&sched_lock);
+    while (irq_waiters.head) {
+        make_ready(irq_waiters.head);
+    }
+    if (need_resched && this_cpu()->preempt_count == 1) {
+        if (current->state == THREAD_RUNNING && current != idle_thread) {
+            preemptions++;
+        }
+        schedule();
+    } else {
+        /* Wakeups posted by APs could not arm the BSP's timer */
+        sched_arm_timer(timer_get_ns());
+    }
+    spin_unlock(&sched_lock);
+}
+
+bool sched_wait_irq(void)
+{
+    if (!interrupts_enabled() || !can_block()) {
+        /* The caller halts instead: make sure an interrupt comes */
+        if (smp_cpu_id() == 0) {
+            timer_request_event(timer_get_ns() + SCHED_POLL_NS);
+        }
+        return false;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&sched_lock);
+    wait_queue_push(&irq_waiters, current);
+    current->wake_ns = 0;
+    current->state = THREAD_BLOCKED;
+    schedule();
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return true;
+}
+
+void sched_print_info(void)
+{
+    console_printf("\nThreads (%ld context switches, %ld preemptions):\n",
+        context_switches, preemptions);
+    uint64_t now = timer_get_ns();
+    for (int i = 0; i < SCHED_MAX_THREADS; i++) {
+        Thread *t = &threads[i];
+        if (t->state == THREAD_FREE) continue;
+        uint64_t run_ns = t->run_ns + (t == current ? now - switched_in_ns : 0);
+        console_printf("  %d %s: %s, %s priority, %ld switches, %ld.%03ld ms run\n",
+            (int)t->id, t->name, state_names[t->state], prio_names[t->priority],
+            t->switches, run_ns / NS_PER_MS, (run_ns % NS_PER_MS) / NS_PER_US);
+    }
+    console_printf("\n");
+}
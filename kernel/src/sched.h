@@ -0,0 +1,147 @@
+/*
+ * ojjyOS v3 Kernel - Kernel Threads and Scheduler
+ *
+ * Preemptive kernel threads on the BSP, which is where the timer and
+ * device IRQs arrive. Each priority level is a round-robin run queue;
+ * the highest non-empty level runs, for up to SCHED_SLICE_MS at a
+ * time. Timer events end slices and wake sleepers, and a wakeup of a
+ * higher-priority thread preempts the current one at IRQ exit. Once
+ * the timer is tickless, the scheduler arms the next event itself: the
+ * earliest sleeper deadline, the end of a contested slice, or a 1 ms
+ * poll while someone waits in cpu_wait().
+ *
+ * APs are not scheduled: they run smp_call() work. Mutexes and wait
+ * queues still work there by spinning instead of sleeping.
+ */
+
+#ifndef _OJJY_SCHED_H
+#define _OJJY_SCHED_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/* Thread table size (including main and idle) */
+#define SCHED_MAX_THREADS       16
+
+/* Thread stacks: 2^order pages */
+#define THREAD_STACK_ORDER      2
+
+/* Round-robin time slice */
+#define SCHED_SLICE_MS          10
+
+/* Priorities, highest first */
+typedef enum {
+    PRIO_HIGH = 0,      /* Input and shell */
+    PRIO_NORMAL,        /* Compositor */
+    PRIO_LOW,           /* Bulk work: flushing, indexing */
+    PRIO_IDLE,          /* Idle thread only */
+    PRIO_COUNT
+} ThreadPriority;
+
+typedef enum {
+    THREAD_FREE = 0,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,     /* On a wait queue and/or sleeping */
+    THREAD_DEAD
+} ThreadState;
+
+typedef void (*ThreadFn)(void *arg);
+
+typedef struct Thread {
+    uint8_t fpu[512];               /* FXSAVE area (must stay first: 16-byte aligned) */
+    uint64_t rsp;                   /* Saved stack pointer while switched out */
+    uint64_t stack;                 /* Stack base (physical = virtual), 0 for main */
+    uint32_t id;
+    ThreadState state;
+    ThreadPriority priority;
+    char name[16];
+
+    struct Thread *next;            /* Run queue or wait queue link */
+    struct WaitQueue *waiting_on;
+    uint64_t wake_ns;               /* Sleep deadline (timer_get_ns()), 0 = none */
+    bool timed_out;
+
+    /* Statistics */
+    uint64_t switches;              /* Times switched in */
+    uint64_t run_ns;                /* Time spent running */
+} __attribute__((aligned(16))) Thread;
+
+/* FIFO of blocked threads, protected by the scheduler lock */
+typedef struct WaitQueue {
+    Thread *head;
+    Thread *tail;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT     { NULL, NULL }
+
+/*
+ * Sleeping lock for sections that may take milliseconds (disk I/O).
+ * Threads block; callers that cannot block (APs, IRQs off, spinlock
+ * held, scheduler not started) spin.
+ */
+typedef struct {
+    volatile uint32_t locked;
+    Thread *owner;
+    WaitQueue waiters;
+} Mutex;
+
+#define MUTEX_INIT          { 0, NULL, WAIT_QUEUE_INIT }
+
+/* Turn kernel_main into the "main" thread and create the idle thread */
+void sched_init(void);
+
+/* True once sched_init() ran */
+bool sched_running(void);
+
+/* Create a thread; returns its id or -1 */
+int thread_create(const char *name, ThreadFn fn, void *arg, ThreadPriority priority);
+
+/* Calling thread, or NULL on an AP / before sched_init() */
+Thread *thread_current(void);
+
+/* Give up the rest of the time slice */
+void thread_yield(void);
+
+/* Block the calling thread for at least ms milliseconds */
+void thread_sleep(uint64_t ms);
+
+/* Block the calling thread until timer_get_ns() reaches deadline_ns */
+void thread_sleep_until(uint64_t deadline_ns);
+
+/* End the calling thread */
+void thread_exit(void) __attribute__((noreturn));
+
+/*
+ * Block on a wait queue until woken or timeout_ms passes (0 = no
+ * timeout). Call with interrupts disabled after checking the condition
+ * being waited for, so a wakeup cannot slip in between. Returns false
+ * on timeout.
+ */
+bool wait_queue_sleep(WaitQueue *wq, uint64_t timeout_ms);
+
+/* Wake the first / every thread on a wait queue (any context) */
+void wait_queue_wake_one(WaitQueue *wq);
+void wait_queue_wake_all(WaitQueue *wq);
+
+void mutex_init(Mutex *mutex);
+void mutex_lock(Mutex *mutex);
+bool mutex_trylock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+/* Timer IRQ: end slices, wake sleepers and arm the next event */
+void sched_tick(void);
+
+/* End of a device IRQ: wake IRQ waiters and switch if needed */
+void sched_irq_exit(void);
+
+/*
+ * Block the calling thread until the next device or timer IRQ (see
+ * cpu_wait()). Returns false if the caller cannot block.
+ */
+bool sched_wait_irq(void);
+
+/* Print thread list and statistics to the console */
+void sched_print_info(void);
+
+#endif /* _OJJY_SCHED_H */
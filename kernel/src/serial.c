@@ -2,18 +2,51 @@
  * ojjyOS v3 Kernel - Serial Port Driver
  *
  * 16550 UART driver for debug output.
+ *
+ * Output goes into a TX ring and is moved into the UART's 16-byte FIFO
+ * whenever the transmitter is empty: opportunistically from
+ * serial_putc() during early boot, then from the THR-empty interrupt
+ * once serial_driver_init() has registered the IRQ. Callers only block
+ * when the ring is full. serial_sync() drains the ring and switches
+ * to direct polled output for the panic path. The ring and the UART
+ * registers are guarded by tx_lock, taken with interrupts off.
  */
 
 #include "serial.h"
 #include "string.h"
+#include "spinlock.h"
+#include "drivers/driver.h"
 
 /* Current serial port */
 static uint16_t serial_port = COM1_PORT;
 
+/* TX ring (power of two) */
+#define SERIAL_TX_RING_SIZE     32768
+#define SERIAL_FIFO_SIZE        16
+
+/* Spins before serial_sync() gives up on the lock (holder stopped by panic) */
+#define SERIAL_SYNC_SPINS       1000000
+
+static Spinlock tx_lock = SPINLOCK_INIT;
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;      /* Next write */
+static volatile uint32_t tx_tail = 0;      /* Next byte to send */
+static bool tx_irq_mode = false;           /* THR-empty IRQ drains the ring */
+static bool tx_irq_armed = false;          /* THRI enabled in IER */
+static bool tx_sync = false;               /* Panic: bypass the ring */
+static uint8_t serial_irq = 4;
+
+/* Statistics */
+static uint64_t tx_stalls = 0;             /* putc found the ring full */
+static uint32_t tx_peak = 0;               /* Highest ring fill */
+
+extern void pic_enable_irq(uint8_t irq);
+
 /* UART register offsets */
 #define UART_DATA       0   /* Data register (R/W) */
 #define UART_IER        1   /* Interrupt Enable Register */
 #define UART_FCR        2   /* FIFO Control Register (W) */
+#define UART_IIR        2   /* Interrupt Identification Register (R) */
 #define UART_LCR        3   /* Line Control Register */
 #define UART_MCR        4   /* Modem Control Register */
 #define UART_LSR        5   /* Line Status Register */
@@ -23,6 +56,10 @@ static uint16_t serial_port = COM1_PORT;
 #define LSR_DR          0x01    /* Data Ready */
 #define LSR_THRE        0x20    /* Transmitter Holding Register Empty */
 
+/* Interrupt Enable / Identification bits */
+#define IER_THRI        0x02    /* Interrupt when THR empty */
+#define IIR_NO_INT      0x01    /* No interrupt pending */
+
 /* Baud rate divisor for 115200 baud */
 #define BAUD_DIVISOR    1
 
@@ -32,6 +69,7 @@ static uint16_t serial_port = COM1_PORT;
 void serial_init(uint16_t port)
 {
     serial_port = port;
+    serial_irq = (port == COM2_PORT || port == COM4_PORT) ? 3 : 4;
 
     /* Disable interrupts */
     outb(port + UART_IER, 0x00);
@@ -76,22 +114,193 @@ static int serial_is_transmit_empty(void)
 }
 
 /*
- * Write a character
+ * Polled write of one byte
  */
-void serial_putc(char c)
+static void serial_putc_sync(char c)
 {
-    /* Wait for transmitter to be ready */
     while (!serial_is_transmit_empty()) {
         /* Busy wait */
     }
-
-    /* Send the character */
     outb(serial_port + UART_DATA, c);
+}
+
+/*
+ * Move up to a FIFO's worth of bytes to the UART (THR must be empty)
+ */
+static void tx_fill_fifo(void)
+{
+    for (int n = 0; n < SERIAL_FIFO_SIZE && tx_tail != tx_head; n++) {
+        outb(serial_port + UART_DATA, tx_ring[tx_tail & (SERIAL_TX_RING_SIZE - 1)]);
+        tx_tail++;
+    }
+}
+
+/*
+ * Enable or disable the THR-empty interrupt
+ */
+static void tx_arm(bool arm)
+{
+    if (tx_irq_armed != arm) {
+        tx_irq_armed = arm;
+        outb(serial_port + UART_IER, arm ? IER_THRI : 0x00);
+    }
+}
 
-    /* Also send CR if LF */
+/*
+ * Queue one byte; tx_lock must be held
+ */
+static void tx_push(char c)
+{
+    if (tx_head - tx_tail >= SERIAL_TX_RING_SIZE) {
+        /* Full: make room the slow way */
+        tx_stalls++;
+        while (!serial_is_transmit_empty()) {
+            /* Busy wait */
+        }
+        tx_fill_fifo();
+    }
+
+    tx_ring[tx_head & (SERIAL_TX_RING_SIZE - 1)] = c;
+    tx_head++;
+
+    uint32_t fill = tx_head - tx_tail;
+    if (fill > tx_peak) {
+        tx_peak = fill;
+    }
+}
+
+/*
+ * Write a character
+ */
+void serial_putc(char c)
+{
+    if (tx_sync) {
+        serial_putc_sync(c);
+        if (c == '\n') {
+            serial_putc_sync('\r');
+        }
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+
+    tx_push(c);
     if (c == '\n') {
-        serial_putc('\r');
+        tx_push('\r');     /* Also send CR if LF */
     }
+
+    /* Start the transmitter if nothing is draining the ring */
+    if (!tx_irq_armed) {
+        if (serial_is_transmit_empty()) {
+            tx_fill_fifo();
+        }
+        if (tx_irq_mode && tx_tail != tx_head) {
+            tx_arm(true);
+        }
+    }
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+/*
+ * Drain the ring and write synchronously from now on
+ */
+void serial_sync(void)
+{
+    uint64_t flags = irq_save();
+
+    /* A CPU halted by the panic may still hold the lock: take it over */
+    for (int i = 0; i < SERIAL_SYNC_SPINS && !spin_trylock(&tx_lock); i++) {
+        cpu_relax();
+    }
+
+    tx_arm(false);
+    tx_irq_mode = false;
+    tx_sync = true;
+    while (tx_tail != tx_head) {
+        while (!serial_is_transmit_empty()) {
+            /* Busy wait */
+        }
+        tx_fill_fifo();
+    }
+
+    spin_unlock(&tx_lock);
+    irq_restore(flags);
+}
+
+/*
+ * THR-empty interrupt: refill the FIFO, stop when the ring is empty
+ */
+static bool serial_handle_irq(Driver *drv, uint8_t irq)
+{
+    (void)drv;
+    (void)irq;
+
+    if (inb(serial_port + UART_IIR) & IIR_NO_INT) {
+        return false;
+    }
+
+    spin_lock(&tx_lock);
+    if (serial_is_transmit_empty()) {
+        tx_fill_fifo();
+    }
+    if (tx_tail == tx_head) {
+        tx_arm(false);
+    }
+    spin_unlock(&tx_lock);
+    return true;
+}
+
+static int serial_drv_init(Driver *drv)
+{
+    driver_register_irq(drv, serial_irq);
+    pic_enable_irq(serial_irq);
+
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    tx_irq_mode = true;
+    if (tx_tail != tx_head) {
+        tx_arm(true);
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    serial_printf("[SERIAL] Interrupt-driven output on IRQ %d (%d KB ring)\n",
+        (uint64_t)serial_irq, (uint64_t)(SERIAL_TX_RING_SIZE / 1024));
+    return 0;
+}
+
+static DriverOps serial_ops = {
+    .init = serial_drv_init,
+    .handle_irq = serial_handle_irq,
+};
+
+static Driver serial_driver = {
+    .name = "serial",
+    .description = "16550 UART (buffered TX)",
+    .version = DRIVER_VERSION(1, 0, 0),
+    .type = DRIVER_TYPE_CHAR,
+    .ops = &serial_ops,
+};
+
+/*
+ * Register the IRQ-driven transmitter
+ */
+void serial_driver_init(void)
+{
+    driver_register(&serial_driver);
+}
+
+/*
+ * Bytes waiting in the TX ring, and ring statistics
+ */
+uint32_t serial_tx_pending(void)
+{
+    return tx_head - tx_tail;
+}
+
+void serial_get_tx_stats(uint32_t *peak, uint64_t *stalls)
+{
+    if (peak) *peak = tx_peak;
+    if (stalls) *stalls = tx_stalls;
 }
 
 /*
@@ -2,7 +2,9 @@
  * ojjyOS v3 Kernel - Serial Port Driver
  *
  * 16550 UART driver for debug output.
- * Uses COM1 (0x3F8) by default.
+ * Uses COM1 (0x3F8) by default. Output is buffered in a TX ring and
+ * drained by the THR-empty interrupt, so writers don't wait on the
+ * line rate.
  */
 
 #ifndef _OJJY_SERIAL_H
@@ -19,9 +21,19 @@
 /* Initialize serial port */
 void serial_init(uint16_t port);
 
-/* Write a character */
+/* Register the serial driver and switch to IRQ-driven output */
+void serial_driver_init(void);
+
+/* Write a character (queued; blocks only if the TX ring is full) */
 void serial_putc(char c);
 
+/* Flush queued output and write synchronously from now on (panic path) */
+void serial_sync(void);
+
+/* Bytes still queued, and ring high-water mark / full-ring stalls */
+uint32_t serial_tx_pending(void);
+void serial_get_tx_stats(uint32_t *peak, uint64_t *stalls);
+
 /* Write a string */
 void serial_puts(const char *s);
 
@@ -0,0 +1,350 @@
+/*
+ * ojjyOS v3 Kernel - Symmetric Multiprocessing Implementation
+ *
+ * APs are started one at a time: the trampoline page and its parameter
+ * block are shared, so the BSP waits for each AP to report online
+ * before starting the next.
+ */
+
+#include "smp.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "paging.h"
+#include "memory.h"
+#include "timer.h"
+#include "task.h"
+#include "panic.h"
+#include "serial.h"
+#include "console.h"
+#include "string.h"
+#include "boot_info.h"
+
+#define MSR_GS_BASE         0xC0000101
+#define MSR_EFER            0xC0000080
+
+#define EFER_SCE            (1ULL << 0)
+#define EFER_LME            (1ULL << 8)
+#define EFER_NXE            (1ULL << 11)
+
+#define CR4_PAE             (1ULL << 5)
+#define CR4_PGE             (1ULL << 7)
+#define CR4_OSFXSR          (1ULL << 9)
+#define CR4_OSXMMEXCPT      (1ULL << 10)
+
+/* Startup timing (Intel MP spec) */
+#define INIT_DELAY_MS       10
+#define SIPI_DELAY_MS       1
+#define AP_ONLINE_TIMEOUT   100
+
+/* Parameter block at the end of the trampoline (see ap_trampoline.asm) */
+typedef struct {
+    uint64_t cr3;
+    uint64_t cr4;
+    uint64_t cr0;
+    uint64_t efer;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t cpu;
+} PACKED ApTrampolineParams;
+
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_trampoline_params[];
+
+static PerCpu cpus[SMP_MAX_CPUS];
+static uint32_t cpu_count = 1;
+static volatile bool stopping = false;
+
+static inline uint64_t read_cr0(void)
+{
+    uint64_t val;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline uint64_t read_cr4(void)
+{
+    uint64_t val;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+/*
+ * NMI: either another CPU is panicking (halt quietly) or it is a real
+ * hardware NMI, which was fatal before SMP as well
+ */
+static void nmi_handler(InterruptFrame *frame)
+{
+    if (stopping) {
+        for (;;) {
+            cli();
+            hlt();
+        }
+    }
+    panic_with_frame("Non-Maskable Interrupt", frame);
+}
+
+/* smp_call() and task pool doorbell: the work itself runs from the idle loop */
+static void wake_handler(InterruptFrame *frame)
+{
+    (void)frame;
+    this_cpu()->wakeups++;
+}
+
+/*
+ * AP idle loop: smp_call() work first, then pool tasks. Before halting
+ * the CPU publishes 'idle' and checks both again, so a task pushed
+ * meanwhile either is seen here or finds the flag set and sends the
+ * wakeup IPI; "sti; hlt" closes the window in which that IPI could be
+ * missed.
+ */
+static void ap_idle(PerCpu *cpu)
+{
+    for (;;) {
+        cli();
+        SmpCallFn fn = __atomic_load_n(&cpu->call_fn, __ATOMIC_ACQUIRE);
+        /* Claim the call; smp_call_cancel() races for the same slot */
+        if (fn && __atomic_compare_exchange_n(&cpu->call_fn, &fn, NULL, false,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            sti();
+            fn(cpu->call_arg);
+            cpu->calls++;
+            __atomic_store_n(&cpu->call_busy, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+        sti();
+
+        if (task_run_one()) continue;
+
+        cli();
+        __atomic_store_n(&cpu->idle, true, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&cpu->call_fn, __ATOMIC_ACQUIRE) || task_pending()) {
+            __atomic_store_n(&cpu->idle, false, __ATOMIC_RELAXED);
+            continue;
+        }
+        uint64_t start = rdtsc();
+        __asm__ volatile("sti; hlt" : : : "memory");
+        cpu->idle_cycles += rdtsc() - start;
+        __atomic_store_n(&cpu->idle, false, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * 64-bit entry for APs, called by the trampoline on the AP's own stack
+ */
+static void ap_main(PerCpu *cpu)
+{
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    gdt_init_cpu(cpu->id);
+    idt_load();
+    paging_init_ap();
+    lapic_init_ap();
+
+    /* INIT leaves the x87 control word with every exception unmasked */
+    __asm__ volatile("fninit");
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    serial_printf("[SMP] CPU %d online (APIC ID %d)\n",
+        (uint64_t)cpu->id, (uint64_t)cpu->apic_id);
+
+    ap_idle(cpu);
+}
+
+static bool wait_online(PerCpu *cpu, uint64_t ms)
+{
+    uint64_t start = timer_get_ticks();
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (timer_get_ticks() - start >= ms) {
+            return false;
+        }
+        cpu_relax();
+    }
+    return true;
+}
+
+/*
+ * Start one AP with INIT-SIPI-SIPI. The second SIPI is only sent if
+ * the first did not get the AP going.
+ */
+static bool start_ap(uint32_t apic_id)
+{
+    PerCpu *cpu = &cpus[cpu_count];
+    uint64_t stack = pmm_alloc_pages(AP_STACK_ORDER, 0);
+    if (!stack) {
+        serial_printf("[SMP] No stack for APIC ID %d\n", (uint64_t)apic_id);
+        return false;
+    }
+
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->self = cpu;
+    cpu->id = cpu_count;
+    cpu->apic_id = apic_id;
+    cpu->stack_top = stack + (PAGE_SIZE << AP_STACK_ORDER);
+
+    ApTrampolineParams *params = (ApTrampolineParams *)(AP_TRAMPOLINE_PHYS +
+        (uint64_t)(ap_trampoline_params - ap_trampoline_start));
+    params->stack = cpu->stack_top;
+    params->cpu = (uint64_t)cpu;
+
+    lapic_send_init(apic_id);
+    timer_sleep(INIT_DELAY_MS);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_PHYS >> 12);
+    if (!wait_online(cpu, SIPI_DELAY_MS)) {
+        lapic_send_startup(apic_id, AP_TRAMPOLINE_PHYS >> 12);
+        if (!wait_online(cpu, AP_ONLINE_TIMEOUT)) {
+            /* Park it again so a late start cannot use the next AP's slot */
+            lapic_send_init(apic_id);
+            pmm_free_pages(stack, AP_STACK_ORDER);
+            serial_printf("[SMP] APIC ID %d did not start\n", (uint64_t)apic_id);
+            return false;
+        }
+    }
+
+    cpu_count++;
+    return true;
+}
+
+void smp_init_bsp(void)
+{
+    memset(&cpus[0], 0, sizeof(cpus[0]));
+    cpus[0].self = &cpus[0];
+    cpus[0].online = true;
+    wrmsr(MSR_GS_BASE, (uint64_t)&cpus[0]);
+}
+
+void smp_init(void)
+{
+    idt_register_handler(INT_NMI, nmi_handler);
+    idt_register_handler(INT_IPI_WAKE, wake_handler);
+
+    if (!acpi_init(g_boot_info ? g_boot_info->rsdp_addr : 0)) {
+        serial_printf("[SMP] No ACPI tables, running on one CPU\n");
+        return;
+    }
+    const AcpiMadt *madt = acpi_get_madt();
+    if (!madt || !lapic_init(madt->lapic_base)) {
+        serial_printf("[SMP] No usable MADT/local APIC, running on one CPU\n");
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+
+    /* Install the trampoline and the parameters every AP shares */
+    uint64_t size = (uint64_t)(ap_trampoline_end - ap_trampoline_start);
+    memcpy((void *)AP_TRAMPOLINE_PHYS, ap_trampoline_start, size);
+
+    ApTrampolineParams *params = (ApTrampolineParams *)(AP_TRAMPOLINE_PHYS +
+        (uint64_t)(ap_trampoline_params - ap_trampoline_start));
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4() & (CR4_PAE | CR4_PGE | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    params->cr0 = read_cr0();
+    params->efer = rdmsr(MSR_EFER) & (EFER_SCE | EFER_LME | EFER_NXE);
+    params->entry = (uint64_t)ap_main;
+
+    for (uint32_t i = 0; i < madt->cpu_count; i++) {
+        if (madt->apic_ids[i] == cpus[0].apic_id) continue;
+        if (cpu_count >= SMP_MAX_CPUS) {
+            serial_printf("[SMP] Ignoring CPUs beyond %d\n", (uint64_t)SMP_MAX_CPUS);
+            break;
+        }
+        start_ap(madt->apic_ids[i]);
+    }
+
+    serial_printf("[SMP] %d of %d CPUs online\n",
+        (uint64_t)cpu_count, (uint64_t)madt->cpu_count);
+}
+
+uint32_t smp_cpu_count(void)
+{
+    return cpu_count;
+}
+
+PerCpu *smp_get_cpu(uint32_t cpu)
+{
+    return cpu < cpu_count ? &cpus[cpu] : NULL;
+}
+
+bool smp_call(uint32_t cpu, SmpCallFn fn, void *arg)
+{
+    if (cpu == 0 || cpu >= cpu_count) {
+        return false;
+    }
+
+    PerCpu *target = &cpus[cpu];
+    uint32_t idle = 0;
+    if (!__atomic_compare_exchange_n(&target->call_busy, &idle, 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    target->call_arg = arg;
+    __atomic_store_n(&target->call_fn, fn, __ATOMIC_RELEASE);
+    lapic_send_ipi(target->apic_id, INT_IPI_WAKE);
+    return true;
+}
+
+void smp_call_wait(uint32_t cpu)
+{
+    if (cpu == 0 || cpu >= cpu_count) {
+        return;
+    }
+    while (__atomic_load_n(&cpus[cpu].call_busy, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+}
+
+bool smp_call_cancel(uint32_t cpu)
+{
+    if (cpu == 0 || cpu >= cpu_count) {
+        return false;
+    }
+
+    PerCpu *target = &cpus[cpu];
+    SmpCallFn fn = __atomic_load_n(&target->call_fn, __ATOMIC_ACQUIRE);
+    if (!fn || !__atomic_compare_exchange_n(&target->call_fn, &fn, NULL, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    __atomic_store_n(&target->call_busy, 0, __ATOMIC_RELEASE);
+    return true;
+}
+
+void smp_wake_idle(void)
+{
+    for (uint32_t i = 1; i < cpu_count; i++) {
+        PerCpu *target = &cpus[i];
+        bool idle = true;
+        if (__atomic_load_n(&target->idle, __ATOMIC_SEQ_CST) &&
+            __atomic_compare_exchange_n(&target->idle, &idle, false, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            lapic_send_ipi(target->apic_id, INT_IPI_WAKE);
+            return;
+        }
+    }
+}
+
+void smp_wake_cpu(uint32_t cpu)
+{
+    if (cpu < cpu_count && cpu != smp_cpu_id()) {
+        lapic_send_ipi(cpus[cpu].apic_id, INT_IPI_WAKE);
+    }
+}
+
+void smp_stop_others(void)
+{
+    stopping = true;
+    lapic_send_nmi_others();
+}
+
+void smp_print_info(void)
+{
+    console_printf("\nCPUs: %d online\n", (int)cpu_count);
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        PerCpu *cpu = &cpus[i];
+        console_printf("  CPU %d: APIC ID %d, %s, %ld calls, %ld wakeups\n",
+            (int)cpu->id, (int)cpu->apic_id, i == 0 ? "BSP" : "AP",
+            cpu->calls, cpu->wakeups);
+    }
+    console_printf("\n");
+}
@@ -0,0 +1,124 @@
+/*
+ * ojjyOS v3 Kernel - Symmetric Multiprocessing
+ *
+ * Application processors are found through the ACPI MADT and started
+ * with INIT-SIPI-SIPI through a real-mode trampoline. Each CPU gets its
+ * own GDT, TSS, stack and PerCpu block, reached through GS. Device and
+ * timer interrupts stay on the BSP (8259 PICs); APs run work handed to
+ * them with smp_call(), then pool tasks (task.c), and halt when both
+ * run out.
+ */
+
+#ifndef _OJJY_SMP_H
+#define _OJJY_SMP_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/* CPUs brought up (the rest of the MADT is ignored) */
+#define SMP_MAX_CPUS            32
+
+/* Trampoline page; must be below 1MB and match ap_trampoline.asm */
+#define AP_TRAMPOLINE_PHYS      0x8000
+
+/* AP kernel stacks: 2^order pages */
+#define AP_STACK_ORDER          2
+
+/* Work function run on another CPU */
+typedef void (*SmpCallFn)(void *arg);
+
+/* Per-CPU data; GS base points here on every CPU */
+typedef struct PerCpu {
+    struct PerCpu *self;            /* Must stay first (read via %gs:0) */
+    volatile uint32_t preempt_count; /* Must stay at PERCPU_PREEMPT_OFFSET */
+    uint32_t id;                    /* Logical CPU number, BSP = 0 */
+    uint32_t apic_id;
+    volatile bool online;
+    uint64_t stack_top;
+
+    /* smp_call() mailbox */
+    volatile SmpCallFn call_fn;
+    void *call_arg;
+    volatile uint32_t call_busy;
+
+    /* Halted with nothing to do; smp_wake_idle() clears it */
+    volatile bool idle;
+
+    /* Statistics */
+    uint64_t calls;                 /* smp_call() functions run */
+    uint64_t wakeups;               /* Wakeup IPIs received */
+    uint64_t idle_cycles;           /* TSC cycles spent halted */
+} PerCpu;
+
+/* Calling CPU's PerCpu block */
+static inline PerCpu *this_cpu(void)
+{
+    PerCpu *cpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint32_t smp_cpu_id(void)
+{
+    return this_cpu()->id;
+}
+
+/* Block the calling thread until the next IRQ (sched.c) */
+bool sched_wait_irq(void);
+
+/*
+ * Wait for something another agent will change. The BSP receives the
+ * device and timer IRQs: a thread blocks until one arrives so other
+ * threads can run, and code that cannot block halts. An AP would sleep
+ * until the next IPI, so it spins instead.
+ */
+static inline void cpu_wait(void)
+{
+    if (smp_cpu_id() != 0) {
+        cpu_relax();
+    } else if (!sched_wait_irq()) {
+        hlt();
+    }
+}
+
+/* Set up the BSP's PerCpu block (first thing in kernel_main) */
+void smp_init_bsp(void);
+
+/* Find and start the application processors (interrupts enabled) */
+void smp_init(void);
+
+/* CPUs online, including the BSP */
+uint32_t smp_cpu_count(void);
+
+/* PerCpu block of a logical CPU, or NULL */
+PerCpu *smp_get_cpu(uint32_t cpu);
+
+/*
+ * Run fn(arg) on an AP. Returns false if the CPU is not an online AP
+ * or is still running a previous call.
+ */
+bool smp_call(uint32_t cpu, SmpCallFn fn, void *arg);
+
+/* Wait until the AP has finished its smp_call() function */
+void smp_call_wait(uint32_t cpu);
+
+/*
+ * Withdraw a call the AP has not started yet (it only looks at the
+ * mailbox between pool tasks). Returns true if withdrawn; false means
+ * the function is running or finished, so smp_call_wait() is bounded.
+ */
+bool smp_call_cancel(uint32_t cpu);
+
+/* Wake one halted AP to look for pool tasks (task.c) */
+void smp_wake_idle(void);
+
+/* Send a wakeup IPI to another CPU (the BSP reschedules on it) */
+void smp_wake_cpu(uint32_t cpu);
+
+/* Halt every other CPU (panic path) */
+void smp_stop_others(void);
+
+/* Print CPU list and statistics to the console */
+void smp_print_info(void);
+
+#endif /* _OJJY_SMP_H */
@@ -0,0 +1,150 @@
+/*
+ * ojjyOS v3 Kernel - Spinlocks
+ *
+ * Spinlock is a test-and-test-and-set lock: one exchange when free,
+ * then spinning on a plain load so waiters don't bounce the cache line.
+ * TicketLock hands the lock over in arrival order, which keeps busy
+ * allocators (heap, PMM) fair when several CPUs hammer them.
+ *
+ * The _irqsave variants also disable interrupts on this CPU. Use them
+ * for anything an IRQ handler touches, otherwise the handler can spin
+ * forever on a lock its own CPU holds.
+ *
+ * Holding any of these locks also disables preemption: the scheduler
+ * never switches away from a lock holder, so a higher-priority thread
+ * cannot end up spinning on a lock held by the thread it displaced.
+ * Locks held across slow work (VFS, block cache) are Mutexes (sched.h).
+ */
+
+#ifndef _OJJY_SPINLOCK_H
+#define _OJJY_SPINLOCK_H
+
+#include "types.h"
+
+typedef struct {
+    volatile uint32_t locked;
+} Spinlock;
+
+typedef struct {
+    volatile uint16_t next;     /* Next ticket to hand out */
+    volatile uint16_t owner;    /* Ticket being served */
+} TicketLock;
+
+#define SPINLOCK_INIT       { 0 }
+#define TICKET_LOCK_INIT    { 0, 0 }
+
+/* Spin-wait hint (PAUSE) */
+static inline void cpu_relax(void)
+{
+    __asm__ volatile("pause" : : : "memory");
+}
+
+/* GS offset of PerCpu.preempt_count (see smp.h) */
+#define PERCPU_PREEMPT_OFFSET   8
+
+/* Nesting count of sections the scheduler must not switch away from */
+static inline void preempt_disable(void)
+{
+    __asm__ volatile("incl %%gs:%c0" : : "i"(PERCPU_PREEMPT_OFFSET) : "memory");
+}
+
+static inline void preempt_enable(void)
+{
+    __asm__ volatile("decl %%gs:%c0" : : "i"(PERCPU_PREEMPT_OFFSET) : "memory");
+}
+
+/* Disable interrupts, returning the previous RFLAGS */
+static inline uint64_t irq_save(void)
+{
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Re-enable interrupts if they were on before irq_save() */
+static inline void irq_restore(uint64_t flags)
+{
+    if (flags & (1 << 9)) {
+        sti();
+    }
+}
+
+static inline void spin_init(Spinlock *lock)
+{
+    lock->locked = 0;
+}
+
+static inline bool spin_trylock(Spinlock *lock)
+{
+    preempt_disable();
+    if (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0) {
+        return true;
+    }
+    preempt_enable();
+    return false;
+}
+
+static inline void spin_lock(Spinlock *lock)
+{
+    preempt_disable();
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void spin_unlock(Spinlock *lock)
+{
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline uint64_t spin_lock_irqsave(Spinlock *lock)
+{
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(Spinlock *lock, uint64_t flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline void ticket_init(TicketLock *lock)
+{
+    lock->next = 0;
+    lock->owner = 0;
+}
+
+static inline void ticket_lock(TicketLock *lock)
+{
+    preempt_disable();
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        cpu_relax();
+    }
+}
+
+static inline void ticket_unlock(TicketLock *lock)
+{
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline uint64_t ticket_lock_irqsave(TicketLock *lock)
+{
+    uint64_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(TicketLock *lock, uint64_t flags)
+{
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif /* _OJJY_SPINLOCK_H */
@@ -4,12 +4,100 @@
 
 #include "string.h"
 
+/*
+ * Bulk memory routines. The kernel is built with -mno-sse, so copies use
+ * general purpose registers: "rep movsb/stosb" when the CPU advertises
+ * Enhanced REP MOVSB/STOSB (ERMS), 8-byte word loops otherwise. The
+ * choice is made once by string_init().
+ */
+
+/* CPUID leaf 7 EBX: Enhanced REP MOVSB/STOSB */
+#define CPUID_7_EBX_ERMS    (1U << 9)
+
+/* Below this size, rep startup costs more than a word loop */
+#define REP_THRESHOLD       128
+
+/* Unaligned 8-byte access that may alias anything */
+typedef uint64_t __attribute__((may_alias, aligned(1))) word_t;
+
+static bool use_erms = false;
+
+/*
+ * Pick the memory routine variants for this CPU
+ */
+void string_init(void)
+{
+    uint32_t max_leaf, ebx;
+    cpuid(0, 0, &max_leaf, NULL, NULL, NULL);
+    if (max_leaf >= 7) {
+        cpuid(7, 0, NULL, &ebx, NULL, NULL);
+        use_erms = (ebx & CPUID_7_EBX_ERMS) != 0;
+    }
+}
+
+/*
+ * Whether the rep movsb/stosb variants are in use
+ */
+bool string_uses_erms(void)
+{
+    return use_erms;
+}
+
+static inline void copy_forward_words(uint8_t *d, const uint8_t *s, size_t n)
+{
+    while (n >= 32) {
+        word_t a = ((const word_t *)s)[0];
+        word_t b = ((const word_t *)s)[1];
+        word_t c = ((const word_t *)s)[2];
+        word_t e = ((const word_t *)s)[3];
+        ((word_t *)d)[0] = a;
+        ((word_t *)d)[1] = b;
+        ((word_t *)d)[2] = c;
+        ((word_t *)d)[3] = e;
+        d += 32;
+        s += 32;
+        n -= 32;
+    }
+    while (n >= 8) {
+        *(word_t *)d = *(const word_t *)s;
+        d += 8;
+        s += 8;
+        n -= 8;
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
 /*
  * Set memory to a value
  */
 void *memset(void *s, int c, size_t n)
 {
     uint8_t *p = (uint8_t *)s;
+
+    if (use_erms && n >= REP_THRESHOLD) {
+        __asm__ volatile("rep stosb"
+            : "+D"(p), "+c"(n)
+            : "a"(c)
+            : "memory");
+        return s;
+    }
+
+    uint64_t pattern = (uint8_t)c * 0x0101010101010101ULL;
+    while (n >= 32) {
+        ((word_t *)p)[0] = pattern;
+        ((word_t *)p)[1] = pattern;
+        ((word_t *)p)[2] = pattern;
+        ((word_t *)p)[3] = pattern;
+        p += 32;
+        n -= 32;
+    }
+    while (n >= 8) {
+        *(word_t *)p = pattern;
+        p += 8;
+        n -= 8;
+    }
     while (n--) {
         *p++ = (uint8_t)c;
     }
@@ -23,9 +111,16 @@ void *memcpy(void *dest, const void *src, size_t n)
 {
     uint8_t *d = (uint8_t *)dest;
     const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
+
+    if (use_erms && n >= REP_THRESHOLD) {
+        __asm__ volatile("rep movsb"
+            : "+D"(d), "+S"(s), "+c"(n)
+            :
+            : "memory");
+        return dest;
     }
+
+    copy_forward_words(d, s, n);
     return dest;
 }
 
@@ -37,16 +132,22 @@ void *memmove(void *dest, const void *src, size_t n)
     uint8_t *d = (uint8_t *)dest;
     const uint8_t *s = (const uint8_t *)src;
 
-    if (d < s) {
-        while (n--) {
-            *d++ = *s++;
-        }
-    } else {
-        d += n;
-        s += n;
-        while (n--) {
-            *--d = *--s;
-        }
+    /* Forward copies are safe when the destination starts below the source */
+    if (d <= s || d >= s + n) {
+        return memcpy(dest, src, n);
+    }
+
+    /* Overlapping with dest above src: copy words from the end */
+    d += n;
+    s += n;
+    while (n >= 8) {
+        d -= 8;
+        s -= 8;
+        n -= 8;
+        *(word_t *)d = *(const word_t *)s;
+    }
+    while (n--) {
+        *--d = *--s;
     }
     return dest;
 }
@@ -59,6 +160,13 @@ int memcmp(const void *s1, const void *s2, size_t n)
     const uint8_t *p1 = (const uint8_t *)s1;
     const uint8_t *p2 = (const uint8_t *)s2;
 
+    /* Skip equal words, then find the differing byte */
+    while (n >= 8 && *(const word_t *)p1 == *(const word_t *)p2) {
+        p1 += 8;
+        p2 += 8;
+        n -= 8;
+    }
+
     while (n--) {
         if (*p1 != *p2) {
             return *p1 - *p2;
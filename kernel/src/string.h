@@ -7,6 +7,10 @@
 
 #include "types.h"
 
+/* Select memory routine variants via CPUID (call once at boot) */
+void string_init(void);
+bool string_uses_erms(void);
+
 /* Memory operations */
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
@@ -0,0 +1,47 @@
+; ojjyOS v3 Kernel - Thread Context Switch
+;
+; context_switch(&prev->rsp, next->rsp) pushes the callee-saved
+; registers on the current stack, saves RSP and pops the next thread's
+; registers from its stack. Everything else is saved by the C caller
+; (sched.c switches with interrupts off and handles the FPU state).
+;
+; NASM syntax
+
+[BITS 64]
+
+global context_switch
+global thread_start
+
+extern thread_bootstrap
+
+section .text
+
+context_switch:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
+
+; First switch into a new thread returns here (see thread_create()):
+; R12 = entry function, R13 = its argument
+thread_start:
+    mov rdi, r12
+    mov rsi, r13
+    call thread_bootstrap
+
+    ; thread_bootstrap() never returns
+.halt:
+    cli
+    hlt
+    jmp .halt
@@ -0,0 +1,321 @@
+/*
+ * ojjyOS v3 Kernel - Work-Stealing Task Pool Implementation
+ *
+ * The deques are the fixed-size Chase-Lev variant: the owner pushes and
+ * pops at the bottom without atomics except on the last element, and
+ * thieves take the top with a CAS. A fence between the owner's bottom
+ * store and its top load (and the thief's top and bottom loads) makes
+ * the two sides agree on who gets a single remaining task.
+ */
+
+#include "task.h"
+#include "smp.h"
+#include "sched.h"
+#include "heap.h"
+#include "console.h"
+
+#define TASK_DEQUE_MASK         (TASK_DEQUE_SIZE - 1)
+
+typedef struct {
+    volatile int64_t top;           /* Next task to steal */
+    uint8_t pad[56];                /* Keep thieves off the owner's line */
+    volatile int64_t bottom;        /* Next free slot */
+    Task *volatile slots[TASK_DEQUE_SIZE];
+
+    /* Statistics for this CPU */
+    uint64_t spawned;
+    uint64_t executed;
+    uint64_t stolen;                /* Tasks this CPU took from others */
+    uint64_t inline_runs;           /* Spawns that ran inline (deque full) */
+    uint64_t join_cycles;           /* task_join() with nothing to run */
+    uint64_t max_depth;
+} __attribute__((aligned(64))) TaskDeque;
+
+typedef struct {
+    Task task;
+    TaskRangeFn fn;
+    void *arg;
+    uint32_t begin;
+    uint32_t end;
+} ForChunk;
+
+static TaskDeque deques[SMP_MAX_CPUS];
+
+/* BSP threads blocked in task_join(); any CPU finishing a task wakes them */
+static WaitQueue join_waiters = WAIT_QUEUE_INIT;
+static volatile uint32_t joiners = 0;
+
+static bool deque_push(TaskDeque *d, Task *task)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= TASK_DEQUE_SIZE) {
+        return false;
+    }
+    d->slots[b & TASK_DEQUE_MASK] = task;
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+
+    if ((uint64_t)(b + 1 - t) > d->max_depth) {
+        d->max_depth = (uint64_t)(b + 1 - t);
+    }
+    return true;
+}
+
+static Task *deque_pop(TaskDeque *d)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    Task *task = d->slots[b & TASK_DEQUE_MASK];
+    if (t == b) {
+        /* Last task: race the thieves for it */
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static Task *deque_steal(TaskDeque *d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+
+    /* The slot cannot be reused before top moves past it */
+    Task *task = d->slots[t & TASK_DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+/*
+ * Queue a task on this CPU's deque and wake a halted AP to steal it.
+ * Returns false if the deque is full.
+ */
+static bool task_submit(Task *task)
+{
+    preempt_disable();
+    TaskDeque *d = &deques[smp_cpu_id()];
+    bool queued = deque_push(d, task);
+    if (queued) {
+        d->spawned++;
+    } else {
+        d->inline_runs++;
+    }
+    preempt_enable();
+
+    if (queued) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        smp_wake_idle();
+    }
+    return queued;
+}
+
+/*
+ * Run a task and publish completion. Nothing touches the task after
+ * 'done' is set: its joiner may free it at once.
+ */
+static void task_run(Task *task)
+{
+    task->fn(task->arg);
+    __atomic_fetch_add(&deques[smp_cpu_id()].executed, 1, __ATOMIC_RELAXED);
+
+    if (task->detached) {
+        kfree(task);
+        return;
+    }
+    __atomic_store_n(&task->done, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&joiners, __ATOMIC_SEQ_CST)) {
+        wait_queue_wake_all(&join_waiters);
+    }
+}
+
+static Task *task_alloc(TaskFn fn, void *arg, bool detached)
+{
+    Task *task = (Task *)kmalloc(sizeof(Task));
+    if (!task) return NULL;
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+    task->detached = detached;
+    task->allocated = true;
+    return task;
+}
+
+Task *task_spawn(TaskFn fn, void *arg)
+{
+    Task *task = task_alloc(fn, arg, false);
+    if (!task) {
+        fn(arg);
+        return NULL;
+    }
+    if (!task_submit(task)) {
+        kfree(task);
+        fn(arg);
+        return NULL;
+    }
+    return task;
+}
+
+void task_spawn_detached(TaskFn fn, void *arg)
+{
+    Task *task = task_alloc(fn, arg, true);
+    if (!task) {
+        fn(arg);
+        return;
+    }
+    if (!task_submit(task)) {
+        kfree(task);
+        fn(arg);
+    }
+}
+
+bool task_run_one(void)
+{
+    preempt_disable();
+    uint32_t self = smp_cpu_id();
+    Task *task = deque_pop(&deques[self]);
+    if (!task) {
+        uint32_t n = smp_cpu_count();
+        for (uint32_t i = 1; i < n && !task; i++) {
+            task = deque_steal(&deques[(self + i) % n]);
+        }
+        if (task) {
+            deques[self].stolen++;
+        }
+    }
+    preempt_enable();
+
+    if (!task) return false;
+    task_run(task);
+    return true;
+}
+
+bool task_pending(void)
+{
+    uint32_t n = smp_cpu_count();
+    for (uint32_t cpu = 0; cpu < n; cpu++) {
+        TaskDeque *d = &deques[cpu];
+        if (__atomic_load_n(&d->top, __ATOMIC_SEQ_CST) <
+            __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Help until the task is done. Once there is nothing left to run, the
+ * task is running on another CPU: BSP threads block (the 1 ms timeout
+ * covers a completion that lands just before they queue), APs spin.
+ */
+static void task_wait(Task *task)
+{
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        if (task_run_one()) continue;
+
+        uint64_t start = rdtsc();
+        if (thread_current()) {
+            uint64_t irq = irq_save();
+            __atomic_add_fetch(&joiners, 1, __ATOMIC_SEQ_CST);
+            if (!__atomic_load_n(&task->done, __ATOMIC_SEQ_CST)) {
+                wait_queue_sleep(&join_waiters, 1);
+            }
+            __atomic_sub_fetch(&joiners, 1, __ATOMIC_SEQ_CST);
+            irq_restore(irq);
+        } else {
+            cpu_relax();
+        }
+        __atomic_fetch_add(&deques[smp_cpu_id()].join_cycles, rdtsc() - start,
+                           __ATOMIC_RELAXED);
+    }
+}
+
+void task_join(Task *task)
+{
+    if (!task) return;
+    task_wait(task);
+    if (task->allocated) {
+        kfree(task);
+    }
+}
+
+static void for_chunk_main(void *arg)
+{
+    ForChunk *chunk = (ForChunk *)arg;
+    chunk->fn(chunk->begin, chunk->end, chunk->arg);
+}
+
+void task_parallel_for(uint32_t begin, uint32_t end, uint32_t grain,
+                       TaskRangeFn fn, void *arg)
+{
+    if (end <= begin) return;
+
+    uint32_t total = end - begin;
+    uint32_t chunks = (total + MAX(grain, 1) - 1) / MAX(grain, 1);
+    chunks = MIN(chunks, TASK_FOR_MAX_CHUNKS);
+    if (chunks <= 1 || smp_cpu_count() == 1) {
+        fn(begin, end, arg);
+        return;
+    }
+
+    /* Queue chunks 1..n-1 (thieves take the low ones), run chunk 0 here */
+    ForChunk chunk[TASK_FOR_MAX_CHUNKS];
+    for (uint32_t i = 1; i < chunks; i++) {
+        ForChunk *c = &chunk[i];
+        c->fn = fn;
+        c->arg = arg;
+        c->begin = begin + (uint32_t)((uint64_t)total * i / chunks);
+        c->end = begin + (uint32_t)((uint64_t)total * (i + 1) / chunks);
+        c->task.fn = for_chunk_main;
+        c->task.arg = c;
+        c->task.done = 0;
+        c->task.detached = false;
+        c->task.allocated = false;
+        if (!task_submit(&c->task)) {
+            for_chunk_main(c);
+            c->task.done = 1;
+        }
+    }
+
+    fn(begin, begin + total / chunks, arg);
+
+    for (uint32_t i = 1; i < chunks; i++) {
+        task_wait(&chunk[i].task);
+    }
+}
+
+void task_print_stats(void)
+{
+    uint32_t n = smp_cpu_count();
+    uint64_t now = rdtsc();
+
+    console_printf("\nTask pool (%d CPUs, %d-slot deques):\n", (int)n, TASK_DEQUE_SIZE);
+    for (uint32_t cpu = 0; cpu < n; cpu++) {
+        TaskDeque *d = &deques[cpu];
+        PerCpu *pc = smp_get_cpu(cpu);
+        int64_t depth = d->bottom - d->top;
+        int idle = (pc && now) ? (int)(pc->idle_cycles * 100 / now) : 0;
+        console_printf("  CPU %d: depth %d (max %d), %ld spawned, %ld run, %ld stolen, %ld inline\n",
+            (int)cpu, (int)MAX(depth, 0), (int)d->max_depth,
+            d->spawned, d->executed, d->stolen, d->inline_runs);
+        console_printf("         join wait %ld Kcycles, idle %d%%\n",
+            d->join_cycles / 1000, idle);
+    }
+    console_printf("\n");
+}
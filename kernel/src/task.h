@@ -0,0 +1,65 @@
+/*
+ * ojjyOS v3 Kernel - Work-Stealing Task Pool
+ *
+ * Short background jobs (directory scans, icon and thumbnail loads,
+ * blur passes) run on every CPU. Each CPU has a Chase-Lev deque: the
+ * CPU pushes and pops its own tasks at the bottom, other CPUs steal
+ * from the top. APs run tasks between smp_call()s, the BSP from its
+ * idle thread and from task_join(), which runs tasks while it waits.
+ *
+ * On the BSP several threads share CPU 0's deque; owner operations run
+ * with preemption disabled, so they never interleave.
+ */
+
+#ifndef _OJJY_TASK_H
+#define _OJJY_TASK_H
+
+#include "types.h"
+
+/* Deque slots per CPU (power of two); spawning into a full deque runs inline */
+#define TASK_DEQUE_SIZE         256
+
+/* Most chunks task_parallel_for() splits a range into */
+#define TASK_FOR_MAX_CHUNKS     32
+
+typedef void (*TaskFn)(void *arg);
+typedef void (*TaskRangeFn)(uint32_t begin, uint32_t end, void *arg);
+
+typedef struct Task {
+    TaskFn fn;
+    void *arg;
+    volatile uint32_t done;
+    bool detached;                  /* Freed by whoever runs it */
+    bool allocated;                 /* From kmalloc, freed by task_join() */
+} Task;
+
+/*
+ * Queue fn(arg) on the calling CPU's deque. Returns a handle for
+ * task_join(), or NULL if the task already ran inline (no memory,
+ * deque full).
+ */
+Task *task_spawn(TaskFn fn, void *arg);
+
+/* Queue fn(arg) with no handle; it is freed after it runs */
+void task_spawn_detached(TaskFn fn, void *arg);
+
+/* Wait for a task, running other tasks meanwhile, then free it */
+void task_join(Task *task);
+
+/*
+ * Call fn on [begin, end) split into chunks of at least grain items,
+ * spread over the CPUs. Returns when every chunk is done.
+ */
+void task_parallel_for(uint32_t begin, uint32_t end, uint32_t grain,
+                       TaskRangeFn fn, void *arg);
+
+/* Run one task from this CPU's deque or a stolen one; false if none */
+bool task_run_one(void);
+
+/* True if any deque holds a task */
+bool task_pending(void);
+
+/* Print per-CPU pool statistics to the console */
+void task_print_stats(void);
+
+#endif /* _OJJY_TASK_H */
@@ -1,13 +1,18 @@
 /*
  * ojjyOS v3 Kernel - Timer Driver Implementation
  *
- * Uses the legacy PIT (8254) for system timing.
- * Configured for approximately 1000 Hz (1ms per tick).
+ * Uses the legacy PIT (8254) for the boot-time tick (1000 Hz) and, on
+ * channel 2, as the reference for TSC calibration. Time conversions
+ * use 32.32 fixed-point factors so no 128-bit division is needed.
  */
 
 #include "timer.h"
 #include "idt.h"
+#include "lapic.h"
 #include "serial.h"
+#include "console.h"
+#include "smp.h"
+#include "sched.h"
 
 /* PIT ports */
 #define PIT_CHANNEL0    0x40
@@ -21,12 +26,53 @@
 /* Desired tick rate (Hz) */
 #define TICK_RATE       1000
 
+/* Port 0x61: channel 2 gate, speaker enable, channel 2 output */
+#define PIT_GATE_PORT   0x61
+#define PIT_GATE2       0x01
+#define PIT_SPEAKER     0x02
+#define PIT_OUT2        0x20
+
+/* TSC calibration: shortest of several 10 ms PIT windows */
+#define CALIBRATE_MS    10
+#define CALIBRATE_RUNS  3
+#define CALIBRATE_SPINS 10000000
+
+typedef enum {
+    TIMER_EVENT_PIT = 0,            /* Periodic 1 ms tick */
+    TIMER_EVENT_ONESHOT,            /* LAPIC one-shot count */
+    TIMER_EVENT_TSC_DEADLINE        /* LAPIC TSC-deadline */
+} TimerEventMode;
+
+static const char *event_mode_names[] = { "PIT 1000 Hz", "LAPIC one-shot", "LAPIC TSC-deadline" };
+
 /* Tick counter */
 static volatile uint64_t tick_count = 0;
 
+/* TSC clock */
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_base = 0;               /* TSC at calibration = 0 ns */
+static uint64_t ns_per_cycle = 0;           /* 32.32 fixed point */
+static uint64_t cycles_per_ns = 0;          /* 32.32 fixed point */
+static bool tsc_invariant = false;
+
+/* BSP event device */
+static TimerEventMode event_mode = TIMER_EVENT_PIT;
+static uint64_t lapic_hz = 0;               /* One-shot count rate */
+static uint64_t lapic_per_ns = 0;           /* 32.32 fixed point */
+static uint64_t event_pending_ns = 0;       /* Armed deadline, 0 = none */
+
+/* Statistics */
+static uint64_t event_irqs = 0;
+static uint64_t event_programs = 0;
+
 /* PIC helper (from idt.c) */
 extern void pic_enable_irq(uint8_t irq);
 
+static inline uint64_t fp_mul(uint64_t value, uint64_t factor)
+{
+    return (uint64_t)(((unsigned __int128)value * factor) >> 32);
+}
+
 /*
  * Timer interrupt handler
  */
@@ -34,6 +80,87 @@ static void timer_handler(InterruptFrame *frame)
 {
     (void)frame;
     tick_count++;
+    sched_tick();
+}
+
+/*
+ * LAPIC timer event: the armed deadline is used up, and sched_tick()
+ * asks for the next one
+ */
+static void event_handler(InterruptFrame *frame)
+{
+    (void)frame;
+    event_pending_ns = 0;
+    event_irqs++;
+    sched_tick();
+}
+
+/*
+ * Count TSC cycles across one PIT channel 2 countdown of ms
+ * milliseconds (mode 0, polled through port 0x61). Returns 0 if the
+ * output never rises.
+ */
+static uint64_t pit_measure_tsc(uint32_t ms)
+{
+    uint16_t count = (uint16_t)((uint64_t)PIT_FREQUENCY * ms / 1000);
+    uint8_t gate = inb(PIT_GATE_PORT);
+
+    /* Gate low while loading, speaker off */
+    outb(PIT_GATE_PORT, gate & ~(PIT_GATE2 | PIT_SPEAKER));
+    outb(PIT_CMD, 0xB0);            /* Channel 2, lobyte/hibyte, mode 0 */
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+    /* Raising the gate starts the countdown */
+    outb(PIT_GATE_PORT, (gate & ~PIT_SPEAKER) | PIT_GATE2);
+    uint64_t start = rdtsc();
+    uint32_t spins = 0;
+    while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+        if (++spins >= CALIBRATE_SPINS) {
+            outb(PIT_GATE_PORT, gate);
+            return 0;
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_GATE_PORT, gate);
+    return cycles;
+}
+
+/*
+ * Measure the TSC rate. SMIs and VM exits only lengthen a window, so
+ * the shortest one is the best estimate.
+ */
+static void tsc_calibrate(void)
+{
+    uint64_t best = 0;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = pit_measure_tsc(CALIBRATE_MS);
+        if (cycles && (!best || cycles < best)) {
+            best = cycles;
+        }
+    }
+    if (!best) {
+        serial_printf("[TIMER] TSC calibration failed, clock stays at PIT resolution\n");
+        return;
+    }
+
+    uint32_t max_ext;
+    uint32_t edx = 0;
+    cpuid(0x80000000, 0, &max_ext, NULL, NULL, NULL);
+    if (max_ext >= 0x80000007) {
+        cpuid(0x80000007, 0, NULL, NULL, NULL, &edx);
+    }
+    tsc_invariant = (edx & (1U << 8)) != 0;
+
+    uint64_t count = (uint64_t)PIT_FREQUENCY * CALIBRATE_MS / 1000;
+    tsc_hz = best * PIT_FREQUENCY / count;
+    ns_per_cycle = (NS_PER_SEC << 32) / tsc_hz;
+    cycles_per_ns = ((tsc_hz / 1000) << 32) / (NS_PER_SEC / 1000);
+    tsc_base = rdtsc();
+
+    serial_printf("[TIMER] TSC %d kHz%s\n",
+        tsc_hz / 1000, tsc_invariant ? " (invariant)" : "");
 }
 
 /*
@@ -43,6 +170,9 @@ void timer_init(void)
 {
     serial_printf("[TIMER] Initializing PIT at %d Hz...\n", TICK_RATE);
 
+    /* Calibrate first: channel 2 is polled, so no interrupts are needed */
+    tsc_calibrate();
+
     /* Calculate divisor */
     uint16_t divisor = PIT_FREQUENCY / TICK_RATE;
 
@@ -67,16 +197,140 @@ void timer_init(void)
  */
 uint64_t timer_get_ticks(void)
 {
-    return tick_count;
+    return timer_get_ns() / NS_PER_MS;
+}
+
+uint64_t timer_get_ns(void)
+{
+    if (!tsc_hz) {
+        return tick_count * NS_PER_MS;
+    }
+    return fp_mul(rdtsc() - tsc_base, ns_per_cycle);
+}
+
+uint64_t timer_tsc_hz(void)
+{
+    return tsc_hz;
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles)
+{
+    return tsc_hz ? fp_mul(cycles, ns_per_cycle) : 0;
 }
 
 /*
- * Sleep for specified milliseconds
+ * Sleep for specified milliseconds (threads block, others wait)
  */
 void timer_sleep(uint64_t ms)
 {
-    uint64_t end = tick_count + ms;
-    while (tick_count < end) {
-        __asm__ volatile("hlt");  /* Wait for interrupt */
+    thread_sleep(ms);
+}
+
+/*
+ * Rate of the one-shot countdown, measured against the TSC over
+ * CALIBRATE_MS. Returns 0 if the counter did not move.
+ */
+static uint64_t lapic_calibrate(void)
+{
+    uint64_t window = tsc_hz * CALIBRATE_MS / 1000;
+
+    uint64_t flags = irq_save();
+    lapic_timer_oneshot(0xFFFFFFFF);
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < window) {
+        cpu_relax();
+    }
+    uint32_t left = lapic_timer_count();
+    uint64_t cycles = rdtsc() - start;
+    lapic_timer_oneshot(0);
+    irq_restore(flags);
+
+    uint64_t counted = 0xFFFFFFFFULL - left;
+    return cycles ? counted * tsc_hz / cycles : 0;
+}
+
+bool timer_enable_tickless(void)
+{
+    if (!tsc_hz || !lapic_present()) {
+        serial_printf("[TIMER] No %s, keeping the PIT tick\n", tsc_hz ? "local APIC" : "TSC rate");
+        return false;
+    }
+
+    idt_register_handler(INT_LAPIC_TIMER, event_handler);
+
+    /* TSC-deadline needs a TSC that keeps counting at one rate */
+    TimerEventMode mode = TIMER_EVENT_ONESHOT;
+    if (tsc_invariant && lapic_timer_has_tsc_deadline()) {
+        mode = TIMER_EVENT_TSC_DEADLINE;
+    }
+    lapic_timer_setup(INT_LAPIC_TIMER, mode == TIMER_EVENT_TSC_DEADLINE);
+
+    if (mode == TIMER_EVENT_ONESHOT) {
+        lapic_hz = lapic_calibrate();
+        if (!lapic_hz) {
+            serial_printf("[TIMER] LAPIC timer does not count, keeping the PIT tick\n");
+            return false;
+        }
+        lapic_per_ns = ((lapic_hz / 1000) << 32) / (NS_PER_SEC / 1000);
+    }
+
+    /* Hand over: the first event makes the scheduler arm the next one */
+    uint64_t flags = irq_save();
+    pic_disable_irq(IRQ_TIMER);
+    event_mode = mode;
+    event_pending_ns = 0;
+    irq_restore(flags);
+    timer_request_event(timer_get_ns() + NS_PER_MS);
+
+    if (mode == TIMER_EVENT_ONESHOT) {
+        serial_printf("[TIMER] Tickless: LAPIC one-shot at %d kHz\n", lapic_hz / 1000);
+    } else {
+        serial_printf("[TIMER] Tickless: LAPIC TSC-deadline\n");
+    }
+    return true;
+}
+
+void timer_request_event(uint64_t deadline_ns)
+{
+    if (event_mode == TIMER_EVENT_PIT || smp_cpu_id() != 0) {
+        return;
+    }
+    deadline_ns = MAX(deadline_ns, 1);
+
+    uint64_t flags = irq_save();
+    if (!event_pending_ns || deadline_ns < event_pending_ns) {
+        event_pending_ns = deadline_ns;
+        event_programs++;
+
+        if (event_mode == TIMER_EVENT_TSC_DEADLINE) {
+            /* A deadline already passed fires at once */
+            lapic_timer_deadline(MAX(tsc_base + fp_mul(deadline_ns, cycles_per_ns), 1));
+        } else {
+            uint64_t now = timer_get_ns();
+            uint64_t count = deadline_ns > now ? fp_mul(deadline_ns - now, lapic_per_ns) : 0;
+            lapic_timer_oneshot((uint32_t)MIN(MAX(count, 1), 0xFFFFFFFFULL));
+        }
+    }
+    irq_restore(flags);
+}
+
+void timer_print_info(void)
+{
+    uint64_t now = timer_get_ns();
+    console_printf("Uptime: %ld.%06ld s\n", now / NS_PER_SEC, (now % NS_PER_SEC) / NS_PER_US);
+    if (tsc_hz) {
+        console_printf("Clock: TSC, %ld.%03ld MHz%s\n", tsc_hz / 1000000,
+            (tsc_hz / 1000) % 1000, tsc_invariant ? " (invariant)" : "");
+    } else {
+        console_printf("Clock: PIT ticks (TSC not calibrated)\n");
+    }
+    console_printf("Timer: %s", event_mode_names[event_mode]);
+    if (event_mode == TIMER_EVENT_ONESHOT) {
+        console_printf(" at %ld kHz", lapic_hz / 1000);
+    }
+    if (event_mode == TIMER_EVENT_PIT) {
+        console_printf(", %ld ticks\n", (uint64_t)tick_count);
+    } else {
+        console_printf(", %ld interrupts, %ld programmed\n", event_irqs, event_programs);
     }
 }
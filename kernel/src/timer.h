@@ -1,7 +1,11 @@
 /*
  * ojjyOS v3 Kernel - Timer Driver
  *
- * Uses PIT (Programmable Interval Timer) for system tick.
+ * The PIT ticks at 1000 Hz during boot and calibrates the TSC, which
+ * then provides a nanosecond monotonic clock. Once the scheduler runs,
+ * the BSP's local APIC timer (TSC-deadline mode if available, else
+ * one-shot) replaces the PIT tick: the scheduler asks for an interrupt
+ * at its next deadline instead of taking one every millisecond.
  */
 
 #ifndef _OJJY_TIMER_H
@@ -9,13 +13,47 @@
 
 #include "types.h"
 
-/* Initialize timer (sets up PIT at 1000 Hz) */
+#define NS_PER_US               1000ULL
+#define NS_PER_MS               1000000ULL
+#define NS_PER_SEC              1000000000ULL
+
+/* Initialize timer (PIT at 1000 Hz) and calibrate the TSC */
 void timer_init(void);
 
 /* Get tick count (milliseconds since boot) */
 uint64_t timer_get_ticks(void);
 
+/*
+ * Nanoseconds since timer_init(), from the TSC. Falls back to whole
+ * PIT ticks if calibration failed.
+ */
+uint64_t timer_get_ns(void);
+
+/* Calibrated TSC frequency in Hz, 0 if unknown */
+uint64_t timer_tsc_hz(void);
+
+/* Convert a TSC cycle count to nanoseconds (0 if the TSC rate is unknown) */
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+
 /* Sleep for specified milliseconds */
 void timer_sleep(uint64_t ms);
 
+/*
+ * Move the BSP from the periodic PIT tick to local APIC timer events
+ * (after smp_init() and sched_init()). Returns false, keeping the PIT,
+ * if there is no calibrated TSC or local APIC.
+ */
+bool timer_enable_tickless(void);
+
+/*
+ * Make sure a timer interrupt reaches the BSP at or before deadline_ns
+ * (timer_get_ns() time). Earlier requests win; an interrupt that comes
+ * early is harmless because the scheduler re-arms from it. No-op with
+ * the periodic PIT tick and on APs.
+ */
+void timer_request_event(uint64_t deadline_ns);
+
+/* Print clock source and timer statistics to the console */
+void timer_print_info(void);
+
 #endif /* _OJJY_TIMER_H */
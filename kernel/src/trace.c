@@ -0,0 +1,250 @@
+/*
+ * ojjyOS v3 Kernel - Tracepoints Implementation
+ *
+ * Rings are statically allocated. A record is claimed and filled under
+ * the ring's lock with interrupts off, so tracepoints on other CPUs or
+ * in IRQ context can't interleave with it. Dumps merge the rings by
+ * timestamp and show times relative to the first record printed,
+ * converted to microseconds with the timer's calibrated TSC rate.
+ */
+
+#include "trace.h"
+#include "console.h"
+#include "serial.h"
+#include "string.h"
+#include "timer.h"
+#include "spinlock.h"
+
+/* Records printed by trace_dump() */
+#define TRACE_DUMP_MAX      64
+
+typedef struct {
+    TraceRecord records[TRACE_RING_SIZE];
+    uint64_t    head;           /* Records ever written */
+    Spinlock    lock;
+} TraceRing;
+
+/* How the args of an event are decoded */
+typedef enum {
+    TRACE_ARGS_NUM = 0,         /* fmt takes a0, a1, a2 as %ld */
+    TRACE_ARGS_NAME,            /* fmt takes the packed name (%s), then a2 */
+} TraceArgKind;
+
+typedef struct {
+    uint16_t     event;
+    TraceArgKind kind;
+    const char  *fmt;
+} TraceEventInfo;
+
+volatile uint32_t trace_mask = 0;
+
+static TraceRing rings[TRACE_SUBSYS_COUNT];
+
+static const char *subsys_names[TRACE_SUBSYS_COUNT] = {
+    "ata", "cache", "input", "vfs",
+};
+
+static const TraceEventInfo event_info[] = {
+    { TRACE_ATA_READ,         TRACE_ARGS_NUM,  "read lba=%ld count=%ld dma=%ld" },
+    { TRACE_ATA_WRITE,        TRACE_ARGS_NUM,  "write lba=%ld count=%ld dma=%ld" },
+    { TRACE_ATA_DMA_FALLBACK, TRACE_ARGS_NUM,  "dma failed, pio retry lba=%ld count=%ld write=%ld" },
+    { TRACE_CACHE_MISS,       TRACE_ARGS_NUM,  "miss block=%ld fetched=%ld" },
+    { TRACE_CACHE_READAHEAD,  TRACE_ARGS_NUM,  "read-ahead start=%ld blocks=%ld async=%ld" },
+    { TRACE_CACHE_FLUSH,      TRACE_ARGS_NUM,  "flush dirty=%ld" },
+    { TRACE_CACHE_EVICT,      TRACE_ARGS_NUM,  "evict block=%ld dirty=%ld" },
+    { TRACE_INPUT_KEY,        TRACE_ARGS_NUM,  "key scan=%ld key=%ld ascii=%ld" },
+    { TRACE_INPUT_BUTTON,     TRACE_ARGS_NUM,  "button %ld down=%ld" },
+    { TRACE_INPUT_DROP,       TRACE_ARGS_NUM,  "queue full, dropped type=%ld" },
+    { TRACE_VFS_OPEN,         TRACE_ARGS_NAME, "open %s -> %ld" },
+    { TRACE_VFS_READ,         TRACE_ARGS_NUM,  "read #%ld count=%ld -> %ld" },
+    { TRACE_VFS_WRITE,        TRACE_ARGS_NUM,  "write #%ld count=%ld -> %ld" },
+    { TRACE_VFS_CLOSE,        TRACE_ARGS_NUM,  "close #%ld" },
+};
+
+static const TraceEventInfo *find_event(uint16_t event)
+{
+    for (size_t i = 0; i < sizeof(event_info) / sizeof(event_info[0]); i++) {
+        if (event_info[i].event == event) {
+            return &event_info[i];
+        }
+    }
+    return NULL;
+}
+
+void trace_record(uint16_t event, uint64_t a0, uint64_t a1, uint32_t a2)
+{
+    uint32_t subsys = TRACE_EVENT_SUBSYS(event);
+    if (subsys >= TRACE_SUBSYS_COUNT) return;
+
+    TraceRing *ring = &rings[subsys];
+    uint64_t flags = spin_lock_irqsave(&ring->lock);
+
+    TraceRecord *rec = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+    ring->head++;
+
+    rec->tsc = rdtsc();
+    rec->event = event;
+    rec->reserved = 0;
+    rec->arg0 = a0;
+    rec->arg1 = a1;
+    rec->arg2 = a2;
+
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+void trace_pack_name(const char *name, uint64_t *a0, uint64_t *a1)
+{
+    char packed[16];
+    memset(packed, 0, sizeof(packed));
+
+    /* Keep the end of the path: it names the file */
+    size_t len = name ? strlen(name) : 0;
+    const char *tail = len > sizeof(packed) ? name + len - sizeof(packed) : name;
+    if (tail) {
+        memcpy(packed, tail, MIN(len, sizeof(packed)));
+    }
+
+    memcpy(a0, packed, 8);
+    memcpy(a1, packed + 8, 8);
+}
+
+void trace_init(void)
+{
+    memset(rings, 0, sizeof(rings));
+    trace_mask = (1U << TRACE_SUBSYS_COUNT) - 1;
+
+    serial_printf("[TRACE] %d subsystems, %d records each\n",
+        (uint64_t)TRACE_SUBSYS_COUNT, (uint64_t)TRACE_RING_SIZE);
+}
+
+void trace_enable(TraceSubsys subsys, bool enabled)
+{
+    uint32_t bits = subsys >= TRACE_SUBSYS_COUNT ?
+        (1U << TRACE_SUBSYS_COUNT) - 1 : 1U << subsys;
+    if (enabled) {
+        trace_mask |= bits;
+    } else {
+        trace_mask &= ~bits;
+    }
+}
+
+int trace_subsys_by_name(const char *name)
+{
+    for (int i = 0; i < TRACE_SUBSYS_COUNT; i++) {
+        if (strcmp(name, subsys_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void trace_clear(void)
+{
+    for (int i = 0; i < TRACE_SUBSYS_COUNT; i++) {
+        uint64_t flags = spin_lock_irqsave(&rings[i].lock);
+        rings[i].head = 0;
+        spin_unlock_irqrestore(&rings[i].lock, flags);
+    }
+}
+
+/*
+ * Print one decoded record
+ */
+static void print_record(const TraceRecord *rec, uint64_t base_tsc)
+{
+    uint64_t delta = rec->tsc - base_tsc;
+    if (timer_tsc_hz()) {
+        console_printf("  %8ld us ", (int64_t)(timer_cycles_to_ns(delta) / NS_PER_US));
+    } else {
+        console_printf("  %8ld cy ", (int64_t)delta);
+    }
+    console_printf("%5s ", subsys_names[TRACE_EVENT_SUBSYS(rec->event)]);
+
+    const TraceEventInfo *info = find_event(rec->event);
+    if (!info) {
+        console_printf("event 0x%x %lx %lx %x\n", (unsigned)rec->event,
+            rec->arg0, rec->arg1, (unsigned)rec->arg2);
+        return;
+    }
+
+    if (info->kind == TRACE_ARGS_NAME) {
+        char name[17];
+        memcpy(name, &rec->arg0, 8);
+        memcpy(name + 8, &rec->arg1, 8);
+        name[16] = '\0';
+        console_printf(info->fmt, name, (int64_t)(int32_t)rec->arg2);
+    } else {
+        console_printf(info->fmt, (int64_t)rec->arg0, (int64_t)rec->arg1,
+            (int64_t)(int32_t)rec->arg2);
+    }
+    console_printf("\n");
+}
+
+void trace_dump(void)
+{
+    uint64_t head[TRACE_SUBSYS_COUNT];
+    uint64_t oldest[TRACE_SUBSYS_COUNT];
+    uint64_t pos[TRACE_SUBSYS_COUNT];
+    uint64_t total = 0;
+    uint64_t lost = 0;
+
+    uint32_t saved_mask = trace_mask;
+    trace_mask = 0;     /* Freeze the rings while decoding */
+
+    for (int s = 0; s < TRACE_SUBSYS_COUNT; s++) {
+        head[s] = rings[s].head;
+        oldest[s] = head[s] > TRACE_RING_SIZE ? head[s] - TRACE_RING_SIZE : 0;
+        pos[s] = head[s];
+        total += head[s];
+        lost += oldest[s];
+    }
+
+    /* Walk back from the newest record to find where the dump starts */
+    for (int n = 0; n < TRACE_DUMP_MAX; n++) {
+        int pick = -1;
+        for (int s = 0; s < TRACE_SUBSYS_COUNT; s++) {
+            if (pos[s] == oldest[s]) continue;
+            const TraceRecord *r = &rings[s].records[(pos[s] - 1) & (TRACE_RING_SIZE - 1)];
+            if (pick < 0 || r->tsc > rings[pick].records[(pos[pick] - 1) & (TRACE_RING_SIZE - 1)].tsc) {
+                pick = s;
+            }
+        }
+        if (pick < 0) break;
+        pos[pick]--;
+    }
+
+    console_printf("\n=== Trace (%ld records, %ld overwritten) ===\n",
+        (int64_t)total, (int64_t)lost);
+    console_printf("  Enabled:");
+    for (int s = 0; s < TRACE_SUBSYS_COUNT; s++) {
+        if (saved_mask & (1U << s)) {
+            console_printf(" %s", subsys_names[s]);
+        }
+    }
+    console_printf("\n");
+
+    /* Forward merge from there */
+    uint64_t base_tsc = 0;
+    bool first = true;
+    for (;;) {
+        int pick = -1;
+        for (int s = 0; s < TRACE_SUBSYS_COUNT; s++) {
+            if (pos[s] == head[s]) continue;
+            const TraceRecord *r = &rings[s].records[pos[s] & (TRACE_RING_SIZE - 1)];
+            if (pick < 0 || r->tsc < rings[pick].records[pos[pick] & (TRACE_RING_SIZE - 1)].tsc) {
+                pick = s;
+            }
+        }
+        if (pick < 0) break;
+
+        const TraceRecord *rec = &rings[pick].records[pos[pick] & (TRACE_RING_SIZE - 1)];
+        if (first) {
+            base_tsc = rec->tsc;
+            first = false;
+        }
+        print_record(rec, base_tsc);
+        pos[pick]++;
+    }
+
+    trace_mask = saved_mask;
+}
@@ -0,0 +1,101 @@
+/*
+ * ojjyOS v3 Kernel - Tracepoints
+ *
+ * Lightweight in-memory event tracing for hot paths that can't afford
+ * serial output. Each subsystem has its own ring of fixed-size binary
+ * records stamped with the TSC; the oldest records are overwritten.
+ * Recording is a mask test when a subsystem is disabled and a handful
+ * of stores when enabled. Rings are decoded only on demand
+ * (trace_dump(), the "trace" console command).
+ */
+
+#ifndef _OJJY_TRACE_H
+#define _OJJY_TRACE_H
+
+#include "types.h"
+
+/* Records kept per subsystem (power of two) */
+#define TRACE_RING_SIZE     1024
+
+/* Traced subsystems */
+typedef enum {
+    TRACE_ATA = 0,      /* ATA/IDE commands */
+    TRACE_CACHE,        /* Block cache */
+    TRACE_INPUT,        /* Keyboard, mouse, input queue */
+    TRACE_VFS,          /* File operations */
+    TRACE_SUBSYS_COUNT
+} TraceSubsys;
+
+/* Event ids carry their subsystem in the high byte */
+#define TRACE_EVENT_ID(subsys, n)   (((subsys) << 8) | (n))
+#define TRACE_EVENT_SUBSYS(event)   ((event) >> 8)
+
+typedef enum {
+    /* ATA: a0 = LBA, a1 = sectors, a2 = 1 for DMA */
+    TRACE_ATA_READ          = TRACE_EVENT_ID(TRACE_ATA, 0),
+    TRACE_ATA_WRITE         = TRACE_EVENT_ID(TRACE_ATA, 1),
+    TRACE_ATA_DMA_FALLBACK  = TRACE_EVENT_ID(TRACE_ATA, 2),
+
+    /* Block cache */
+    TRACE_CACHE_MISS        = TRACE_EVENT_ID(TRACE_CACHE, 0),  /* a0 = block, a1 = blocks fetched */
+    TRACE_CACHE_READAHEAD   = TRACE_EVENT_ID(TRACE_CACHE, 1),  /* a0 = start, a1 = blocks, a2 = async */
+    TRACE_CACHE_FLUSH       = TRACE_EVENT_ID(TRACE_CACHE, 2),  /* a0 = dirty blocks */
+    TRACE_CACHE_EVICT       = TRACE_EVENT_ID(TRACE_CACHE, 3),  /* a0 = block, a1 = was dirty */
+
+    /* Input */
+    TRACE_INPUT_KEY         = TRACE_EVENT_ID(TRACE_INPUT, 0),  /* a0 = scancode, a1 = keycode, a2 = ascii */
+    TRACE_INPUT_BUTTON      = TRACE_EVENT_ID(TRACE_INPUT, 1),  /* a0 = button, a1 = 1 down / 0 up */
+    TRACE_INPUT_DROP        = TRACE_EVENT_ID(TRACE_INPUT, 2),  /* a0 = event type */
+
+    /* VFS: a0/a1 = first 16 bytes of the name, a2 = result */
+    TRACE_VFS_OPEN          = TRACE_EVENT_ID(TRACE_VFS, 0),
+    TRACE_VFS_READ          = TRACE_EVENT_ID(TRACE_VFS, 1),    /* a0 = handle, a1 = bytes asked */
+    TRACE_VFS_WRITE         = TRACE_EVENT_ID(TRACE_VFS, 2),    /* a0 = handle, a1 = bytes asked */
+    TRACE_VFS_CLOSE         = TRACE_EVENT_ID(TRACE_VFS, 3),    /* a0 = handle */
+} TraceEvent;
+
+/* One trace record (32 bytes) */
+typedef struct {
+    uint64_t tsc;
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t arg2;
+    uint64_t arg0;
+    uint64_t arg1;
+} TraceRecord;
+
+/* Bit per enabled subsystem (read inline on every tracepoint) */
+extern volatile uint32_t trace_mask;
+
+/* Append a record (use trace() instead) */
+void trace_record(uint16_t event, uint64_t a0, uint64_t a1, uint32_t a2);
+
+/*
+ * Tracepoint. Safe from IRQ context.
+ */
+static inline void trace(uint16_t event, uint64_t a0, uint64_t a1, uint32_t a2)
+{
+    if (trace_mask & (1U << TRACE_EVENT_SUBSYS(event))) {
+        trace_record(event, a0, a1, a2);
+    }
+}
+
+/* Pack the tail of a string into two record args (for TRACE_VFS_OPEN) */
+void trace_pack_name(const char *name, uint64_t *a0, uint64_t *a1);
+
+/* Initialize (all subsystems enabled) */
+void trace_init(void);
+
+/* Enable or disable one subsystem, or all with TRACE_SUBSYS_COUNT */
+void trace_enable(TraceSubsys subsys, bool enabled);
+
+/* Look up a subsystem by name ("ata", "cache", ...); -1 if unknown */
+int trace_subsys_by_name(const char *name);
+
+/* Discard all records */
+void trace_clear(void);
+
+/* Decode the rings to the console, merged in time order */
+void trace_dump(void);
+
+#endif /* _OJJY_TRACE_H */
@@ -12,8 +12,12 @@
 #include "../fs/vfs.h"
 #include "../drivers/rtc.h"
 #include "../serial.h"
+#include "../console.h"
+#include "../heap.h"
+#include "../smp.h"
+#include "../task.h"
 
-#define COMPOSITOR_MAX_WINDOWS  8
+#define COMPOSITOR_MAX_WINDOWS  32
 #define WALLPAPER_MAX_W         1024
 #define WALLPAPER_MAX_H         1024
 
@@ -34,6 +38,35 @@
 #define PREVIEW_THUMB_H         80
 #define PREVIEW_RAW_MAX         (640 * 480 * 4)
 
+/* Frame period (30 Hz) */
+#define COMPOSITOR_FRAME_NS     (NS_PER_SEC / 30)
+
+/* Damage tracking */
+#define DAMAGE_MAX_RECTS        16
+#define WINDOW_SHADOW_SPREAD    14
+#define CURSOR_W                8
+#define CURSOR_H                12
+#define DRAG_LABEL_W            (64 * FONT_WIDTH)
+
+/*
+ * Parallel rendering: damage is cut into horizontal bands that the CPUs
+ * take from per-CPU ranges, stealing from each other when they run dry.
+ * Small frames stay on the BSP, where the IPIs would cost more than
+ * they save.
+ */
+#define TILE_HEIGHT             64
+#define TILE_MAX                512
+#define TILE_PARALLEL_MIN_PIXELS (128 * 1024)
+
+/* Blurred wallpaper cache: one surface per glass blur level, half resolution */
+#define BLUR_LEVELS             3
+#define BLUR_CACHE_SHIFT        1
+#define BLUR_CACHE_MAX_W        1024
+#define BLUR_CACHE_MAX_H        640
+
+/* Rows or columns per blur cache task */
+#define BLUR_TASK_GRAIN         16
+
 static uint32_t comp_width = 0;
 static uint32_t comp_height = 0;
 
@@ -48,6 +81,52 @@ static uint32_t wallpaper_w = 0;
 static uint32_t wallpaper_h = 0;
 static uint8_t wallpaper_data[WALLPAPER_MAX_W * WALLPAPER_MAX_H * 4];
 
+static Color blur_cache[BLUR_LEVELS][BLUR_CACHE_MAX_W * BLUR_CACHE_MAX_H];
+static Color blur_scratch[SMP_MAX_CPUS][MAX(BLUR_CACHE_MAX_W, BLUR_CACHE_MAX_H)];
+static uint32_t blur_cache_w = 0;
+static uint32_t blur_cache_h = 0;
+static bool blur_cache_valid = false;
+static bool blur_cache_dirty = true;
+
+typedef struct {
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+} DamageRect;
+
+static DamageRect damage_rects[DAMAGE_MAX_RECTS];
+static int damage_count = 0;
+static uint64_t damage_last_pixels = 0;
+static uint32_t damage_last_rects = 0;
+static uint64_t damage_total_pixels = 0;
+static uint64_t frames_drawn = 0;
+static uint64_t frames_idle = 0;
+static int clock_minute = -1;
+static RtcTime frame_time;              /* Clock sampled once per rendered frame */
+static uint64_t clock_checked_ms = 0;
+static bool dock_was_bouncing = false;
+
+/* Render bands and per-CPU tile queues */
+typedef struct {
+    volatile uint64_t range;    /* Unrendered tiles: head << 32 | tail */
+    uint64_t tiles;             /* Lifetime totals */
+    uint64_t stolen;
+    uint64_t cycles;
+    uint32_t last_tiles;        /* Last parallel frame */
+    uint32_t last_stolen;
+    uint64_t last_cycles;
+} __attribute__((aligned(64))) TileWorker;
+
+static DamageRect tiles[TILE_MAX];
+static int tile_count = 0;
+static TileWorker tile_workers[SMP_MAX_CPUS];
+static uint32_t tile_worker_count = 0;
+static uint64_t tile_frame_ms = 0;
+static uint64_t frames_parallel = 0;
+static uint64_t render_last_cycles = 0;
+static uint64_t render_total_cycles = 0;
+
 static bool dragging = false;
 static int drag_index = -1;
 static int drag_dx = 0;
@@ -79,6 +158,7 @@ typedef struct {
     char name[64];
     VfsFileType type;
     uint64_t size;
+    int app_index;          /* Registered app for a bundle, else -1 */
 } FinderEntry;
 
 #define FINDER_MAX_ENTRIES 64
@@ -213,7 +293,10 @@ typedef struct {
     CalendarState calendar;
 } AppWindowState;
 
-static AppWindowState app_states[COMPOSITOR_MAX_WINDOWS];
+/* Per-window app state is large, so it lives in a slab cache and z-order
+ * changes only move pointers */
+static AppWindowState *app_states[COMPOSITOR_MAX_WINDOWS];
+static KmemCache *app_state_cache = NULL;
 static int active_window_index = -1;
 static int app_window_index[APP_COUNT];
 static char last_opened_path[128] = "";
@@ -252,7 +335,8 @@ static int anim_control_center = 0;
 static int anim_mission_control = 0;
 static int anim_app_switcher = 0;
 
-static uint64_t last_frame_ms = 0;
+/* Frame cadence: next frame is due at this timer_get_ns() time */
+static uint64_t next_frame_ns = 0;
 
 static uint8_t overlay_alpha(uint8_t base, int anim);
 static int overlay_offset(int anim, int max_offset);
@@ -380,6 +464,139 @@ static Color blur_sample(int x, int y, int radius)
     return RGB(r, g, b);
 }
 
+/*
+ * Box-filter one row or column of the blur cache in place.
+ * Edges are clamped, matching wallpaper_sample(). Runs on any CPU with
+ * that CPU's scratch line.
+ */
+static void blur_box_line(Color *line, int count, int stride, int radius)
+{
+    if (radius <= 0 || count <= 0) return;
+
+    preempt_disable();
+    Color *scratch = blur_scratch[smp_cpu_id()];
+    for (int i = 0; i < count; i++) {
+        scratch[i] = line[i * stride];
+    }
+
+    int width = radius * 2 + 1;
+    int r = 0, g = 0, b = 0;
+    for (int k = -radius; k <= radius; k++) {
+        Color c = scratch[MIN(MAX(k, 0), count - 1)];
+        r += (c >> 16) & 0xFF;
+        g += (c >> 8) & 0xFF;
+        b += (c >> 0) & 0xFF;
+    }
+
+    for (int i = 0; i < count; i++) {
+        line[i * stride] = RGB(r / width, g / width, b / width);
+
+        Color in = scratch[MIN(i + radius + 1, count - 1)];
+        Color out = scratch[MAX(i - radius, 0)];
+        r += (int)((in >> 16) & 0xFF) - (int)((out >> 16) & 0xFF);
+        g += (int)((in >> 8) & 0xFF) - (int)((out >> 8) & 0xFF);
+        b += (int)((in >> 0) & 0xFF) - (int)((out >> 0) & 0xFF);
+    }
+    preempt_enable();
+}
+
+/* One blur cache surface, split by rows or columns across the task pool */
+typedef struct {
+    Color *surface;
+    int w;
+    int h;
+    int radius;
+} BlurPass;
+
+static void blur_sample_rows(uint32_t begin, uint32_t end, void *arg)
+{
+    BlurPass *pass = (BlurPass *)arg;
+    for (int y = (int)begin; y < (int)end; y++) {
+        for (int x = 0; x < pass->w; x++) {
+            pass->surface[y * pass->w + x] =
+                wallpaper_sample(x << BLUR_CACHE_SHIFT, y << BLUR_CACHE_SHIFT);
+        }
+    }
+}
+
+static void blur_rows(uint32_t begin, uint32_t end, void *arg)
+{
+    BlurPass *pass = (BlurPass *)arg;
+    for (int y = (int)begin; y < (int)end; y++) {
+        blur_box_line(pass->surface + y * pass->w, pass->w, 1, pass->radius);
+    }
+}
+
+static void blur_columns(uint32_t begin, uint32_t end, void *arg)
+{
+    BlurPass *pass = (BlurPass *)arg;
+    for (int x = (int)begin; x < (int)end; x++) {
+        blur_box_line(pass->surface + x, pass->h, pass->w, pass->radius);
+    }
+}
+
+/*
+ * Rebuild the blurred wallpaper surfaces if the wallpaper, theme or
+ * resolution changed since the last frame. Each level is a separable
+ * box blur (horizontal then vertical pass) of the wallpaper; every pass
+ * is a parallel-for over independent rows or columns.
+ */
+static void blur_cache_ensure(void)
+{
+    if (!blur_cache_dirty) return;
+    blur_cache_dirty = false;
+
+    blur_cache_w = (comp_width + (1 << BLUR_CACHE_SHIFT) - 1) >> BLUR_CACHE_SHIFT;
+    blur_cache_h = (comp_height + (1 << BLUR_CACHE_SHIFT) - 1) >> BLUR_CACHE_SHIFT;
+    if (blur_cache_w == 0 || blur_cache_h == 0 ||
+        blur_cache_w > BLUR_CACHE_MAX_W || blur_cache_h > BLUR_CACHE_MAX_H) {
+        serial_printf("[COMPOSITOR] Blur cache disabled for %dx%d\n", comp_width, comp_height);
+        blur_cache_valid = false;
+        return;
+    }
+
+    int w = (int)blur_cache_w;
+    int h = (int)blur_cache_h;
+    Color *base = blur_cache[0];
+    BlurPass pass = { base, w, h, 0 };
+    task_parallel_for(0, (uint32_t)h, BLUR_TASK_GRAIN, blur_sample_rows, &pass);
+
+    for (int level = BLUR_LEVELS - 1; level >= 0; level--) {
+        Color *surface = blur_cache[level];
+        if (level != 0) {
+            memcpy(surface, base, (size_t)w * h * sizeof(Color));
+        }
+
+        pass.surface = surface;
+        pass.radius = theme->glass.blur_px[level] >> BLUR_CACHE_SHIFT;
+        if (pass.radius <= 0) continue;
+        task_parallel_for(0, (uint32_t)h, BLUR_TASK_GRAIN, blur_rows, &pass);
+        task_parallel_for(0, (uint32_t)w, BLUR_TASK_GRAIN, blur_columns, &pass);
+    }
+
+    blur_cache_valid = true;
+    serial_printf("[COMPOSITOR] Blur cache built: %dx%d, radii %d/%d/%d\n",
+                  blur_cache_w, blur_cache_h,
+                  theme->glass.blur_px[0], theme->glass.blur_px[1], theme->glass.blur_px[2]);
+}
+
+/*
+ * Blurred wallpaper at screen position (x, y) for a glass blur level.
+ * Falls back to direct sampling when the cache cannot cover the screen.
+ */
+static inline Color blurred_wallpaper(int level, int x, int y)
+{
+    if (!blur_cache_valid) {
+        return blur_sample(x, y, theme->glass.blur_px[level]);
+    }
+
+    uint32_t cx = (uint32_t)MAX(x, 0) >> BLUR_CACHE_SHIFT;
+    uint32_t cy = (uint32_t)MAX(y, 0) >> BLUR_CACHE_SHIFT;
+    if (cx >= blur_cache_w) cx = blur_cache_w - 1;
+    if (cy >= blur_cache_h) cy = blur_cache_h - 1;
+    return blur_cache[level][cy * blur_cache_w + cx];
+}
+
 static bool point_in_rounded_rect(int px, int py, int x, int y, int w, int h, int r)
 {
     if (px < x || py < y || px >= x + w || py >= y + h) return false;
@@ -402,12 +619,106 @@ static bool point_in_rounded_rect(int px, int py, int x, int y, int w, int h, in
     return (dx * dx + dy * dy) <= (r * r);
 }
 
+static bool damage_rects_touch(const DamageRect *a, const DamageRect *b)
+{
+    return a->x1 <= b->x2 && b->x1 <= a->x2 && a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+static uint64_t damage_rect_area(const DamageRect *r)
+{
+    return (uint64_t)(r->x2 - r->x1) * (uint64_t)(r->y2 - r->y1);
+}
+
+static void damage_rect_union(DamageRect *dst, const DamageRect *src)
+{
+    dst->x1 = MIN(dst->x1, src->x1);
+    dst->y1 = MIN(dst->y1, src->y1);
+    dst->x2 = MAX(dst->x2, src->x2);
+    dst->y2 = MAX(dst->y2, src->y2);
+}
+
+/*
+ * Record a dirty rectangle for the next frame. Touching rectangles are
+ * merged; when the list is full the new rectangle is folded into the
+ * entry whose bounding box grows least.
+ */
+void compositor_damage(int x, int y, int w, int h)
+{
+    DamageRect rect = {
+        MAX(0, x), MAX(0, y),
+        MIN((int)comp_width, x + w), MIN((int)comp_height, y + h)
+    };
+    if (rect.x2 <= rect.x1 || rect.y2 <= rect.y1) return;
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < damage_count; i++) {
+            if (damage_rects_touch(&damage_rects[i], &rect)) {
+                damage_rect_union(&rect, &damage_rects[i]);
+                damage_rects[i] = damage_rects[--damage_count];
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    if (damage_count < DAMAGE_MAX_RECTS) {
+        damage_rects[damage_count++] = rect;
+        return;
+    }
+
+    int best = 0;
+    uint64_t best_growth = ~0ULL;
+    for (int i = 0; i < damage_count; i++) {
+        DamageRect u = damage_rects[i];
+        damage_rect_union(&u, &rect);
+        uint64_t growth = damage_rect_area(&u) - damage_rect_area(&damage_rects[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    damage_rect_union(&rect, &damage_rects[best]);
+    damage_rects[best] = damage_rects[--damage_count];
+    compositor_damage(rect.x1, rect.y1, rect.x2 - rect.x1, rect.y2 - rect.y1);
+}
+
+void compositor_damage_all(void)
+{
+    damage_count = 0;
+    compositor_damage(0, 0, (int)comp_width, (int)comp_height);
+}
+
+/* Window bounds including the drop shadow */
+static void damage_window(int idx)
+{
+    if (idx < 0 || idx >= window_count) return;
+    CompositorWindow *win = &windows[idx];
+    compositor_damage(win->x - WINDOW_SHADOW_SPREAD, win->y - WINDOW_SHADOW_SPREAD,
+                      win->w + WINDOW_SHADOW_SPREAD * 2, win->h + WINDOW_SHADOW_SPREAD * 2);
+}
+
+static void damage_menu_bar(void)
+{
+    compositor_damage(0, 0, (int)comp_width, MENU_BAR_HEIGHT);
+}
+
+static bool rect_visible(int x, int y, int w, int h)
+{
+    int cx1, cy1, cx2, cy2;
+    fb_get_clip(&cx1, &cy1, &cx2, &cy2);
+    return x < cx2 && y < cy2 && x + w > cx1 && y + h > cy1;
+}
+
 static void draw_rounded_rect_blend(int x, int y, int w, int h, int r, Color color, uint8_t alpha)
 {
-    int x1 = MAX(0, x);
-    int y1 = MAX(0, y);
-    int x2 = MIN((int)comp_width, x + w);
-    int y2 = MIN((int)comp_height, y + h);
+    int x1, y1, x2, y2;
+    fb_get_clip(&x1, &y1, &x2, &y2);
+    x1 = MAX(x1, x);
+    y1 = MAX(y1, y);
+    x2 = MIN(x2, x + w);
+    y2 = MIN(y2, y + h);
 
     for (int py = y1; py < y2; py++) {
         for (int px = x1; px < x2; px++) {
@@ -435,50 +746,46 @@ static void draw_shadow(int x, int y, int w, int h, int radius)
 
 static void draw_finder_window(const CompositorWindow *win, FinderState *state, int content_x, int content_y, int content_w, int content_h)
 {
-    if (state->needs_refresh) {
-        finder_refresh(state);
-    }
-
     int sidebar_w = 150;
     int preview_w = 180;
     draw_rounded_rect_blend(content_x, content_y, sidebar_w, content_h, 12, theme->dock_tint, 130);
-    fb_draw_string(content_x + 12, content_y + 12, "Favorites", theme->text_muted, theme->dock_tint);
-    fb_draw_string(content_x + 12, content_y + 32, "Applications", theme->text, theme->dock_tint);
-    fb_draw_string(content_x + 12, content_y + 52, "System", theme->text, theme->dock_tint);
-    fb_draw_string(content_x + 12, content_y + 72, "Users", theme->text, theme->dock_tint);
+    fb_draw_string(content_x + 12, content_y + 12, "Favorites", theme->text_muted, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 12, content_y + 32, "Applications", theme->text, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 12, content_y + 52, "System", theme->text, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 12, content_y + 72, "Users", theme->text, COLOR_TRANSPARENT);
 
     int main_x = content_x + sidebar_w + 10;
     int main_w = content_w - sidebar_w - preview_w - 20;
 
     draw_rounded_rect_blend(main_x, content_y, main_w, content_h, 12, theme->dock_tint, 90);
     fb_draw_string(main_x + 12, content_y + 12, state->path[0] ? state->path : "/",
-                   theme->text_muted, theme->dock_tint);
+                   theme->text_muted, COLOR_TRANSPARENT);
 
     int preview_x = main_x + main_w + 10;
     draw_rounded_rect_blend(preview_x, content_y, preview_w, content_h, 12, theme->dock_tint, 110);
-    fb_draw_string(preview_x + 12, content_y + 12, "Preview", theme->text_muted, theme->dock_tint);
+    fb_draw_string(preview_x + 12, content_y + 12, "Preview", theme->text_muted, COLOR_TRANSPARENT);
     if (state->preview_ready) {
-        fb_draw_string(preview_x + 12, content_y + 32, state->preview_name, theme->text, theme->dock_tint);
-        fb_draw_string(preview_x + 12, content_y + 50, state->preview_type, theme->text_muted, theme->dock_tint);
+        fb_draw_string(preview_x + 12, content_y + 32, state->preview_name, theme->text, COLOR_TRANSPARENT);
+        fb_draw_string(preview_x + 12, content_y + 50, state->preview_type, theme->text_muted, COLOR_TRANSPARENT);
         char sizebuf[24];
         if (state->preview_size > 0) {
             utoa(state->preview_size, sizebuf, 10);
-            fb_draw_string(preview_x + 12, content_y + 68, sizebuf, theme->text_muted, theme->dock_tint);
+            fb_draw_string(preview_x + 12, content_y + 68, sizebuf, theme->text_muted, COLOR_TRANSPARENT);
         }
         for (int i = 0; i < 3; i++) {
             if (state->preview_lines[i][0]) {
                 fb_draw_string(preview_x + 12, content_y + 90 + i * 16,
-                               state->preview_lines[i], theme->text_muted, theme->dock_tint);
+                               state->preview_lines[i], theme->text_muted, COLOR_TRANSPARENT);
             }
         }
     } else {
-        fb_draw_string(preview_x + 12, content_y + 32, "No selection", theme->text_muted, theme->dock_tint);
+        fb_draw_string(preview_x + 12, content_y + 32, "No selection", theme->text_muted, COLOR_TRANSPARENT);
     }
 
     if (state->view_mode == FINDER_VIEW_LIST) {
-        fb_draw_string(main_x + 16, content_y + 28, "Name", theme->text_muted, theme->dock_tint);
-        fb_draw_string(main_x + 220, content_y + 28, "Type", theme->text_muted, theme->dock_tint);
-        fb_draw_string(main_x + 300, content_y + 28, "Size", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 28, "Name", theme->text_muted, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 220, content_y + 28, "Type", theme->text_muted, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 300, content_y + 28, "Size", theme->text_muted, COLOR_TRANSPARENT);
 
         int row_y = content_y + 44;
         for (int i = 0; i < state->entry_count && i < 16; i++) {
@@ -488,12 +795,12 @@ static void draw_finder_window(const CompositorWindow *win, FinderState *state,
             } else if (state->drag_active && i == state->drag_hover_index && entry->type == VFS_TYPE_DIR) {
                 draw_rounded_rect_blend(main_x + 6, row_y - 2, main_w - 12, 18, 8, theme->accent_soft, 40);
             }
-            fb_draw_string(main_x + 16, row_y + 2, entry->name, theme->text, theme->dock_tint);
+            fb_draw_string(main_x + 16, row_y + 2, entry->name, theme->text, COLOR_TRANSPARENT);
 
             const char *type = "File";
             if (entry->type == VFS_TYPE_DIR) type = "Folder";
             if (entry->type == VFS_TYPE_BUNDLE) type = "App";
-            fb_draw_string(main_x + 220, row_y + 2, type, theme->text_muted, theme->dock_tint);
+            fb_draw_string(main_x + 220, row_y + 2, type, theme->text_muted, COLOR_TRANSPARENT);
 
             char sizebuf[16];
             if (entry->type == VFS_TYPE_FILE) {
@@ -501,7 +808,7 @@ static void draw_finder_window(const CompositorWindow *win, FinderState *state,
             } else {
                 strcpy(sizebuf, "--");
             }
-            fb_draw_string(main_x + 300, row_y + 2, sizebuf, theme->text_muted, theme->dock_tint);
+            fb_draw_string(main_x + 300, row_y + 2, sizebuf, theme->text_muted, COLOR_TRANSPARENT);
 
             row_y += 18;
         }
@@ -522,16 +829,10 @@ static void draw_finder_window(const CompositorWindow *win, FinderState *state,
                 draw_rounded_rect_blend(ix - 2, iy - 2, icon + 4, icon + 4, 8, theme->accent_soft, 40);
             }
             if (entry->type == VFS_TYPE_BUNDLE) {
-                char path[256];
-                vfs_join_path(path, sizeof(path), state->path, entry->name);
-                Bundle bundle;
-                if (bundle_load(path, &bundle) == 0) {
-                    int app_idx = app_registry_find_by_bundle_id(bundle.manifest.bundle_id);
-                    AppInfo *app = app_registry_get(app_idx);
-                    if (app && app->icon.valid) {
-                        draw_icon_scaled(app->icon.pixels, BUNDLE_ICON_SIZE, ix, iy, icon);
-                        drew_icon = true;
-                    }
+                AppInfo *app = app_registry_get(entry->app_index);
+                if (app && app->icon.valid) {
+                    draw_icon_scaled(app->icon.pixels, BUNDLE_ICON_SIZE, ix, iy, icon);
+                    drew_icon = true;
                 }
             } else if (entry->type == VFS_TYPE_DIR) {
                 if (icon_folder_loaded) {
@@ -547,31 +848,26 @@ static void draw_finder_window(const CompositorWindow *win, FinderState *state,
             if (!drew_icon) {
                 fb_fill_rect(ix, iy, icon, icon, theme->accent_soft);
             }
-            fb_draw_string(ix - 2, iy + icon + 8, state->entries[i].name, theme->text, theme->dock_tint);
+            fb_draw_string(ix - 2, iy + icon + 8, state->entries[i].name, theme->text, COLOR_TRANSPARENT);
         }
     }
 
     int toolbar_y = win->y + 36;
     fb_fill_rect(content_x + 8, toolbar_y - 26, 18, 18, theme->accent_soft);
     fb_fill_rect(content_x + 30, toolbar_y - 26, 18, 18, theme->accent_soft);
-    fb_draw_string(content_x + 62, toolbar_y - 22, "View", theme->text_muted, theme->dock_tint);
+    fb_draw_string(content_x + 62, toolbar_y - 22, "View", theme->text_muted, COLOR_TRANSPARENT);
 
     int search_x = main_x + main_w - 150;
     fb_fill_rect(search_x, toolbar_y - 26, 140, 18, theme->dock_tint);
     if (state->rename_mode) {
         fb_draw_string(search_x + 6, toolbar_y - 22, state->rename_buffer,
-                       theme->text, theme->dock_tint);
+                       theme->text, COLOR_TRANSPARENT);
         fb_draw_string(search_x - 70, toolbar_y - 22, "Rename:",
-                       theme->text_muted, theme->dock_tint);
+                       theme->text_muted, COLOR_TRANSPARENT);
     } else {
         fb_draw_string(search_x + 6, toolbar_y - 22,
                        state->search[0] ? state->search : "Search",
-                       theme->text_muted, theme->dock_tint);
-    }
-
-    if (state->drag_active) {
-        fb_draw_string(cursor_x + 10, cursor_y + 10, vfs_basename(state->drag_path),
-                       theme->text, theme->dock_tint);
+                       theme->text_muted, COLOR_TRANSPARENT);
     }
 }
 
@@ -594,7 +890,7 @@ static void draw_settings_window(SettingsStateUi *state, int content_x, int cont
         if (state->page == (SettingsPage)i) {
             draw_rounded_rect_blend(content_x + 6, item_y - 2, sidebar_w - 12, 18, 8, theme->accent, 40);
         }
-        fb_draw_string(content_x + 12, item_y, items[i], theme->text, theme->dock_tint);
+        fb_draw_string(content_x + 12, item_y, items[i], theme->text, COLOR_TRANSPARENT);
     }
 
     int main_x = content_x + sidebar_w + 10;
@@ -604,39 +900,39 @@ static void draw_settings_window(SettingsStateUi *state, int content_x, int cont
     SettingsState *settings = settings_get();
 
     if (state->page == SETTINGS_PAGE_APPEARANCE) {
-        fb_draw_string(main_x + 16, content_y + 16, "Appearance", theme->text, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "Appearance", theme->text, COLOR_TRANSPARENT);
         fb_draw_string(main_x + 16, content_y + 42,
-                       settings->dark_mode ? "Dark" : "Light", theme->text_muted, theme->dock_tint);
+                       settings->dark_mode ? "Dark" : "Light", theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 100, content_y + 38, 40, 14, settings->dark_mode ? theme->accent : theme->accent_soft);
         fb_draw_string(main_x + 16, content_y + 64,
                        settings->time_24h ? "Time: 24-hour" : "Time: 12-hour",
-                       theme->text_muted, theme->dock_tint);
+                       theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 140, content_y + 60, 40, 14, settings->time_24h ? theme->accent : theme->accent_soft);
     } else if (state->page == SETTINGS_PAGE_WALLPAPER) {
-        fb_draw_string(main_x + 16, content_y + 16, "Wallpaper", theme->text, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "Wallpaper", theme->text, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 16, content_y + 48, 80, 50, theme->accent_soft);
-        fb_draw_string(main_x + 20, content_y + 104, "Tahoe Light", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 20, content_y + 104, "Tahoe Light", theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 120, content_y + 48, 80, 50, theme->accent);
-        fb_draw_string(main_x + 124, content_y + 104, "Tahoe Dark", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 124, content_y + 104, "Tahoe Dark", theme->text_muted, COLOR_TRANSPARENT);
     } else if (state->page == SETTINGS_PAGE_DOCK) {
-        fb_draw_string(main_x + 16, content_y + 16, "Dock & Menu Bar", theme->text, theme->dock_tint);
-        fb_draw_string(main_x + 16, content_y + 42, "Dock Size", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "Dock & Menu Bar", theme->text, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 16, content_y + 42, "Dock Size", theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 120, content_y + 38, settings->dock_size, 10, theme->accent_soft);
-        fb_draw_string(main_x + 16, content_y + 64, "Magnification", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 64, "Magnification", theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 120, content_y + 60, settings->dock_magnify, 10, theme->accent);
     } else if (state->page == SETTINGS_PAGE_KEYBOARD) {
-        fb_draw_string(main_x + 16, content_y + 16, "Keyboard", theme->text, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "Keyboard", theme->text, COLOR_TRANSPARENT);
         fb_draw_string(main_x + 16, content_y + 42,
                        settings->shortcuts_enabled ? "Shortcuts: On" : "Shortcuts: Off",
-                       theme->text_muted, theme->dock_tint);
+                       theme->text_muted, COLOR_TRANSPARENT);
     } else if (state->page == SETTINGS_PAGE_MOUSE) {
-        fb_draw_string(main_x + 16, content_y + 16, "Mouse/Trackpad", theme->text, theme->dock_tint);
-        fb_draw_string(main_x + 16, content_y + 42, "Tracking Speed", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "Mouse/Trackpad", theme->text, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 16, content_y + 42, "Tracking Speed", theme->text_muted, COLOR_TRANSPARENT);
         fb_fill_rect(main_x + 140, content_y + 38, settings->mouse_speed * 20, 10, theme->accent_soft);
     } else if (state->page == SETTINGS_PAGE_ABOUT) {
-        fb_draw_string(main_x + 16, content_y + 16, "About", theme->text, theme->dock_tint);
-        fb_draw_string(main_x + 16, content_y + 42, "ojjyOS v3", theme->text_muted, theme->dock_tint);
-        fb_draw_string(main_x + 16, content_y + 60, "Created by Jonas Lee", theme->text_muted, theme->dock_tint);
+        fb_draw_string(main_x + 16, content_y + 16, "About", theme->text, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 16, content_y + 42, "ojjyOS v3", theme->text_muted, COLOR_TRANSPARENT);
+        fb_draw_string(main_x + 16, content_y + 60, "Created by Jonas Lee", theme->text_muted, COLOR_TRANSPARENT);
     }
 }
 
@@ -665,12 +961,11 @@ static void draw_textedit_window(TextEditState *edit, int content_x, int content
     draw_rounded_rect_blend(content_x, content_y, content_w, content_h, 10, theme->dock_tint, 120);
 
     fb_draw_string(content_x + 10, content_y + 8,
-                   edit->file_path[0] ? edit->file_path : "Untitled", theme->text, theme->dock_tint);
+                   edit->file_path[0] ? edit->file_path : "Untitled", theme->text, COLOR_TRANSPARENT);
 
     int line_y = content_y + 30;
     for (int i = 0; i < edit->line_count && i < TEXTEDIT_MAX_LINES; i++) {
         if (edit->sel_active && edit->sel_line == i) {
-            textedit_normalize_selection(edit);
             int start = edit->sel_start;
             int end = edit->sel_end;
             if (start < end) {
@@ -680,7 +975,7 @@ static void draw_textedit_window(TextEditState *edit, int content_x, int content
                                         6, theme->accent, 40);
             }
         }
-        fb_draw_string(content_x + 10, line_y, edit->lines[i], theme->text, theme->dock_tint);
+        fb_draw_string(content_x + 10, line_y, edit->lines[i], theme->text, COLOR_TRANSPARENT);
         line_y += 16;
     }
 
@@ -699,7 +994,7 @@ static void draw_textedit_window(TextEditState *edit, int content_x, int content
     str_append(status, sizeof(status), num);
 
     fb_draw_string(content_x + 10, content_y + content_h - 18, status,
-                   theme->text_muted, theme->dock_tint);
+                   theme->text_muted, COLOR_TRANSPARENT);
 }
 
 static void calendar_format_time(const CalendarEvent *ev, char *out, size_t size)
@@ -753,16 +1048,6 @@ static int calendar_events_for_day(CalendarState *cal, int year, int month, int
 
 static void draw_calendar_window(CalendarState *cal, int content_x, int content_y, int content_w, int content_h)
 {
-    if (!cal->loaded) {
-        calendar_load(cal);
-    }
-
-    RtcTime now;
-    rtc_read_time(&now);
-    if (now.year == cal->year && now.month == cal->month) {
-        cal->day = now.day;
-    }
-
     int header_h = 40;
     int sidebar_w = 160;
     int agenda_w = 200;
@@ -784,13 +1069,13 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
     char num[8];
     utoa(cal->year, num, 10);
     str_append(title, sizeof(title), num);
-    fb_draw_string(header_x + 12, content_y + 12, title, theme->text, theme->dock_tint);
+    fb_draw_string(header_x + 12, content_y + 12, title, theme->text, COLOR_TRANSPARENT);
 
     int nav_y = content_y + 10;
     fb_fill_rect(header_x + header_w - 90, nav_y, 18, 18, theme->accent_soft);
     fb_fill_rect(header_x + header_w - 66, nav_y, 18, 18, theme->accent_soft);
     fb_fill_rect(header_x + header_w - 42, nav_y, 36, 18, theme->accent);
-    fb_draw_string(header_x + header_w - 36, nav_y + 4, "Today", theme->text, theme->dock_tint);
+    fb_draw_string(header_x + header_w - 36, nav_y + 4, "Today", theme->text, COLOR_TRANSPARENT);
 
     int view_x = header_x + header_w - 200;
     const char *views[] = { "Month", "Week", "Day", "Agenda" };
@@ -799,16 +1084,16 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
         if (cal->view == (CalendarView)i) {
             draw_rounded_rect_blend(vx, content_y + header_h - 18, 42, 16, 8, theme->accent, 50);
         }
-        fb_draw_string(vx + 4, content_y + header_h - 16, views[i], theme->text_muted, theme->dock_tint);
+        fb_draw_string(vx + 4, content_y + header_h - 16, views[i], theme->text_muted, COLOR_TRANSPARENT);
     }
 
     draw_rounded_rect_blend(content_x, content_y, sidebar_w, content_h, 12, theme->dock_tint, 130);
-    fb_draw_string(content_x + 10, content_y + 10, "Calendars", theme->text_muted, theme->dock_tint);
-    fb_draw_string(content_x + 10, content_y + 30, "Local", theme->text, theme->dock_tint);
-    fb_draw_string(content_x + 10, content_y + 48, "Personal", theme->text, theme->dock_tint);
-    fb_draw_string(content_x + 10, content_y + 66, "Work", theme->text, theme->dock_tint);
+    fb_draw_string(content_x + 10, content_y + 10, "Calendars", theme->text_muted, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 10, content_y + 30, "Local", theme->text, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 10, content_y + 48, "Personal", theme->text, COLOR_TRANSPARENT);
+    fb_draw_string(content_x + 10, content_y + 66, "Work", theme->text, COLOR_TRANSPARENT);
     draw_rounded_rect_blend(content_x + 10, content_y + content_h - 36, sidebar_w - 20, 22, 10, theme->accent, 60);
-    fb_draw_string(content_x + 20, content_y + content_h - 32, "New Event", theme->text, theme->dock_tint);
+    fb_draw_string(content_x + 20, content_y + content_h - 32, "New Event", theme->text, COLOR_TRANSPARENT);
 
     int grid_x = header_x;
     int grid_y = content_y + header_h + 6;
@@ -820,7 +1105,7 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
         int cell_w = grid_w / 7;
         int cell_h = (grid_h - 20) / 6;
         for (int i = 0; i < 7; i++) {
-            fb_draw_string(grid_x + i * cell_w + 6, grid_y, weekdays[i], theme->text_muted, theme->dock_tint);
+            fb_draw_string(grid_x + i * cell_w + 6, grid_y, weekdays[i], theme->text_muted, COLOR_TRANSPARENT);
         }
 
         int first_wd = weekday_of_date(cal->year, cal->month, 1);
@@ -841,7 +1126,7 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
                     }
                     char numstr[4];
                     utoa(day, numstr, 10);
-                    fb_draw_string(cx + 8, cy + 6, numstr, theme->text, theme->dock_tint);
+                    fb_draw_string(cx + 8, cy + 6, numstr, theme->text, COLOR_TRANSPARENT);
 
                     int indices[4];
                     int count = calendar_events_for_day(cal, cal->year, cal->month, day, indices, 4);
@@ -850,11 +1135,11 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
                     for (int e = 0; e < shown; e++) {
                         CalendarEvent *ev = &cal->events[indices[e]];
                         draw_rounded_rect_blend(cx + 6, chip_y, cell_w - 12, 12, 6, theme->accent, 70);
-                        fb_draw_string(cx + 10, chip_y + 2, ev->title, theme->text, theme->dock_tint);
+                        fb_draw_string(cx + 10, chip_y + 2, ev->title, theme->text, COLOR_TRANSPARENT);
                         chip_y += 14;
                     }
                     if (count > 2) {
-                        fb_draw_string(cx + 10, chip_y + 2, "+", theme->text_muted, theme->dock_tint);
+                        fb_draw_string(cx + 10, chip_y + 2, "+", theme->text_muted, COLOR_TRANSPARENT);
                     }
                     day++;
                 }
@@ -870,7 +1155,7 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
             draw_rounded_rect_blend(cx + 2, grid_y, cell_w - 4, grid_h, 8, theme->dock_tint, 100);
             char numstr[4];
             utoa(day, numstr, 10);
-            fb_draw_string(cx + 8, grid_y + 6, numstr, theme->text, theme->dock_tint);
+            fb_draw_string(cx + 8, grid_y + 6, numstr, theme->text, COLOR_TRANSPARENT);
 
             int indices[6];
             int count = calendar_events_for_day(cal, cal->year, cal->month, day, indices, 6);
@@ -878,21 +1163,21 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
             for (int e = 0; e < count && e < 4; e++) {
                 CalendarEvent *ev = &cal->events[indices[e]];
                 draw_rounded_rect_blend(cx + 6, ey, cell_w - 12, 12, 6, theme->accent, 70);
-                fb_draw_string(cx + 10, ey + 2, ev->title, theme->text, theme->dock_tint);
+                fb_draw_string(cx + 10, ey + 2, ev->title, theme->text, COLOR_TRANSPARENT);
                 ey += 14;
             }
         }
     } else if (cal->view == CAL_VIEW_DAY) {
         int indices[10];
         int count = calendar_events_for_day(cal, cal->year, cal->month, cal->selected_day, indices, 10);
-        fb_draw_string(grid_x + 10, grid_y + 6, "Day", theme->text_muted, theme->dock_tint);
+        fb_draw_string(grid_x + 10, grid_y + 6, "Day", theme->text_muted, COLOR_TRANSPARENT);
         int ey = grid_y + 24;
         for (int i = 0; i < count; i++) {
             CalendarEvent *ev = &cal->events[indices[i]];
             char timebuf[16];
             calendar_format_time(ev, timebuf, sizeof(timebuf));
-            fb_draw_string(grid_x + 10, ey, timebuf, theme->text_muted, theme->dock_tint);
-            fb_draw_string(grid_x + 80, ey, ev->title, theme->text, theme->dock_tint);
+            fb_draw_string(grid_x + 10, ey, timebuf, theme->text_muted, COLOR_TRANSPARENT);
+            fb_draw_string(grid_x + 80, ey, ev->title, theme->text, COLOR_TRANSPARENT);
             ey += 18;
         }
     } else {
@@ -901,15 +1186,15 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
             CalendarEvent *ev = &cal->events[i];
             char timebuf[16];
             calendar_format_time(ev, timebuf, sizeof(timebuf));
-            fb_draw_string(grid_x + 8, ey, timebuf, theme->text_muted, theme->dock_tint);
-            fb_draw_string(grid_x + 72, ey, ev->title, theme->text, theme->dock_tint);
+            fb_draw_string(grid_x + 8, ey, timebuf, theme->text_muted, COLOR_TRANSPARENT);
+            fb_draw_string(grid_x + 72, ey, ev->title, theme->text, COLOR_TRANSPARENT);
             ey += 18;
         }
     }
 
     int agenda_x = content_x + content_w - agenda_w;
     draw_rounded_rect_blend(agenda_x, content_y, agenda_w, content_h, 12, theme->dock_tint, 110);
-    fb_draw_string(agenda_x + 10, content_y + 10, "Agenda", theme->text_muted, theme->dock_tint);
+    fb_draw_string(agenda_x + 10, content_y + 10, "Agenda", theme->text_muted, COLOR_TRANSPARENT);
     int indices[8];
     int count = calendar_events_for_day(cal, cal->year, cal->month, cal->selected_day, indices, 8);
     int ay = content_y + 30;
@@ -920,8 +1205,8 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
         if (indices[i] == cal->selected_event) {
             draw_rounded_rect_blend(agenda_x + 6, ay - 2, agenda_w - 12, 16, 8, theme->accent, 40);
         }
-        fb_draw_string(agenda_x + 10, ay, timebuf, theme->text_muted, theme->dock_tint);
-        fb_draw_string(agenda_x + 70, ay, ev->title, theme->text, theme->dock_tint);
+        fb_draw_string(agenda_x + 10, ay, timebuf, theme->text_muted, COLOR_TRANSPARENT);
+        fb_draw_string(agenda_x + 70, ay, ev->title, theme->text, COLOR_TRANSPARENT);
         ay += 18;
     }
 
@@ -933,13 +1218,13 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
         if (cal->edit_field == 2) label = "Location";
         if (cal->edit_field == 3) label = "Notes";
         fb_draw_string(agenda_x + 12, content_y + content_h - 36, label,
-                       theme->text_muted, theme->dock_tint);
+                       theme->text_muted, COLOR_TRANSPARENT);
         fb_draw_string(agenda_x + 70, content_y + content_h - 36,
                        cal->edit_buffer[0] ? cal->edit_buffer : "",
-                       theme->text, theme->dock_tint);
+                       theme->text, COLOR_TRANSPARENT);
         if (cal->edit_error) {
             fb_draw_string(agenda_x + 12, content_y + content_h - 20,
-                           "Invalid time", theme->text_muted, theme->dock_tint);
+                           "Invalid time", theme->text_muted, COLOR_TRANSPARENT);
         }
     }
 }
@@ -947,7 +1232,7 @@ static void draw_calendar_window(CalendarState *cal, int content_x, int content_
 static void draw_preview_window(PreviewState *preview, int content_x, int content_y, int content_w, int content_h)
 {
     draw_rounded_rect_blend(content_x, content_y, content_w, content_h, 10, theme->dock_tint, 120);
-    fb_draw_string(content_x + 12, content_y + 12, "Preview", theme->text, theme->dock_tint);
+    fb_draw_string(content_x + 12, content_y + 12, "Preview", theme->text, COLOR_TRANSPARENT);
 
     int thumb_y = content_y + 40;
     int thumb_x = content_x + 16;
@@ -961,19 +1246,18 @@ static void draw_preview_window(PreviewState *preview, int content_x, int conten
         fb_fill_rect(thumb_x + 120 + gap, thumb_y, 120, 80, theme->accent);
     }
 
-    fb_draw_string(thumb_x + 10, thumb_y + 90, "Tahoe Light", theme->text_muted, theme->dock_tint);
-    fb_draw_string(thumb_x + 140 + gap, thumb_y + 90, "Tahoe Dark", theme->text_muted, theme->dock_tint);
+    fb_draw_string(thumb_x + 10, thumb_y + 90, "Tahoe Light", theme->text_muted, COLOR_TRANSPARENT);
+    fb_draw_string(thumb_x + 140 + gap, thumb_y + 90, "Tahoe Dark", theme->text_muted, COLOR_TRANSPARENT);
 
     fb_draw_string(content_x + 12, content_y + content_h - 18,
-                   preview->current, theme->text_muted, theme->dock_tint);
+                   preview->current, theme->text_muted, COLOR_TRANSPARENT);
 }
 
 static void draw_window(int idx)
 {
     CompositorWindow *win = &windows[idx];
-    AppWindowState *state = &app_states[idx];
+    AppWindowState *state = app_states[idx];
     int r = theme->glass.corner_radius[win->corner_level];
-    int blur_px = theme->glass.blur_px[win->blur_level];
     uint8_t opacity = theme->glass.opacity[win->glass_level];
     uint8_t highlight = theme->glass.highlight[win->glass_level];
 
@@ -987,14 +1271,26 @@ static void draw_window(int idx)
     int draw_x = win->x + (win->w - draw_w) / 2;
     int draw_y = win->y + (win->h - draw_h) / 2;
 
+    if (!rect_visible(draw_x - WINDOW_SHADOW_SPREAD, draw_y - WINDOW_SHADOW_SPREAD,
+                      draw_w + WINDOW_SHADOW_SPREAD * 2, draw_h + WINDOW_SHADOW_SPREAD * 2)) {
+        return;
+    }
+
     draw_shadow(draw_x, draw_y, draw_w, draw_h, r);
 
-    for (int py = draw_y; py < draw_y + draw_h; py++) {
-        for (int px = draw_x; px < draw_x + draw_w; px++) {
+    int clip_x1, clip_y1, clip_x2, clip_y2;
+    fb_get_clip(&clip_x1, &clip_y1, &clip_x2, &clip_y2);
+    clip_x1 = MAX(clip_x1, draw_x);
+    clip_y1 = MAX(clip_y1, draw_y);
+    clip_x2 = MIN(clip_x2, draw_x + draw_w);
+    clip_y2 = MIN(clip_y2, draw_y + draw_h);
+
+    for (int py = clip_y1; py < clip_y2; py++) {
+        for (int px = clip_x1; px < clip_x2; px++) {
             if (!point_in_rounded_rect(px, py, draw_x, draw_y, draw_w, draw_h, r)) {
                 continue;
             }
-            Color blurred = blur_sample(px, py, blur_px);
+            Color blurred = blurred_wallpaper(win->blur_level, px, py);
             Color glass = blend(blurred, theme->glass_aqua, opacity);
             fb_put_pixel(px, py, glass);
         }
@@ -1002,7 +1298,7 @@ static void draw_window(int idx)
 
     draw_rounded_rect_blend(draw_x, draw_y, draw_w, 32, r, theme->accent_soft, highlight);
     fb_draw_string(draw_x + 16, draw_y + 10, win->title,
-                   theme->text, blend(theme->accent_soft, theme->glass_aqua, 24));
+                   theme->text, COLOR_TRANSPARENT);
 
     fb_fill_rect(draw_x + 10, draw_y + 10, 8, 8, RGB(235, 92, 86));
     fb_fill_rect(draw_x + 22, draw_y + 10, 8, 8, RGB(245, 197, 72));
@@ -1048,9 +1344,9 @@ static void draw_window(int idx)
 
         draw_rounded_rect_blend(panel_x, panel_y, panel_w, panel_h, pr, theme->accent, 40);
         fb_draw_string(panel_x + 20, panel_y + 16, "Glass Panel",
-                       theme->text, blend(theme->accent, theme->glass_aqua, 40));
+                       theme->text, COLOR_TRANSPARENT);
         fb_draw_string(panel_x + 20, panel_y + 36, "Tahoe material demo",
-                       theme->text_muted, blend(theme->accent, theme->glass_aqua, 30));
+                       theme->text_muted, COLOR_TRANSPARENT);
 
         int dot_y = panel_y + 62;
         for (int i = 0; i < 3; i++) {
@@ -1062,23 +1358,26 @@ static void draw_window(int idx)
 
 static void draw_wallpaper(void)
 {
-    for (uint32_t y = 0; y < comp_height; y++) {
-        for (uint32_t x = 0; x < comp_width; x++) {
-            fb_put_pixel((int)x, (int)y, wallpaper_sample((int)x, (int)y));
+    int x1, y1, x2, y2;
+    fb_get_clip(&x1, &y1, &x2, &y2);
+    for (int y = y1; y < y2; y++) {
+        for (int x = x1; x < x2; x++) {
+            fb_put_pixel(x, y, wallpaper_sample(x, y));
         }
     }
 }
 
 static void draw_menu_bar(void)
 {
+    if (!rect_visible(0, 0, (int)comp_width, MENU_BAR_HEIGHT)) return;
+
     draw_rounded_rect_blend(0, 0, (int)comp_width, MENU_BAR_HEIGHT, 0,
                             theme->dock_tint, 140);
 
-    fb_draw_string(14, 8, active_app_name, theme->text, theme->dock_tint);
-    fb_draw_string(120, 8, "File  Edit  View  Window  Help", theme->text_muted, theme->dock_tint);
+    fb_draw_string(14, 8, active_app_name, theme->text, COLOR_TRANSPARENT);
+    fb_draw_string(120, 8, "File  Edit  View  Window  Help", theme->text_muted, COLOR_TRANSPARENT);
 
-    RtcTime time;
-    rtc_read_time(&time);
+    RtcTime time = frame_time;
     char time_buf[16];
     bool is_24 = settings_get()->time_24h;
     int hour = time.hour;
@@ -1103,12 +1402,14 @@ static void draw_menu_bar(void)
 
     const char *status = "WiFi  Vol";
     int status_x = (int)comp_width - 120;
-    fb_draw_string(status_x, 8, status, theme->text_muted, theme->dock_tint);
-    fb_draw_string((int)comp_width - 70, 8, time_buf, theme->text, theme->dock_tint);
+    fb_draw_string(status_x, 8, status, theme->text_muted, COLOR_TRANSPARENT);
+    fb_draw_string((int)comp_width - 70, 8, time_buf, theme->text, COLOR_TRANSPARENT);
 }
 
 static void draw_icon_scaled(const uint8_t *pixels, int src_size, int x, int y, int size)
 {
+    if (!rect_visible(x, y, size, size)) return;
+
     for (int py = 0; py < size; py++) {
         int sy = (py * src_size) / size;
         for (int px = 0; px < size; px++) {
@@ -1127,6 +1428,8 @@ static void draw_icon_scaled(const uint8_t *pixels, int src_size, int x, int y,
 
 static void draw_image_scaled(const uint8_t *pixels, int src_w, int src_h, int x, int y, int w, int h)
 {
+    if (!rect_visible(x, y, w, h)) return;
+
     for (int py = 0; py < h; py++) {
         int sy = (py * src_h) / h;
         for (int px = 0; px < w; px++) {
@@ -1143,11 +1446,42 @@ static void draw_image_scaled(const uint8_t *pixels, int src_w, int src_h, int x
     }
 }
 
+/*
+ * Dock area including magnified and bouncing icons
+ */
+static void dock_damage_bounds(int *x, int *y, int *w, int *h)
+{
+    SettingsState *settings = settings_get();
+    int count = app_registry_count();
+    int icon_base = settings->dock_size;
+    int grow = MAX(0, settings->dock_magnify - icon_base);
+
+    int spacing = 12;
+    int total_width = count * icon_base + (count - 1) * spacing + 40;
+    if (total_width < 240) total_width = 240;
+
+    *x = ((int)comp_width - total_width) / 2 - grow;
+    *y = (int)comp_height - DOCK_HEIGHT - 20 - grow - 10;
+    *w = total_width + grow * 2;
+    *h = DOCK_HEIGHT + grow + 10;
+}
+
+static void damage_dock(void)
+{
+    int x, y, w, h;
+    dock_damage_bounds(&x, &y, &w, &h);
+    compositor_damage(x, y, w, h);
+}
+
 static void draw_dock(uint64_t now_ms)
 {
     int count = app_registry_count();
     if (count == 0) return;
 
+    int area_x, area_y, area_w, area_h;
+    dock_damage_bounds(&area_x, &area_y, &area_w, &area_h);
+    if (!rect_visible(area_x, area_y, area_w, area_h)) return;
+
     SettingsState *settings = settings_get();
     int icon_base = settings->dock_size;
     int icon_max = settings->dock_magnify;
@@ -1215,7 +1549,7 @@ static void draw_spotlight(int anim)
     draw_shadow(x, y, SPOTLIGHT_WIDTH, SPOTLIGHT_HEIGHT, r);
     draw_rounded_rect_blend(x, y, SPOTLIGHT_WIDTH, SPOTLIGHT_HEIGHT, r, theme->glass_aqua, panel_alpha);
     fb_draw_string(x + 18, y + 20, spotlight_query[0] ? spotlight_query : "Search", theme->text,
-                   blend(theme->glass_aqua, theme->dock_tint, 60));
+                   COLOR_TRANSPARENT);
 
     int list_y = y + SPOTLIGHT_HEIGHT + 8;
     int list_h = spotlight_count * 28 + 12;
@@ -1228,25 +1562,26 @@ static void draw_spotlight(int anim)
                                         theme->accent, panel_alpha);
             }
             fb_draw_string(x + 18, row_y + 6, spotlight_results[i].title,
-                           theme->text, theme->dock_tint);
+                           theme->text, COLOR_TRANSPARENT);
             fb_draw_string(x + 240, row_y + 6, spotlight_results[i].subtitle,
-                           theme->text_muted, theme->dock_tint);
+                           theme->text_muted, COLOR_TRANSPARENT);
         }
     } else if (spotlight_query[0]) {
         draw_rounded_rect_blend(x, list_y, SPOTLIGHT_WIDTH, 36, 14, theme->dock_tint, panel_alpha + 20);
-        fb_draw_string(x + 18, list_y + 10, "No results", theme->text_muted, theme->dock_tint);
+        fb_draw_string(x + 18, list_y + 10, "No results", theme->text_muted, COLOR_TRANSPARENT);
     }
 }
 
 static void draw_launchpad(int anim)
 {
-    int blur_radius = theme->glass.blur_px[2];
-    for (uint32_t y = 0; y < comp_height; y++) {
-        for (uint32_t x = 0; x < comp_width; x++) {
-            Color blurred = blur_sample((int)x, (int)y, blur_radius);
+    int x1, y1, x2, y2;
+    fb_get_clip(&x1, &y1, &x2, &y2);
+    for (int y = y1; y < y2; y++) {
+        for (int x = x1; x < x2; x++) {
+            Color blurred = blurred_wallpaper(BLUR_LEVELS - 1, x, y);
             Color blended = blend(blurred, theme->dock_tint, 80);
-            Color base = fb_get_pixel((int)x, (int)y);
-            fb_put_pixel((int)x, (int)y, blend(base, blended, overlay_alpha(220, anim)));
+            Color base = fb_get_pixel(x, y);
+            fb_put_pixel(x, y, blend(base, blended, overlay_alpha(220, anim)));
         }
     }
 
@@ -1270,7 +1605,7 @@ static void draw_launchpad(int anim)
                 fb_fill_rect(ix, iy, LAUNCHPAD_ICON_SIZE, LAUNCHPAD_ICON_SIZE, theme->accent);
             }
             fb_draw_string(ix - 4, iy + LAUNCHPAD_ICON_SIZE + 10, app->name,
-                           theme->text, theme->dock_tint);
+                           theme->text, COLOR_TRANSPARENT);
             idx++;
         }
     }
@@ -1288,22 +1623,22 @@ static void draw_control_center(int anim)
 
     SettingsState *settings = settings_get();
 
-    fb_draw_string(x + 16, y + 12, "Control Center", theme->text, theme->dock_tint);
+    fb_draw_string(x + 16, y + 12, "Control Center", theme->text, COLOR_TRANSPARENT);
 
     int toggle_y = y + 44;
     fb_draw_string(x + 16, toggle_y, settings->wifi_enabled ? "Wi-Fi: On" : "Wi-Fi: Off",
-                   theme->text, theme->dock_tint);
+                   theme->text, COLOR_TRANSPARENT);
     fb_draw_string(x + 16, toggle_y + 22,
                    settings->bluetooth_enabled ? "Bluetooth: On" : "Bluetooth: Off",
-                   theme->text, theme->dock_tint);
+                   theme->text, COLOR_TRANSPARENT);
     fb_draw_string(x + 16, toggle_y + 44,
                    settings->dark_mode ? "Appearance: Dark" : "Appearance: Light",
-                   theme->text, theme->dock_tint);
+                   theme->text, COLOR_TRANSPARENT);
 
-    fb_draw_string(x + 16, toggle_y + 76, "Volume", theme->text_muted, theme->dock_tint);
+    fb_draw_string(x + 16, toggle_y + 76, "Volume", theme->text_muted, COLOR_TRANSPARENT);
     fb_fill_rect(x + 16, toggle_y + 92, settings->volume, 6, theme->accent);
 
-    fb_draw_string(x + 16, toggle_y + 112, "Brightness", theme->text_muted, theme->dock_tint);
+    fb_draw_string(x + 16, toggle_y + 112, "Brightness", theme->text_muted, COLOR_TRANSPARENT);
     fb_fill_rect(x + 16, toggle_y + 128, settings->brightness, 6, theme->accent_soft);
 }
 
@@ -1312,7 +1647,7 @@ static void draw_mission_control(int anim)
     draw_rounded_rect_blend(0, 0, (int)comp_width, (int)comp_height, 0,
                             theme->dock_tint, overlay_alpha(140, anim));
     fb_draw_string(((int)comp_width - 220) / 2, 120,
-                   "Mission Control (Phase 2)", theme->text, theme->dock_tint);
+                   "Mission Control (Phase 2)", theme->text, COLOR_TRANSPARENT);
 }
 
 static void draw_app_switcher(int anim)
@@ -1356,6 +1691,23 @@ static void draw_app_switcher(int anim)
     }
 }
 
+static FinderState *finder_drag_state(void)
+{
+    if (active_window_index < 0 || active_window_index >= window_count) return NULL;
+    AppWindowState *state = app_states[active_window_index];
+    if (state->type != APP_FINDER || !state->finder.drag_active) return NULL;
+    return &state->finder;
+}
+
+static void draw_drag_label(void)
+{
+    FinderState *finder = finder_drag_state();
+    if (finder) {
+        fb_draw_string(cursor_x + 10, cursor_y + 10, vfs_basename(finder->drag_path),
+                       theme->text, COLOR_TRANSPARENT);
+    }
+}
+
 static void draw_cursor(int x, int y)
 {
     static const uint8_t cursor[12] = {
@@ -1406,6 +1758,8 @@ static void launch_app_index(int index, uint64_t now_ms)
         if (app) {
             strncpy(active_app_name, app->name, sizeof(active_app_name) - 1);
             app->bounce_until = now_ms + 600;
+            damage_menu_bar();
+            damage_dock();
             AppType type = app_type_from_bundle(app->bundle.manifest.bundle_id);
             if (type != APP_DEMO) {
                 app_open_window(type, app->name);
@@ -1497,30 +1851,53 @@ static bool preview_load_thumbnail(const char *path, uint8_t *out)
     uint32_t w = header[0];
     uint32_t h = header[1];
     uint64_t size = (uint64_t)w * (uint64_t)h * 4;
-    if (size > PREVIEW_RAW_MAX) {
+    if (w == 0 || h == 0 || size > PREVIEW_RAW_MAX) {
         vfs_close(file);
         return false;
     }
 
-    static uint8_t raw[PREVIEW_RAW_MAX];
-    ssize_t read_size = vfs_read(file, raw, size);
-    vfs_close(file);
-    if (read_size != (ssize_t)size) return false;
+    /* Only the sampled rows are read, into a private buffer (runs as a task) */
+    uint8_t *row = (uint8_t *)kmalloc((size_t)w * 4);
+    if (!row) {
+        vfs_close(file);
+        return false;
+    }
+
+    bool ok = true;
+    for (int y = 0; y < PREVIEW_THUMB_H && ok; y++) {
+        uint32_t sy = (uint32_t)((y * h) / PREVIEW_THUMB_H);
+        int64_t offset = (int64_t)sizeof(header) + (int64_t)sy * w * 4;
+        if (vfs_seek(file, offset, VFS_SEEK_SET) != offset ||
+            vfs_read(file, row, (size_t)w * 4) != (ssize_t)w * 4) {
+            ok = false;
+            break;
+        }
 
-    for (int y = 0; y < PREVIEW_THUMB_H; y++) {
-        int sy = (int)((y * h) / PREVIEW_THUMB_H);
         for (int x = 0; x < PREVIEW_THUMB_W; x++) {
-            int sx = (int)((x * w) / PREVIEW_THUMB_W);
-            uint32_t src = (sy * w + sx) * 4;
+            uint32_t src = (uint32_t)((x * w) / PREVIEW_THUMB_W) * 4;
             uint32_t dst = (y * PREVIEW_THUMB_W + x) * 4;
-            out[dst + 0] = raw[src + 0];
-            out[dst + 1] = raw[src + 1];
-            out[dst + 2] = raw[src + 2];
-            out[dst + 3] = raw[src + 3];
+            out[dst + 0] = row[src + 0];
+            out[dst + 1] = row[src + 1];
+            out[dst + 2] = row[src + 2];
+            out[dst + 3] = row[src + 3];
         }
     }
 
-    return true;
+    kfree(row);
+    vfs_close(file);
+    return ok;
+}
+
+typedef struct {
+    const char *path;
+    uint8_t *out;
+    bool ok;
+} ThumbJob;
+
+static void preview_thumb_task(void *arg)
+{
+    ThumbJob *job = (ThumbJob *)arg;
+    job->ok = preview_load_thumbnail(job->path, job->out);
 }
 
 static void normalize_path(char *path, size_t size)
@@ -1877,7 +2254,7 @@ static void rebuild_app_window_index(void)
         app_window_index[i] = -1;
     }
     for (int i = 0; i < window_count; i++) {
-        AppType type = app_states[i].type;
+        AppType type = app_states[i]->type;
         if (type >= 0 && type < APP_COUNT) {
             app_window_index[type] = i;
         }
@@ -1903,6 +2280,17 @@ static void finder_refresh(FinderState *state)
         strncpy(dst->name, entry.name, sizeof(dst->name) - 1);
         dst->type = entry.type;
         dst->size = entry.size;
+        dst->app_index = -1;
+
+        /* Resolve bundle icons here rather than reading manifests every frame */
+        if (entry.type == VFS_TYPE_BUNDLE) {
+            char path[256];
+            vfs_join_path(path, sizeof(path), state->path, entry.name);
+            Bundle bundle;
+            if (bundle_load(path, &bundle) == 0) {
+                dst->app_index = app_registry_find_by_bundle_id(bundle.manifest.bundle_id);
+            }
+        }
     }
     vfs_closedir(dir);
     state->needs_refresh = false;
@@ -2366,7 +2754,7 @@ static void terminal_exec(TerminalState *term, const char *cmd)
         } else if (vfs_isdir(path)) {
             app_open_window(APP_FINDER, "Finder");
             if (app_window_index[APP_FINDER] >= 0) {
-                FinderState *finder = &app_states[app_window_index[APP_FINDER]].finder;
+                FinderState *finder = &app_states[app_window_index[APP_FINDER]]->finder;
                 finder_set_path(finder, path);
             }
         } else if (vfs_isfile(path)) {
@@ -2375,7 +2763,7 @@ static void terminal_exec(TerminalState *term, const char *cmd)
             if (textedit_idx >= 0) {
                 launch_app_index(textedit_idx, timer_get_ticks());
                 if (app_window_index[APP_TEXTEDIT] >= 0) {
-                    TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]].textedit;
+                    TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]]->textedit;
                     textedit_load_file(edit, path);
                 }
             }
@@ -2565,7 +2953,7 @@ static void textedit_save(TextEditState *edit)
     vfs_close(file);
     strcpy(edit->status, "Saved");
     edit->dirty = false;
-    search_index_init();
+    search_index_refresh();
 }
 
 static void terminal_handle_key(TerminalState *term, char ascii, KeyCode key)
@@ -2805,10 +3193,12 @@ static int create_window_internal(const char *title, int x, int y, int w, int h,
     if (window_count >= COMPOSITOR_MAX_WINDOWS) return -1;
 
     int id = window_count + 1;
+    AppWindowState *state = (AppWindowState *)kmem_cache_alloc(app_state_cache);
+    if (!state) return -1;
+
     CompositorWindow *win = &windows[window_count];
-    AppWindowState *state = &app_states[window_count];
+    app_states[window_count] = state;
     memset(win, 0, sizeof(*win));
-    memset(state, 0, sizeof(*state));
 
     win->id = id;
     win->app_type = type;
@@ -2853,11 +3243,14 @@ static int create_window_internal(const char *title, int x, int y, int w, int h,
         strncpy(state->preview.options[1], "Tahoe Dark", sizeof(state->preview.options[1]) - 1);
         strncpy(state->preview.current, state->preview.options[0], sizeof(state->preview.current) - 1);
         state->preview.loaded = false;
-        if (preview_load_thumbnail("/System/Wallpapers/Tahoe Light.raw", state->preview.light_thumb)) {
-            if (preview_load_thumbnail("/System/Wallpapers/Tahoe Dark.raw", state->preview.dark_thumb)) {
-                state->preview.loaded = true;
-            }
-        }
+
+        /* Both thumbnails at once: one as a task, one here */
+        ThumbJob light = { "/System/Wallpapers/Tahoe Light.raw", state->preview.light_thumb, false };
+        ThumbJob dark = { "/System/Wallpapers/Tahoe Dark.raw", state->preview.dark_thumb, false };
+        Task *task = task_spawn(preview_thumb_task, &light);
+        preview_thumb_task(&dark);
+        task_join(task);
+        state->preview.loaded = light.ok && dark.ok;
     } else if (type == APP_CALENDAR) {
         RtcTime now;
         rtc_read_time(&now);
@@ -2873,6 +3266,7 @@ static int create_window_internal(const char *title, int x, int y, int w, int h,
     }
 
     window_count++;
+    damage_window(window_count - 1);
     if (wm_hooks.on_create) {
         wm_hooks.on_create(id, type, x, y, w, h);
     }
@@ -2887,7 +3281,7 @@ static int app_open_window(AppType type, const char *title)
         int idx = app_window_index[type];
         if (idx != window_count - 1) {
             CompositorWindow temp = windows[idx];
-            AppWindowState temp_state = app_states[idx];
+            AppWindowState *temp_state = app_states[idx];
             for (int j = idx; j < window_count - 1; j++) {
                 windows[j] = windows[j + 1];
                 app_states[j] = app_states[j + 1];
@@ -2897,6 +3291,7 @@ static int app_open_window(AppType type, const char *title)
         }
         active_window_index = window_count - 1;
         rebuild_app_window_index();
+        damage_window(window_count - 1);
         return windows[window_count - 1].id;
     }
 
@@ -2930,9 +3325,23 @@ void compositor_init(uint32_t width, uint32_t height)
     for (int i = 0; i < APP_COUNT; i++) {
         app_window_index[i] = -1;
     }
-    memset(app_states, 0, sizeof(app_states));
-    last_frame_ms = 0;
+    if (!app_state_cache) {
+        app_state_cache = kmem_cache_create("app_window", sizeof(AppWindowState));
+    }
+    for (int i = 0; i < COMPOSITOR_MAX_WINDOWS; i++) {
+        if (app_states[i]) {
+            kmem_cache_free(app_state_cache, app_states[i]);
+            app_states[i] = NULL;
+        }
+    }
+    next_frame_ns = 0;
     wallpaper_loaded = false;
+    blur_cache_dirty = true;
+    damage_count = 0;
+    damage_last_pixels = 0;
+    damage_last_rects = 0;
+    clock_minute = -1;
+    dock_was_bouncing = false;
     dragging = false;
     drag_index = -1;
     cursor_x = (int)width / 2;
@@ -2961,6 +3370,7 @@ void compositor_init(uint32_t width, uint32_t height)
 
     icon_folder_loaded = load_system_icon("/System/Library/Icons/Folder.raw", icon_folder);
     icon_file_loaded = load_system_icon("/System/Library/Icons/File.raw", icon_file);
+    compositor_damage_all();
 }
 
 void compositor_set_dark_mode(bool enabled)
@@ -2968,10 +3378,15 @@ void compositor_set_dark_mode(bool enabled)
     dark_mode = enabled;
     theme = dark_mode ? theme_dark() : theme_light();
     settings_get()->dark_mode = enabled;
+    blur_cache_dirty = true;
+    compositor_damage_all();
 }
 
 void compositor_set_wallpaper(const char *path)
 {
+    blur_cache_dirty = true;
+    compositor_damage_all();
+
     if (!path) {
         wallpaper_loaded = false;
         return;
@@ -3025,8 +3440,10 @@ void compositor_move_window(int id, int x, int y)
 {
     for (int i = 0; i < window_count; i++) {
         if (windows[i].id == id) {
+            damage_window(i);
             windows[i].x = x;
             windows[i].y = y;
+            damage_window(i);
             if (wm_hooks.on_move) {
                 wm_hooks.on_move(id, x, y);
             }
@@ -3039,8 +3456,10 @@ void compositor_resize_window(int id, int w, int h)
 {
     for (int i = 0; i < window_count; i++) {
         if (windows[i].id == id) {
+            damage_window(i);
             windows[i].w = w;
             windows[i].h = h;
+            damage_window(i);
             if (wm_hooks.on_resize) {
                 wm_hooks.on_resize(id, w, h);
             }
@@ -3054,6 +3473,7 @@ void compositor_set_demo(int id, bool demo)
     for (int i = 0; i < window_count; i++) {
         if (windows[i].id == id) {
             windows[i].demo = demo;
+            damage_window(i);
             return;
         }
     }
@@ -3063,6 +3483,7 @@ void compositor_set_active_app(const char *name)
 {
     if (!name || name[0] == '\0') return;
     strncpy(active_app_name, name, sizeof(active_app_name) - 1);
+    damage_menu_bar();
 }
 
 void compositor_set_wm_hooks(const CompositorWmHooks *hooks)
@@ -3092,7 +3513,55 @@ void compositor_open_default_apps(void)
     }
 }
 
-void compositor_handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
+typedef struct {
+    OverlayMode overlay;
+    int active_window;
+    int window_count;
+    int cursor_x;
+    int cursor_y;
+    bool finder_drag;
+} InputSnapshot;
+
+static void input_snapshot(InputSnapshot *snap)
+{
+    snap->overlay = overlay;
+    snap->active_window = active_window_index;
+    snap->window_count = window_count;
+    snap->cursor_x = cursor_x;
+    snap->cursor_y = cursor_y;
+    snap->finder_drag = finder_drag_state() != NULL;
+}
+
+static void damage_cursor(int x, int y, bool drag_label)
+{
+    compositor_damage(x, y, CURSOR_W, CURSOR_H);
+    if (drag_label) {
+        compositor_damage(x + 10, y + 10, DRAG_LABEL_W, FONT_HEIGHT);
+    }
+}
+
+/*
+ * Damage whatever an input event may have changed. Overlay, focus and
+ * window list changes repaint the whole screen; otherwise only the
+ * focused window, menu bar, dock and cursor are recomposited.
+ */
+static void damage_after_input(const InputSnapshot *before)
+{
+    if (before->overlay != OVERLAY_NONE || overlay != OVERLAY_NONE ||
+        before->active_window != active_window_index ||
+        before->window_count != window_count) {
+        compositor_damage_all();
+        return;
+    }
+
+    damage_window(active_window_index);
+    damage_menu_bar();
+    damage_dock();
+    damage_cursor(before->cursor_x, before->cursor_y, before->finder_drag);
+    damage_cursor(cursor_x, cursor_y, finder_drag_state() != NULL);
+}
+
+static void handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
 {
     if (keycode == KEY_ESCAPE && overlay != OVERLAY_NONE) {
         overlay_set(OVERLAY_NONE);
@@ -3213,7 +3682,7 @@ void compositor_handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
     }
 
     if (overlay == OVERLAY_NONE && active_window_index >= 0 && active_window_index < window_count) {
-        AppWindowState *state = &app_states[active_window_index];
+        AppWindowState *state = app_states[active_window_index];
         if (state->type == APP_TERMINAL) {
             terminal_handle_key(&state->terminal, ascii, keycode);
         } else if (state->type == APP_TEXTEDIT) {
@@ -3397,7 +3866,7 @@ void compositor_handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
                         launch_app_index(textedit_idx, timer_get_ticks());
                     }
                     if (app_window_index[APP_TEXTEDIT] >= 0) {
-                        TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]].textedit;
+                        TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]]->textedit;
                         textedit_load_file(edit, path);
                     }
                 }
@@ -3473,18 +3942,26 @@ void compositor_handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
     }
 }
 
+void compositor_handle_key(KeyCode keycode, char ascii, uint8_t modifiers)
+{
+    InputSnapshot before;
+    input_snapshot(&before);
+    handle_key(keycode, ascii, modifiers);
+    damage_after_input(&before);
+}
+
 bool compositor_overlay_active(void)
 {
     return overlay != OVERLAY_NONE;
 }
 
-void compositor_handle_mouse(int x, int y, bool down, bool up)
+static void handle_mouse(int x, int y, bool down, bool up)
 {
     cursor_x = x;
     cursor_y = y;
 
     if (active_window_index >= 0 && active_window_index < window_count) {
-        AppWindowState *state = &app_states[active_window_index];
+        AppWindowState *state = app_states[active_window_index];
         CompositorWindow *win = &windows[active_window_index];
         if (state->type == APP_FINDER && state->finder.drag_active) {
             FinderState *finder = &state->finder;
@@ -3527,7 +4004,7 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
     }
 
     if (up && active_window_index >= 0 && active_window_index < window_count) {
-        AppWindowState *state = &app_states[active_window_index];
+        AppWindowState *state = app_states[active_window_index];
         CompositorWindow *win = &windows[active_window_index];
         if (state->type == APP_FINDER && state->finder.drag_active) {
             FinderState *finder = &state->finder;
@@ -3703,7 +4180,7 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
 
         for (int i = window_count - 1; i >= 0; i--) {
             CompositorWindow *win = &windows[i];
-            AppWindowState *state = &app_states[i];
+            AppWindowState *state = app_states[i];
                 if (x >= win->x && x < win->x + win->w && y >= win->y && y < win->y + win->h) {
                     active_window_index = i;
                     strncpy(active_app_name, app_name_from_type(state->type),
@@ -3782,7 +4259,7 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
                                             app_open_window(APP_TEXTEDIT, "TextEdit");
                                         }
                                         if (app_window_index[APP_TEXTEDIT] >= 0) {
-                                            TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]].textedit;
+                                            TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]]->textedit;
                                             textedit_load_file(edit, path);
                                         }
                                     }
@@ -3825,7 +4302,7 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
                                             launch_app_index(textedit_idx, timer_get_ticks());
                                         }
                                         if (app_window_index[APP_TEXTEDIT] >= 0) {
-                                            TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]].textedit;
+                                            TextEditState *edit = &app_states[app_window_index[APP_TEXTEDIT]]->textedit;
                                             textedit_load_file(edit, path);
                                         }
                                     }
@@ -4010,7 +4487,7 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
 
                 if (i != window_count - 1) {
                     CompositorWindow temp = windows[i];
-                    AppWindowState temp_state = app_states[i];
+                    AppWindowState *temp_state = app_states[i];
                     for (int j = i; j < window_count - 1; j++) {
                         windows[j] = windows[j + 1];
                         app_states[j] = app_states[j + 1];
@@ -4035,17 +4512,31 @@ void compositor_handle_mouse(int x, int y, bool down, bool up)
     }
 
     if (dragging && drag_index >= 0 && drag_index < window_count) {
+        damage_window(drag_index);
         windows[drag_index].x = x - drag_dx;
         windows[drag_index].y = y - drag_dy;
+        damage_window(drag_index);
     }
 }
 
+void compositor_handle_mouse(int x, int y, bool down, bool up)
+{
+    InputSnapshot before;
+    input_snapshot(&before);
+    handle_mouse(x, y, down, up);
+    damage_after_input(&before);
+}
+
 void compositor_handle_mouse_move(int32_t dx, int32_t dy)
 {
     int speed = settings_get()->mouse_speed;
     if (speed < 1) speed = 1;
     if (speed > 4) speed = 4;
 
+    bool drag_label = finder_drag_state() != NULL;
+    damage_cursor(cursor_x, cursor_y, drag_label);
+    int old_y = cursor_y;
+
     cursor_x += dx * speed;
     cursor_y += dy * speed;
 
@@ -4054,17 +4545,43 @@ void compositor_handle_mouse_move(int32_t dx, int32_t dy)
     if (cursor_x >= (int)comp_width) cursor_x = (int)comp_width - 1;
     if (cursor_y >= (int)comp_height) cursor_y = (int)comp_height - 1;
 
+    damage_cursor(cursor_x, cursor_y, drag_label);
+
+    /* Dock magnification follows the cursor */
+    int dock_x, dock_y, dock_w, dock_h;
+    dock_damage_bounds(&dock_x, &dock_y, &dock_w, &dock_h);
+    if (MAX(old_y, cursor_y) >= dock_y - DOCK_HOVER_RADIUS) {
+        damage_dock();
+    }
+
     if (dragging && drag_index >= 0 && drag_index < window_count) {
+        damage_window(drag_index);
         windows[drag_index].x = cursor_x - drag_dx;
         windows[drag_index].y = cursor_y - drag_dy;
+        damage_window(drag_index);
     }
 }
 
+/*
+ * Move an overlay animation toward 0 or 1000; returns true if it changed
+ */
+static bool anim_step(int *value, bool open, int step)
+{
+    int prev = *value;
+    if (open) {
+        *value = MIN(1000, *value + step);
+    } else {
+        *value = MAX(0, *value - step);
+    }
+    return *value != prev;
+}
+
 static void update_animations(void)
 {
     for (int i = 0; i < window_count; i++) {
         CompositorWindow *win = &windows[i];
         if (win->animating) {
+            damage_window(i);
             win->anim_open += 40;
             if (win->anim_open >= 1000) {
                 win->anim_open = 1000;
@@ -4074,37 +4591,53 @@ static void update_animations(void)
     }
 
     int step = 120;
-    int target_spotlight = (overlay == OVERLAY_SPOTLIGHT) ? 1000 : 0;
-    int target_launchpad = (overlay == OVERLAY_LAUNCHPAD) ? 1000 : 0;
-    int target_control = (overlay == OVERLAY_CONTROL_CENTER) ? 1000 : 0;
-    int target_mission = (overlay == OVERLAY_MISSION_CONTROL) ? 1000 : 0;
-    int target_switcher = (overlay == OVERLAY_APP_SWITCHER) ? 1000 : 0;
+    bool overlay_changed = false;
+    overlay_changed |= anim_step(&anim_spotlight, overlay == OVERLAY_SPOTLIGHT, step);
+    overlay_changed |= anim_step(&anim_launchpad, overlay == OVERLAY_LAUNCHPAD, step);
+    overlay_changed |= anim_step(&anim_control_center, overlay == OVERLAY_CONTROL_CENTER, step);
+    overlay_changed |= anim_step(&anim_mission_control, overlay == OVERLAY_MISSION_CONTROL, step);
+    overlay_changed |= anim_step(&anim_app_switcher, overlay == OVERLAY_APP_SWITCHER, step);
 
-    if (anim_spotlight < target_spotlight) anim_spotlight = MIN(1000, anim_spotlight + step);
-    if (anim_spotlight > target_spotlight) anim_spotlight = MAX(0, anim_spotlight - step);
-
-    if (anim_launchpad < target_launchpad) anim_launchpad = MIN(1000, anim_launchpad + step);
-    if (anim_launchpad > target_launchpad) anim_launchpad = MAX(0, anim_launchpad - step);
-
-    if (anim_control_center < target_control) anim_control_center = MIN(1000, anim_control_center + step);
-    if (anim_control_center > target_control) anim_control_center = MAX(0, anim_control_center - step);
-
-    if (anim_mission_control < target_mission) anim_mission_control = MIN(1000, anim_mission_control + step);
-    if (anim_mission_control > target_mission) anim_mission_control = MAX(0, anim_mission_control - step);
-
-    if (anim_app_switcher < target_switcher) anim_app_switcher = MIN(1000, anim_app_switcher + step);
-    if (anim_app_switcher > target_switcher) anim_app_switcher = MAX(0, anim_app_switcher - step);
+    if (overlay_changed) {
+        compositor_damage_all();
+    }
 }
 
-void compositor_tick(uint64_t now_ms)
+/*
+ * Damage that follows time rather than input: the dock bounce and the
+ * menu bar clock (checked once per second).
+ */
+static void damage_periodic(uint64_t now_ms)
 {
-    if (now_ms - last_frame_ms < 33) {
+    bool bouncing = false;
+    int count = app_registry_count();
+    for (int i = 0; i < count; i++) {
+        AppInfo *app = app_registry_get(i);
+        if (app && app->bounce_until > now_ms) {
+            bouncing = true;
+            break;
+        }
+    }
+    if (bouncing || dock_was_bouncing) {
+        damage_dock();
+    }
+    dock_was_bouncing = bouncing;
+
+    if (clock_minute >= 0 && now_ms - clock_checked_ms < 1000) {
         return;
     }
+    clock_checked_ms = now_ms;
 
-    last_frame_ms = now_ms;
-    update_animations();
+    RtcTime time;
+    rtc_read_time(&time);
+    if (time.minute != clock_minute) {
+        clock_minute = time.minute;
+        damage_menu_bar();
+    }
+}
 
+static void render_scene(uint64_t now_ms)
+{
     draw_wallpaper();
 
     if (anim_launchpad > 0) {
@@ -4136,5 +4669,275 @@ void compositor_tick(uint64_t now_ms)
         draw_app_switcher(anim_app_switcher);
     }
 
+    draw_drag_label();
     draw_cursor(cursor_x, cursor_y);
 }
+
+/*
+ * Bring app state up to date before drawing, so the draw pass only
+ * reads shared state and can run on several CPUs at once
+ */
+static void frame_prepare(void)
+{
+    rtc_read_time(&frame_time);
+
+    for (int i = 0; i < window_count; i++) {
+        AppWindowState *state = app_states[i];
+        switch (state->type) {
+            case APP_FINDER:
+                if (state->finder.needs_refresh) {
+                    finder_refresh(&state->finder);
+                }
+                break;
+            case APP_TEXTEDIT:
+                textedit_normalize_selection(&state->textedit);
+                break;
+            case APP_NOTES:
+                textedit_normalize_selection(&state->notes);
+                break;
+            case APP_CALENDAR: {
+                CalendarState *cal = &state->calendar;
+                if (!cal->loaded) {
+                    calendar_load(cal);
+                }
+                if (frame_time.year == cal->year && frame_time.month == cal->month) {
+                    cal->day = frame_time.day;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/*
+ * Cut the damage rectangles into bands aligned to TILE_HEIGHT rows
+ */
+static void tiles_build(void)
+{
+    tile_count = 0;
+    for (int i = 0; i < damage_count; i++) {
+        DamageRect *rect = &damage_rects[i];
+        int y = rect->y1;
+        while (y < rect->y2) {
+            int y2 = MIN(rect->y2, (y / TILE_HEIGHT + 1) * TILE_HEIGHT);
+            if (tile_count == TILE_MAX - 1) {
+                y2 = rect->y2;      /* Table full: the rest is one tile */
+            }
+            if (tile_count == TILE_MAX) {
+                tiles[tile_count - 1].y2 = MAX(tiles[tile_count - 1].y2, rect->y2);
+                break;
+            }
+            tiles[tile_count++] = (DamageRect){ rect->x1, y, rect->x2, y2 };
+            y = y2;
+        }
+    }
+}
+
+static void tile_render(int index)
+{
+    DamageRect *t = &tiles[index];
+    fb_set_clip(t->x1, t->y1, t->x2 - t->x1, t->y2 - t->y1);
+    render_scene(tile_frame_ms);
+}
+
+/* Take the next tile from our own range (front) */
+static int tile_take(TileWorker *w)
+{
+    uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t head = (uint32_t)(r >> 32);
+        uint32_t tail = (uint32_t)r;
+        if (head >= tail) return -1;
+        uint64_t next = ((uint64_t)(head + 1) << 32) | tail;
+        if (__atomic_compare_exchange_n(&w->range, &r, next, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return (int)head;
+        }
+    }
+}
+
+/* Steal the last tile of another CPU's range (back) */
+static int tile_steal(uint32_t self)
+{
+    for (uint32_t n = 1; n < tile_worker_count; n++) {
+        TileWorker *victim = &tile_workers[(self + n) % tile_worker_count];
+        uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+        for (;;) {
+            uint32_t head = (uint32_t)(r >> 32);
+            uint32_t tail = (uint32_t)r;
+            if (head >= tail) break;
+            uint64_t next = ((uint64_t)head << 32) | (tail - 1);
+            if (__atomic_compare_exchange_n(&victim->range, &r, next, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return (int)(tail - 1);
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * Per-CPU render loop: own tiles first, then steal until every range
+ * is empty. Runs on the BSP and, through smp_call(), on each AP.
+ */
+static void tile_worker(void *arg)
+{
+    (void)arg;
+    uint32_t self = smp_cpu_id();
+    TileWorker *w = &tile_workers[self];
+    uint32_t done = 0;
+    uint32_t stolen = 0;
+    uint64_t start = rdtsc();
+
+    for (;;) {
+        int t = tile_take(w);
+        if (t < 0) {
+            t = tile_steal(self);
+            if (t < 0) break;
+            stolen++;
+        }
+        tile_render(t);
+        done++;
+    }
+    fb_reset_clip();
+
+    uint64_t cycles = rdtsc() - start;
+    w->last_tiles = done;
+    w->last_stolen = stolen;
+    w->last_cycles = cycles;
+    w->tiles += done;
+    w->stolen += stolen;
+    w->cycles += cycles;
+}
+
+/*
+ * Render all tiles on every CPU. Each CPU starts with a contiguous
+ * share; an AP that could not be posted (still busy) simply has its
+ * share stolen. Once the BSP runs out of tiles, calls that an AP has
+ * not picked up (it is inside a pool task) are withdrawn, so the frame
+ * barrier only waits for APs that are actually rendering.
+ */
+static void render_parallel(void)
+{
+    tile_worker_count = MIN(smp_cpu_count(), (uint32_t)tile_count);
+    for (uint32_t cpu = 0; cpu < tile_worker_count; cpu++) {
+        uint32_t head = (uint32_t)((uint64_t)tile_count * cpu / tile_worker_count);
+        uint32_t tail = (uint32_t)((uint64_t)tile_count * (cpu + 1) / tile_worker_count);
+        __atomic_store_n(&tile_workers[cpu].range, ((uint64_t)head << 32) | tail,
+                         __ATOMIC_RELEASE);
+    }
+
+    bool posted[SMP_MAX_CPUS] = { false };
+    for (uint32_t cpu = 1; cpu < tile_worker_count; cpu++) {
+        posted[cpu] = smp_call(cpu, tile_worker, NULL);
+    }
+
+    tile_worker(NULL);
+
+    for (uint32_t cpu = 1; cpu < tile_worker_count; cpu++) {
+        if (posted[cpu] && !smp_call_cancel(cpu)) {
+            smp_call_wait(cpu);
+        } else {
+            tile_workers[cpu].last_tiles = 0;
+            tile_workers[cpu].last_stolen = 0;
+            tile_workers[cpu].last_cycles = 0;
+        }
+    }
+    frames_parallel++;
+}
+
+void compositor_tick(uint64_t now_ms)
+{
+    uint64_t now_ns = timer_get_ns();
+    if (now_ns < next_frame_ns) {
+        return;
+    }
+
+    /* Fixed cadence; after a stall, restart it from now instead of bursting */
+    next_frame_ns += COMPOSITOR_FRAME_NS;
+    if (next_frame_ns <= now_ns) {
+        next_frame_ns = now_ns + COMPOSITOR_FRAME_NS;
+    }
+    update_animations();
+    damage_periodic(now_ms);
+    blur_cache_ensure();
+
+    if (damage_count == 0) {
+        damage_last_pixels = 0;
+        damage_last_rects = 0;
+        frames_idle++;
+        return;
+    }
+
+    frame_prepare();
+
+    uint64_t pixels = 0;
+    for (int i = 0; i < damage_count; i++) {
+        pixels += damage_rect_area(&damage_rects[i]);
+    }
+
+    /* Recomposite the damage in bands, in parallel when it is worth it */
+    uint64_t start = rdtsc();
+    tiles_build();
+    tile_frame_ms = now_ms;
+    if (smp_cpu_count() > 1 && tile_count > 1 && pixels >= TILE_PARALLEL_MIN_PIXELS) {
+        render_parallel();
+    } else {
+        for (int i = 0; i < tile_count; i++) {
+            tile_render(i);
+        }
+        fb_reset_clip();
+    }
+    render_last_cycles = rdtsc() - start;
+    render_total_cycles += render_last_cycles;
+
+    /* Present the finished frame (no-op when drawing straight to the screen) */
+    for (int i = 0; i < damage_count; i++) {
+        DamageRect *rect = &damage_rects[i];
+        fb_present(rect->x1, rect->y1, rect->x2 - rect->x1, rect->y2 - rect->y1);
+    }
+
+    damage_last_pixels = pixels;
+    damage_last_rects = (uint32_t)damage_count;
+    damage_total_pixels += pixels;
+    frames_drawn++;
+    damage_count = 0;
+}
+
+uint64_t compositor_next_frame_ns(void)
+{
+    return next_frame_ns;
+}
+
+uint64_t compositor_get_damaged_pixels(void)
+{
+    return damage_last_pixels;
+}
+
+void compositor_print_stats(void)
+{
+    uint64_t screen = (uint64_t)comp_width * comp_height;
+
+    console_printf("Compositor:\n");
+    console_printf("  Frames drawn:   %d\n", (int)frames_drawn);
+    console_printf("  Frames idle:    %d\n", (int)frames_idle);
+    console_printf("  Last damage:    %d px in %d rects\n",
+        (int)damage_last_pixels, (int)damage_last_rects);
+    if (frames_drawn > 0 && screen > 0) {
+        console_printf("  Avg damage:     %d%% of screen\n",
+            (int)((damage_total_pixels * 100) / (frames_drawn * screen)));
+        console_printf("  Render time:    last %d Kcycles, avg %d Kcycles\n",
+            (int)(render_last_cycles / 1000), (int)(render_total_cycles / frames_drawn / 1000));
+    }
+    console_printf("  Parallel:       %d frames on %d CPUs, %d-row bands\n",
+        (int)frames_parallel, (int)smp_cpu_count(), TILE_HEIGHT);
+    for (uint32_t cpu = 0; cpu < smp_cpu_count() && cpu < SMP_MAX_CPUS; cpu++) {
+        TileWorker *w = &tile_workers[cpu];
+        console_printf("    CPU %d: %d tiles (%d stolen), last %d tiles in %d Kcycles\n",
+            (int)cpu, (int)w->tiles, (int)w->stolen,
+            (int)w->last_tiles, (int)(w->last_cycles / 1000));
+    }
+    console_printf("\n");
+}
@@ -56,4 +56,15 @@ void compositor_handle_mouse(int x, int y, bool down, bool up);
 bool compositor_overlay_active(void);
 void compositor_tick(uint64_t now_ms);
 
+/* When compositor_tick() draws its next frame (timer_get_ns() time) */
+uint64_t compositor_next_frame_ns(void);
+
+/* Damage tracking: only dirty rectangles are recomposited each tick */
+void compositor_damage(int x, int y, int w, int h);
+void compositor_damage_all(void);
+
+/* Pixels recomposited by the last tick (0 when idle) */
+uint64_t compositor_get_damaged_pixels(void);
+void compositor_print_stats(void);
+
 #endif /* _OJJY_UI_COMPOSITOR_H */
@@ -6,12 +6,23 @@
 #include "../string.h"
 #include "../fs/vfs.h"
 #include "../serial.h"
+#include "../sched.h"
+#include "../task.h"
 
 static AppInfo app_registry[APP_REGISTRY_MAX];
 static int app_count = 0;
 
+/* Query-side index, swapped in whole under index_lock */
 static char file_index[16][256];
 static int file_count = 0;
+static Mutex index_lock = MUTEX_INIT;
+
+/* Rebuilds happen in index_build under build_lock, off the query path */
+static char index_build[16][256];
+static Mutex build_lock = MUTEX_INIT;
+
+/* A rebuild task is queued and has not started yet */
+static volatile bool index_queued = false;
 
 static SettingsState settings_state = {
     .dark_mode = false,
@@ -114,6 +125,17 @@ static bool str_prefix_ci(const char *haystack, const char *needle)
     return *needle == '\0';
 }
 
+static void app_load_icons(uint32_t begin, uint32_t end, void *arg)
+{
+    (void)arg;
+    for (uint32_t i = begin; i < end; i++) {
+        AppInfo *app = &app_registry[i];
+        if (bundle_load_icon(&app->bundle, &app->icon) != 0) {
+            app->icon.valid = false;
+        }
+    }
+}
+
 void app_registry_init(void)
 {
     app_count = 0;
@@ -132,15 +154,14 @@ void app_registry_init(void)
         strncpy(app->bundle_id, bundles[i].manifest.bundle_id, BUNDLE_ID_MAX - 1);
         strncpy(app->path, bundles[i].path, BUNDLE_PATH_MAX - 1);
 
-        if (bundle_load_icon(&app->bundle, &app->icon) != 0) {
-            app->icon.valid = false;
-        }
-
         if (strcmp(app->bundle_id, "com.ojjyos.finder") == 0) {
             app->running = true;
         }
     }
 
+    /* Icons are independent file reads: load them across the task pool */
+    task_parallel_for(0, (uint32_t)app_count, 1, app_load_icons, NULL);
+
     serial_printf("[UI] App registry initialized: %d app(s)\n", app_count);
 }
 
@@ -196,34 +217,61 @@ int app_registry_launch(int index)
     return -1;
 }
 
-void search_index_init(void)
+static bool index_dir(const char *path, int *count)
 {
-    file_count = 0;
-    memset(file_index, 0, sizeof(file_index));
-
-    VfsDir *dir = vfs_opendir("/System/Wallpapers");
-    if (!dir) return;
+    VfsDir *dir = vfs_opendir(path);
+    if (!dir) return false;
 
     VfsDirEntry entry;
-    while (vfs_readdir(dir, &entry) == 0 && file_count < (int)ARRAY_SIZE(file_index)) {
+    while (vfs_readdir(dir, &entry) == 0 && *count < (int)ARRAY_SIZE(index_build)) {
         if (entry.type == VFS_TYPE_FILE) {
             char full[256];
-            vfs_join_path(full, sizeof(full), "/System/Wallpapers", entry.name);
-            strncpy(file_index[file_count++], full, sizeof(file_index[0]) - 1);
+            vfs_join_path(full, sizeof(full), path, entry.name);
+            strncpy(index_build[(*count)++], full, sizeof(index_build[0]) - 1);
         }
     }
     vfs_closedir(dir);
+    return true;
+}
 
-    VfsDir *docs = vfs_opendir("/Users/guest/Documents");
-    if (!docs) return;
-    while (vfs_readdir(docs, &entry) == 0 && file_count < (int)ARRAY_SIZE(file_index)) {
-        if (entry.type == VFS_TYPE_FILE) {
-            char full[256];
-            vfs_join_path(full, sizeof(full), "/Users/guest/Documents", entry.name);
-            strncpy(file_index[file_count++], full, sizeof(file_index[0]) - 1);
-        }
+static void index_rebuild(void)
+{
+    mutex_lock(&build_lock);
+    int count = 0;
+    memset(index_build, 0, sizeof(index_build));
+    if (index_dir("/System/Wallpapers", &count)) {
+        index_dir("/Users/guest/Documents", &count);
+    }
+
+    mutex_lock(&index_lock);
+    memcpy(file_index, index_build, sizeof(file_index));
+    file_count = count;
+    mutex_unlock(&index_lock);
+    mutex_unlock(&build_lock);
+}
+
+/*
+ * Rebuild task. The flag is cleared before the scan starts, so a
+ * refresh that arrives during the scan queues one more rebuild.
+ */
+static void index_task(void *arg)
+{
+    (void)arg;
+    __atomic_store_n(&index_queued, false, __ATOMIC_SEQ_CST);
+    index_rebuild();
+}
+
+void search_index_init(void)
+{
+    search_index_refresh();
+}
+
+void search_index_refresh(void)
+{
+    /* Queued rebuilds coalesce: callers never wait for the directory scans */
+    if (!__atomic_exchange_n(&index_queued, true, __ATOMIC_SEQ_CST)) {
+        task_spawn_detached(index_task, NULL);
     }
-    vfs_closedir(docs);
 }
 
 static void add_result(SearchResult *results, int *count, int max_results,
@@ -273,6 +321,7 @@ int search_index_query(const char *query, SearchResult *results, int max_results
         }
     }
 
+    mutex_lock(&index_lock);
     for (int i = 0; i < file_count && count < max_results; i++) {
         const char *path = file_index[i];
         const char *name = vfs_basename(path);
@@ -284,6 +333,7 @@ int search_index_query(const char *query, SearchResult *results, int max_results
                        name, "System file", path, -1, 3);
         }
     }
+    mutex_unlock(&index_lock);
 
     sort_results(results, count);
     return count;
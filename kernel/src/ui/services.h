@@ -59,6 +59,7 @@ int app_registry_find_by_name(const char *name);
 int app_registry_find_by_bundle_id(const char *bundle_id);
 
 void search_index_init(void);
+void search_index_refresh(void);
 int search_index_query(const char *query, SearchResult *results, int max_results);
 
 SettingsState *settings_get(void);